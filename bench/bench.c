@@ -0,0 +1,493 @@
+/* Microbenchmarks for the stages of running an expression: lexing, parsing,
+ * evaluating (arithmetic, builtins, user functions, vectors), printing, and
+ * setting up a state.
+ *
+ * Each benchmark is first run enough times in a row to take at least
+ * --min-time milliseconds; that batch is then timed --reps times, and the
+ * statistics are of the time per operation across those repetitions. A
+ * table goes to stdout, and --json=PATH writes the same results as JSON
+ * ('-' for stdout, which moves the table to stderr). */
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <math.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "arena/arena.h"
+#include "mml/config.h"
+#include "mml/eval.h"
+#include "mml/expr.h"
+#include "mml/infer.h"
+#include "mml/lexer.h"
+#include "mml/output.h"
+#include "mml/parser.h"
+#include "dvec/dvec.h"
+
+typedef enum {
+	BENCH_LEX,	// tokenize SRC
+	BENCH_PARSE,	// parse SRC
+	BENCH_EVAL,	// evaluate SRC's statements, parsed beforehand
+	BENCH_PRINT,	// print the value of SRC, evaluated beforehand
+	BENCH_INIT,	// create and clean up a state while another one is alive
+	BENCH_INIT_FIRST, // the same, with no other state alive on the thread
+} bench_kind;
+
+typedef struct {
+	const char *name;
+	bench_kind kind;
+	// evaluated once before timing; `vectors` also defines `v` and `w` as
+	// vectors of VEC_LEN numbers
+	const char *setup;
+	bool vectors;
+	const char *src;
+} bench_def;
+
+#define VEC_LEN 1000
+#define SCRIPT_LINES 200
+// stands for the generated script (see `make_script`)
+#define SCRIPT NULL
+
+static const bench_def BENCHES[] = {
+	{ "lex/expr",		BENCH_LEX,	.src = "1.5*x^2 - sin{y}/4 + f{3, 4.25e-3}" },
+	{ "lex/script",		BENCH_LEX,	.src = SCRIPT },
+	{ "parse/expr",		BENCH_PARSE,	.src = "1.5*x^2 - sin{y}/4 + f{3, 4.25e-3}" },
+	{ "parse/script",	BENCH_PARSE,	.src = SCRIPT },
+
+	{ "eval/number",	BENCH_EVAL,	.src = "2.5" },
+	{ "eval/arith",		BENCH_EVAL,	.src = "1.5*2.25 + 3.75/1.25 - 4^2" },
+	{ "eval/int_arith",	BENCH_EVAL,	.src = "17 + 4*3 - 9" },
+	{ "eval/complex",	BENCH_EVAL,	.src = "(1 + 2i)*(3 - i)" },
+	{ "eval/variables",	BENCH_EVAL,	.setup = "x = 1.5; y = 2.5", .src = "x*x + y" },
+	{ "eval/real_chain",	BENCH_EVAL,	.setup = "x = 1.5; y = 2.5", .src = "x*x*y - x/y + (x + y)^2 - |x - y|*3" },
+	{ "eval/compare",	BENCH_EVAL,	.src = "3.5 < 4 == true" },
+
+	{ "builtin/constant",	BENCH_EVAL,	.src = "pi" },
+	{ "builtin/sin",	BENCH_EVAL,	.src = "sin{0.5}" },
+	{ "builtin/csqrt",	BENCH_EVAL,	.src = "csqrt{-4}" },
+	{ "builtin/max",	BENCH_EVAL,	.src = "max{1, 5, 3, 4, 2}" },
+	{ "builtin/atan2",	BENCH_EVAL,	.src = "atan2{1, 2}" },
+
+	{ "func/call",		BENCH_EVAL,	.setup = "f{t} = t*t + 1", .src = "f{3}" },
+	{ "func/two_args",	BENCH_EVAL,	.setup = "g{a, b} = a*b - a", .src = "g{3, 4}" },
+	{ "func/two_calls",	BENCH_EVAL,	.setup = "f{t} = t*t + 1", .src = "f{3} + f{4}" },
+	{ "func/map",		BENCH_EVAL,	.vectors = true, .setup = "f{t} = t*t + 1", .src = "map{f, v}" },
+	{ "func/filter",	BENCH_EVAL,	.vectors = true, .setup = "p{t} = t > 0.5", .src = "filter{p, v}" },
+	{ "func/fold",		BENCH_EVAL,	.vectors = true, .setup = "g{a, b} = a*b - a", .src = "fold{g, 0, v}" },
+
+	{ "vector/literal",	BENCH_EVAL,	.src = "[1, 2, 3, 4, 5, 6, 7, 8]" },
+	{ "vector/index",	BENCH_EVAL,	.vectors = true, .src = "v.500" },
+	{ "vector/scale",	BENCH_EVAL,	.vectors = true, .src = "v*2" },
+	{ "vector/dot",		BENCH_EVAL,	.vectors = true, .src = "v*w" },
+	{ "vector/sort",	BENCH_EVAL,	.vectors = true, .src = "sort{w}" },
+	{ "vector/range_scale",	BENCH_EVAL,	.setup = "r = range{1, 1000}", .src = "r*2" },
+	{ "vector/range_dot",	BENCH_EVAL,	.setup = "r = range{1, 1000}", .src = "r*r" },
+
+	{ "reduce/sum",		BENCH_EVAL,	.vectors = true, .src = "sum{v}" },
+	{ "reduce/var",		BENCH_EVAL,	.vectors = true, .src = "var{v}" },
+	{ "reduce/dot",		BENCH_EVAL,	.vectors = true, .src = "dot{v, w}" },
+	{ "reduce/range_sum",	BENCH_EVAL,	.setup = "r = range{1, 1000000}", .src = "sum{r}" },
+
+	{ "print/real",		BENCH_PRINT,	.src = "3.14159265358979" },
+	{ "print/integer",	BENCH_PRINT,	.src = "1234567" },
+	{ "print/complex",	BENCH_PRINT,	.src = "1.5 - 2.25i" },
+	{ "print/vector",	BENCH_PRINT,	.src = "[1.5, 2, 3.25, 4, 5.125, 6, 7.5, 8]" },
+
+	{ "init/state",		BENCH_INIT,	.setup = NULL },
+	{ "init/first_state",	BENCH_INIT_FIRST, .setup = NULL },
+};
+#define N_BENCHES (sizeof(BENCHES) / sizeof(BENCHES[0]))
+
+typedef struct {
+	double min, median, mean, stddev, max;
+} bench_stats;
+
+typedef struct {
+	const bench_def *def;
+	uint64_t iters;
+	size_t src_len;
+	bench_stats ns; // per operation
+} bench_result;
+
+// everything a benchmark's timed loop uses, set up beforehand
+typedef struct {
+	const bench_def *def;
+	const char *src;
+	struct MML_config config;
+	MML_state *state;
+	Arena *scratch;
+	MML_expr_dvec stmts;
+	MML_value val;
+} bench_ctx;
+
+static MML_outbuf null_out;
+
+// keeps the compiler from dropping work whose result is otherwise unused
+static volatile uint64_t sink;
+
+static uint64_t now_ns(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000ull + (uint64_t)ts.tv_nsec;
+}
+
+static char *script;
+
+// a few hundred lines of the kind of statements scripts are made of
+static char *make_script(void)
+{
+	static const char *const LINES[] = {
+		"x_%d = %d.25 * (y + 3) / 7;\n",
+		"f_%d{a, b} = a*a - 2*a*b + b^2 + %d;\n",
+		"println{\"line %d\", sin{%d.5}, max{1, 2, x}};\n",
+		"v_%d = [1, 2.5, 3e-2, %d, pi, i];\n",
+		"z_%d = (%d + 2i) * conj{1 - i} == 5 | x < 4;\n",
+	};
+	constexpr size_t N_LINES = sizeof(LINES) / sizeof(LINES[0]);
+
+	char *s = NULL;
+	size_t len = 0;
+	FILE *f = open_memstream(&s, &len);
+	for (int i = 0; i < SCRIPT_LINES; ++i)
+		fprintf(f, LINES[(size_t)i % N_LINES], i, i);
+	fclose(f);
+	return s;
+}
+
+static char *make_vector(const char *name, uint32_t seed)
+{
+	char *s = NULL;
+	size_t len = 0;
+	FILE *f = open_memstream(&s, &len);
+	fprintf(f, "%s = [", name);
+	for (uint32_t i = 0; i < VEC_LEN; ++i)
+	{
+		seed = seed * 1103515245u + 12345u;
+		fprintf(f, "%s%u.5", (i > 0) ? ", " : "", (seed >> 16) % 1000);
+	}
+	fprintf(f, "]");
+	fclose(f);
+	return s;
+}
+
+static void eval_source(MML_state *state, const char *src)
+{
+	MML_expr_dvec stmts = MML_parse_stmts(src);
+	MML_expr **cur;
+	dv_foreach(stmts, cur)
+		if (*cur != NULL)
+			MML_eval_stmt(state, *cur);
+	dv_destroy(stmts);
+}
+
+static void bench_setup(bench_ctx *ctx, const bench_def *def)
+{
+	*ctx = (bench_ctx) {
+		.def = def,
+		.src = (def->src != NULL) ? def->src : script,
+		.config = MML_global_config,
+	};
+	ctx->config.out = &null_out;
+
+	if (def->kind == BENCH_INIT_FIRST)
+		return;
+
+	ctx->state = MML_init_state();
+	ctx->state->config = &ctx->config;
+
+	if (def->vectors)
+	{
+		char *v = make_vector("v", 1), *w = make_vector("w", 2);
+		eval_source(ctx->state, v);
+		eval_source(ctx->state, w);
+		free(v);
+		free(w);
+	}
+	if (def->setup != NULL)
+		eval_source(ctx->state, def->setup);
+
+	switch (def->kind) {
+	case BENCH_LEX:
+		ctx->scratch = arena_create(1 << 16);
+		break;
+	case BENCH_EVAL:
+		// inferred up front, like `MML_eval_stmt` does the first time
+		ctx->stmts = MML_parse_stmts(ctx->src);
+		MML_expr **cur;
+		dv_foreach(ctx->stmts, cur)
+			if (*cur != NULL)
+				MML_infer_kinds(ctx->state, *cur);
+		break;
+	case BENCH_PRINT:
+		ctx->val = MML_eval_parse(ctx->state, ctx->src);
+		break;
+	default:
+		break;
+	}
+}
+
+static void bench_teardown(bench_ctx *ctx)
+{
+	if (ctx->scratch != NULL)
+		arena_destroy(ctx->scratch);
+	dv_destroy(ctx->stmts);
+	if (ctx->state != NULL)
+		MML_cleanup_state(ctx->state);
+}
+
+static void bench_run(bench_ctx *ctx, uint64_t iters)
+{
+	uint64_t acc = 0;
+	switch (ctx->def->kind) {
+	case BENCH_LEX:
+		for (uint64_t n = 0; n < iters; ++n)
+		{
+			const ArenaMark mark = arena_mark(ctx->scratch);
+			acc += MML_tokenize(ctx->src, ctx->scratch).n;
+			arena_reset(ctx->scratch, mark);
+		}
+		break;
+	case BENCH_PARSE:
+		for (uint64_t n = 0; n < iters; ++n)
+		{
+			const ArenaMark mark = arena_mark(MML_global_arena);
+			MML_expr_dvec stmts = MML_parse_stmts_borrowed(ctx->src);
+			acc += dv_n(stmts);
+			dv_destroy(stmts);
+			arena_reset(MML_global_arena, mark);
+		}
+		break;
+	case BENCH_EVAL:
+		for (uint64_t n = 0; n < iters; ++n)
+		{
+			const ArenaMark mark = arena_mark(MML_global_arena);
+			MML_expr **cur;
+			dv_foreach(ctx->stmts, cur)
+				acc += (uint64_t)MML_eval_expr(ctx->state, *cur).type;
+			arena_reset(MML_global_arena, mark);
+		}
+		break;
+	case BENCH_PRINT:
+		for (uint64_t n = 0; n < iters; ++n)
+			MML_println_typedval(ctx->state, &ctx->val);
+		acc = null_out.len;
+		break;
+	case BENCH_INIT:
+	case BENCH_INIT_FIRST:
+		for (uint64_t n = 0; n < iters; ++n)
+		{
+			MML_state *state = MML_init_state();
+			acc += state->is_init;
+			MML_cleanup_state(state);
+		}
+		break;
+	}
+	sink = acc;
+}
+
+static uint64_t time_run(bench_ctx *ctx, uint64_t iters)
+{
+	const uint64_t start = now_ns();
+	bench_run(ctx, iters);
+	return now_ns() - start;
+}
+
+// the number of iterations that takes at least MIN_NS
+static uint64_t calibrate(bench_ctx *ctx, uint64_t min_ns)
+{
+	uint64_t iters = 1;
+	for (;;)
+	{
+		const uint64_t ns = time_run(ctx, iters);
+		if (ns >= min_ns)
+			return iters;
+		// aim a little past MIN_NS, but don't trust a tiny measurement too far
+		const uint64_t guess = (ns > 0) ? (uint64_t)((double)iters * 1.2 * (double)min_ns / (double)ns) : iters * 100;
+		iters = (guess > iters * 100) ? iters * 100 : (guess > iters) ? guess : iters + 1;
+	}
+}
+
+static int cmp_double(const void *a, const void *b)
+{
+	const double x = *(const double *)a, y = *(const double *)b;
+	return (x > y) - (x < y);
+}
+
+static bench_stats compute_stats(double *samples, size_t n)
+{
+	qsort(samples, n, sizeof(double), cmp_double);
+
+	double sum = 0.0;
+	for (size_t i = 0; i < n; ++i)
+		sum += samples[i];
+	const double mean = sum / (double)n;
+
+	double sq = 0.0;
+	for (size_t i = 0; i < n; ++i)
+		sq += (samples[i] - mean) * (samples[i] - mean);
+
+	return (bench_stats) {
+		.min = samples[0],
+		.median = (n % 2 == 1) ? samples[n/2] : (samples[n/2 - 1] + samples[n/2]) / 2.0,
+		.mean = mean,
+		.stddev = (n > 1) ? sqrt(sq / (double)(n - 1)) : 0.0,
+		.max = samples[n-1],
+	};
+}
+
+static bench_result run_bench(const bench_def *def, uint32_t reps, uint64_t min_ns)
+{
+	bench_ctx ctx;
+	bench_setup(&ctx, def);
+
+	bench_result res = {
+		.def = def,
+		.iters = calibrate(&ctx, min_ns),
+		.src_len = (def->kind == BENCH_LEX || def->kind == BENCH_PARSE) ? strlen(ctx.src) : 0,
+	};
+
+	double *samples = malloc(reps * sizeof(double));
+	for (uint32_t r = 0; r < reps; ++r)
+		samples[r] = (double)time_run(&ctx, res.iters) / (double)res.iters;
+	res.ns = compute_stats(samples, reps);
+	free(samples);
+
+	bench_teardown(&ctx);
+	return res;
+}
+
+static void print_row(FILE *f, const bench_result *res)
+{
+	fprintf(f, "%-18s %12.1f %12.1f %12.1f %8.2f%% %12" PRIu64,
+			res->def->name, res->ns.median, res->ns.mean, res->ns.min,
+			(res->ns.mean > 0.0) ? 100.0 * res->ns.stddev / res->ns.mean : 0.0,
+			res->iters);
+	if (res->src_len > 0)
+		fprintf(f, "  %7.1f MB/s", (double)res->src_len / res->ns.median * 1e3);
+	fputc('\n', f);
+}
+
+static void write_json(FILE *f, const bench_result *results, size_t n,
+		uint32_t reps, uint64_t min_ns)
+{
+	char date[32];
+	const time_t t = time(NULL);
+	strftime(date, sizeof(date), "%Y-%m-%dT%H:%M:%SZ", gmtime(&t));
+
+	fprintf(f, "{\n");
+	fprintf(f, "\t\"context\": {\n");
+	fprintf(f, "\t\t\"date\": \"%s\",\n", date);
+#ifdef __VERSION__
+	fprintf(f, "\t\t\"compiler\": \"%s\",\n", __VERSION__);
+#endif
+	fprintf(f, "\t\t\"repetitions\": %" PRIu32 ",\n", reps);
+	fprintf(f, "\t\t\"min_time_ns\": %" PRIu64 "\n", min_ns);
+	fprintf(f, "\t},\n");
+	fprintf(f, "\t\"benchmarks\": [\n");
+	for (size_t i = 0; i < n; ++i)
+	{
+		const bench_result *res = &results[i];
+		fprintf(f, "\t\t{ \"name\": \"%s\", \"iterations\": %" PRIu64 ", "
+				"\"ns_per_op\": { \"median\": %.3f, \"mean\": %.3f, \"stddev\": %.3f, "
+				"\"min\": %.3f, \"max\": %.3f }",
+				res->def->name, res->iters, res->ns.median, res->ns.mean,
+				res->ns.stddev, res->ns.min, res->ns.max);
+		if (res->src_len > 0)
+			fprintf(f, ", \"bytes_per_op\": %zu", res->src_len);
+		fprintf(f, " }%s\n", (i + 1 < n) ? "," : "");
+	}
+	fprintf(f, "\t]\n");
+	fprintf(f, "}\n");
+}
+
+static void usage(const char *prog)
+{
+	fprintf(stderr,
+		"usage: %s [options]\n\n"
+		"options:\n"
+		"  --reps=N          Time each benchmark N times (default 10)\n"
+		"  --min-time=MS     Run each benchmark enough times in a row to take at least MS milliseconds (default 20)\n"
+		"  --filter=STR      Only run the benchmarks whose names contain STR\n"
+		"  --json=PATH       Also write the results to PATH as JSON ('-' for stdout)\n"
+		"  --list            List the benchmarks and exit\n", prog);
+}
+
+int main(int argc, char **argv)
+{
+	uint32_t reps = 10;
+	uint64_t min_ms = 20;
+	const char *filter = NULL;
+	const char *json_path = NULL;
+
+	for (int i = 1; i < argc; ++i)
+	{
+		const char *arg = argv[i];
+		if (strncmp(arg, "--reps=", 7) == 0)
+			reps = (uint32_t)strtoul(arg + 7, NULL, 10);
+		else if (strncmp(arg, "--min-time=", 11) == 0)
+			min_ms = strtoull(arg + 11, NULL, 10);
+		else if (strncmp(arg, "--filter=", 9) == 0)
+			filter = arg + 9;
+		else if (strncmp(arg, "--json=", 7) == 0)
+			json_path = arg + 7;
+		else if (strcmp(arg, "--list") == 0)
+		{
+			for (size_t b = 0; b < N_BENCHES; ++b)
+				puts(BENCHES[b].name);
+			return 0;
+		} else
+		{
+			usage(argv[0]);
+			return strcmp(arg, "--help") == 0 ? 0 : 1;
+		}
+	}
+	if (reps == 0)
+		reps = 1;
+	const uint64_t min_ns = min_ms * 1000000ull;
+
+	FILE *json = NULL;
+	if (json_path != NULL)
+	{
+		json = (strcmp(json_path, "-") == 0) ? stdout : fopen(json_path, "w");
+		if (json == NULL)
+		{
+			fprintf(stderr, "couldn't open '%s' for writing\n", json_path);
+			return 1;
+		}
+	}
+	FILE *table = (json == stdout) ? stderr : stdout;
+
+	null_out.stream = fopen("/dev/null", "w");
+	null_out.is_tty = 0;
+	script = make_script();
+
+	fprintf(table, "%-18s %12s %12s %12s %9s %12s\n",
+			"benchmark", "median ns", "mean ns", "min ns", "stddev", "iterations");
+
+	bench_result results[N_BENCHES];
+	size_t n_results = 0;
+	for (size_t b = 0; b < N_BENCHES; ++b)
+	{
+		if (filter != NULL && strstr(BENCHES[b].name, filter) == NULL)
+			continue;
+		results[n_results] = run_bench(&BENCHES[b], reps, min_ns);
+		print_row(table, &results[n_results]);
+		fflush(table);
+		++n_results;
+	}
+
+	if (json != NULL)
+	{
+		write_json(json, results, n_results, reps, min_ns);
+		if (json != stdout)
+			fclose(json);
+	}
+
+	free(script);
+	fclose(null_out.stream);
+	return 0;
+}
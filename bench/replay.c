@@ -0,0 +1,221 @@
+/* Replays a session recorded with `--record` (see mml/record.h): every
+ * recorded evaluation is fed, in order, through a fresh state, as fast as it
+ * goes, with its output thrown away. That's repeated --reps times (after
+ * --warmup untimed runs), and the report is the throughput and the latency
+ * percentiles across all of them, next to the latencies the session was
+ * recorded with. A table goes to stdout, and --json=PATH writes the same
+ * results as JSON ('-' for stdout, which moves the table to stderr), to
+ * compare builds on the same session. */
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <inttypes.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "mml/config.h"
+#include "mml/eval.h"
+#include "mml/output.h"
+#include "mml/record.h"
+
+typedef struct {
+	double p50, p90, p99, p999, max;
+	double total;
+} latency_stats;
+
+static MML_outbuf null_out;
+
+// keeps the compiler from dropping work whose result is otherwise unused
+static volatile uint64_t sink;
+
+static uint64_t now_ns(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000ull + (uint64_t)ts.tv_nsec;
+}
+
+// replays RECORDING once through a fresh state, writing each evaluation's
+// latency to LATENCIES if it isn't NULL; returns the total time
+static uint64_t replay(const MML_recording *recording, uint64_t *latencies)
+{
+	struct MML_config config = MML_global_config;
+	config.out = &null_out;
+	MML_state *state = MML_init_state();
+	state->config = &config;
+
+	uint64_t acc = 0;
+	const uint64_t start = now_ns();
+	for (size_t i = 0; i < recording->n_evals; ++i)
+	{
+		const uint64_t t = now_ns();
+		acc += (uint64_t)MML_eval_parse(state, recording->evals[i].source).type;
+		if (latencies != NULL)
+			latencies[i] = now_ns() - t;
+	}
+	const uint64_t total = now_ns() - start;
+
+	MML_cleanup_state(state);
+	sink = acc;
+	return total;
+}
+
+static int cmp_u64(const void *a, const void *b)
+{
+	const uint64_t x = *(const uint64_t *)a, y = *(const uint64_t *)b;
+	return (x > y) - (x < y);
+}
+
+// nearest-rank percentile of the N sorted SAMPLES
+static double percentile(const uint64_t *samples, size_t n, double p)
+{
+	size_t rank = (size_t)(p / 100.0 * (double)n + 0.999999);
+	if (rank == 0)
+		rank = 1;
+	return (double)samples[(rank < n) ? rank - 1 : n - 1];
+}
+
+static latency_stats compute_stats(uint64_t *samples, size_t n)
+{
+	qsort(samples, n, sizeof(uint64_t), cmp_u64);
+
+	double total = 0.0;
+	for (size_t i = 0; i < n; ++i)
+		total += (double)samples[i];
+
+	return (latency_stats) {
+		.p50 = percentile(samples, n, 50.0),
+		.p90 = percentile(samples, n, 90.0),
+		.p99 = percentile(samples, n, 99.0),
+		.p999 = percentile(samples, n, 99.9),
+		.max = (double)samples[n-1],
+		.total = total,
+	};
+}
+
+static void print_row(FILE *f, const char *name, const latency_stats *s)
+{
+	fprintf(f, "%-10s %12.1f %12.1f %12.1f %12.1f %12.1f\n",
+			name, s->p50 / 1e3, s->p90 / 1e3, s->p99 / 1e3, s->p999 / 1e3, s->max / 1e3);
+}
+
+static void write_stats_json(FILE *f, const char *name, const latency_stats *s, bool last)
+{
+	fprintf(f, "\t\"%s\": { \"p50_ns\": %.0f, \"p90_ns\": %.0f, \"p99_ns\": %.0f, "
+			"\"p999_ns\": %.0f, \"max_ns\": %.0f, \"total_ns\": %.0f }%s\n",
+			name, s->p50, s->p90, s->p99, s->p999, s->max, s->total, last ? "" : ",");
+}
+
+static void usage(const char *prog)
+{
+	fprintf(stderr,
+		"usage: %s [options] RECORDING\n\n"
+		"options:\n"
+		"  --reps=N          Replay the session N times (default 10)\n"
+		"  --warmup=N        Replay it N times first, untimed (default 1)\n"
+		"  --json=PATH       Also write the results to PATH as JSON ('-' for stdout)\n", prog);
+}
+
+int main(int argc, char **argv)
+{
+	uint32_t reps = 10;
+	uint32_t warmup = 1;
+	const char *json_path = NULL;
+	const char *path = NULL;
+
+	for (int i = 1; i < argc; ++i)
+	{
+		const char *arg = argv[i];
+		if (strncmp(arg, "--reps=", 7) == 0)
+			reps = (uint32_t)strtoul(arg + 7, NULL, 10);
+		else if (strncmp(arg, "--warmup=", 9) == 0)
+			warmup = (uint32_t)strtoul(arg + 9, NULL, 10);
+		else if (strncmp(arg, "--json=", 7) == 0)
+			json_path = arg + 7;
+		else if (arg[0] != '-' && path == NULL)
+			path = arg;
+		else
+		{
+			usage(argv[0]);
+			return strcmp(arg, "--help") == 0 ? 0 : 1;
+		}
+	}
+	if (path == NULL)
+	{
+		usage(argv[0]);
+		return 1;
+	}
+	if (reps == 0)
+		reps = 1;
+
+	MML_recording recording;
+	if (!MML_recording_load(path, &recording))
+		return 1;
+	if (recording.n_evals == 0)
+	{
+		fprintf(stderr, "'%s' doesn't have any evaluations in it\n", path);
+		MML_recording_free(&recording);
+		return 1;
+	}
+
+	FILE *json = NULL;
+	if (json_path != NULL)
+	{
+		json = (strcmp(json_path, "-") == 0) ? stdout : fopen(json_path, "w");
+		if (json == NULL)
+		{
+			fprintf(stderr, "couldn't open '%s' for writing\n", json_path);
+			MML_recording_free(&recording);
+			return 1;
+		}
+	}
+	FILE *table = (json == stdout) ? stderr : stdout;
+
+	null_out.stream = fopen("/dev/null", "w");
+	null_out.is_tty = 0;
+
+	const size_t n = recording.n_evals;
+	for (uint32_t r = 0; r < warmup; ++r)
+		replay(&recording, NULL);
+
+	uint64_t *latencies = malloc((size_t)reps * n * sizeof(uint64_t));
+	uint64_t total_ns = 0;
+	for (uint32_t r = 0; r < reps; ++r)
+		total_ns += replay(&recording, latencies + (size_t)r * n);
+	const latency_stats replayed = compute_stats(latencies, (size_t)reps * n);
+
+	for (size_t i = 0; i < n; ++i)
+		latencies[i] = recording.evals[i].ns;
+	const latency_stats recorded = compute_stats(latencies, n);
+	free(latencies);
+
+	const double evals_per_sec = (double)reps * (double)n / ((double)total_ns / 1e9);
+	fprintf(table, "%zu evaluations, replayed %" PRIu32 " times: %.3f s, %.0f evaluations/s\n",
+			n, reps, (double)total_ns / 1e9, evals_per_sec);
+	fprintf(table, "%-10s %12s %12s %12s %12s %12s\n",
+			"latency", "p50 us", "p90 us", "p99 us", "p99.9 us", "max us");
+	print_row(table, "replayed", &replayed);
+	print_row(table, "recorded", &recorded);
+
+	if (json != NULL)
+	{
+		fprintf(json, "{\n");
+		fprintf(json, "\t\"recording\": \"%s\",\n", path);
+		fprintf(json, "\t\"evaluations\": %zu,\n", n);
+		fprintf(json, "\t\"repetitions\": %" PRIu32 ",\n", reps);
+		fprintf(json, "\t\"total_ns\": %" PRIu64 ",\n", total_ns);
+		fprintf(json, "\t\"evaluations_per_sec\": %.1f,\n", evals_per_sec);
+		write_stats_json(json, "replayed", &replayed, false);
+		write_stats_json(json, "recorded", &recorded, true);
+		fprintf(json, "}\n");
+		if (json != stdout)
+			fclose(json);
+	}
+
+	MML_recording_free(&recording);
+	fclose(null_out.stream);
+	return 0;
+}
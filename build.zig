@@ -5,10 +5,24 @@ const mml_lib_source = [_][]const u8{
     "src/eval.c",
     "src/expr.c",
     "src/parser.c",
+    "src/lexer.c",
+    "src/parse_cache.c",
+    "src/profile.c",
+    "src/timing.c",
+    "src/trace.c",
+    "src/record.c",
+    "src/compile.c",
+    "src/infer.c",
+    "src/server.c",
+    "src/batch.c",
     "src/config.c",
+    "src/csv.c",
+    "src/output.c",
+    "src/numparse.c",
 
     "lib/math.c",
     "lib/stdmml.c",
+    "lib/io.c",
 
     "src/arena.c",
 };
@@ -17,6 +31,13 @@ const mml_exe_source = [_][]const u8{
     "src/prompt.c",
 };
 
+const builtin_defs = [_][]const u8{
+    "src/builtins.def",
+    "lib/math.def",
+    "lib/stdmml.def",
+    "lib/io.def",
+};
+
 const include_path: []const u8 = "incl";
 
 pub fn build(b: *std.Build) void {
@@ -40,6 +61,32 @@ pub fn build(b: *std.Build) void {
     const cvi_dep = b.dependency("cvi", .{});
     const chashmap_dep = b.dependency("c-hashmap", .{});
 
+    // BUILTINS TABLE
+    // a host tool writes the perfect-hash table of builtins, which eval.c includes
+    const gen_phash_mod = b.createModule(.{
+        .root_source_file = null, // C project
+        .target = b.graph.host,
+        .optimize = .ReleaseSafe,
+        .link_libc = true,
+    });
+    const gen_phash = b.addExecutable(.{
+        .name = "gen_builtin_phash",
+        .root_module = gen_phash_mod,
+    });
+    gen_phash_mod.addIncludePath(b.path(include_path));
+    gen_phash_mod.addIncludePath(chashmap_dep.path("."));
+    gen_phash_mod.addIncludePath(cvi_dep.path("."));
+    gen_phash_mod.addCSourceFile(.{
+        .file = b.path("tools/gen_builtin_phash.c"),
+        .flags = &c_compiler_flags,
+    });
+    const run_gen_phash = b.addRunArtifact(gen_phash);
+    run_gen_phash.extra_file_dependencies = &builtin_defs;
+    const builtins_phash = run_gen_phash.captureStdOut();
+    const builtins_phash_dir = b.addWriteFiles();
+    _ = builtins_phash_dir.addCopyFile(builtins_phash, "builtins_phash_incl.c");
+
+
     // MML LIBRARY
     var libmml_mod = b.createModule(.{
         .root_source_file = null, // C project
@@ -56,6 +103,7 @@ pub fn build(b: *std.Build) void {
     libmml.installHeadersDirectory(b.path(include_path), ".", .{});
     if (is_debug == null or !is_debug.?) libmml_mod.addCMacro("NDEBUG", "");
     libmml_mod.addIncludePath(b.path(include_path));
+    libmml_mod.addIncludePath(builtins_phash_dir.getDirectory());
     libmml_mod.addIncludePath(chashmap_dep.path("."));
     libmml_mod.addIncludePath(cvi_dep.path("."));
     libmml_mod.addCSourceFiles(.{
@@ -94,5 +142,57 @@ pub fn build(b: *std.Build) void {
     b.installArtifact(mml_exe);
     build_targets_list.append(b.allocator, mml_exe) catch @panic("OOM");
 
+    // BENCHMARKS
+    // `zig build bench -- --filter=eval` passes everything after `--` on
+    const bench_mod = b.createModule(.{
+        .root_source_file = null, // C project
+        .target = target,
+        .optimize = optimize,
+        .link_libc = true,
+    });
+    const bench_exe = b.addExecutable(.{
+        .name = "mml-bench",
+        .root_module = bench_mod,
+    });
+    bench_mod.addIncludePath(b.path(include_path));
+    bench_mod.addIncludePath(cvi_dep.path("."));
+    bench_mod.addIncludePath(chashmap_dep.path("."));
+    bench_mod.addCSourceFile(.{
+        .file = b.path("bench/bench.c"),
+        .flags = &c_compiler_flags,
+    });
+    bench_mod.linkLibrary(libmml);
+
+    const run_bench = b.addRunArtifact(bench_exe);
+    run_bench.addArg("--json=-");
+    if (b.args) |args| run_bench.addArgs(args);
+    const bench_step = b.step("bench", "Run the microbenchmarks and print their results as JSON");
+    bench_step.dependOn(&run_bench.step);
+
+    // `zig build replay -- session.mmlrec` replays a recorded session
+    const replay_mod = b.createModule(.{
+        .root_source_file = null, // C project
+        .target = target,
+        .optimize = optimize,
+        .link_libc = true,
+    });
+    const replay_exe = b.addExecutable(.{
+        .name = "mml-replay",
+        .root_module = replay_mod,
+    });
+    replay_mod.addIncludePath(b.path(include_path));
+    replay_mod.addIncludePath(cvi_dep.path("."));
+    replay_mod.addIncludePath(chashmap_dep.path("."));
+    replay_mod.addCSourceFile(.{
+        .file = b.path("bench/replay.c"),
+        .flags = &c_compiler_flags,
+    });
+    replay_mod.linkLibrary(libmml);
+
+    const run_replay = b.addRunArtifact(replay_exe);
+    if (b.args) |args| run_replay.addArgs(args);
+    const replay_step = b.step("replay", "Replay a recorded session and print its throughput and latencies");
+    replay_step.dependOn(&run_replay.step);
+
     _ = zcc.createStep(b, "cdb", build_targets_list.toOwnedSlice(b.allocator) catch @panic("OOM"));
 }
@@ -11,14 +11,28 @@ MML__CPP_COMPAT_BEGIN_DECLS
 
 typedef struct Arena Arena;
 
+// a saved allocation position; see `arena_mark` and `arena_reset`
+typedef struct ArenaMark {
+	void *bucket;
+	size_t index;
+} ArenaMark;
+
 // bucket_init_size is the number of bytes to allocate
 // for each bucket, if a given allocation won't fit in
 // the current bucket but would fit in a new one
 Arena *arena_create(size_t bucket_init_size);
 void arena_destroy(Arena *arena);
 
+// returns NULL if the allocation needs a new bucket and there is no memory for one
 void *arena_alloc(Arena *arena, size_t size, size_t align);
 
+// returns the current allocation position of the arena, which can later
+// be passed to `arena_reset` to free everything allocated after it
+ArenaMark arena_mark(Arena *arena);
+// rolls the arena back to `mark`; the buckets after it are kept and
+// reused by later allocations instead of being freed
+void arena_reset(Arena *arena, ArenaMark mark);
+
 #define arena_alloc_T(_a, _n, _T) ((_T *)arena_alloc((_a), (_n)*sizeof(_T), _Alignof(_T)))
 
 MML__CPP_COMPAT_END_DECLS
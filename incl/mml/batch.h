@@ -0,0 +1,27 @@
+#ifndef BATCH_H
+#define BATCH_H
+
+#include <stdint.h>
+#include <stdio.h>
+
+#include "old_std_compat.h"
+#include "cpp_compat.h"
+
+MML__CPP_COMPAT_BEGIN_DECLS
+
+/* Evaluates every line of IN as an independent expression on N_WORKERS
+ * threads (the number of online CPUs if 0), and writes each line's output,
+ * and then its value if it isn't nothing, to OUT in input order; a line that
+ * fails still prints its (invalid) value, so results stay lined up with the
+ * input. Log messages go to ERR, also in input order.
+ *
+ * Without PRELUDE, each line gets a fresh state. With it, each worker
+ * evaluates the script at PRELUDE once, and lines are evaluated in that
+ * state, which they may read but not modify: a line that defines anything
+ * fails. Lines are handed out in blocks, so output comes out a block at a
+ * time. Returns 0 if every line succeeded and 1 otherwise. */
+int32_t MML_eval_batch(FILE *in, FILE *out, FILE *err, const char *prelude, uint32_t n_workers);
+
+MML__CPP_COMPAT_END_DECLS
+
+#endif /* BATCH_H */
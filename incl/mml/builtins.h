@@ -0,0 +1,57 @@
+#ifndef BUILTINS_H
+#define BUILTINS_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "old_std_compat.h"
+#include "cpp_compat.h"
+
+#include "mml/expr.h"
+#include "mml/eval.h"
+
+MML__CPP_COMPAT_BEGIN_DECLS
+
+/* A builtin constant or function. Builtins are listed in X-macro files
+ * (src/builtins.def, lib/<name>.def) as
+ *	MML_BUILTIN(name, .field = value, ...)
+ * and each list is expanded into a read-only array of these by the file that
+ * defines the functions it names. A function name can have one variant per
+ * argument type; a call picks the one matching its first argument, and
+ * `vec_args` takes every argument as is. At build time,
+ * tools/gen_builtin_phash.c reads the same lists and writes a perfect-hash
+ * table over all of their names, so finding a builtin is one hash, one load
+ * and one compare, and nothing has to be set up at runtime. */
+typedef struct MML_builtin {
+	strbuf name;
+
+	const MML_value *constant;
+	MML_val_func vec_args;
+	double (*d_d)(double);
+	_Complex double (*cd_cd)(_Complex double);
+	_Complex double (*cd_d)(double);
+	double (*d_cd)(_Complex double);
+
+	// set on `vec_args` functions that only work out a value from their
+	// arguments, so that `map` and `filter` can call them from other threads
+	// (the other variants always can be)
+	bool pure;
+} MML_builtin;
+
+#define MML_BUILTIN_ENTRY(ident, ...) { .name = { #ident, sizeof(#ident) - 1 }, __VA_ARGS__ },
+
+// the builtin named NAME, or NULL if there isn't one
+const MML_builtin *MML_find_builtin(strbuf name);
+
+// the hash behind the generated table; changing it means regenerating it
+static inline uint32_t MML_builtin_hash(const char *s, size_t len, uint32_t seed)
+{
+	uint32_t h = seed ^ (uint32_t)len;
+	for (size_t i = 0; i < len; ++i)
+		h = (h ^ (unsigned char)s[i]) * 0x01000193u;
+	return h ^ (h >> 16);
+}
+
+MML__CPP_COMPAT_END_DECLS
+
+#endif /* BUILTINS_H */
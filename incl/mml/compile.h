@@ -0,0 +1,47 @@
+#ifndef COMPILE_H
+#define COMPILE_H
+
+#include <stdint.h>
+
+#include "old_std_compat.h"
+#include "cpp_compat.h"
+
+#include "mml/eval.h"
+#include "mml/expr.h"
+
+MML__CPP_COMPAT_BEGIN_DECLS
+
+#define MML_COMPILED_MAGIC "MMLC"
+#define MML_COMPILED_VERSION 1
+
+/* Compiled scripts (.mmlc) hold a statement list as it comes out of the
+ * parser, so running one skips lexing and parsing entirely. The format is
+ * little-endian and has no pointers: a 32-byte header, the AST nodes as
+ * fixed-size records with children ordered before their parents, a table of
+ * node indices for vector elements and the statements, and a blob with the
+ * text of every identifier and string. */
+
+// whether FILE starts like a compiled script
+bool MML_is_compiled(strbuf file);
+
+/* Writes STMTS to a compiled script at PATH. Only the node types the parser
+ * produces (plus literals folded by `MML_fold_constants`) can be written.
+ * Returns 0 on success and -1 on failure, which has been logged. */
+int32_t MML_write_compiled(MML_expr_vec stmts, bool optimized, const char *path);
+
+/* Rebuilds the statements of the compiled script FILE (e.g. from
+ * `MML_map_file`) in the global arena and stores them in *STMTS. Like
+ * `MML_parse_stmts_borrowed`, identifiers and strings point straight into
+ * FILE, so it must outlive them. Every index in FILE is checked, so a corrupt
+ * file is rejected instead of read out of bounds. Returns false (after
+ * logging why) if FILE isn't a valid compiled script of this version. */
+bool MML_load_compiled(strbuf file, MML_expr_dvec *stmts);
+
+/* Replaces every operation on number literals with its result, computed by
+ * the evaluator itself so the result is exactly what evaluating it would
+ * give. Identifiers are never folded, since they can be redefined. */
+void MML_fold_constants(MML_state *state, MML_expr_vec stmts);
+
+MML__CPP_COMPAT_END_DECLS
+
+#endif /* COMPILE_H */
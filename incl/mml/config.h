@@ -9,6 +9,7 @@
 #include "cpp_compat.h"
 
 #include "mml/token.h"
+#include "mml/output.h"
 
 MML__CPP_COMPAT_BEGIN_DECLS
 
@@ -21,6 +22,11 @@ enum {
 	NO_EVAL	= BIT(4),
 	RUN_PROMPT	= BIT(5),
 	DBG_TIME	= BIT(6),
+	STREAM_STDIN	= BIT(7),
+	COMPILE	= BIT(8),
+	OPTIMIZE	= BIT(9),
+	BATCH		= BIT(10),
+	PROFILE	= BIT(11),
 };
 
 #define SET_FLAG(f) (MML_global_config.runtime_flags |= (f))
@@ -38,8 +44,11 @@ struct MML_config {
 	uint32_t precision;
 	uint32_t runtime_flags;
 	MML_state *eval_state;
+	MML_outbuf *out;
 	bool last_print_was_newline;
 	bool full_prec_floats;
+	bool round_trip_floats;
+	uint32_t parse_cache_size; // in entries; 0 disables the parse cache
 };
 extern struct MML_config MML_global_config;
 
@@ -49,6 +58,12 @@ void MML_arg_parse(int32_t argc, char **argv);
 strbuf MML_read_string_from_stream(FILE *stream);
 strbuf strbuf_dup(strbuf buf);
 
+/* Maps the file at PATH read-only and returns its contents. The mapping is
+ * followed by at least one zero byte, so the returned string can be parsed
+ * directly. Returns { NULL, 0 } on failure. Release it with `MML_unmap_file`. */
+strbuf MML_map_file(const char *path);
+void MML_unmap_file(strbuf file);
+
 enum LOG_TYPE {
 	MML_LOG_DEBUG,
 	MML_LOG_ERROR,
@@ -86,10 +101,15 @@ static inline void MML_dbg_print_func(
 
 	va_end(args);
 }
-#define MML_log(log_type, fmt, ...) (MML_dbg_print_func(__FILE_NAME__, __LINE__, stderr, log_type, fmt, ##__VA_ARGS__))
-#define MML_log_dbg(fmt, ...) (MML_dbg_print_func(__FILE_NAME__, __LINE__, stderr, MML_LOG_DEBUG, fmt, ##__VA_ARGS__))
-#define MML_log_err(fmt, ...) (MML_dbg_print_func(__FILE_NAME__, __LINE__, stderr, MML_LOG_ERROR, fmt, ##__VA_ARGS__))
-#define MML_log_warn(fmt, ...) (MML_dbg_print_func(__FILE_NAME__, __LINE__, stderr, MML_LOG_WARN, fmt, ##__VA_ARGS__))
+
+// where the MML_log_* macros write to on this thread; NULL means stderr
+extern thread_local FILE *MML_log_stream;
+#define MML_LOG_STREAM ((MML_log_stream != NULL) ? MML_log_stream : stderr)
+
+#define MML_log(log_type, fmt, ...) (MML_dbg_print_func(__FILE_NAME__, __LINE__, MML_LOG_STREAM, log_type, fmt, ##__VA_ARGS__))
+#define MML_log_dbg(fmt, ...) (MML_dbg_print_func(__FILE_NAME__, __LINE__, MML_LOG_STREAM, MML_LOG_DEBUG, fmt, ##__VA_ARGS__))
+#define MML_log_err(fmt, ...) (MML_dbg_print_func(__FILE_NAME__, __LINE__, MML_LOG_STREAM, MML_LOG_ERROR, fmt, ##__VA_ARGS__))
+#define MML_log_warn(fmt, ...) (MML_dbg_print_func(__FILE_NAME__, __LINE__, MML_LOG_STREAM, MML_LOG_WARN, fmt, ##__VA_ARGS__))
 
 MML__CPP_COMPAT_END_DECLS
 
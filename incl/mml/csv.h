@@ -0,0 +1,25 @@
+#ifndef CSV_H
+#define CSV_H
+
+#include <stdint.h>
+#include <stdio.h>
+
+#include "old_std_compat.h"
+#include "cpp_compat.h"
+
+#include "mml/eval.h"
+#include "mml/expr.h"
+
+MML__CPP_COMPAT_BEGIN_DECLS
+
+/* Evaluates STMTS once for every data row of the CSV read from STREAM. The
+ * first row names the columns, and each column is bound to the variable of
+ * that name before the row is evaluated. For every row, the value of the
+ * last statement (if it isn't `Nothing`) is printed, followed by a newline.
+ * Fields that aren't plain numbers are parsed as MML expressions.
+ * Returns the number of rows evaluated, or -1 if the header couldn't be read. */
+int64_t MML_eval_csv(MML_state *state, MML_expr_dvec stmts, FILE *stream);
+
+MML__CPP_COMPAT_END_DECLS
+
+#endif /* CSV_H */
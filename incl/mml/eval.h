@@ -6,11 +6,18 @@
 
 #include "mml/config.h"
 #include "mml/expr.h"
+#include "mml/parse_cache.h"
+#include "mml/profile.h"
+#include "mml/record.h"
 #include "arena/arena.h"
 
 MML__CPP_COMPAT_BEGIN_DECLS
 
-extern Arena *MML_global_arena;
+/* Where ASTs and values are allocated. Each thread has its own, created with
+ * the first state on that thread and destroyed with the last one, so states
+ * on different threads can be used at the same time, but a state must only
+ * be used on the thread that created it. */
+extern thread_local Arena *MML_global_arena;
 
 typedef struct hashmap hashmap;
 
@@ -19,9 +26,26 @@ typedef struct MML_state {
 
 	hashmap *variables;
 	hashmap *locals;
+	// bumped by every `MML_eval_set_variable`, so comparing it before and
+	// after a statement tells whether the statement defined anything, even
+	// from inside a function it called
+	uint64_t n_definitions;
 
 	MML_value last_val;
 	bool is_init;
+
+	// files mapped by `MML_eval_file`, kept until cleanup since the ASTs
+	// parsed from them point into the mapping
+	dvec_t(strbuf) mapped_files;
+
+	// created on first use if `config->parse_cache_size` is nonzero
+	MML_parse_cache *parse_cache;
+	// NULL unless it's being profiled; written to stderr and freed by
+	// `MML_cleanup_state`
+	MML_profile *profile;
+	// NULL unless the session is being recorded (see mml/record.h); closed by
+	// `MML_cleanup_state`
+	MML_recorder *recorder;
 } MML_state;
 
 typedef MML_value (*MML_val_func)(MML_state *restrict state, MML_expr_vec *args);
@@ -33,9 +57,9 @@ MML_value MML_apply_binary_op(MML_state *restrict state,
 
 
 /* Returns a pointer to a valid, initialized evaluator state, which should be
- * passed to any function that takes `MML_state *` as an argument. The library
- * was developed with the ability to create multiple states in mind, but it
- * has not yet been formally tested.
+ * passed to any function that takes `MML_state *` as an argument. Any number
+ * of states can be alive at once, on any number of threads (see
+ * `MML_global_arena`).
  * `MML_cleanup_state` must be called on this function's return value when you are
  * done with it. */
 MML_state *MML_init_state(void);
@@ -49,9 +73,26 @@ MML_expr *MML_eval_get_variable(MML_state *restrict state, strbuf name);
 
 /* evaluates EXPR using the evaluator state data in STATE */
 MML_value MML_eval_expr(MML_state *restrict state, const MML_expr *expr);
+/* Same as `MML_eval_expr`, for a top-level statement: this is where its
+ * evaluation is profiled (see `MML_state.profile`) and timed (see
+ * mml/timing.h), and where its kinds are inferred (see mml/infer.h) the
+ * first time it's evaluated. */
+MML_value MML_eval_stmt(MML_state *restrict state, const MML_expr *expr);
 MML_value MML_eval_expr_recurse(MML_state *restrict state, const MML_expr *expr);
 
+
+/* Parses S into statements like `MML_parse_stmts`, except that the result is
+ * kept in the global arena, and comes from STATE's parse cache (see
+ * mml/parse_cache.h) if `config->parse_cache_size` is nonzero. */
+MML_expr_vec MML_parse_stmts_cached(MML_state *state, const char *s);
+/* Parses and evaluates the statements in S, returning the last one's value.
+ * This is what's recorded if `state->recorder` is set. */
 MML_value MML_eval_parse(MML_state *state, const char *s);
+/* Maps the script at PATH and evaluates its statements in order without
+ * copying it, returning the value of the last one. PATH may also be a script
+ * compiled with `--compile`. The mapping stays alive until
+ * `MML_cleanup_state` is called on STATE. */
+MML_value MML_eval_file(MML_state *state, const char *path);
 
 MML__CPP_COMPAT_END_DECLS
 
@@ -1,6 +1,7 @@
 #ifndef EXPR_H
 #define EXPR_H
 
+#include <assert.h>
 #include <complex.h>
 #include <stdint.h>
 
@@ -14,10 +15,22 @@ MML__CPP_COMPAT_BEGIN_DECLS
 
 typedef struct MML_expr MML_expr;
 
+// what an operation is expected to evaluate to; filled in by
+// `MML_infer_kinds` (see mml/infer.h) in `MML_expr.kind`
+typedef enum {
+	MML_KIND_UNINFERRED,
+	MML_KIND_UNKNOWN,
+	MML_KIND_INTEGER,
+	MML_KIND_REAL,
+	MML_KIND_COMPLEX,
+	MML_KIND_BOOLEAN,
+	MML_KIND_VECTOR,
+} MML_value_kind;
+
+// the operator is in `MML_expr.op`
 typedef struct MML_Operation {
 	MML_expr *left;
 	MML_expr *right;
-	MML_token_type op;
 } MML_operation;
 
 typedef enum MML_ExprType {
@@ -32,6 +45,9 @@ typedef enum MML_ExprType {
 	Identifier_type,
 	Vector_type,
 	FuncObject_type,
+	String_type,
+	NumArray_type,
+	Range_type,
 } MML_expr_type;
 
 typedef struct {
@@ -51,13 +67,45 @@ typedef struct {
 
 typedef dvec_t(MML_expr *) MML_expr_dvec;
 
+// a vector of numbers stored unboxed, as doubles (or (real, imag) pairs
+// of doubles if `is_complex` is set); the data is never written through
+typedef struct {
+	const double *ptr;
+	// packed into one word, to fit in a value
+	size_t n : 63;
+	bool is_complex : 1;
+} MML_num_array;
+
+// an arithmetic sequence whose elements are worked out when they're read
+// instead of being stored: element i is `start + i*step`, except that the
+// last one is exactly `last` (see `range` and `linspace` in lib/math.c)
+typedef struct {
+	double start;
+	double step;
+	double last;
+	size_t n;
+} MML_range;
+
 #define VALTYPE_IS_ORDERED(v) \
 	((v).type != ComplexNumber_type && \
 	 (v).type != Vector_type && \
+	 (v).type != NumArray_type && \
+	 (v).type != Range_type && \
 	 (v).type != Invalid_type)
 
+/* Values and AST nodes are a type tag and a 16-byte union, 24 bytes in all:
+ * numbers, booleans and pointers take 8 bytes of it, complex numbers,
+ * strings and vectors 16, and function objects and ranges are kept out of
+ * line.
+ *
+ * 16 bytes (or 8, NaN-boxed) would need the tag inside the union. A
+ * complex number uses all 128 bits, so it would have to go out of line,
+ * which means an allocation for every complex result; strings and vectors
+ * would have to give up bits of their lengths or pointers, and every read
+ * of one would have to mask them off again. Neither is worth the 8 bytes,
+ * so values stay at 24. */
 struct value_union_size {
-	uint64_t b[3];
+	uint64_t b[2];
 };
 
 typedef struct MML_value {
@@ -69,13 +117,19 @@ typedef struct MML_value {
 		bool b;
 		strbuf s;
 		MML_expr_vec v;
-		MML_func_object fo;
+		const MML_func_object *fo;
+		MML_num_array a;
+		const MML_range *r;
 		struct value_union_size w;
 	};
 } MML_value;
 
 typedef struct MML_expr {
 	MML_expr_type type;
+	// an Operation_type's MML_token_type and MML_value_kind, which fit in
+	// the padding before the union
+	uint8_t op;
+	uint8_t kind;
 	union {
 		MML_operation o;
 
@@ -85,12 +139,19 @@ typedef struct MML_expr {
 		bool b;
 		strbuf s;
 		MML_expr_vec v;
-		MML_func_object fo;
+		const MML_func_object *fo;
+		MML_num_array a;
+		const MML_range *r;
 		struct value_union_size w; // used for copying the union between MML_expr's
 	};
 } MML_expr;
 
+static_assert(sizeof(MML_value) == 24, "MML_value should be a tag and 16 bytes");
+static_assert(sizeof(MML_expr) == 24, "MML_expr should be a tag and 16 bytes");
+
 #define EXPR_NUM(num) ((MML_expr) { RealNumber_type, .n = (num) })
+#define EXPR_INT(num) ((MML_expr) { Integer_type, .i = (num) })
+#define VAL_INT(num) ((MML_value) { Integer_type, .i = (num) })
 #define VAL_NUM(num) ((MML_value) { RealNumber_type, .n = (num) })
 #define VAL_CNUM(num) ((MML_value) { ComplexNumber_type, .cn = (num) })
 #define VAL_BOOL(bl) ((MML_value) { Boolean_type, .b = (bl) })
@@ -107,8 +168,15 @@ constexpr MML_expr NOTHING_EXPR = { Nothing_type, .w={} };
 
 #define VAL_IS_NUM(v) (\
     (v).type == RealNumber_type \
+ || (v).type == Integer_type \
  || (v).type == ComplexNumber_type \
  || (v).type == Boolean_type)
+// values that don't point anywhere, so they outlive the arena they were
+// made in
+#define VAL_IS_SELF_CONTAINED(v) (\
+    VAL_IS_NUM(v) \
+ || (v).type == Nothing_type \
+ || (v).type == Invalid_type)
 
 typedef struct MML_state MML_state;
 MML_value MML_print_typedval(MML_state *restrict state, const MML_value *val);
@@ -124,6 +192,24 @@ void MML_free_pp(void *p);
 double MML_get_number(const MML_value *v);
 _Complex double MML_get_complex(const MML_value *v);
 
+MML_value MML_num_array_get(const MML_num_array *a, size_t i);
+// boxes every element of A into a regular vector
+MML_expr_vec MML_num_array_to_vec(const MML_num_array *a);
+
+MML_value MML_make_range(double start, double step, double last, size_t n);
+static inline double MML_range_at(const MML_range *r, size_t i)
+{
+	return (i + 1 == r->n) ? r->last : r->start + (double)i * r->step;
+}
+// the longest range that's packed into an array (1 GiB of doubles); a range
+// can be far longer than that, as long as it's only read one element at a time
+#define MML_RANGE_PACK_MAX ((size_t)1 << 27)
+// stores every element of R in a packed array, for the operations that
+// can't work on it as it is; if it's longer than MML_RANGE_PACK_MAX, or
+// there's no memory for it, logs an error and returns an array whose `ptr`
+// is nullptr
+MML_num_array MML_range_to_num_array(const MML_range *r);
+
 MML__CPP_COMPAT_END_DECLS
 
 #endif /* EXPR_H */
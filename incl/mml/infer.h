@@ -0,0 +1,33 @@
+#ifndef INFER_H
+#define INFER_H
+
+#include "old_std_compat.h"
+#include "cpp_compat.h"
+
+#include "mml/eval.h"
+#include "mml/expr.h"
+
+MML__CPP_COMPAT_BEGIN_DECLS
+
+/* Kind inference: works out what every operation in a statement will
+ * evaluate to (see `MML_value_kind`) from its operands, the builtins it calls
+ * and what its variables are currently defined as, and stores it in the
+ * operation. An operation inferred to be real or complex is evaluated
+ * straight in doubles (or complex doubles) down through the operations under
+ * it that are too, without going through `MML_apply_binary_op`.
+ *
+ * Variables can be redefined after a statement is inferred, and a function's
+ * parameters are unknown until it's called, so a kind is only a prediction:
+ * the specialized evaluation checks each value that doesn't come from a
+ * literal or another specialized operation, and carries on with the regular
+ * evaluation from there if it isn't what was predicted. Getting a kind wrong
+ * costs time, but never changes a result. */
+
+/* Infers the kinds of every operation in STMT (including the bodies of the
+ * functions it defines) from the definitions in STATE. `MML_eval_stmt` does
+ * this the first time it evaluates a statement. */
+void MML_infer_kinds(MML_state *state, MML_expr *stmt);
+
+MML__CPP_COMPAT_END_DECLS
+
+#endif /* INFER_H */
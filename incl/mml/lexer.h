@@ -0,0 +1,27 @@
+#ifndef LEXER_H
+#define LEXER_H
+
+#include "old_std_compat.h"
+#include "cpp_compat.h"
+
+#include "mml/token.h"
+#include "arena/arena.h"
+
+MML__CPP_COMPAT_BEGIN_DECLS
+
+typedef struct {
+	MML_token *ptr;
+	size_t n;
+} MML_token_vec;
+
+/* Splits the zero-terminated string S into tokens in one pass. The result
+ * always ends with a MML_EOF_TOK, and token offsets are relative to S. A
+ * number directly after a '.' token is read as an integer (so `v.1.0` indexes
+ * twice). Sources longer than UINT32_MAX bytes are cut off there. The array
+ * is allocated in ARENA, along with the smaller arrays it outgrew, so a
+ * scratch arena that's reset afterwards is the best fit. */
+MML_token_vec MML_tokenize(const char *s, Arena *arena);
+
+MML__CPP_COMPAT_END_DECLS
+
+#endif /* LEXER_H */
@@ -0,0 +1,26 @@
+#ifndef NUMPARSE_H
+#define NUMPARSE_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "old_std_compat.h"
+#include "cpp_compat.h"
+
+MML__CPP_COMPAT_BEGIN_DECLS
+
+/* Scans the numeric literal at S: decimal digits, which may be separated by
+ * single underscores, then (unless INT_ONLY is set) an optional fraction
+ * starting at '.' and an optional exponent ('e' or 'E', an optional sign and
+ * at least one digit). Stores the correctly rounded value in *VALUE and
+ * returns a pointer just past the literal, or S itself if S doesn't start
+ * with a digit. Doesn't depend on the locale. */
+const char *MML_scan_number(const char *s, bool int_only, double *value);
+/* Scans the same literals as `MML_scan_number`, but only succeeds for one
+ * without a fraction or exponent whose value fits in an int64_t: stores it in
+ * *VALUE and returns a pointer just past it. Otherwise, returns S. */
+const char *MML_scan_int(const char *s, bool int_only, int64_t *value);
+
+MML__CPP_COMPAT_END_DECLS
+
+#endif /* NUMPARSE_H */
@@ -0,0 +1,65 @@
+#ifndef OUTPUT_H
+#define OUTPUT_H
+
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "old_std_compat.h"
+#include "cpp_compat.h"
+
+MML__CPP_COMPAT_BEGIN_DECLS
+
+#define MML_OUTBUF_SIZE (64 * 1024)
+
+/* A byte buffer in front of a FILE. Everything the evaluator prints goes
+ * through one of these instead of stdio, so printing a number is a few
+ * stores into the buffer rather than a (locked) vfprintf call. Nothing reaches
+ * STREAM until the buffer fills up or `MML_out_flush` is called, except that
+ * `MML_out_newline` flushes when STREAM is a terminal. A NULL STREAM means
+ * stdout. */
+typedef struct MML_outbuf {
+	FILE *stream;
+	size_t len;
+	int8_t is_tty; // -1 until it's been checked
+	char buf[MML_OUTBUF_SIZE];
+} MML_outbuf;
+
+extern MML_outbuf MML_stdout_buf;
+
+typedef enum {
+	MML_FLOAT_GENERAL,	// like "%.*g"
+	MML_FLOAT_FIXED,	// like "%.*f"
+	MML_FLOAT_SHORTEST,	// the fewest digits that read back as the same double
+} MML_float_format;
+
+/* Formats X into DST the way printf would with the format FMT and PRECISION
+ * (PRECISION is ignored for MML_FLOAT_SHORTEST), and with snprintf's
+ * semantics: at most SIZE-1 characters and a terminating zero byte are
+ * written, and the length of the full result is returned. Common cases are
+ * formatted directly from the shortest round-trip digits; the rest fall back
+ * to snprintf, so the output always matches it exactly. */
+size_t MML_format_double(char *dst, size_t size, double x, uint32_t precision, MML_float_format fmt);
+
+void MML_out_flush(MML_outbuf *out);
+void MML_out_write(MML_outbuf *out, const char *s, size_t len);
+void MML_out_printf(MML_outbuf *out, const char *fmt, ...) __attribute__((format(printf, 2, 3)));
+void MML_out_double(MML_outbuf *out, double x, uint32_t precision, MML_float_format fmt);
+void MML_out_int(MML_outbuf *out, int64_t i);
+void MML_out_newline(MML_outbuf *out);
+
+static inline void MML_out_putc(MML_outbuf *out, char c)
+{
+	if (out->len == sizeof(out->buf))
+		MML_out_flush(out);
+	out->buf[out->len++] = c;
+}
+
+static inline void MML_out_puts(MML_outbuf *out, const char *s)
+{
+	MML_out_write(out, s, strlen(s));
+}
+
+MML__CPP_COMPAT_END_DECLS
+
+#endif /* OUTPUT_H */
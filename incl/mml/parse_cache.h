@@ -0,0 +1,32 @@
+#ifndef PARSE_CACHE_H
+#define PARSE_CACHE_H
+
+#include <stddef.h>
+
+#include "old_std_compat.h"
+#include "cpp_compat.h"
+
+#include "mml/expr.h"
+
+MML__CPP_COMPAT_BEGIN_DECLS
+
+/* A bounded map from source text to the statements parsed from it, so text
+ * that's evaluated over and over (REPL lines, an embedder's formulas) only
+ * goes through the parser once. It's set-associative: the hash of the text
+ * picks a set of a few entries, and a miss replaces the least recently used
+ * entry of that set. The ASTs live in the global arena like any others and
+ * are shared by every lookup of the same text, so they must not be modified,
+ * and evicting an entry only forgets it. */
+typedef struct MML_parse_cache MML_parse_cache;
+
+// N_ENTRIES is rounded up to a whole number of sets
+MML_parse_cache *MML_parse_cache_create(size_t n_entries);
+void MML_parse_cache_destroy(MML_parse_cache *cache);
+
+/* Returns the statements in S, parsing it only if it isn't cached. Text with
+ * syntax errors isn't cached, so they're reported every time. */
+MML_expr_vec MML_parse_cache_get(MML_parse_cache *cache, const char *s);
+
+MML__CPP_COMPAT_END_DECLS
+
+#endif /* PARSE_CACHE_H */
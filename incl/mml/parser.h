@@ -6,12 +6,25 @@
 
 #include "mml/token.h"
 #include "mml/expr.h"
+#include "arena/arena.h"
 
 MML__CPP_COMPAT_BEGIN_DECLS
 
 MML_expr *MML_parse(const char *s);
 
 MML_expr_dvec MML_parse_stmts(const char *s);
+/* Same as `MML_parse_stmts`, except identifiers in the returned ASTs point
+ * straight into S instead of being copied, so S must outlive them (and any
+ * variables they define). */
+MML_expr_dvec MML_parse_stmts_borrowed(const char *s);
+/* Same as `MML_parse_stmts`, and stores the number of syntax errors found in
+ * *N_ERRORS. Statements with errors come out as NULL or as partial ASTs. */
+MML_expr_dvec MML_parse_stmts_checked(const char *s, uint32_t *n_errors);
+
+/* Tokens and the parser's own stack live in a scratch arena that's reset
+ * after every parse, so parsing doesn't touch the heap once the arena has
+ * grown to fit. There's one per thread; this frees the calling thread's. */
+void MML_free_parser_scratch(void);
 
 #ifndef MML_BARE_USE
 constexpr const uint8_t PRECEDENCE[] = {
@@ -298,12 +311,25 @@ extern const char *const TOK_STRINGS[];
 extern const char *const EXPR_TYPE_STRINGS[];
 
 
+struct parser_frame;
+
 struct parser_state {
-	const char *saved_s;
-	MML_token peeked_tok;
+	const char *src;
+	const MML_token *toks;
+	size_t n_toks;
+	size_t pos;
 	MML_token current_tok;
-	bool has_peeked;
-	bool looking_for_int;
+	bool borrow_source;
+	uint32_t pipe_depth; // how many `|...|` blocks the parser is inside
+	uint32_t n_errors;
+
+	// the parser's explicit stack, and the elements of the vector literals
+	// and argument lists it's in the middle of; both live in `scratch`
+	Arena *scratch;
+	struct parser_frame *frames;
+	size_t n_frames, frames_cap;
+	MML_expr **elems;
+	size_t n_elems, elems_cap;
 };
 #endif
 
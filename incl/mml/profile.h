@@ -0,0 +1,50 @@
+#ifndef PROFILE_H
+#define PROFILE_H
+
+#include <stdint.h>
+#include <stdio.h>
+
+#include "old_std_compat.h"
+#include "cpp_compat.h"
+
+#include "mml/token.h"
+#include "mml/expr.h"
+
+MML__CPP_COMPAT_BEGIN_DECLS
+
+/* A profile of where an evaluator state spends its time (see `--profile`).
+ * The evaluator only calls into it when `state->profile` is set, so an
+ * unprofiled state pays for nothing but that check, once per statement
+ * (`MML_eval_stmt`), function call, builtin call and variable read.
+ *
+ * Everything it times is a region between `MML_profile_enter` and
+ * `MML_profile_exit`, keyed by its kind and name. A region's inclusive time
+ * is all of it, and its exclusive time leaves out the regions inside it; a
+ * region that's inside itself (a recursive function) is only counted once
+ * towards inclusive time. */
+
+typedef enum {
+	MML_PROFILE_STATEMENT,
+	MML_PROFILE_FUNCTION,
+	MML_PROFILE_BUILTIN,
+	MML_PROFILE_VARIABLE,
+	MML_PROFILE_N_KINDS,
+} MML_profile_kind;
+
+typedef struct MML_profile MML_profile;
+
+MML_profile *MML_profile_create(void);
+void MML_profile_destroy(MML_profile *profile);
+
+void MML_profile_enter(MML_profile *profile, MML_profile_kind kind, strbuf name);
+/* Enters a top-level statement, named after (a shortened form of) its
+ * source, so repeated statements add up. */
+void MML_profile_enter_statement(MML_profile *profile, const MML_expr *stmt);
+void MML_profile_exit(MML_profile *profile);
+
+/* Writes the regions to STREAM, most exclusive time first. */
+void MML_profile_report(const MML_profile *profile, FILE *stream);
+
+MML__CPP_COMPAT_END_DECLS
+
+#endif /* PROFILE_H */
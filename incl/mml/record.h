@@ -0,0 +1,53 @@
+#ifndef RECORD_H
+#define RECORD_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+#include "old_std_compat.h"
+#include "cpp_compat.h"
+
+MML__CPP_COMPAT_BEGIN_DECLS
+
+/* A recording of a session (see `--record`): the source of every line the
+ * prompt evaluated, or every call to `MML_eval_parse`, in order, each with
+ * how long it took. `bench/replay.c` feeds one back through a fresh state to
+ * time it again.
+ *
+ * The file is a header line, then one entry per evaluation: a line with the
+ * nanoseconds it took and the length of its source, then the source itself
+ * and a newline. */
+
+typedef struct MML_recorder MML_recorder;
+
+/* Starts a recording in a new file at PATH; returns NULL if it can't be
+ * created. */
+MML_recorder *MML_record_open(const char *path);
+/* Finishes the recording and frees RECORDER. */
+void MML_record_close(MML_recorder *recorder);
+
+/* The time to pass to `MML_record` as when an evaluation started. */
+uint64_t MML_record_now(void);
+/* Adds an evaluation of SOURCE that started at START_NS. */
+void MML_record(MML_recorder *recorder, const char *source, size_t len, uint64_t start_ns);
+
+typedef struct {
+	const char *source; // nul-terminated
+	size_t len;
+	uint64_t ns;
+} MML_recorded_eval;
+
+typedef struct {
+	MML_recorded_eval *evals;
+	size_t n_evals;
+	char *data; // what `evals` point into
+} MML_recording;
+
+/* Reads the recording at PATH into *RECORDING; returns false (and logs why)
+ * if it can't be read or isn't a recording. */
+bool MML_recording_load(const char *path, MML_recording *recording);
+void MML_recording_free(MML_recording *recording);
+
+MML__CPP_COMPAT_END_DECLS
+
+#endif /* RECORD_H */
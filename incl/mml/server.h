@@ -0,0 +1,55 @@
+#ifndef SERVER_H
+#define SERVER_H
+
+#include <stdint.h>
+#include <stdio.h>
+
+#include "old_std_compat.h"
+#include "cpp_compat.h"
+
+#include "mml/token.h"
+
+MML__CPP_COMPAT_BEGIN_DECLS
+
+/* An evaluation daemon on a Unix domain socket, so running an expression
+ * costs a round trip instead of starting a process.
+ *
+ * Every message either way is a frame: a 32-bit little-endian length and
+ * then that many bytes. A connection starts with one frame from the client
+ * holding the name of its session. Named sessions keep their variables
+ * between requests and connections; an empty name gets a fresh state for
+ * every request. After that, the client sends requests, each a frame with a
+ * flags byte (`MML_REQ_*`) followed by the source to evaluate, and the server
+ * answers each one with any number of output frames, whose first byte is
+ * `MML_FRAME_OUT` or `MML_FRAME_ERR` (what would have gone to stdout or
+ * stderr), and then one `MML_FRAME_END` frame whose second byte is 0 if the
+ * request succeeded and 1 if it had syntax errors or its last statement
+ * evaluated to an invalid value. Output is sent as it's produced. */
+
+enum {
+	MML_REQ_PRINT = 1, // print the value of the last statement, like -P
+};
+
+#define MML_FRAME_OUT 'o'
+#define MML_FRAME_ERR 'e'
+#define MML_FRAME_END '.'
+
+/* Listens at PATH and evaluates requests on N_WORKERS threads (the number of
+ * online CPUs if 0) until SIGINT or SIGTERM. Connections waiting for their
+ * next request don't tie up a worker: a request without a session goes to
+ * whichever worker is free, and one in a named session to the worker that
+ * holds it, so a session's state is never shared between threads. A
+ * connection that's idle for a minute is closed, and each worker keeps at
+ * most 64 sessions, dropping the least recently used one to make room.
+ * Returns nonzero if it couldn't listen. */
+int32_t MML_serve(const char *path, uint32_t n_workers);
+
+/* Sends SOURCE to the daemon at PATH in SESSION (or a fresh state if NULL or
+ * empty) and copies its output to OUT and ERR. Returns the request's status,
+ * or -1 if the daemon couldn't be reached. */
+int32_t MML_client_eval(const char *path, const char *session, strbuf source,
+		uint8_t flags, FILE *out, FILE *err);
+
+MML__CPP_COMPAT_END_DECLS
+
+#endif /* SERVER_H */
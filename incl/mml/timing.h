@@ -0,0 +1,77 @@
+#ifndef TIMING_H
+#define TIMING_H
+
+#include <stdint.h>
+#include <stdio.h>
+
+#include "old_std_compat.h"
+#include "cpp_compat.h"
+
+MML__CPP_COMPAT_BEGIN_DECLS
+
+/* Where the time goes between reading source and printing its results (see
+ * `--dbg-time`). Each thread that calls `MML_timing_start` keeps totals per
+ * phase: wall time from a monotonic clock and, where `perf_event_open` lets
+ * us, cycles, instructions and cache misses counted in user space.
+ *
+ * Phases nest: time spent lexing while parsing counts as lexing only, and
+ * printing a value from inside a statement counts as printing, not
+ * evaluating. Entering a phase that's already the innermost one is free, so
+ * recursive code can mark itself without paying for a clock read every
+ * time. */
+
+typedef enum {
+	MML_PHASE_LEX,
+	MML_PHASE_PARSE, // includes loading compiled scripts
+	MML_PHASE_OPTIMIZE,
+	MML_PHASE_EVAL,
+	MML_PHASE_PRINT,
+	MML_N_PHASES,
+} MML_phase;
+
+typedef struct {
+	uint64_t count; // times the phase was entered
+	uint64_t ns;
+	uint64_t cycles;
+	uint64_t instructions;
+	uint64_t cache_misses;
+} MML_phase_totals;
+
+typedef struct {
+	MML_phase_totals phases[MML_N_PHASES];
+	bool has_counters; // whether the hardware counters were read
+} MML_timing;
+
+/* Whether the calling thread is timing phases. */
+extern thread_local bool MML_timing_on;
+
+/* Starts timing phases on the calling thread. */
+void MML_timing_start(void);
+/* Stops timing phases on the calling thread, and moves its totals (including
+ * any merged into it) into *TOTALS if it isn't NULL. */
+void MML_timing_stop(MML_timing *totals);
+/* Moves the calling thread's totals so far into *TOTALS and resets them. */
+void MML_timing_take(MML_timing *totals);
+/* Adds TOTALS (from another thread) to the calling thread's. */
+void MML_timing_merge(const MML_timing *totals);
+/* Writes the phases in TOTALS that were entered at all to STREAM. */
+void MML_timing_report(const MML_timing *totals, FILE *stream);
+
+void MML_timing_push(MML_phase phase);
+void MML_timing_pop(MML_phase phase);
+
+static inline void MML_phase_begin(MML_phase phase)
+{
+	if (MML_timing_on)
+		MML_timing_push(phase);
+}
+
+static inline void MML_phase_end(MML_phase phase)
+{
+	if (MML_timing_on)
+		MML_timing_pop(phase);
+}
+
+MML__CPP_COMPAT_END_DECLS
+
+#endif /* TIMING_H */
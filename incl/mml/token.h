@@ -2,6 +2,7 @@
 #define TOKEN_H
 
 #include <stddef.h>
+#include <stdint.h>
 
 #include "old_std_compat.h"
 #include "cpp_compat.h"
@@ -36,6 +37,8 @@ typedef enum {
 	// non-operator tokens
 	MML_IDENT_TOK,
 	MML_NUMBER_TOK,
+	MML_INTEGER_TOK,
+	MML_STRING_TOK,
 
 	MML_DIGIT_TOK, // not really used
 	MML_LETTER_TOK,
@@ -78,11 +81,16 @@ typedef struct strbuf {
 #define str_lit(s) ((strbuf) { (s), sizeof(s)-1 })
 
 typedef struct MML_token {
-	strbuf buf;
+	uint32_t offset; // into the tokenized source
 	MML_token_type type;
+	union {
+		uint32_t len;
+		double num; // a MML_NUMBER_TOK holds its value instead of its length
+		int64_t inum; // and so does a MML_INTEGER_TOK
+	};
 } MML_token;
 
-#define nToken(type, buf, len) ((MML_token) { { (char *)(buf), (len) }, (type) })
+#define nToken(_type, _offset, _len) ((MML_token) { (uint32_t)(_offset), (_type), { .len = (uint32_t)(_len) } })
 
 MML__CPP_COMPAT_END_DECLS
 
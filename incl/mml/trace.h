@@ -0,0 +1,59 @@
+#ifndef TRACE_H
+#define TRACE_H
+
+#include <stdint.h>
+
+#include "old_std_compat.h"
+#include "cpp_compat.h"
+
+#include "mml/token.h"
+
+MML__CPP_COMPAT_BEGIN_DECLS
+
+/* A timeline of evaluation (see `--trace`), written in the Chrome trace-event
+ * JSON format that chrome://tracing and Perfetto open. Every thread records
+ * begin and end events into a ring buffer of its own, without locking; when
+ * a ring fills up, its oldest events are overwritten. The rings are written
+ * out by `MML_trace_stop`, which has to run once the threads that recorded
+ * into them are done. */
+
+typedef enum {
+	MML_TRACE_PARSE,	// lexing and parsing each statement
+	MML_TRACE_STATEMENT,	// evaluating a top-level statement
+	MML_TRACE_FUNCTION,	// user function calls
+	MML_TRACE_BUILTIN,	// builtin calls
+	MML_TRACE_VECTOR,	// operations on vectors of `MML_TRACE_VECTOR_MIN` elements or more
+	MML_TRACE_N_CATEGORIES,
+} MML_trace_category;
+
+#define MML_TRACE_VECTOR_MIN 1024
+
+/* Whether events are being recorded; only set before (or after) any other
+ * threads that record run. */
+extern bool MML_trace_on;
+
+/* Starts recording events, to be written to the file at PATH. Returns false
+ * (without starting) if the file can't be created. */
+bool MML_trace_start(const char *path);
+/* Stops recording and writes every thread's events to the file. */
+void MML_trace_stop(void);
+
+/* ARG is shown with the event if it isn't 0 (the length of a vector, say). */
+void MML_trace_record_begin(MML_trace_category cat, strbuf name, uint64_t arg);
+void MML_trace_record_end(MML_trace_category cat);
+
+static inline void MML_trace_begin(MML_trace_category cat, strbuf name, uint64_t arg)
+{
+	if (MML_trace_on)
+		MML_trace_record_begin(cat, name, arg);
+}
+
+static inline void MML_trace_end(MML_trace_category cat)
+{
+	if (MML_trace_on)
+		MML_trace_record_end(cat);
+}
+
+MML__CPP_COMPAT_END_DECLS
+
+#endif /* TRACE_H */
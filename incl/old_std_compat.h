@@ -5,6 +5,7 @@
 #include <stdbool.h>
 #define nullptr NULL
 #define constexpr static
+#define thread_local _Thread_local
 #endif
 
 #endif /* OLD_STD_COMPAT_H */
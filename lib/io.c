@@ -0,0 +1,376 @@
+#define _DEFAULT_SOURCE
+
+#include <complex.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "arena/arena.h"
+#include "mml/expr.h"
+#include "mml/eval.h"
+#include "mml/config.h"
+#include "mml/parser.h"
+#include "mml/builtins.h"
+#include "dvec/dvec.h"
+
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+#define IO_NEEDS_BYTESWAP
+#endif
+
+// The current mapping of every file loaded by `load`, one per path. A
+// variable defined as `load{...}` reloads the file every time it's used, so
+// mappings are looked up by path and reused as long as the file hasn't
+// changed. They're shared by the states on every thread, hence the lock.
+typedef struct {
+	char *path;
+	// the mapping, or on big-endian hosts a byteswapped copy of it, made
+	// once so that loading the file again reuses it too
+	const double *base;
+	size_t size;
+	dev_t dev;
+	ino_t ino;
+	time_t mtime;
+} mapped_array;
+
+typedef struct {
+	const double *base;
+	size_t size;
+} mapped_range;
+
+// When a file changes, values loaded from it before may still point into its
+// old mapping, and there's no telling when the last of them is gone. The
+// last MAX_STALE_MAPPINGS replaced mappings are kept as they are; the one
+// before that has its pages replaced by zeros, which frees the file and the
+// memory while the addresses stay readable. Only `io__cleanup` unmaps them.
+#define MAX_STALE_MAPPINGS 16
+
+#ifdef IO_NEEDS_BYTESWAP
+static double swap_double(double d)
+{
+	uint64_t bits;
+	memcpy(&bits, &d, sizeof(bits));
+	bits = __builtin_bswap64(bits);
+	memcpy(&d, &bits, sizeof(d));
+	return d;
+}
+
+// a byteswapped copy of the SIZE bytes at BASE, or NULL; it's an anonymous
+// mapping so that it's released the same way as a file's
+static const double *swapped_copy(const double *base, size_t size)
+{
+	const size_t n = size / sizeof(double);
+	double *copy = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if (copy == MAP_FAILED)
+		return NULL;
+	for (size_t i = 0; i < n; ++i)
+		copy[i] = swap_double(base[i]);
+	mprotect(copy, size, PROT_READ);
+	return copy;
+}
+#endif
+
+static dvec_t(mapped_array) mapped_arrays = DVEC_INIT;
+// the last MAX_STALE_MAPPINGS replaced mappings, in a ring
+static mapped_range stale_mappings[MAX_STALE_MAPPINGS];
+static size_t n_replaced;
+// the ones before those, now zeros
+static dvec_t(mapped_range) zeroed_mappings = DVEC_INIT;
+static pthread_mutex_t mapped_arrays_lock = PTHREAD_MUTEX_INITIALIZER;
+
+// puts the replaced mapping R aside, zeroing the oldest one kept if there
+// are too many
+static void retire_mapping(mapped_range r)
+{
+	if (r.base == NULL)
+		return;
+
+	mapped_range *slot = &stale_mappings[n_replaced++ % MAX_STALE_MAPPINGS];
+	if (slot->base != NULL)
+	{
+		// if this fails, the old mapping just stays as it was
+		void *zeros = mmap((void *)slot->base, slot->size, PROT_READ,
+				MAP_PRIVATE | MAP_ANONYMOUS | MAP_FIXED, -1, 0);
+		if (zeros != MAP_FAILED)
+			dv_push(zeroed_mappings, *slot);
+		else
+			MML_log_warn("`load`: failed to release an old mapping\n");
+	}
+	*slot = r;
+}
+
+// the entry may move once the lock is released, so it's returned by value
+static bool map_array_file_locked(const char *path, mapped_array *out)
+{
+	struct stat st;
+	if (stat(path, &st) != 0 || !S_ISREG(st.st_mode))
+		return false;
+
+	mapped_array *entry = NULL, *cur;
+	dv_foreach(mapped_arrays, cur)
+	{
+		if (strcmp(cur->path, path) != 0)
+			continue;
+		if (cur->dev == st.st_dev && cur->ino == st.st_ino
+		 && cur->size == (size_t)st.st_size && cur->mtime == st.st_mtime)
+		{
+			*out = *cur;
+			return true;
+		}
+		entry = cur;
+		break;
+	}
+
+	mapped_array m = {
+		.path = strdup(path),
+		.base = NULL,
+		.size = (size_t)st.st_size,
+		.dev = st.st_dev,
+		.ino = st.st_ino,
+		.mtime = st.st_mtime,
+	};
+
+	if (m.size > 0)
+	{
+		const int fd = open(path, O_RDONLY);
+		if (fd < 0)
+		{
+			free(m.path);
+			return false;
+		}
+		void *base = mmap(NULL, m.size, PROT_READ, MAP_SHARED, fd, 0);
+		close(fd);
+		if (base == MAP_FAILED)
+		{
+			free(m.path);
+			return false;
+		}
+		m.base = base;
+#ifdef IO_NEEDS_BYTESWAP
+		m.base = swapped_copy(base, m.size);
+		munmap(base, m.size);
+		if (m.base == NULL)
+		{
+			free(m.path);
+			return false;
+		}
+#endif
+	}
+
+	// the file changed: the new mapping takes the old one's place
+	if (entry != NULL)
+	{
+		retire_mapping((mapped_range) { entry->base, entry->size });
+		free(entry->path);
+		*entry = m;
+	} else
+	{
+		dv_push(mapped_arrays, m);
+	}
+	*out = m;
+	return true;
+}
+
+static bool map_array_file(const char *path, mapped_array *out)
+{
+	pthread_mutex_lock(&mapped_arrays_lock);
+	const bool ok = map_array_file_locked(path, out);
+	pthread_mutex_unlock(&mapped_arrays_lock);
+	return ok;
+}
+
+static MML_value custom_load(MML_state *state, MML_expr_vec *args)
+{
+	if (args->n < 1 || args->n > 2)
+	{
+		MML_log_err("`load`: takes a path string and optionally a Boolean that's "
+				"true if the file holds complex numbers\n");
+		return VAL_INVAL;
+	}
+
+	const MML_value path_val = MML_eval_expr(state, args->ptr[0]);
+	if (path_val.type != String_type)
+	{
+		MML_log_err("`load`: the path must be a string\n");
+		return VAL_INVAL;
+	}
+
+	bool is_complex = false;
+	if (args->n == 2)
+	{
+		const MML_value complex_val = MML_eval_expr(state, args->ptr[1]);
+		if (complex_val.type != Boolean_type)
+		{
+			MML_log_err("`load`: the second argument must be a Boolean\n");
+			return VAL_INVAL;
+		}
+		is_complex = complex_val.b;
+	}
+
+	char *path __attribute__((cleanup(MML_free_pp))) = strndup(path_val.s.s, path_val.s.len);
+	mapped_array m;
+	if (!map_array_file(path, &m))
+	{
+		MML_log_err("`load`: failed to map '%s'\n", path);
+		return VAL_INVAL;
+	}
+
+	const size_t elem_size = (is_complex ? 2 : 1) * sizeof(double);
+	if (m.size % elem_size != 0)
+	{
+		MML_log_err("`load`: the size of '%s' (%zu bytes) isn't a multiple of %zu\n",
+				path, m.size, elem_size);
+		return VAL_INVAL;
+	}
+
+	const MML_num_array ret = { m.base, m.size / elem_size, is_complex };
+	return (MML_value) { NumArray_type, .a = ret };
+}
+
+static bool write_doubles(FILE *stream, const double *p, size_t n)
+{
+#ifdef IO_NEEDS_BYTESWAP
+	for (size_t i = 0; i < n; ++i)
+	{
+		const double d = swap_double(p[i]);
+		if (fwrite(&d, sizeof(double), 1, stream) != 1)
+			return false;
+	}
+	return true;
+#else
+	return fwrite(p, sizeof(double), n, stream) == n;
+#endif
+}
+
+// packs the elements of VAL as (real, imag) pairs into an arena buffer
+static const double *pack_value(MML_state *state, const MML_value *val, size_t *n, bool *is_complex)
+{
+	if (val->type == Range_type)
+	{
+		// a null array if it's too long to pack, which has been reported
+		const MML_num_array packed = MML_range_to_num_array(val->r);
+		*n = packed.n;
+		*is_complex = false;
+		return packed.ptr;
+	}
+	if (val->type == NumArray_type)
+	{
+		*n = val->a.n;
+		*is_complex = val->a.is_complex;
+		return val->a.ptr;
+	}
+
+	const MML_expr_vec elems = (val->type == Vector_type)
+		? val->v
+		: (MML_expr_vec) { nullptr, 1 };
+
+	double *buf = arena_alloc_T(MML_global_arena, 2*elems.n, double);
+	*n = elems.n;
+	*is_complex = false;
+	for (size_t i = 0; i < elems.n; ++i)
+	{
+		const MML_value cur = (elems.ptr != nullptr) ? MML_eval_expr(state, elems.ptr[i]) : *val;
+		if (!VAL_IS_NUM(cur))
+		{
+			MML_log_err("`save`: can only save numbers, but element %zu is a %s\n",
+					i, EXPR_TYPE_STRINGS[cur.type]);
+			return NULL;
+		}
+		const _Complex double z = MML_get_complex(&cur);
+		buf[2*i] = creal(z);
+		buf[2*i+1] = cimag(z);
+		*is_complex = *is_complex || cur.type == ComplexNumber_type;
+	}
+
+	if (!*is_complex)
+		for (size_t i = 0; i < elems.n; ++i)
+			buf[i] = buf[2*i];
+
+	return buf;
+}
+
+static MML_value custom_save(MML_state *state, MML_expr_vec *args)
+{
+	if (args->n != 2)
+	{
+		MML_log_err("`save`: takes a vector and a path string\n");
+		return VAL_INVAL;
+	}
+
+	const MML_value val = MML_eval_expr(state, args->ptr[0]);
+	const MML_value path_val = MML_eval_expr(state, args->ptr[1]);
+	if (path_val.type != String_type)
+	{
+		MML_log_err("`save`: the path must be a string\n");
+		return VAL_INVAL;
+	}
+
+	size_t n;
+	bool is_complex;
+	const double *data = pack_value(state, &val, &n, &is_complex);
+	if (data == NULL)
+		return VAL_INVAL;
+
+	// write to a temporary file and rename it over the destination, so any
+	// existing mapping of the old file stays intact
+	char *path __attribute__((cleanup(MML_free_pp))) = strndup(path_val.s.s, path_val.s.len);
+	char *tmp_path __attribute__((cleanup(MML_free_pp))) = malloc(path_val.s.len + sizeof(".XXXXXX"));
+	sprintf(tmp_path, "%s.XXXXXX", path);
+
+	const int fd = mkstemp(tmp_path);
+	FILE *out = (fd >= 0) ? fdopen(fd, "wb") : NULL;
+	if (out == NULL)
+	{
+		if (fd >= 0) close(fd);
+		MML_log_err("`save`: failed to create a file next to '%s'\n", path);
+		return VAL_INVAL;
+	}
+	fchmod(fd, 0644);
+
+	const bool ok = write_doubles(out, data, (is_complex) ? 2*n : n);
+	if (fclose(out) != 0 || !ok || rename(tmp_path, path) != 0)
+	{
+		unlink(tmp_path);
+		MML_log_err("`save`: failed to write '%s'\n", path);
+		return VAL_INVAL;
+	}
+
+	return NOTHING_VAL;
+}
+
+const MML_builtin io__builtins[] = {
+#define MML_BUILTIN MML_BUILTIN_ENTRY
+#include "io.def"
+#undef MML_BUILTIN
+};
+
+void io__cleanup(void)
+{
+	pthread_mutex_lock(&mapped_arrays_lock);
+	mapped_array *cur;
+	dv_foreach(mapped_arrays, cur)
+	{
+		if (cur->base != NULL)
+			munmap((void *)cur->base, cur->size);
+		free(cur->path);
+	}
+	dv_destroy(mapped_arrays);
+
+	for (size_t i = 0; i < MAX_STALE_MAPPINGS; ++i)
+	{
+		if (stale_mappings[i].base != NULL)
+			munmap((void *)stale_mappings[i].base, stale_mappings[i].size);
+		stale_mappings[i] = (mapped_range) { NULL, 0 };
+	}
+	n_replaced = 0;
+	mapped_range *zeroed;
+	dv_foreach(zeroed_mappings, zeroed)
+		munmap((void *)zeroed->base, zeroed->size);
+	dv_destroy(zeroed_mappings);
+	pthread_mutex_unlock(&mapped_arrays_lock);
+}
@@ -1,12 +1,19 @@
+#define _DEFAULT_SOURCE
+
+#include <float.h>
 #include <math.h>
+#include <pthread.h>
 #include <stdlib.h>
+#include <string.h>
 #include <complex.h>
+#include <unistd.h>
 
 #include "arena/arena.h"
 #include "mml/expr.h"
 #include "mml/eval.h"
 #include "mml/config.h"
-#include "map.h"
+#include "mml/builtins.h"
+#include "mml/parser.h"
 
 static _Complex double custom_clog2(_Complex double a)
 {
@@ -91,12 +98,13 @@ static MML_value custom_atan2(MML_state *state, MML_expr_vec *args)
 
 	const MML_value y = MML_eval_expr(state, args->ptr[0]);
 	const MML_value x = MML_eval_expr(state, args->ptr[1]);
-	if (y.type != RealNumber_type || x.type != RealNumber_type)
+	if ((y.type != RealNumber_type && y.type != Integer_type)
+	 || (x.type != RealNumber_type && x.type != Integer_type))
 	{
 		MML_log_err("`atan2` takes exactly 2 real number arguments\n");
 		return VAL_INVAL;
 	}
-	return VAL_NUM(atan2(y.n, x.n));
+	return VAL_NUM(atan2(MML_get_number(&y), MML_get_number(&x)));
 }
 
 static MML_value custom_max(MML_state *state, MML_expr_vec *args)
@@ -137,8 +145,548 @@ static MML_value custom_min(MML_state *state, MML_expr_vec *args)
 	return min;
 }
 
+// past this, the indices of a range's elements aren't exact as doubles
+#define RANGE_MAX_LEN (1ull << 53)
+
+// evaluates ARG into *OUT if it's a finite real number
+static bool get_finite_real(MML_state *state, const MML_expr *arg, double *out)
+{
+	const MML_value v = MML_eval_expr(state, arg);
+	if (v.type != RealNumber_type && v.type != Integer_type)
+		return false;
+	*out = MML_get_number(&v);
+	return isfinite(*out);
+}
+
+static MML_value custom_range(MML_state *state, MML_expr_vec *args)
+{
+	double x[3] = { 0.0, 0.0, 1.0 };
+	bool ok = args->n == 2 || args->n == 3;
+	for (size_t i = 0; ok && i < args->n; ++i)
+		ok = get_finite_real(state, args->ptr[i], &x[i]);
+	if (!ok)
+	{
+		MML_log_err("`range`: takes 2 or 3 finite real number arguments: the start, the end and optionally the step\n");
+		return VAL_INVAL;
+	}
+
+	const double start = x[0], end = x[1], step = x[2];
+	if (step == 0.0)
+	{
+		MML_log_err("`range`: the step can't be 0\n");
+		return VAL_INVAL;
+	}
+
+	// like MATLAB's `start:step:end`, the end is included if it's within
+	// rounding error of the last step
+	const double span = (end - start) / step;
+	const double tolerance = 3 * DBL_EPSILON * fmax(fabs(start), fabs(end)) / fabs(step);
+	if (span + tolerance < 0.0)
+		return MML_make_range(start, step, start, 0);
+	if (span + tolerance >= (double)(RANGE_MAX_LEN - 1))
+	{
+		MML_log_err("`range`: too many elements\n");
+		return VAL_INVAL;
+	}
+
+	const size_t n = (size_t)floor(span + tolerance) + 1;
+	return MML_make_range(start, step, start + (double)(n-1) * step, n);
+}
+
+static MML_value custom_linspace(MML_state *state, MML_expr_vec *args)
+{
+	double start, end, count;
+	if (args->n != 3
+	 || !get_finite_real(state, args->ptr[0], &start)
+	 || !get_finite_real(state, args->ptr[1], &end)
+	 || !get_finite_real(state, args->ptr[2], &count)
+	 || count < 0.0 || count != floor(count))
+	{
+		MML_log_err("`linspace`: takes 3 arguments: the start and end (finite real numbers) and how many elements (a non-negative integer)\n");
+		return VAL_INVAL;
+	}
+	if (count > (double)RANGE_MAX_LEN)
+	{
+		MML_log_err("`linspace`: too many elements\n");
+		return VAL_INVAL;
+	}
+
+	const size_t n = (size_t)count;
+	if (n <= 1)
+		return MML_make_range(start, 0.0, start, n);
+	return MML_make_range(start, (end - start) / (double)(n-1), end, n);
+}
+
+/*
+ * Reductions. Real elements are reduced in blocks of BLOCK_LEN by a kernel
+ * working on 2-double SIMD lanes, with pairwise summation inside each block and over the blocks of
+ * a chunk and over the chunks, so the rounding error grows with log(n)
+ * instead of n. Chunks are what threads split up, and since the chunks are
+ * the same however many threads there are, so is the result. Ranges are
+ * generated a block at a time, without being stored.
+ */
+
+#define BLOCK_LEN 4096
+#define CHUNK_BLOCKS 64
+#define CHUNK_LEN ((size_t)BLOCK_LEN * CHUNK_BLOCKS)
+// below this, threads cost more than they save
+#define PARALLEL_MIN_LEN (4 * CHUNK_LEN)
+#define MAX_REDUCE_THREADS 64
+// below this, the kernel works on its own instead of halving further
+#define PAIRWISE_LEN 128
+
+// the width of SSE2 and NEON registers, which every target this builds for has
+typedef double lanes __attribute__((vector_size(2 * sizeof(double))));
+
+typedef enum {
+	REDUCE_SUM,	// x
+	REDUCE_SQDEV,	// (x - m)^2
+	REDUCE_DOT,	// x*y
+	REDUCE_PROD,	// x, multiplied instead of added
+} reduce_op;
+
+// a vector's elements, as the reductions read them
+typedef struct {
+	const double *ptr; // (real, imag) pairs if `is_complex`; NULL for `r`
+	const MML_range *r;
+	size_t n;
+	bool is_complex;
+} reduce_elems;
+
+static inline lanes load_lanes(const double *p)
+{
+	lanes v;
+	memcpy(&v, p, sizeof(v));
+	return v;
+}
+
+static inline double combine(reduce_op op, double a, double b)
+{
+	return (op == REDUCE_PROD) ? a*b : a + b;
+}
+
+static inline double term(reduce_op op, const double *x, const double *y, size_t i, double m)
+{
+	switch (op) {
+	case REDUCE_SQDEV: return (x[i] - m) * (x[i] - m);
+	case REDUCE_DOT: return x[i] * y[i];
+	default: return x[i];
+	}
+}
+
+static double reduce_kernel(reduce_op op, const double *x, const double *y, size_t n, double m)
+{
+	const double identity = (op == REDUCE_PROD) ? 1.0 : 0.0;
+	lanes acc[4];
+	for (size_t j = 0; j < 4; ++j)
+		acc[j] = (lanes) { identity, identity };
+	size_t i = 0;
+
+	// four accumulators, so consecutive additions don't wait on each other
+	switch (op) {
+	case REDUCE_SUM:
+		for (; i + 8 <= n; i += 8)
+			for (size_t j = 0; j < 4; ++j)
+				acc[j] += load_lanes(x + i + 2*j);
+		break;
+	case REDUCE_SQDEV:
+		for (; i + 8 <= n; i += 8)
+			for (size_t j = 0; j < 4; ++j)
+			{
+				const lanes d = load_lanes(x + i + 2*j) - m;
+				acc[j] += d*d;
+			}
+		break;
+	case REDUCE_DOT:
+		for (; i + 8 <= n; i += 8)
+			for (size_t j = 0; j < 4; ++j)
+				acc[j] += load_lanes(x + i + 2*j) * load_lanes(y + i + 2*j);
+		break;
+	case REDUCE_PROD:
+		for (; i + 8 <= n; i += 8)
+			for (size_t j = 0; j < 4; ++j)
+				acc[j] *= load_lanes(x + i + 2*j);
+		break;
+	}
+
+	const lanes total = (op == REDUCE_PROD)
+		? (acc[0]*acc[1]) * (acc[2]*acc[3])
+		: (acc[0] + acc[1]) + (acc[2] + acc[3]);
+	double ret = combine(op, total[0], total[1]);
+	for (; i < n; ++i)
+		ret = combine(op, ret, term(op, x, y, i, m));
+	return ret;
+}
+
+static double reduce_pairwise(reduce_op op, const double *x, const double *y, size_t n, double m)
+{
+	if (n <= PAIRWISE_LEN)
+		return reduce_kernel(op, x, y, n, m);
+
+	const size_t half = n / 2;
+	return combine(op,
+			reduce_pairwise(op, x, y, half, m),
+			reduce_pairwise(op, x + half, (y != NULL) ? y + half : NULL, n - half, m));
+}
+
+// the LEN elements of E from FIRST on, written to BUF if E is a range
+static const double *elems_block(const reduce_elems *e, size_t first, size_t len, double *buf)
+{
+	if (e->ptr != NULL)
+		return e->ptr + first;
+
+	// the same as `MML_range_at`, in a form that vectorizes: indices are
+	// below 2^53, so they're exact either way
+	const MML_range *r = e->r;
+	const double base = (double)first;
+	for (uint32_t i = 0; i < (uint32_t)len; ++i)
+		buf[i] = r->start + (base + (double)i) * r->step;
+	if (first + len == r->n)
+		buf[len-1] = r->last;
+	return buf;
+}
+
+typedef struct {
+	reduce_op op;
+	const reduce_elems *x, *y;
+	double m;
+	size_t first_chunk, end_chunk;
+	double *chunk_results;
+} reduce_task;
+
+static void *run_reduce_task(void *arg)
+{
+	const reduce_task *t = arg;
+	double x_buf[BLOCK_LEN], y_buf[BLOCK_LEN];
+	double block_results[CHUNK_BLOCKS];
+
+	for (size_t c = t->first_chunk; c < t->end_chunk; ++c)
+	{
+		const size_t chunk_first = c * CHUNK_LEN;
+		const size_t chunk_len = (t->x->n - chunk_first < CHUNK_LEN) ? t->x->n - chunk_first : CHUNK_LEN;
+		size_t n_blocks = 0;
+		for (size_t first = chunk_first; first < chunk_first + chunk_len; first += BLOCK_LEN)
+		{
+			const size_t len = (chunk_first + chunk_len - first < BLOCK_LEN)
+				? chunk_first + chunk_len - first
+				: BLOCK_LEN;
+			const double *x = elems_block(t->x, first, len, x_buf);
+			const double *y = (t->y != NULL) ? elems_block(t->y, first, len, y_buf) : NULL;
+			block_results[n_blocks++] = reduce_pairwise(t->op, x, y, len, t->m);
+		}
+		t->chunk_results[c] = reduce_pairwise(
+				(t->op == REDUCE_PROD) ? REDUCE_PROD : REDUCE_SUM,
+				block_results, NULL, n_blocks, 0.0);
+	}
+	return NULL;
+}
+
+static uint32_t reduce_threads(size_t n, size_t n_chunks)
+{
+	if (n < PARALLEL_MIN_LEN)
+		return 1;
+	const long n_cpus = sysconf(_SC_NPROCESSORS_ONLN);
+	size_t n_threads = (n_cpus > 1) ? (size_t)n_cpus : 1;
+	if (n_threads > n_chunks)
+		n_threads = n_chunks;
+	return (n_threads < MAX_REDUCE_THREADS) ? (uint32_t)n_threads : MAX_REDUCE_THREADS;
+}
+
+// reduces the real elements of X (and Y, which has as many, for dot
+// products); M is the mean for REDUCE_SQDEV
+static double reduce_real(reduce_op op, const reduce_elems *x, const reduce_elems *y, double m)
+{
+	if (x->n == 0)
+		return (op == REDUCE_PROD) ? 1.0 : 0.0;
+
+	const size_t n_chunks = (x->n + CHUNK_LEN - 1) / CHUNK_LEN;
+	double one_result;
+	double *chunk_results = (n_chunks > 1) ? malloc(n_chunks * sizeof(double)) : &one_result;
+	if (chunk_results == NULL)
+	{
+		MML_log_err("failed to allocate memory for a reduction of %zu elements\n", x->n);
+		return NAN;
+	}
+
+	const uint32_t n_threads = reduce_threads(x->n, n_chunks);
+	reduce_task tasks[MAX_REDUCE_THREADS];
+	pthread_t threads[MAX_REDUCE_THREADS];
+	bool started[MAX_REDUCE_THREADS];
+	for (uint32_t i = 0; i < n_threads; ++i)
+	{
+		tasks[i] = (reduce_task) {
+			.op = op, .x = x, .y = y, .m = m,
+			.first_chunk = n_chunks * i / n_threads,
+			.end_chunk = n_chunks * (i+1) / n_threads,
+			.chunk_results = chunk_results,
+		};
+		// the calling thread does the first share itself
+		started[i] = i > 0 && pthread_create(&threads[i], NULL, run_reduce_task, &tasks[i]) == 0;
+	}
+	run_reduce_task(&tasks[0]);
+	for (uint32_t i = 1; i < n_threads; ++i)
+	{
+		if (started[i])
+			pthread_join(threads[i], NULL);
+		else
+			run_reduce_task(&tasks[i]);
+	}
+
+	const double ret = reduce_pairwise((op == REDUCE_PROD) ? REDUCE_PROD : REDUCE_SUM,
+			chunk_results, NULL, n_chunks, 0.0);
+	if (chunk_results != &one_result)
+		free(chunk_results);
+	return ret;
+}
+
+// compensated (Kahan-Babuska) summation, for complex elements
+typedef struct {
+	double sum, c;
+} neumaier;
+
+static inline void neumaier_add(neumaier *acc, double x)
+{
+	const double t = acc->sum + x;
+	acc->c += (fabs(acc->sum) >= fabs(x)) ? (acc->sum - t) + x : (x - t) + acc->sum;
+	acc->sum = t;
+}
+
+static inline _Complex double complex_elem(const reduce_elems *e, size_t i)
+{
+	if (e->is_complex)
+		return CMPLX(e->ptr[2*i], e->ptr[2*i+1]);
+	return (e->ptr != NULL) ? e->ptr[i] : MML_range_at(e->r, i);
+}
+
+static _Complex double reduce_complex(reduce_op op, const reduce_elems *x, const reduce_elems *y, _Complex double m)
+{
+	if (op == REDUCE_PROD)
+	{
+		_Complex double prod = 1.0;
+		for (size_t i = 0; i < x->n; ++i)
+			prod *= complex_elem(x, i);
+		return prod;
+	}
+
+	neumaier re = { 0.0, 0.0 }, im = { 0.0, 0.0 };
+	for (size_t i = 0; i < x->n; ++i)
+	{
+		const _Complex double z = complex_elem(x, i);
+		_Complex double t;
+		switch (op) {
+		case REDUCE_SQDEV: t = cabs(z - m) * cabs(z - m); break;
+		case REDUCE_DOT: t = z * complex_elem(y, i); break;
+		default: t = z; break;
+		}
+		neumaier_add(&re, creal(t));
+		neumaier_add(&im, cimag(t));
+	}
+	return CMPLX(re.sum + re.c, im.sum + im.c);
+}
+
+static MML_value complex_result(_Complex double z)
+{
+	return (cimag(z) == 0.0) ? VAL_NUM(creal(z)) : VAL_CNUM(z);
+}
+
+// packs the numbers in EXPRS into the arena
+static bool pack_elems(MML_state *state, const char *fn, const MML_expr_vec *exprs, reduce_elems *out)
+{
+	double *re = arena_alloc_T(MML_global_arena, exprs->n, double);
+	double *im = NULL;
+	for (size_t i = 0; i < exprs->n; ++i)
+	{
+		const MML_value cur = MML_eval_expr(state, exprs->ptr[i]);
+		if (!VAL_IS_NUM(cur))
+		{
+			MML_log_err("`%s`: can only reduce numbers, but element %zu is a %s\n",
+					fn, i, EXPR_TYPE_STRINGS[cur.type]);
+			return false;
+		}
+		const _Complex double z = MML_get_complex(&cur);
+		if (cimag(z) != 0.0 && im == NULL)
+		{
+			im = arena_alloc_T(MML_global_arena, exprs->n, double);
+			memset(im, 0, exprs->n * sizeof(double));
+		}
+		re[i] = creal(z);
+		if (im != NULL)
+			im[i] = cimag(z);
+	}
+
+	*out = (reduce_elems) { re, nullptr, exprs->n, false };
+	if (im != NULL)
+	{
+		double *pairs = arena_alloc_T(MML_global_arena, 2*exprs->n, double);
+		for (size_t i = 0; i < exprs->n; ++i)
+		{
+			pairs[2*i] = re[i];
+			pairs[2*i+1] = im[i];
+		}
+		*out = (reduce_elems) { pairs, nullptr, exprs->n, true };
+	}
+	return true;
+}
+
+// the elements of the vector VAL, or VAL itself if it's a number
+static bool value_elems(MML_state *state, const char *fn, const MML_value *val, reduce_elems *out)
+{
+	switch (val->type) {
+	case NumArray_type:
+		*out = (reduce_elems) { val->a.ptr, nullptr, val->a.n, val->a.is_complex };
+		return true;
+	case Range_type:
+		*out = (reduce_elems) { nullptr, val->r, val->r->n, false };
+		return true;
+	case Vector_type:
+		return pack_elems(state, fn, &val->v, out);
+	default:
+		if (!VAL_IS_NUM(*val))
+		{
+			MML_log_err("`%s`: takes a vector or numbers; found a %s\n", fn, EXPR_TYPE_STRINGS[val->type]);
+			return false;
+		}
+		MML_expr *e = arena_alloc_T(MML_global_arena, 1, MML_expr);
+		e->type = val->type;
+		e->w = val->w;
+		return pack_elems(state, fn, &(MML_expr_vec) { &e, 1 }, out);
+	}
+}
+
+// the elements of ARGS: the vector if there's just one, otherwise the
+// arguments themselves
+static bool arg_elems(MML_state *state, const char *fn, MML_expr_vec *args, reduce_elems *out)
+{
+	if (args->n != 1)
+		return pack_elems(state, fn, args, out);
+	const MML_value val = MML_eval_expr(state, args->ptr[0]);
+	return value_elems(state, fn, &val, out);
+}
+
+static MML_value custom_sum(MML_state *state, MML_expr_vec *args)
+{
+	reduce_elems e;
+	if (!arg_elems(state, "sum", args, &e))
+		return VAL_INVAL;
+	if (e.is_complex)
+		return complex_result(reduce_complex(REDUCE_SUM, &e, NULL, 0.0));
+	return VAL_NUM(reduce_real(REDUCE_SUM, &e, NULL, 0.0));
+}
+
+static MML_value custom_prod(MML_state *state, MML_expr_vec *args)
+{
+	reduce_elems e;
+	if (!arg_elems(state, "prod", args, &e))
+		return VAL_INVAL;
+	if (e.is_complex)
+		return complex_result(reduce_complex(REDUCE_PROD, &e, NULL, 0.0));
+	return VAL_NUM(reduce_real(REDUCE_PROD, &e, NULL, 0.0));
+}
+
+static MML_value custom_mean(MML_state *state, MML_expr_vec *args)
+{
+	reduce_elems e;
+	if (!arg_elems(state, "mean", args, &e))
+		return VAL_INVAL;
+	if (e.n == 0)
+		return VAL_NUM(NAN);
+	if (e.is_complex)
+		return complex_result(reduce_complex(REDUCE_SUM, &e, NULL, 0.0) / (double)e.n);
+	return VAL_NUM(reduce_real(REDUCE_SUM, &e, NULL, 0.0) / (double)e.n);
+}
+
+// the sample variance (divided by n - 1), from the squared distances to
+// the mean, which loses far less than subtracting the squared mean does
+static double variance(const reduce_elems *e)
+{
+	if (e->n < 2)
+		return (e->n == 1) ? 0.0 : NAN;
+	if (e->is_complex)
+	{
+		const _Complex double m = reduce_complex(REDUCE_SUM, e, NULL, 0.0) / (double)e->n;
+		return creal(reduce_complex(REDUCE_SQDEV, e, NULL, m)) / (double)(e->n - 1);
+	}
+	const double m = reduce_real(REDUCE_SUM, e, NULL, 0.0) / (double)e->n;
+	return reduce_real(REDUCE_SQDEV, e, NULL, m) / (double)(e->n - 1);
+}
+
+static MML_value custom_var(MML_state *state, MML_expr_vec *args)
+{
+	reduce_elems e;
+	if (!arg_elems(state, "var", args, &e))
+		return VAL_INVAL;
+	return VAL_NUM(variance(&e));
+}
+
+static MML_value custom_std(MML_state *state, MML_expr_vec *args)
+{
+	reduce_elems e;
+	if (!arg_elems(state, "std", args, &e))
+		return VAL_INVAL;
+	return VAL_NUM(sqrt(variance(&e)));
+}
+
+// the norm of E with every element divided by the largest magnitude first,
+// like `hypot` does, so no square can overflow or underflow
+static double scaled_norm(const reduce_elems *e)
+{
+	double scale = 0.0;
+	for (size_t i = 0; i < e->n; ++i)
+		scale = fmax(scale, cabs(complex_elem(e, i)));
+	if (scale == 0.0 || isinf(scale))
+		return scale;
+
+	neumaier acc = { 0.0, 0.0 };
+	for (size_t i = 0; i < e->n; ++i)
+	{
+		const double t = cabs(complex_elem(e, i)) / scale;
+		neumaier_add(&acc, t*t);
+	}
+	return scale * sqrt(acc.sum + acc.c);
+}
+
+static MML_value custom_norm(MML_state *state, MML_expr_vec *args)
+{
+	reduce_elems e;
+	if (!arg_elems(state, "norm", args, &e))
+		return VAL_INVAL;
+	const double sum_sq = (e.is_complex)
+		? creal(reduce_complex(REDUCE_SQDEV, &e, NULL, 0.0))
+		: reduce_real(REDUCE_DOT, &e, &e, 0.0);
+	// the squares are only out of range for elements beyond about 1e154 or
+	// below about 1e-154, so the scaled pass is rarely needed (an overflow
+	// shows up as NaN in the compensated complex sum, not as inf)
+	if (!isfinite(sum_sq) || sum_sq < DBL_MIN / DBL_EPSILON)
+		return VAL_NUM(scaled_norm(&e));
+	return VAL_NUM(sqrt(sum_sq));
+}
+
+static MML_value custom_dot(MML_state *state, MML_expr_vec *args)
+{
+	if (args->n != 2)
+	{
+		MML_log_err("`dot`: takes exactly 2 vector arguments\n");
+		return VAL_INVAL;
+	}
+
+	const MML_value a = MML_eval_expr(state, args->ptr[0]);
+	const MML_value b = MML_eval_expr(state, args->ptr[1]);
+	reduce_elems x, y;
+	if (!value_elems(state, "dot", &a, &x) || !value_elems(state, "dot", &b, &y))
+		return VAL_INVAL;
+	if (x.n != y.n)
+	{
+		MML_log_err("`dot`: the vectors have different lengths (%zu and %zu)\n", x.n, y.n);
+		return VAL_INVAL;
+	}
+
+	if (x.is_complex || y.is_complex)
+		return complex_result(reduce_complex(REDUCE_DOT, &x, &y, 0.0));
+	return VAL_NUM(reduce_real(REDUCE_DOT, &x, &y, 0.0));
+}
+
 // set this before using compare_values()
-static MML_state *cur_state;
+static thread_local MML_state *cur_state;
 
 static int compare_values(const void *a, const void *b)
 {
@@ -150,10 +698,43 @@ static int compare_values(const void *a, const void *b)
 	return MML_get_number(&va) - MML_get_number(&vb);
 }
 
+static int compare_doubles(const void *a, const void *b)
+{
+	const double da = *(const double *)a;
+	const double db = *(const double *)b;
+	return (da > db) - (da < db);
+}
+
 static MML_value custom_sort(MML_state *state, MML_expr_vec *args)
 {
-	const MML_value vec = MML_eval_expr(state, args->ptr[0]);
-	if (vec.type != Vector_type) return VAL_INVAL;
+	MML_value vec = MML_eval_expr(state, args->ptr[0]);
+	if (vec.type == Range_type)
+	{
+		const MML_num_array packed = MML_range_to_num_array(vec.r);
+		if (packed.ptr == nullptr)
+			return VAL_INVAL;
+		vec = (MML_value) { NumArray_type, .a = packed };
+	}
+	if (vec.type == NumArray_type && vec.a.is_complex)
+	{
+		MML_log_err("`sort`: complex numbers have no order\n");
+		return VAL_INVAL;
+	}
+	if (vec.type == NumArray_type)
+	{
+		// packed arrays are sorted without boxing anything
+		double *sorted = arena_alloc_T(MML_global_arena, vec.a.n, double);
+		memcpy(sorted, vec.a.ptr, vec.a.n * sizeof(double));
+		qsort(sorted, vec.a.n, sizeof(double), compare_doubles);
+
+		return (MML_value) { NumArray_type, .a = { sorted, vec.a.n, false } };
+	}
+	if (vec.type != Vector_type)
+	{
+		if (vec.type != Invalid_type)
+			MML_log_err("`sort`: takes a vector; found a %s\n", EXPR_TYPE_STRINGS[vec.type]);
+		return VAL_INVAL;
+	}
 
 	MML_expr_vec ret_vec;
 	ret_vec.ptr = arena_alloc_T(MML_global_arena, vec.v.n, MML_expr *);
@@ -174,83 +755,17 @@ static MML_value custom_sort(MML_state *state, MML_expr_vec *args)
 }
 
 
-static void register_functions(hashmap *maps[6])
-{
-	hashmap_set(maps[1], hashmap_str_lit("max"),			(uintptr_t)custom_max);
-	hashmap_set(maps[1], hashmap_str_lit("min"),			(uintptr_t)custom_min);
-	hashmap_set(maps[1], hashmap_str_lit("root"),			(uintptr_t)custom_root);
-	hashmap_set(maps[1], hashmap_str_lit("logb"),			(uintptr_t)custom_logb);
-	hashmap_set(maps[1], hashmap_str_lit("atan2"),			(uintptr_t)custom_atan2);
-	hashmap_set(maps[1], hashmap_str_lit("sort"),			(uintptr_t)custom_sort);
-
-	hashmap_set(maps[2], hashmap_str_lit("sin"),			(uintptr_t)sin);
-	hashmap_set(maps[2], hashmap_str_lit("cos"),			(uintptr_t)cos);
-	hashmap_set(maps[2], hashmap_str_lit("tan"),			(uintptr_t)tan);
-	hashmap_set(maps[2], hashmap_str_lit("asin"),			(uintptr_t)asin);
-	hashmap_set(maps[2], hashmap_str_lit("acos"),			(uintptr_t)acos);
-	hashmap_set(maps[2], hashmap_str_lit("atan"),			(uintptr_t)atan);
-	hashmap_set(maps[2], hashmap_str_lit("sinh"),			(uintptr_t)sinh);
-	hashmap_set(maps[2], hashmap_str_lit("cosh"),			(uintptr_t)cosh);
-	hashmap_set(maps[2], hashmap_str_lit("tanh"),			(uintptr_t)tanh);
-	hashmap_set(maps[2], hashmap_str_lit("asinh"),			(uintptr_t)asinh);
-	hashmap_set(maps[2], hashmap_str_lit("acosh"),			(uintptr_t)acosh);
-	hashmap_set(maps[2], hashmap_str_lit("atanh"),			(uintptr_t)atanh);
-	hashmap_set(maps[2], hashmap_str_lit("ln"),			(uintptr_t)log);
-	hashmap_set(maps[2], hashmap_str_lit("log"),			(uintptr_t)log);
-	hashmap_set(maps[2], hashmap_str_lit("log2"),			(uintptr_t)log2);
-	hashmap_set(maps[2], hashmap_str_lit("log10"),			(uintptr_t)log10);
-	hashmap_set(maps[2], hashmap_str_lit("sqrt"),			(uintptr_t)sqrt);
-	hashmap_set(maps[2], hashmap_str_lit("floor"),			(uintptr_t)floor);
-	hashmap_set(maps[2], hashmap_str_lit("ceil"),			(uintptr_t)ceil);
-	hashmap_set(maps[2], hashmap_str_lit("round"),			(uintptr_t)round);
-
-	hashmap_set(maps[3], hashmap_str_lit("complex_sin"),		(uintptr_t)csin);
-	hashmap_set(maps[3], hashmap_str_lit("complex_cos"),		(uintptr_t)ccos);
-	hashmap_set(maps[3], hashmap_str_lit("complex_tan"),		(uintptr_t)ctan);
-	hashmap_set(maps[3], hashmap_str_lit("complex_asin"),		(uintptr_t)casin);
-	hashmap_set(maps[3], hashmap_str_lit("complex_acos"),		(uintptr_t)cacos);
-	hashmap_set(maps[3], hashmap_str_lit("complex_atan"),		(uintptr_t)catan);
-	hashmap_set(maps[3], hashmap_str_lit("complex_sinh"),		(uintptr_t)csinh);
-	hashmap_set(maps[3], hashmap_str_lit("complex_cosh"),		(uintptr_t)ccosh);
-	hashmap_set(maps[3], hashmap_str_lit("complex_tanh"),		(uintptr_t)ctanh);
-	hashmap_set(maps[3], hashmap_str_lit("complex_asinh"),	(uintptr_t)casinh);
-	hashmap_set(maps[3], hashmap_str_lit("complex_acosh"),	(uintptr_t)cacosh);
-	hashmap_set(maps[3], hashmap_str_lit("complex_atanh"),	(uintptr_t)catanh);
-	hashmap_set(maps[3], hashmap_str_lit("complex_ln"),		(uintptr_t)clog);
-	hashmap_set(maps[3], hashmap_str_lit("complex_log"),		(uintptr_t)clog);
-	hashmap_set(maps[3], hashmap_str_lit("complex_log2"),		(uintptr_t)custom_clog2);
-	hashmap_set(maps[3], hashmap_str_lit("complex_log10"),	(uintptr_t)custom_clog10);
-	hashmap_set(maps[3], hashmap_str_lit("complex_sqrt"),		(uintptr_t)csqrt);
-	hashmap_set(maps[3], hashmap_str_lit("complex_csqrt"),	(uintptr_t)csqrt);
-
-	hashmap_set(maps[4], hashmap_str_lit("csqrt"),			(uintptr_t)custom_sqrt);
-
-	hashmap_set(maps[5], hashmap_str_lit("complex_conj"),		(uintptr_t)conj);
-	hashmap_set(maps[5], hashmap_str_lit("complex_phase"),	(uintptr_t)carg);
-	hashmap_set(maps[5], hashmap_str_lit("complex_real"),		(uintptr_t)creal);
-	hashmap_set(maps[5], hashmap_str_lit("complex_imag"),		(uintptr_t)cimag);
-
-
-	static constexpr MML_value TRUE_M		= VAL_BOOL(true);
-	static constexpr MML_value FALSE_M		= VAL_BOOL(false);
-	static constexpr MML_value PI_M		= VAL_NUM(3.14159265358979323846);
-	static constexpr MML_value E_M		= VAL_NUM(2.71828182845904523536);
-	static constexpr MML_value PHI_M		= VAL_NUM(1.61803398874989484820);
-	static constexpr MML_value I_M		= VAL_CNUM(I);
-	static constexpr MML_value NAN_M		= VAL_NUM(NAN);
-	static constexpr MML_value INFINITY_M	= VAL_NUM(INFINITY);
-
-	hashmap_set(maps[0], hashmap_str_lit("true"), 	(uintptr_t)&TRUE_M);
-	hashmap_set(maps[0], hashmap_str_lit("false"), 	(uintptr_t)&FALSE_M);
-	hashmap_set(maps[0], hashmap_str_lit("pi"),	(uintptr_t)&PI_M);
-	hashmap_set(maps[0], hashmap_str_lit("e"),	(uintptr_t)&E_M);
-	hashmap_set(maps[0], hashmap_str_lit("phi"),	(uintptr_t)&PHI_M);
-	hashmap_set(maps[0], hashmap_str_lit("i"),	(uintptr_t)&I_M);
-	hashmap_set(maps[0], hashmap_str_lit("nan"),	(uintptr_t)&NAN_M);
-	hashmap_set(maps[0], hashmap_str_lit("inf"),	(uintptr_t)&INFINITY_M);
-}
-
-void math__register_functions(hashmap *maps[6])
-{
-	register_functions(maps);
-}
+static constexpr MML_value TRUE_M		= VAL_BOOL(true);
+static constexpr MML_value FALSE_M		= VAL_BOOL(false);
+static constexpr MML_value PI_M		= VAL_NUM(3.14159265358979323846);
+static constexpr MML_value E_M		= VAL_NUM(2.71828182845904523536);
+static constexpr MML_value PHI_M		= VAL_NUM(1.61803398874989484820);
+static constexpr MML_value I_M		= VAL_CNUM(I);
+static constexpr MML_value NAN_M		= VAL_NUM(NAN);
+static constexpr MML_value INFINITY_M	= VAL_NUM(INFINITY);
+
+const MML_builtin math__builtins[] = {
+#define MML_BUILTIN MML_BUILTIN_ENTRY
+#include "math.def"
+#undef MML_BUILTIN
+};
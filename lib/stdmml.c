@@ -4,12 +4,13 @@
 #include "mml/eval.h"
 #include "mml/expr.h"
 #include "mml/config.h"
+#include "mml/output.h"
 #include "mml/parser.h"
-#include "map.h"
+#include "mml/builtins.h"
 
 static MML_value custom_dbg_type(MML_state *state, MML_expr_vec *args)
 {
-	printf("%s", EXPR_TYPE_STRINGS[MML_eval_expr(state, args->ptr[0]).type]);
+	MML_out_puts(state->config->out, EXPR_TYPE_STRINGS[MML_eval_expr(state, args->ptr[0]).type]);
 	state->config->last_print_was_newline = false;
 
 	return NOTHING_VAL;
@@ -17,9 +18,9 @@ static MML_value custom_dbg_type(MML_state *state, MML_expr_vec *args)
 
 static MML_value custom_dbg_ident(MML_state *state, MML_expr_vec *args)
 {
-	MML_print_exprh(MML_eval_get_variable(state, args->ptr[0]->s));
-
-	return NOTHING_VAL;
+	MML_expr *var = MML_eval_get_variable(state, args->ptr[0]->s);
+	MML_expr_vec var_args = { &var, 1 };
+	return MML_print_exprh_tv_func(state, &var_args);
 }
 
 static MML_value custom_config_set(MML_state *state, MML_expr_vec *args)
@@ -37,13 +38,13 @@ static MML_value custom_config_set(MML_state *state, MML_expr_vec *args)
 	if (strncmp(config_ident.s, "precision", sizeof("precision")-1) == 0)
 	{
 		MML_value val = MML_eval_expr(state, args->ptr[1]);
-		if (val.type != RealNumber_type)
+		if (val.type != RealNumber_type && val.type != Integer_type)
 		{
 			MML_log_err("`config_set`: the `precision` config setting "
 					"must be of type RealNumber\n");
 			return VAL_INVAL;
 		}
-		state->config->precision = (uint32_t)floor(val.n);
+		state->config->precision = (uint32_t)floor(MML_get_number(&val));
 	} else if (strncmp(config_ident.s, "full_prec_floats", sizeof("full_prec_floats")-1) == 0)
 	{
 		MML_value val = MML_eval_expr(state, args->ptr[1]);
@@ -54,6 +55,16 @@ static MML_value custom_config_set(MML_state *state, MML_expr_vec *args)
 			return VAL_INVAL;
 		}
 		state->config->full_prec_floats = val.b;
+	} else if (strncmp(config_ident.s, "round_trip_floats", sizeof("round_trip_floats")-1) == 0)
+	{
+		MML_value val = MML_eval_expr(state, args->ptr[1]);
+		if (val.type != Boolean_type)
+		{
+			MML_log_err("`config_set`: the `round_trip_floats` config setting "
+					"must be of type Boolean\n");
+			return VAL_INVAL;
+		}
+		state->config->round_trip_floats = val.b;
 	} else if (strncmp(config_ident.s, "bools_are_nums", sizeof("bools_are_nums")-1) == 0)
 	{
 		MML_value val = MML_eval_expr(state, args->ptr[1]);
@@ -77,15 +88,8 @@ static MML_value custom_config_set(MML_state *state, MML_expr_vec *args)
 	return NOTHING_VAL;
 }
 
-static void register_functions(hashmap *maps[6])
-{
-	hashmap_set(maps[1], hashmap_str_lit("dbg"),		(uintptr_t)MML_print_exprh_tv_func);
-	hashmap_set(maps[1], hashmap_str_lit("dbg_type"),	(uintptr_t)custom_dbg_type);
-	hashmap_set(maps[1], hashmap_str_lit("dbg_ident"),	(uintptr_t)custom_dbg_ident);
-	hashmap_set(maps[1], hashmap_str_lit("config_set"),	(uintptr_t)custom_config_set);
-}
-
-void stdmml__register_functions(hashmap *maps[6])
-{
-	register_functions(maps);
-}
+const MML_builtin stdmml__builtins[] = {
+#define MML_BUILTIN MML_BUILTIN_ENTRY
+#include "stdmml.def"
+#undef MML_BUILTIN
+};
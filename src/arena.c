@@ -7,6 +7,7 @@
 
 typedef struct ArenaBucket {
 	uint8_t *base;
+	size_t size;
 	struct ArenaBucket *next;
 } ArenaBucket;
 
@@ -27,6 +28,7 @@ Arena *arena_create(size_t bucket_init_size)
 
 	ret->current = calloc(1, sizeof(ArenaBucket));
 	ret->current->base = malloc(ret->bucket_init_size);
+	ret->current->size = ret->bucket_init_size;
 	ret->first = ret->current;
 
 	ret->index = 0;
@@ -66,14 +68,30 @@ void *arena_alloc(Arena *arena, size_t size, size_t align)
 
 	void *ret_ptr = &arena->current->base[arena->index];
 
-	if (arena->index + size > arena->bucket_init_size)
+	if (arena->index + size > arena->current->size)
 	{
-		// current bucket is full; allocate a new one
-		ArenaBucket *new_bucket = calloc(1, sizeof(ArenaBucket));
-
-		new_bucket->base = malloc(MAX(arena->bucket_init_size, size));
-
-		arena->current = arena->current->next = new_bucket;
+		// current bucket is full; reuse the next one if a reset left one
+		// behind that's big enough, otherwise allocate a new one after it
+		ArenaBucket *next = arena->current->next;
+		if (next == NULL || next->size < size)
+		{
+			ArenaBucket *new_bucket = calloc(1, sizeof(ArenaBucket));
+			if (new_bucket == NULL)
+				return NULL;
+
+			new_bucket->size = MAX(arena->bucket_init_size, size);
+			new_bucket->base = malloc(new_bucket->size);
+			if (new_bucket->base == NULL)
+			{
+				// the current bucket stays current
+				free(new_bucket);
+				return NULL;
+			}
+			new_bucket->next = next;
+
+			next = arena->current->next = new_bucket;
+		}
+		arena->current = next;
 
 		arena->index = size;
 		return arena->current->base;
@@ -83,3 +101,14 @@ void *arena_alloc(Arena *arena, size_t size, size_t align)
 	return ret_ptr;
 }
 
+
+ArenaMark arena_mark(Arena *arena)
+{
+	return (ArenaMark) { arena->current, arena->index };
+}
+
+void arena_reset(Arena *arena, ArenaMark mark)
+{
+	arena->current = mark.bucket;
+	arena->index = mark.index;
+}
@@ -0,0 +1,323 @@
+#define _DEFAULT_SOURCE
+
+#include "mml/batch.h"
+
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "arena/arena.h"
+#include "mml/config.h"
+#include "mml/eval.h"
+#include "mml/expr.h"
+#include "mml/output.h"
+#include "mml/parser.h"
+#include "mml/timing.h"
+#include "dvec/dvec.h"
+#include "map.h"
+
+// lines per block; big enough that handing out blocks is cheap compared to
+// evaluating them
+#define BLOCK_LINES 256
+// blocks read ahead of the one being written, per worker
+#define BLOCKS_PER_WORKER 4
+
+typedef struct {
+	char *lines[BLOCK_LINES];
+	size_t n_lines;
+
+	// what evaluating the lines wrote, and whether any of them failed
+	char *out;
+	size_t out_len;
+	char *err;
+	size_t err_len;
+	bool failed;
+	bool done;
+} batch_block;
+
+typedef struct {
+	pthread_mutex_t lock;
+	pthread_cond_t work_ready;
+	pthread_cond_t block_done;
+
+	batch_block *ring;
+	size_t ring_size;
+	// blocks read, handed to a worker and written so far
+	size_t n_read;
+	size_t n_taken;
+	bool at_eof;
+
+	const char *prelude;
+} batch;
+
+typedef struct {
+	pthread_t thread;
+	batch *b;
+	uint32_t index;
+	struct MML_config config;
+	MML_outbuf out;
+	MML_timing timing; // with --dbg-time, merged into the main thread's
+	// the prelude's variables, put back after a line that defines anything
+	hashmap *prelude_vars;
+} batch_worker;
+
+static int copy_variable(const void *key, size_t ksize, uintptr_t value, void *usr)
+{
+	hashmap_set(usr, key, ksize, value);
+	return 0;
+}
+
+static hashmap *copy_variables(hashmap *vars)
+{
+	hashmap *copy = hashmap_create();
+	if (vars != nullptr)
+		hashmap_iterate(vars, copy_variable, copy);
+	return copy;
+}
+
+// Evaluates LINE in SHARED, or in a state of its own if SHARED is NULL.
+// Either way, any `config_set` only lasts for the line.
+static bool eval_line(batch_worker *w, MML_state *shared, const char *line)
+{
+	const ArenaMark mark = arena_mark(MML_global_arena);
+	struct MML_config config = w->config;
+	MML_state *state = (shared != NULL) ? shared : MML_init_state();
+	state->config = &config;
+
+	uint32_t n_errors = 0;
+	MML_expr_dvec stmts = MML_parse_stmts_checked(line, &n_errors);
+
+	// a function from the prelude can define variables as well, so whether
+	// a line does can only be told once it has run
+	const uint64_t n_definitions = state->n_definitions;
+	MML_value val = NOTHING_VAL;
+	MML_expr **cur;
+	dv_foreach(stmts, cur)
+	{
+		val = MML_eval_stmt(state, *cur);
+		if (shared != NULL && state->n_definitions != n_definitions)
+			break;
+	}
+	dv_destroy(stmts);
+
+	if (shared == NULL || state->n_definitions == n_definitions)
+	{
+		if (val.type != Nothing_type)
+			MML_println_typedval(state, &val);
+	}
+	// printing a vector evaluates its elements, which can call functions too
+	if (shared != NULL && state->n_definitions != n_definitions)
+	{
+		MML_log_err("lines can't define anything when there's a prelude\n");
+		hashmap_free(state->variables);
+		state->variables = copy_variables(w->prelude_vars);
+		state->n_definitions = n_definitions;
+		val = VAL_INVAL;
+	}
+
+	if (shared == NULL)
+		MML_cleanup_state(state);
+	else
+	{
+		// the arguments of the last call, and the value `ans` refers to, are
+		// about to be freed; the next line starts from nothing, like it would
+		// in a state of its own
+		if (state->locals != nullptr)
+			hashmap_free(state->locals);
+		state->locals = nullptr;
+		state->last_val = NOTHING_VAL;
+		state->config = &w->config;
+	}
+	arena_reset(MML_global_arena, mark);
+
+	return n_errors == 0 && val.type != Invalid_type;
+}
+
+static void eval_block(batch_worker *w, MML_state *shared, batch_block *block)
+{
+	FILE *out = open_memstream(&block->out, &block->out_len);
+	FILE *err = open_memstream(&block->err, &block->err_len);
+	w->out.stream = out;
+	w->out.len = 0;
+	MML_log_stream = err;
+
+	block->failed = false;
+	for (size_t i = 0; i < block->n_lines; ++i)
+		if (!eval_line(w, shared, block->lines[i]))
+			block->failed = true;
+
+	MML_out_flush(&w->out);
+	w->out.stream = NULL;
+	MML_log_stream = NULL;
+	fclose(out);
+	fclose(err);
+}
+
+// the prelude's output is thrown away, and its errors are only reported once
+static MML_state *load_prelude(batch_worker *w)
+{
+	FILE *null_stream = fopen("/dev/null", "w");
+	w->out.stream = null_stream;
+	if (w->index > 0)
+		MML_log_stream = null_stream;
+
+	MML_state *state = MML_init_state();
+	state->config = &w->config;
+	MML_eval_file(state, w->b->prelude);
+	MML_out_flush(&w->out);
+	w->prelude_vars = copy_variables(state->variables);
+
+	w->out.stream = NULL;
+	MML_log_stream = NULL;
+	fclose(null_stream);
+	return state;
+}
+
+static void *worker_main(void *arg)
+{
+	batch_worker *w = arg;
+	batch *b = w->b;
+
+	if (CFLAG_IS_SET(&w->config, DBG_TIME))
+		MML_timing_start();
+
+	// keeps this thread's arena alive between lines
+	MML_state *anchor = MML_init_state();
+	anchor->config = &w->config;
+	MML_state *shared = (b->prelude != NULL) ? load_prelude(w) : NULL;
+
+	for (;;)
+	{
+		pthread_mutex_lock(&b->lock);
+		while (b->n_taken == b->n_read && !b->at_eof)
+			pthread_cond_wait(&b->work_ready, &b->lock);
+		if (b->n_taken == b->n_read)
+		{
+			pthread_mutex_unlock(&b->lock);
+			break;
+		}
+		batch_block *block = &b->ring[b->n_taken++ % b->ring_size];
+		pthread_mutex_unlock(&b->lock);
+
+		eval_block(w, shared, block);
+
+		pthread_mutex_lock(&b->lock);
+		block->done = true;
+		pthread_cond_broadcast(&b->block_done);
+		pthread_mutex_unlock(&b->lock);
+	}
+
+	if (shared != NULL)
+	{
+		MML_cleanup_state(shared);
+		hashmap_free(w->prelude_vars);
+	}
+	MML_cleanup_state(anchor);
+	MML_timing_stop(&w->timing);
+	return NULL;
+}
+
+// reads up to BLOCK_LINES lines into BLOCK; returns false at EOF
+static bool read_block(FILE *in, batch_block *block)
+{
+	*block = (batch_block) { .n_lines = 0 };
+	char *line = NULL;
+	size_t cap = 0;
+	ssize_t len;
+	while (block->n_lines < BLOCK_LINES && (len = getline(&line, &cap, in)) >= 0)
+	{
+		if (len > 0 && line[len-1] == '\n')
+			line[len-1] = '\0';
+		block->lines[block->n_lines++] = line;
+		line = NULL;
+		cap = 0;
+	}
+	free(line);
+	return block->n_lines > 0;
+}
+
+static void free_block(batch_block *block)
+{
+	for (size_t i = 0; i < block->n_lines; ++i)
+		free(block->lines[i]);
+	free(block->out);
+	free(block->err);
+}
+
+int32_t MML_eval_batch(FILE *in, FILE *out, FILE *err, const char *prelude, uint32_t n_workers)
+{
+	if (n_workers == 0)
+	{
+		const long n_cpus = sysconf(_SC_NPROCESSORS_ONLN);
+		n_workers = (n_cpus > 0) ? (uint32_t)n_cpus : 1;
+	}
+
+	batch b = {
+		.lock = PTHREAD_MUTEX_INITIALIZER,
+		.work_ready = PTHREAD_COND_INITIALIZER,
+		.block_done = PTHREAD_COND_INITIALIZER,
+		.ring_size = (size_t)n_workers * BLOCKS_PER_WORKER,
+		.prelude = prelude,
+	};
+	b.ring = calloc(b.ring_size, sizeof(batch_block));
+
+	batch_worker *workers = calloc(n_workers, sizeof(batch_worker));
+	for (uint32_t i = 0; i < n_workers; ++i)
+	{
+		batch_worker *w = &workers[i];
+		w->b = &b;
+		w->index = i;
+		w->config = MML_global_config;
+		w->config.eval_state = nullptr;
+		w->config.out = &w->out;
+		w->out.is_tty = 0;
+		pthread_create(&w->thread, NULL, worker_main, w);
+	}
+
+	bool failed = false;
+	size_t n_written = 0;
+	for (;;)
+	{
+		// the slots past the last block read aren't touched by the workers
+		while (!b.at_eof && b.n_read - n_written < b.ring_size)
+		{
+			const bool got_block = read_block(in, &b.ring[b.n_read % b.ring_size]);
+			pthread_mutex_lock(&b.lock);
+			if (got_block)
+				++b.n_read;
+			else
+				b.at_eof = true;
+			pthread_cond_broadcast(&b.work_ready);
+			pthread_mutex_unlock(&b.lock);
+		}
+		if (n_written == b.n_read)
+			break;
+
+		batch_block *block = &b.ring[n_written % b.ring_size];
+		pthread_mutex_lock(&b.lock);
+		while (!block->done)
+			pthread_cond_wait(&b.block_done, &b.lock);
+		pthread_mutex_unlock(&b.lock);
+
+		fwrite(block->out, 1, block->out_len, out);
+		fwrite(block->err, 1, block->err_len, err);
+		failed = failed || block->failed;
+		free_block(block);
+		++n_written;
+	}
+	fflush(out);
+
+	for (uint32_t i = 0; i < n_workers; ++i)
+	{
+		pthread_join(workers[i].thread, NULL);
+		if (MML_timing_on)
+			MML_timing_merge(&workers[i].timing);
+	}
+	free(workers);
+	free(b.ring);
+
+	return failed ? 1 : 0;
+}
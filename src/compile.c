@@ -0,0 +1,624 @@
+#include "mml/compile.h"
+
+#include <complex.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "mml/config.h"
+#include "mml/eval.h"
+#include "mml/expr.h"
+#include "mml/parser.h"
+#include "mml/timing.h"
+#include "arena/arena.h"
+#include "dvec/dvec.h"
+#include "map.h"
+
+/*
+ * File layout (all integers little-endian):
+ *
+ *   header   "MMLC", u16 version, u16 flags, u32 n_nodes, u32 n_refs,
+ *            u32 n_stmts, u32 strings_size, 8 reserved bytes
+ *   nodes    n_nodes records of NODE_SIZE bytes: u8 kind, u8 op, 2 reserved
+ *            bytes, u32 a, u64 b, u64 c
+ *   refs     n_refs u32 node indices (NO_NODE for NULL); the statements are
+ *            the last n_stmts of them
+ *   strings  strings_size bytes of identifier and string text
+ *
+ * What a, b and c hold depends on the kind: child indices for operations,
+ * (first ref, count) for vectors, (offset, length) for text, and the raw
+ * bits of the value for literals. Token types are stored as they are, so
+ * MML_COMPILED_VERSION has to change along with MML_token_type.
+ */
+
+#define HEADER_SIZE 32
+#define NODE_SIZE 24
+#define NO_NODE UINT32_MAX
+
+#define FLAG_OPTIMIZED 1
+
+typedef enum {
+	NODE_OPERATION = 1,
+	NODE_IDENTIFIER,
+	NODE_STRING,
+	NODE_REAL,
+	NODE_COMPLEX,
+	NODE_BOOLEAN,
+	NODE_INTEGER,
+	NODE_VECTOR,
+	NODE_NOTHING,
+} node_kind;
+
+static void put_u16(uint8_t *p, uint16_t x)
+{
+	p[0] = (uint8_t)x;
+	p[1] = (uint8_t)(x >> 8);
+}
+
+static void put_u32(uint8_t *p, uint32_t x)
+{
+	for (int i = 0; i < 4; ++i)
+		p[i] = (uint8_t)(x >> 8*i);
+}
+
+static void put_u64(uint8_t *p, uint64_t x)
+{
+	for (int i = 0; i < 8; ++i)
+		p[i] = (uint8_t)(x >> 8*i);
+}
+
+static uint16_t get_u16(const uint8_t *p)
+{
+	return (uint16_t)(p[0] | p[1] << 8);
+}
+
+static uint32_t get_u32(const uint8_t *p)
+{
+	uint32_t x = 0;
+	for (int i = 0; i < 4; ++i)
+		x |= (uint32_t)p[i] << 8*i;
+	return x;
+}
+
+static uint64_t get_u64(const uint8_t *p)
+{
+	uint64_t x = 0;
+	for (int i = 0; i < 8; ++i)
+		x |= (uint64_t)p[i] << 8*i;
+	return x;
+}
+
+static uint64_t double_bits(double d)
+{
+	uint64_t bits;
+	memcpy(&bits, &d, sizeof(bits));
+	return bits;
+}
+
+static double bits_double(uint64_t bits)
+{
+	double d;
+	memcpy(&d, &bits, sizeof(d));
+	return d;
+}
+
+bool MML_is_compiled(strbuf file)
+{
+	return file.s != NULL && file.len >= HEADER_SIZE
+		&& memcmp(file.s, MML_COMPILED_MAGIC, 4) == 0;
+}
+
+/*
+ * Tree walking. The parser accepts arbitrarily deep nesting, so neither
+ * folding nor writing can recurse.
+ */
+
+typedef struct {
+	MML_expr *expr;
+	bool expanded;
+} walk_item;
+
+typedef void (*walk_visitor)(MML_expr *expr, void *ctx);
+
+// Calls VISIT on every node of STMTS (NULL children included), children
+// before their parents and siblings left to right. Returns false if it ran
+// out of memory.
+static bool walk_post_order(MML_expr_vec stmts, walk_visitor visit, void *ctx)
+{
+	walk_item *stack = NULL;
+	size_t n = 0, cap = 0;
+
+	for (size_t i = stmts.n; i-- > 0;)
+	{
+		if (n == cap)
+		{
+			cap = (cap != 0) ? 2*cap : 256;
+			walk_item *tmp = realloc(stack, cap * sizeof(walk_item));
+			if (tmp == NULL) { free(stack); return false; }
+			stack = tmp;
+		}
+		stack[n++] = (walk_item) { stmts.ptr[i], false };
+	}
+
+	while (n > 0)
+	{
+		const walk_item cur = stack[--n];
+		if (cur.expr == NULL || cur.expanded)
+		{
+			visit(cur.expr, ctx);
+			continue;
+		}
+
+		MML_expr *children[2];
+		MML_expr **child_ptr = children;
+		size_t n_children = 0;
+		if (cur.expr->type == Operation_type)
+		{
+			children[0] = cur.expr->o.left;
+			children[1] = cur.expr->o.right;
+			n_children = 2;
+		} else if (cur.expr->type == Vector_type)
+		{
+			child_ptr = cur.expr->v.ptr;
+			n_children = cur.expr->v.n;
+		}
+
+		if (n + 1 + n_children > cap)
+		{
+			while (n + 1 + n_children > cap)
+				cap = (cap != 0) ? 2*cap : 256;
+			walk_item *tmp = realloc(stack, cap * sizeof(walk_item));
+			if (tmp == NULL) { free(stack); return false; }
+			stack = tmp;
+		}
+
+		stack[n++] = (walk_item) { cur.expr, true };
+		for (size_t i = n_children; i-- > 0;)
+			stack[n++] = (walk_item) { child_ptr[i], false };
+	}
+
+	free(stack);
+	return true;
+}
+
+/*
+ * Constant folding
+ */
+
+static bool is_num_literal(const MML_expr *e)
+{
+	return e != NULL && (e->type == RealNumber_type
+		|| e->type == Integer_type
+		|| e->type == ComplexNumber_type
+		|| e->type == Boolean_type);
+}
+
+// whether OP on operands of these kinds is a plain numeric operation the
+// evaluator defines, so folding it can't print a warning at compile time
+static bool op_is_foldable(MML_token_type op, bool unary, bool any_complex)
+{
+	if (unary)
+		return op == MML_OP_NEGATE || op == MML_OP_UNARY_NOTHING
+			|| op == MML_PIPE_TOK || op == MML_OP_ROOT
+			|| (op == MML_OP_NOT_TOK && !any_complex);
+
+	if (!any_complex)
+		return op >= MML_OP_POW_TOK && op <= MML_OP_EXACT_NOTEQ;
+
+	switch (op) {
+	case MML_OP_POW_TOK: case MML_OP_ROOT:
+	case MML_OP_MUL_TOK: case MML_OP_DIV_TOK:
+	case MML_OP_ADD_TOK: case MML_OP_SUB_TOK:
+	case MML_OP_EQ_TOK: case MML_OP_NOTEQ_TOK:
+	case MML_OP_EXACT_EQ: case MML_OP_EXACT_NOTEQ:
+		return true;
+	default:
+		return false;
+	}
+}
+
+static void fold_visit(MML_expr *e, void *ctx)
+{
+	MML_state *state = ctx;
+	if (e == NULL || e->type != Operation_type || !is_num_literal(e->o.left))
+		return;
+
+	const bool unary = e->o.right == NULL;
+	if (!unary && !is_num_literal(e->o.right))
+		return;
+
+	const bool any_complex = e->o.left->type == ComplexNumber_type
+		|| (!unary && e->o.right->type == ComplexNumber_type);
+	if (!op_is_foldable(e->op, unary, any_complex))
+		return;
+
+	const MML_value val = MML_apply_binary_op(state,
+			MML_eval_expr_recurse(state, e->o.left),
+			unary ? VAL_INVAL : MML_eval_expr_recurse(state, e->o.right),
+			e->op);
+	if (!VAL_IS_NUM(val))
+		return;
+
+	e->type = val.type;
+	e->w = val.w;
+}
+
+void MML_fold_constants(MML_state *state, MML_expr_vec stmts)
+{
+	MML_phase_begin(MML_PHASE_OPTIMIZE);
+	if (!walk_post_order(stmts, fold_visit, state))
+		MML_log_warn("ran out of memory while folding constants; some were left as is\n");
+	MML_phase_end(MML_PHASE_OPTIMIZE);
+}
+
+/*
+ * Writing
+ */
+
+typedef struct {
+	uint8_t *ptr;
+	size_t n;
+	size_t cap;
+} bytebuf;
+
+typedef struct {
+	bytebuf nodes;
+	bytebuf refs;
+	bytebuf strings;
+	hashmap *string_offsets; // identical text is only stored once
+
+	// indices of the nodes written for subtrees whose parent hasn't been
+	// written yet, like the operand stack of an RPN calculator
+	uint32_t *results;
+	size_t n_results, results_cap;
+
+	uint32_t n_nodes;
+	bool failed;
+} writer;
+
+static uint8_t *buf_reserve(writer *w, bytebuf *buf, size_t n)
+{
+	if (buf->n + n > buf->cap)
+	{
+		size_t cap = (buf->cap != 0) ? buf->cap : 4096;
+		while (buf->n + n > cap)
+			cap *= 2;
+		uint8_t *tmp = realloc(buf->ptr, cap);
+		if (tmp == NULL)
+		{
+			w->failed = true;
+			return NULL;
+		}
+		buf->ptr = tmp;
+		buf->cap = cap;
+	}
+	uint8_t *ret = buf->ptr + buf->n;
+	buf->n += n;
+	return ret;
+}
+
+static void push_result(writer *w, uint32_t idx)
+{
+	if (w->n_results == w->results_cap)
+	{
+		const size_t cap = (w->results_cap != 0) ? 2*w->results_cap : 256;
+		uint32_t *tmp = realloc(w->results, cap * sizeof(uint32_t));
+		if (tmp == NULL)
+		{
+			w->failed = true;
+			return;
+		}
+		w->results = tmp;
+		w->results_cap = cap;
+	}
+	w->results[w->n_results++] = idx;
+}
+
+static uint32_t pop_result(writer *w)
+{
+	return (w->n_results > 0) ? w->results[--w->n_results] : NO_NODE;
+}
+
+static uint32_t add_string(writer *w, strbuf s)
+{
+	uintptr_t off;
+	if (hashmap_get(w->string_offsets, s.s, s.len, &off))
+		return (uint32_t)off;
+
+	if (w->strings.n + s.len > UINT32_MAX)
+	{
+		w->failed = true;
+		return 0;
+	}
+	off = w->strings.n;
+	uint8_t *dst = buf_reserve(w, &w->strings, s.len);
+	if (dst == NULL)
+		return 0;
+	memcpy(dst, s.s, s.len);
+	hashmap_set(w->string_offsets, s.s, s.len, off);
+	return (uint32_t)off;
+}
+
+static void add_ref(writer *w, uint32_t idx)
+{
+	uint8_t *p = buf_reserve(w, &w->refs, 4);
+	if (p != NULL)
+		put_u32(p, idx);
+}
+
+static void write_visit(MML_expr *e, void *ctx)
+{
+	writer *w = ctx;
+	if (e == NULL)
+	{
+		push_result(w, NO_NODE);
+		return;
+	}
+
+	uint8_t kind = 0, op = 0;
+	uint32_t a = 0;
+	uint64_t b = 0, c = 0;
+
+	switch (e->type) {
+	case Operation_type:
+		kind = NODE_OPERATION;
+		op = (uint8_t)e->op;
+		b = pop_result(w); // the right operand was pushed last
+		a = pop_result(w);
+		break;
+	case Vector_type:
+		if (w->n_results < e->v.n)
+		{
+			w->failed = true;
+			return;
+		}
+		kind = NODE_VECTOR;
+		a = (uint32_t)(w->refs.n / 4);
+		b = e->v.n;
+		for (size_t i = w->n_results - e->v.n; i < w->n_results; ++i)
+			add_ref(w, w->results[i]);
+		w->n_results -= e->v.n;
+		break;
+	case Identifier_type:
+	case String_type:
+		kind = (e->type == Identifier_type) ? NODE_IDENTIFIER : NODE_STRING;
+		a = add_string(w, e->s);
+		b = e->s.len;
+		break;
+	case RealNumber_type:
+		kind = NODE_REAL;
+		b = double_bits(e->n);
+		break;
+	case ComplexNumber_type:
+		kind = NODE_COMPLEX;
+		b = double_bits(creal(e->cn));
+		c = double_bits(cimag(e->cn));
+		break;
+	case Boolean_type:
+		kind = NODE_BOOLEAN;
+		b = e->b;
+		break;
+	case Integer_type:
+		kind = NODE_INTEGER;
+		b = (uint64_t)e->i;
+		break;
+	case Nothing_type:
+		kind = NODE_NOTHING;
+		break;
+	default:
+		MML_log_err("can't compile a %s node\n", EXPR_TYPE_STRINGS[e->type]);
+		w->failed = true;
+		push_result(w, NO_NODE);
+		return;
+	}
+
+	uint8_t *p = buf_reserve(w, &w->nodes, NODE_SIZE);
+	if (p == NULL || w->n_nodes == NO_NODE)
+	{
+		w->failed = true;
+		push_result(w, NO_NODE);
+		return;
+	}
+	p[0] = kind;
+	p[1] = op;
+	put_u16(p + 2, 0);
+	put_u32(p + 4, a);
+	put_u64(p + 8, b);
+	put_u64(p + 16, c);
+
+	push_result(w, w->n_nodes++);
+}
+
+int32_t MML_write_compiled(MML_expr_vec stmts, bool optimized, const char *path)
+{
+	writer w = { .string_offsets = hashmap_create() };
+
+	if (!walk_post_order(stmts, write_visit, &w))
+		w.failed = true;
+
+	// the statements go at the end of the ref table
+	for (size_t i = 0; i < w.n_results; ++i)
+		add_ref(&w, w.results[i]);
+
+	int32_t ret = -1;
+	if (w.failed || w.refs.n / 4 > UINT32_MAX)
+	{
+		MML_log_err("failed to compile the script\n");
+		goto cleanup;
+	}
+
+	uint8_t header[HEADER_SIZE] = {0};
+	memcpy(header, MML_COMPILED_MAGIC, 4);
+	put_u16(header + 4, MML_COMPILED_VERSION);
+	put_u16(header + 6, optimized ? FLAG_OPTIMIZED : 0);
+	put_u32(header + 8, w.n_nodes);
+	put_u32(header + 12, (uint32_t)(w.refs.n / 4));
+	put_u32(header + 16, (uint32_t)w.n_results);
+	put_u32(header + 20, (uint32_t)w.strings.n);
+
+	FILE *out = fopen(path, "wb");
+	if (out == NULL)
+	{
+		MML_log_err("failed to open '%s' for writing\n", path);
+		goto cleanup;
+	}
+	const bool ok = fwrite(header, 1, HEADER_SIZE, out) == HEADER_SIZE
+		&& fwrite(w.nodes.ptr, 1, w.nodes.n, out) == w.nodes.n
+		&& fwrite(w.refs.ptr, 1, w.refs.n, out) == w.refs.n
+		&& fwrite(w.strings.ptr, 1, w.strings.n, out) == w.strings.n;
+	if (fclose(out) != 0 || !ok)
+		MML_log_err("failed to write '%s'\n", path);
+	else
+		ret = 0;
+
+cleanup:
+	hashmap_free(w.string_offsets);
+	free(w.nodes.ptr);
+	free(w.refs.ptr);
+	free(w.strings.ptr);
+	free(w.results);
+	return ret;
+}
+
+/*
+ * Loading
+ */
+
+static bool load_compiled(strbuf file, MML_expr_dvec *stmts)
+{
+	if (!MML_is_compiled(file))
+	{
+		MML_log_err("not a compiled MML script\n");
+		return false;
+	}
+
+	const uint8_t *const base = (const uint8_t *)file.s;
+	const uint16_t version = get_u16(base + 4);
+	if (version != MML_COMPILED_VERSION)
+	{
+		MML_log_err("compiled script has version %u, expected %u; recompile it\n",
+				version, MML_COMPILED_VERSION);
+		return false;
+	}
+
+	const uint32_t n_nodes = get_u32(base + 8);
+	const uint32_t n_refs = get_u32(base + 12);
+	const uint32_t n_stmts = get_u32(base + 16);
+	const uint32_t strings_size = get_u32(base + 20);
+
+	const uint64_t expected_len = HEADER_SIZE + (uint64_t)n_nodes * NODE_SIZE
+		+ (uint64_t)n_refs * 4 + strings_size;
+	if (file.len != expected_len || n_stmts > n_refs)
+	{
+		MML_log_err("compiled script is truncated or corrupt\n");
+		return false;
+	}
+
+	const uint8_t *const node_recs = base + HEADER_SIZE;
+	const uint8_t *const ref_recs = node_recs + (size_t)n_nodes * NODE_SIZE;
+	char *const strings = (char *)(ref_recs + (size_t)n_refs * 4);
+
+	MML_expr *nodes = arena_alloc_T(MML_global_arena, n_nodes, MML_expr);
+	MML_expr **refs = arena_alloc_T(MML_global_arena, n_refs, MML_expr *);
+	uint32_t *ref_idx = malloc((n_refs != 0 ? n_refs : 1) * sizeof(uint32_t));
+	if (ref_idx == NULL)
+	{
+		MML_log_err("failed to allocate memory for loading a compiled script\n");
+		return false;
+	}
+
+	bool ok = true;
+	for (uint32_t i = 0; i < n_refs && ok; ++i)
+	{
+		ref_idx[i] = get_u32(ref_recs + 4*(size_t)i);
+		ok = ref_idx[i] == NO_NODE || ref_idx[i] < n_nodes;
+		if (ok)
+			refs[i] = (ref_idx[i] != NO_NODE) ? &nodes[ref_idx[i]] : NULL;
+	}
+
+	// children always come before their parents, which also rules out
+	// cycles; indices are checked before any pointer is made from them
+	for (uint32_t i = 0; i < n_nodes && ok; ++i)
+	{
+		const uint8_t *p = node_recs + (size_t)i * NODE_SIZE;
+		const uint32_t a = get_u32(p + 4);
+		const uint64_t b = get_u64(p + 8);
+		const uint64_t c = get_u64(p + 16);
+		MML_expr *e = &nodes[i];
+
+		switch ((node_kind)p[0]) {
+		case NODE_OPERATION:
+			ok = (a == NO_NODE || a < i) && (b == NO_NODE || b < i)
+				&& (p[1] < MML_NOT_OP_TOK || p[1] == MML_PIPE_TOK);
+			if (!ok)
+				break;
+			e->type = Operation_type;
+			e->op = (MML_token_type)p[1];
+			e->kind = MML_KIND_UNINFERRED;
+			e->o.left = (a != NO_NODE) ? &nodes[a] : NULL;
+			e->o.right = (b != NO_NODE) ? &nodes[b] : NULL;
+			break;
+		case NODE_VECTOR:
+			ok = a <= n_refs && b <= n_refs - a;
+			for (uint64_t j = a; ok && j < a + b; ++j)
+				ok = ref_idx[j] == NO_NODE || ref_idx[j] < i;
+			if (!ok)
+				break;
+			e->type = Vector_type;
+			e->v = (MML_expr_vec) { &refs[a], (size_t)b };
+			break;
+		case NODE_IDENTIFIER:
+		case NODE_STRING:
+			ok = a <= strings_size && b <= strings_size - a;
+			if (!ok)
+				break;
+			e->type = (p[0] == NODE_IDENTIFIER) ? Identifier_type : String_type;
+			e->s = (strbuf) { strings + a, (size_t)b };
+			break;
+		case NODE_REAL:
+			*e = EXPR_NUM(bits_double(b));
+			break;
+		case NODE_COMPLEX:
+			e->type = ComplexNumber_type;
+			e->cn = CMPLX(bits_double(b), bits_double(c));
+			break;
+		case NODE_BOOLEAN:
+			e->type = Boolean_type;
+			e->b = b != 0;
+			break;
+		case NODE_INTEGER:
+			e->type = Integer_type;
+			e->i = (int64_t)b;
+			break;
+		case NODE_NOTHING:
+			*e = NOTHING_EXPR;
+			break;
+		default:
+			ok = false;
+			break;
+		}
+	}
+
+	if (ok)
+	{
+		MML_expr_dvec ret = DVEC_INIT;
+		for (uint32_t i = n_refs - n_stmts; i < n_refs; ++i)
+			dv_push(ret, refs[i]);
+		*stmts = ret;
+	} else
+	{
+		MML_log_err("compiled script is corrupt\n");
+	}
+
+	free(ref_idx);
+	return ok;
+}
+
+bool MML_load_compiled(strbuf file, MML_expr_dvec *stmts)
+{
+	MML_phase_begin(MML_PHASE_PARSE);
+	const bool ok = load_compiled(file, stmts);
+	MML_phase_end(MML_PHASE_PARSE);
+	return ok;
+}
@@ -1,6 +1,11 @@
+#define _DEFAULT_SOURCE
+
 #include "mml/config.h"
 
+#include <fcntl.h>
 #include <stdarg.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 #include <termios.h>
 #include <unistd.h>
 #include <stdio.h>
@@ -18,11 +23,25 @@ struct MML_config MML_global_config = {
 	.precision = 10,
 	.runtime_flags = 0,
 	.eval_state = nullptr,
+	.out = &MML_stdout_buf,
 	.last_print_was_newline = true,
 	.full_prec_floats = false,
+	.round_trip_floats = false,
+	.parse_cache_size = 0,
 };
 
 strbuf expression = { NULL, 0 };
+char *script_path = NULL;
+char *data_path = NULL;
+char *compile_out_path = NULL;
+char *serve_path = NULL;
+char *client_path = NULL;
+char *session_name = NULL;
+char *trace_path = NULL;
+char *record_path = NULL;
+uint32_t worker_count = 0;
+
+thread_local FILE *MML_log_stream = NULL;
 
 void MML_print_usage(void)
 {
@@ -32,15 +51,42 @@ void MML_print_usage(void)
                     "  -d, --debug                        Enable debug output\n"
                     "  -P, --print                        Print the result value even if `print` was not called (default OFF)\n"
 			  "  -E EXPR, --expr=EXPR               Alternate way to specify the expression to be evaluated\n"
+			  "  --file=PATH                        Evaluate the script in the file at PATH\n"
+			  "  --data=PATH                        Evaluate the expression once per row of the CSV file at PATH ('-' for stdin),\n"
+			  "                                     with each column bound to the variable named in the header row\n"
                     "  -p PREC, --precision=PREC          Set the number of decimal digits to be printed when printing numbers (default 6)\n"
 			  "  --full-prec-floats                 Decimal numbers are represented with the full precision specified by --precision ('%%f' format) (default OFF, uses '%%g').\n"
+			  "  --round-trip-floats                Decimal numbers are printed with the fewest digits that read back as the same number (default OFF)\n"
 			  "  --no-eval                          Only parse the expression; don't evaluate it (default OFF)\n"
+			  "  --compile [SCRIPT]                 Parse SCRIPT (or the --file script) and write it to a compiled .mmlc file\n"
+			  "                                     instead of evaluating it; pass the .mmlc file to --file to run it\n"
+			  "  -o PATH, --output=PATH             Where --compile writes to (default: the script's path with an .mmlc extension)\n"
+			  "  --optimize                         Fold operations on constant numbers before compiling or evaluating\n"
+			  "  --parse-cache=N                    Remember the parsed form of up to N distinct inputs, so repeated REPL lines\n"
+			  "                                     are only parsed once (default 0, OFF)\n"
                     "  --bools-are-nums                   Write the number 1 or 0 to represent boolean values (default OFF)\n"
-			  "  --dbg-time                         Debug option: the parser will print the time it took to parse and evaluate each line\n"
+			  "  --dbg-time                         Print how long lexing, parsing, optimizing, evaluating and printing took (and\n"
+			  "                                     their cycles, instructions and cache misses, where the OS allows) to stderr\n"
+			  "                                     at exit, or after each line in the prompt (not with --serve)\n"
+			  "  --profile                          Time every statement, user function, builtin and variable read, and print\n"
+			  "                                     the ones that took longest to stderr at exit (not with --batch or --serve)\n"
+			  "  --trace=PATH                       Write a timeline of parsing, statements, function and builtin calls and large\n"
+			  "                                     vector operations to PATH, for chrome://tracing or Perfetto (not with --serve)\n"
+			  "  --record=PATH                      Record the source of each prompt line, --stream statement or -E/--file\n"
+			  "                                     expression, and how long it took, to PATH, to replay with build/replay\n"
 			  "  -I, --interactive                  Start an interactive prompt (similar to the Python IDLE)\n"
 			  "  -h, --help                         Display this help message\n"
 			  "  -V, --version                      Display program information\n"
 			  "  -                                  Read expression string from stdin\n"
+			  "  --stream                           Read statements from stdin and evaluate each one as soon as its ';' is read\n"
+			  "  --batch                            Evaluate each line of stdin as an independent expression, in parallel, and print\n"
+			  "                                     the results in input order; lines may use (but not change) the --file script's definitions\n"
+			  "  --serve=SOCKET                     Run as a daemon evaluating requests sent to the Unix socket SOCKET\n"
+			  "  --workers=N                        The number of threads --batch and --serve evaluate on (default: the number of CPUs)\n"
+			  "  --client=SOCKET                    Send the expression (or the --file script, or stdin) to the daemon at SOCKET\n"
+			  "                                     and print its output, instead of evaluating it here\n"
+			  "  --session=NAME                     Evaluate --client requests in the daemon's session NAME, whose variables\n"
+			  "                                     are kept between requests (default: a fresh state for every request)\n"
 			, MML_global_config.PROG_NAME);
 	MML_cleanup_state(MML_global_config.eval_state);
 	exit(1);
@@ -81,16 +127,48 @@ void MML_arg_parse(int32_t argc, char **argv)
 				MML_global_config.precision = strtoul(argv[arg_n]+2+10, NULL, 10);
 			else if (strncmp(argv[arg_n]+2, "expr=", 5) == 0)
 				expression.s = argv[arg_n]+2+5;
+			else if (strncmp(argv[arg_n]+2, "file=", 5) == 0)
+				script_path = argv[arg_n]+2+5;
+			else if (strncmp(argv[arg_n]+2, "data=", 5) == 0)
+				data_path = argv[arg_n]+2+5;
 			else if (strcmp(argv[arg_n]+2, "bools-are-nums") == 0)
 				SET_FLAG(BOOLS_PRINT_NUM);
 			else if (strcmp(argv[arg_n]+2, "dbg-time") == 0)
 				SET_FLAG(DBG_TIME);
+			else if (strcmp(argv[arg_n]+2, "profile") == 0)
+				SET_FLAG(PROFILE);
+			else if (strncmp(argv[arg_n]+2, "record=", 7) == 0)
+				record_path = argv[arg_n]+2+7;
+			else if (strncmp(argv[arg_n]+2, "trace=", 6) == 0)
+				trace_path = argv[arg_n]+2+6;
 			else if (strcmp(argv[arg_n]+2, "full-prec-floats") == 0)
 				MML_global_config.full_prec_floats = true;
+			else if (strcmp(argv[arg_n]+2, "round-trip-floats") == 0)
+				MML_global_config.round_trip_floats = true;
+			else if (strncmp(argv[arg_n]+2, "parse-cache=", 12) == 0)
+				MML_global_config.parse_cache_size = strtoul(argv[arg_n]+2+12, NULL, 10);
 			else if (strcmp(argv[arg_n]+2, "no-eval") == 0)
 				SET_FLAG(NO_EVAL);
+			else if (strcmp(argv[arg_n]+2, "compile") == 0)
+				SET_FLAG(COMPILE);
+			else if (strcmp(argv[arg_n]+2, "optimize") == 0)
+				SET_FLAG(OPTIMIZE);
+			else if (strncmp(argv[arg_n]+2, "output=", 7) == 0)
+				compile_out_path = argv[arg_n]+2+7;
 			else if (strcmp(argv[arg_n]+2, "interactive") == 0)
 				SET_FLAG(RUN_PROMPT);
+			else if (strcmp(argv[arg_n]+2, "stream") == 0)
+				SET_FLAG(READ_STDIN | STREAM_STDIN);
+			else if (strcmp(argv[arg_n]+2, "batch") == 0)
+				SET_FLAG(READ_STDIN | BATCH);
+			else if (strncmp(argv[arg_n]+2, "serve=", 6) == 0)
+				serve_path = argv[arg_n]+2+6;
+			else if (strncmp(argv[arg_n]+2, "workers=", 8) == 0)
+				worker_count = strtoul(argv[arg_n]+2+8, NULL, 10);
+			else if (strncmp(argv[arg_n]+2, "client=", 7) == 0)
+				client_path = argv[arg_n]+2+7;
+			else if (strncmp(argv[arg_n]+2, "session=", 8) == 0)
+				session_name = argv[arg_n]+2+8;
 			else if (strncmp(argv[arg_n]+2, "set_var:", 8) == 0)
 			{
 				const char *cur = argv[arg_n]+2+8;
@@ -129,6 +207,15 @@ void MML_arg_parse(int32_t argc, char **argv)
 				case 'I':
 					SET_FLAG(RUN_PROMPT);
 					break;
+				case 'o':
+					if (argv[arg_n+1] == NULL)
+					{
+						fprintf(stderr, "argument error: a path is required following "
+								"'-o' argument to specify where to write the compiled script.\n");
+						MML_print_usage();
+					}
+					compile_out_path = argv[++arg_n];
+					break;
 				case 'E':
 					if (argv[arg_n+1] == NULL)
 					{
@@ -168,13 +255,16 @@ void MML_arg_parse(int32_t argc, char **argv)
 			}
 			if (cur == argv[arg_n]+1)
 				SET_FLAG(READ_STDIN);
+		} else if (FLAG_IS_SET(COMPILE) && script_path == NULL)
+		{
+			script_path = argv[arg_n];
 		} else if (expression.s == NULL)
 		{
 			expression.s = argv[arg_n];
 		}
 	}
 
-	if (expression.s == NULL && !FLAG_IS_SET(READ_STDIN))
+	if (expression.s == NULL && script_path == NULL && !FLAG_IS_SET(READ_STDIN))
 		SET_FLAG(RUN_PROMPT);
 }
 
@@ -227,3 +317,51 @@ strbuf strbuf_dup(strbuf buf)
 
 	return ret;
 }
+
+static size_t mapped_size(size_t file_len)
+{
+	const size_t page_size = (size_t)sysconf(_SC_PAGESIZE);
+	// always leave room for the terminating zero byte
+	return (file_len + 1 + page_size - 1) & ~(page_size - 1);
+}
+
+strbuf MML_map_file(const char *path)
+{
+	const int fd = open(path, O_RDONLY);
+	if (fd < 0)
+		return (strbuf) { NULL, 0 };
+
+	struct stat st;
+	if (fstat(fd, &st) != 0 || !S_ISREG(st.st_mode))
+	{
+		close(fd);
+		return (strbuf) { NULL, 0 };
+	}
+
+	// reserve zeroed pages for the whole range first, then map the file over
+	// the start of it; whatever's left past the end of the file reads as '\0'
+	const size_t map_len = mapped_size((size_t)st.st_size);
+	char *base = mmap(NULL, map_len, PROT_READ, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if (base == MAP_FAILED)
+	{
+		close(fd);
+		return (strbuf) { NULL, 0 };
+	}
+
+	if (st.st_size > 0
+	 && mmap(base, (size_t)st.st_size, PROT_READ, MAP_PRIVATE | MAP_FIXED, fd, 0) == MAP_FAILED)
+	{
+		munmap(base, map_len);
+		close(fd);
+		return (strbuf) { NULL, 0 };
+	}
+	close(fd);
+
+	return (strbuf) { base, (size_t)st.st_size };
+}
+
+void MML_unmap_file(strbuf file)
+{
+	if (file.s != NULL)
+		munmap(file.s, mapped_size(file.len));
+}
@@ -0,0 +1,195 @@
+#include "mml/csv.h"
+
+#include <ctype.h>
+#include <math.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "arena/arena.h"
+#include "mml/config.h"
+#include "mml/numparse.h"
+#include "mml/eval.h"
+#include "mml/expr.h"
+#include "mml/parser.h"
+#include "dvec/dvec.h"
+
+#define CSV_CHUNK_SIZE (1 << 20)
+
+typedef struct {
+	char *buf;
+	size_t cap;
+	size_t start;
+	size_t end;
+	FILE *stream;
+	bool eof;
+} csv_reader;
+
+// Returns the next line (without its line terminator) or { NULL, 0 } at the
+// end of the stream. The returned line is only valid until the next call.
+static strbuf csv_next_line(csv_reader *r)
+{
+	for (;;)
+	{
+		char *const line = r->buf + r->start;
+		char *const nl = memchr(line, '\n', r->end - r->start);
+		if (nl != NULL || (r->eof && r->start < r->end))
+		{
+			const size_t len = (nl != NULL) ? (size_t)(nl - line) : r->end - r->start;
+			r->start += len + (nl != NULL);
+			line[len] = '\0';
+
+			return (strbuf) { line, (len > 0 && line[len-1] == '\r') ? len-1 : len };
+		}
+		if (r->eof)
+			return (strbuf) { NULL, 0 };
+
+		// move the partial line to the front and refill behind it, growing
+		// the buffer if a single line doesn't fit
+		memmove(r->buf, r->buf + r->start, r->end - r->start);
+		r->end -= r->start;
+		r->start = 0;
+		if (r->cap - r->end < CSV_CHUNK_SIZE / 2)
+		{
+			r->cap *= 2;
+			r->buf = realloc(r->buf, r->cap + 1);
+		}
+
+		const size_t n_read = fread(r->buf + r->end, 1, r->cap - r->end, r->stream);
+		r->end += n_read;
+		if (n_read == 0)
+			r->eof = true;
+	}
+}
+
+// Splits off the next ','-separated field of LINE with surrounding
+// whitespace trimmed; advances LINE past it.
+static strbuf csv_next_field(strbuf *line)
+{
+	char *cur = line->s;
+	char *const end = line->s + line->len;
+	while (cur < end && isspace((unsigned char)*cur)) ++cur;
+
+	char *const start = cur;
+	while (cur < end && *cur != ',') ++cur;
+
+	char *field_end = cur;
+	while (field_end > start && isspace((unsigned char)field_end[-1])) --field_end;
+
+	const size_t consumed = (cur < end) ? (size_t)(cur - line->s) + 1 : line->len;
+	line->s += consumed;
+	line->len -= consumed;
+
+	return (strbuf) { start, (size_t)(field_end - start) };
+}
+
+static void bind_field(MML_expr *col, strbuf field)
+{
+	if (field.len == 0)
+	{
+		*col = EXPR_NUM(NAN);
+		return;
+	}
+
+	const char saved = field.s[field.len];
+	field.s[field.len] = '\0';
+
+	const bool negative = (field.s[0] == '-');
+	const char *num_start = field.s + (negative || field.s[0] == '+');
+	double n;
+	char *num_end = (char *)MML_scan_number(num_start, false, &n);
+	if (num_end == num_start)
+		n = strtod(field.s, &num_end); // "inf", "nan", hex floats...
+	else if (negative)
+		n = -n;
+
+	if (num_end == field.s + field.len)
+	{
+		*col = EXPR_NUM(n);
+	} else
+	{
+		MML_expr *parsed = MML_parse(field.s);
+		*col = (parsed != NULL) ? *parsed : EXPR_NUM(NAN);
+	}
+	field.s[field.len] = saved;
+}
+
+static bool is_func_def(const MML_expr *expr)
+{
+	return expr != NULL
+		&& expr->type == Operation_type
+		&& expr->op == MML_OP_ASSERT_EQUAL
+		&& expr->o.left != NULL
+		&& expr->o.left->type == Operation_type
+		&& expr->o.left->op == MML_OP_FUNC_CALL_TOK;
+}
+
+int64_t MML_eval_csv(MML_state *restrict state, MML_expr_dvec stmts, FILE *stream)
+{
+	csv_reader reader = {
+		.buf = malloc(CSV_CHUNK_SIZE + 1),
+		.cap = CSV_CHUNK_SIZE,
+		.stream = stream,
+	};
+
+	strbuf line = csv_next_line(&reader);
+	if (line.s == NULL)
+	{
+		MML_log_err("expected a header row naming the columns of the CSV data\n");
+		free(reader.buf);
+		return -1;
+	}
+
+	// every column gets one node that's rewritten in place for each row,
+	// so binding a row doesn't allocate anything
+	dvec_t(MML_expr *) cols = DVEC_INIT;
+	while (line.len > 0)
+	{
+		const strbuf name = csv_next_field(&line);
+		MML_expr *col = arena_alloc_T(MML_global_arena, 1, MML_expr);
+		*col = EXPR_NUM(NAN);
+		MML_eval_set_variable(state, strbuf_dup(name), col);
+		dv_push(cols, col);
+	}
+
+	// function definitions don't depend on the row, so they're only
+	// evaluated once instead of allocating a new FuncObject for every row
+	MML_expr **stmt;
+	dv_foreach(stmts, stmt)
+		if (is_func_def(*stmt))
+			MML_eval_stmt(state, *stmt);
+
+	int64_t n_rows = 0;
+	while ((line = csv_next_line(&reader)).s != NULL)
+	{
+		if (line.len == 0)
+			continue;
+
+		const ArenaMark mark = arena_mark(MML_global_arena);
+
+		MML_expr **col;
+		dv_foreach(cols, col)
+			bind_field(*col, csv_next_field(&line));
+
+		MML_value val = NOTHING_VAL;
+		dv_foreach(stmts, stmt)
+			if (!is_func_def(*stmt))
+				val = MML_eval_stmt(state, *stmt);
+
+		if (val.type != Nothing_type)
+			MML_print_typedval(state, &val);
+		MML_out_newline(state->config->out);
+		state->config->last_print_was_newline = true;
+
+		// nothing evaluated for this row is referenced after it
+		state->last_val = NOTHING_VAL;
+		arena_reset(MML_global_arena, mark);
+		++n_rows;
+	}
+
+	dv_destroy(cols);
+	free(reader.buf);
+
+	return n_rows;
+}
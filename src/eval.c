@@ -1,90 +1,102 @@
+#define _DEFAULT_SOURCE
+
 #include "mml/eval.h"
 
 #include <complex.h>
 #include <math.h>
+#include <pthread.h>
+#include <stdatomic.h>
 #include <stddef.h>
 #include <stdint.h>
 #include <stdlib.h>
 #include <string.h>
 #include <stdio.h>
+#include <unistd.h>
 
 #include "old_std_compat.h"
 #include "mml/expr.h"
 #include "mml/config.h"
+#include "mml/output.h"
 #include "mml/token.h"
 #include "mml/parser.h"
+#include "mml/compile.h"
+#include "mml/builtins.h"
+#include "mml/infer.h"
+#include "mml/timing.h"
+#include "mml/trace.h"
 #include "arena/arena.h"
 #include "dvec/dvec.h"
 #include "map.h"
 
-/* 0 constants
- * 1 tv_tv_funcs
- * 2 d_d_funcs
- * 3 cd_cd_funcs
- * 4 cd_d_funcs
- * 5 d_cd_funcs
- */
-static hashmap *eval_builtin_maps[] = {
-	nullptr,
-	nullptr,
-	nullptr,
-	nullptr,
-	nullptr,
-	nullptr,
-};
-static bool eval_builtins_are_initialized = false;
-static size_t initialized_evaluators_count = 0;
-Arena *MML_global_arena = NULL;
-
-void math__register_functions(hashmap *maps[6]);
-void stdmml__register_functions(hashmap *maps[6]);
+static constexpr MML_value EXIT_CMD_M	= { OutputCode_type, .i = MML_QUIT_INVAL };
+static constexpr MML_value CLEAR_CMD_M	= { OutputCode_type, .i = MML_CLEAR_INVAL };
 
-MML_state *MML_init_state(void)
-{
-	MML_state *state = calloc(1, sizeof(MML_state));
-	state->config = &MML_global_config;
+static MML_value custom_map(MML_state *restrict state, MML_expr_vec *args);
+static MML_value custom_filter(MML_state *restrict state, MML_expr_vec *args);
+static MML_value custom_fold(MML_state *restrict state, MML_expr_vec *args);
 
-	if (eval_builtins_are_initialized)
-		goto skip_builtins_init;
-
-	MML_global_arena = arena_create(8192);
-
-	eval_builtin_maps[1] = hashmap_create();
-	eval_builtin_maps[2] = hashmap_create();
-	eval_builtin_maps[3] = hashmap_create();
-	eval_builtin_maps[4] = hashmap_create();
-	eval_builtin_maps[5] = hashmap_create();
+const MML_builtin eval__builtins[] = {
+#define MML_BUILTIN MML_BUILTIN_ENTRY
+#include "builtins.def"
+#undef MML_BUILTIN
+};
 
-	hashmap_set(eval_builtin_maps[1], hashmap_str_lit("print"),			(uintptr_t)MML_print_typedval_multiargs);
-	hashmap_set(eval_builtin_maps[1], hashmap_str_lit("println"),		(uintptr_t)MML_println_typedval_multiargs);
+#include "builtins_phash_incl.c"
 
+// states alive in the whole process, and on this thread; each thread
+// has its own arena, which lives as long as the thread has a state
+static atomic_size_t initialized_evaluators_count = 0;
+static thread_local size_t thread_evaluators_count = 0;
+thread_local Arena *MML_global_arena = NULL;
 
-	eval_builtin_maps[0] = hashmap_create();
-	static constexpr MML_value EXIT_CMD_M	= { OutputCode_type, .i = MML_QUIT_INVAL };
-	static constexpr MML_value CLEAR_CMD_M	= { OutputCode_type, .i = MML_CLEAR_INVAL };
+void io__cleanup(void);
 
-	hashmap_set(eval_builtin_maps[0], hashmap_str_lit("exit"),	(uintptr_t)&EXIT_CMD_M);
-	hashmap_set(eval_builtin_maps[0], hashmap_str_lit("clear"),	(uintptr_t)&CLEAR_CMD_M);
+static const MML_builtin *find_builtin(strbuf name)
+{
+	const MML_builtin *b = builtin_phash[
+		MML_builtin_hash(name.s, name.len, BUILTIN_PHASH_SEED) & (BUILTIN_PHASH_SIZE - 1)];
+	if (b != nullptr && b->name.len == name.len && memcmp(b->name.s, name.s, name.len) == 0)
+		return b;
+	return nullptr;
+}
 
-	math__register_functions(eval_builtin_maps);
-	stdmml__register_functions(eval_builtin_maps);
+const MML_builtin *MML_find_builtin(strbuf name)
+{
+	return find_builtin(name);
+}
 
-	eval_builtins_are_initialized = true;
+MML_state *MML_init_state(void)
+{
+	MML_state *state = calloc(1, sizeof(MML_state));
+	state->config = &MML_global_config;
 
-skip_builtins_init:
+	// the builtins are static tables, so only the arena needs setting up
+	if (thread_evaluators_count++ == 0)
+		MML_global_arena = arena_create(8192);
 
 	state->variables = nullptr;
 	state->locals = nullptr;
+	state->last_val = NOTHING_VAL;
 
 
 	state->is_init = true;
-	++initialized_evaluators_count;
+	atomic_fetch_add(&initialized_evaluators_count, 1);
 
 	return state;
 }
 
 void MML_cleanup_state(MML_state *restrict state)
 {
+	MML_out_flush(state->config->out);
+
+	if (state->profile != nullptr) {
+		MML_profile_report(state->profile, stderr);
+		MML_profile_destroy(state->profile);
+		state->profile = nullptr;
+	}
+	MML_record_close(state->recorder);
+	state->recorder = nullptr;
+
 	if (state->variables != nullptr) {
 		hashmap_free(state->variables);
 		state->variables = nullptr;
@@ -93,17 +105,21 @@ void MML_cleanup_state(MML_state *restrict state)
 		hashmap_free(state->locals);
 		state->locals = nullptr;
 	}
+	strbuf *file;
+	dv_foreach(state->mapped_files, file)
+		MML_unmap_file(*file);
+	dv_destroy(state->mapped_files);
+	MML_parse_cache_destroy(state->parse_cache);
+	state->parse_cache = nullptr;
 
 	state->is_init = false;
-	if (--initialized_evaluators_count == 0) {
-		for (uint8_t i = 0; i < 6; ++i)
-		{
-			hashmap_free(eval_builtin_maps[i]);
-			eval_builtin_maps[i] = nullptr;
-		}
-
+	if (--thread_evaluators_count == 0) {
+		MML_free_parser_scratch();
 		arena_destroy(MML_global_arena);
+		MML_global_arena = NULL;
 	}
+	if (atomic_fetch_sub(&initialized_evaluators_count, 1) == 1)
+		io__cleanup();
 
 	free(state);
 }
@@ -113,6 +129,7 @@ int32_t MML_eval_set_variable(MML_state *restrict state, strbuf name, MML_expr *
 	if (state->variables == nullptr)
 		state->variables = hashmap_create();
 
+	++state->n_definitions;
 	return hashmap_set(state->variables,
 			name.s, name.len, (uintptr_t)expr);
 }
@@ -132,6 +149,13 @@ MML_expr *MML_eval_get_variable(MML_state *restrict state, strbuf name)
 
 #define EPSILON 1e-14
 
+// how many times a call has replaced the locals on this thread; see
+// `hof_apply`
+static thread_local uint64_t locals_replaced = 0;
+
+static MML_value apply_builtin(MML_state *restrict state, strbuf ident,
+		const MML_builtin *builtin, MML_value right_vec);
+
 static MML_value apply_func(MML_state *restrict state, strbuf ident, MML_value right_vec)
 {
 	MML_expr *fo_expr;
@@ -144,7 +168,8 @@ static MML_value apply_func(MML_state *restrict state, strbuf ident, MML_value r
 		}
 		if (state->locals) hashmap_free(state->locals);
 		state->locals = hashmap_create();
-		const MML_func_object fo = fo_expr->fo;
+		++locals_replaced;
+		const MML_func_object fo = *fo_expr->fo;
 
 		if (right_vec.v.n != fo.params.len) {
 			MML_log_err("call to function '%.*s' failed: expected %zu argument(s); found %zu.",
@@ -158,17 +183,39 @@ static MML_value apply_func(MML_state *restrict state, strbuf ident, MML_value r
 			hashmap_set(state->locals, param_ident.s, param_ident.len, (uintptr_t)right_vec.v.ptr[i]);
 		}
 
-		return MML_eval_expr(state, fo.body);
+		if (state->profile == nullptr && !MML_trace_on)
+			return MML_eval_expr(state, fo.body);
+
+		MML_trace_begin(MML_TRACE_FUNCTION, ident, 0);
+		if (state->profile != nullptr)
+			MML_profile_enter(state->profile, MML_PROFILE_FUNCTION, ident);
+		const MML_value ret = MML_eval_expr(state, fo.body);
+		if (state->profile != nullptr)
+			MML_profile_exit(state->profile);
+		MML_trace_end(MML_TRACE_FUNCTION);
+		return ret;
 	}
 
-	MML_val_func vec_args_func;
-	if (hashmap_get(eval_builtin_maps[1], ident.s, ident.len, (uintptr_t *)&vec_args_func))
-		return ((*vec_args_func)(state, &right_vec.v));
+	const MML_builtin *builtin = find_builtin(ident);
+	if (builtin == nullptr || (state->profile == nullptr && !MML_trace_on))
+		return apply_builtin(state, ident, builtin, right_vec);
+
+	MML_trace_begin(MML_TRACE_BUILTIN, builtin->name, 0);
+	if (state->profile != nullptr)
+		MML_profile_enter(state->profile, MML_PROFILE_BUILTIN, builtin->name);
+	const MML_value ret = apply_builtin(state, ident, builtin, right_vec);
+	if (state->profile != nullptr)
+		MML_profile_exit(state->profile);
+	MML_trace_end(MML_TRACE_BUILTIN);
+	return ret;
+}
 
-	double (*d_d_func) (double);
-	_Complex double (*cd_cd_func) (_Complex double);
-	_Complex double (*cd_d_func) (double);
-	double (*d_cd_func) (_Complex double);
+// BUILTIN is NULL if IDENT isn't one
+static MML_value apply_builtin(MML_state *restrict state, strbuf ident,
+		const MML_builtin *builtin, MML_value right_vec)
+{
+	if (builtin != nullptr && builtin->vec_args != nullptr)
+		return ((*builtin->vec_args)(state, &right_vec.v));
 
 	if (right_vec.v.n == 0)
 	{
@@ -176,29 +223,21 @@ static MML_value apply_func(MML_state *restrict state, strbuf ident, MML_value r
 				(int)ident.len, ident.s);
 		return VAL_INVAL;
 	}
-	const MML_value first_arg_val = MML_eval_expr(state, right_vec.v.ptr[0]);
-	if (first_arg_val.type == RealNumber_type)
+	MML_value first_arg_val = MML_eval_expr(state, right_vec.v.ptr[0]);
+	if (first_arg_val.type == Integer_type)
+		first_arg_val = VAL_NUM((double)first_arg_val.i);
+	if (builtin != nullptr && first_arg_val.type == RealNumber_type)
 	{
-		if (hashmap_get(eval_builtin_maps[4], ident.s, ident.len, (uintptr_t *)&cd_d_func))
-			if (first_arg_val.type == RealNumber_type)
-				return VAL_CNUM((*cd_d_func)(first_arg_val.n));
-		if (hashmap_get(eval_builtin_maps[2], ident.s, ident.len, (uintptr_t *)&d_d_func))
-			if (first_arg_val.type == RealNumber_type)
-				return VAL_NUM((*d_d_func)(first_arg_val.n));
-	} else if (first_arg_val.type == ComplexNumber_type)
+		if (builtin->cd_d != nullptr)
+			return VAL_CNUM((*builtin->cd_d)(first_arg_val.n));
+		if (builtin->d_d != nullptr)
+			return VAL_NUM((*builtin->d_d)(first_arg_val.n));
+	} else if (builtin != nullptr && first_arg_val.type == ComplexNumber_type)
 	{
-		char *temp __attribute__((cleanup(MML_free_pp)))
-			= calloc(ident.len + sizeof("complex_")-1, sizeof(char));
-		memcpy(temp, "complex_", sizeof("complex_")-1);
-		memcpy(temp+8, ident.s, ident.len);
-
-		if (hashmap_get(eval_builtin_maps[5], temp, ident.len + sizeof("complex_")-1, (uintptr_t *)&d_cd_func))
-			if (first_arg_val.type == ComplexNumber_type)
-				return VAL_NUM((*d_cd_func)(first_arg_val.cn));
-
-		if (hashmap_get(eval_builtin_maps[3], temp, ident.len + sizeof("complex_")-1, (uintptr_t *)&cd_cd_func))
-			if (first_arg_val.type == ComplexNumber_type)
-				return VAL_CNUM((*cd_cd_func)(first_arg_val.cn));
+		if (builtin->d_cd != nullptr)
+			return VAL_NUM((*builtin->d_cd)(first_arg_val.cn));
+		if (builtin->cd_cd != nullptr)
+			return VAL_CNUM((*builtin->cd_cd)(first_arg_val.cn));
 	}
 
 
@@ -208,8 +247,1020 @@ static MML_value apply_func(MML_state *restrict state, strbuf ident, MML_value r
 	return VAL_INVAL;
 }
 
+/*
+ * Higher-order builtins. `map`, `filter` and `fold` call a function once per
+ * element of a vector. Its parameters are bound once, to nodes that each
+ * element is written into, so an element only costs an evaluation of the
+ * body. `map` and `filter` split long vectors between threads if the
+ * function can't tell the difference (see `is_pure`).
+ */
+
+// how many definitions deep `is_pure` looks
+#define MAX_PURITY_DEPTH 8
+// the shortest vector worth starting threads for, and the least each
+// thread gets
+#define HOF_PARALLEL_MIN_LEN 16384
+#define HOF_THREAD_MIN_LEN 4096
+#define MAX_HOF_THREADS 64
+
+// set on the threads started by `map` and `filter`, which don't start more
+static thread_local bool in_hof_worker = false;
+
+// what's called per element: a user function, or a builtin
+typedef struct {
+	strbuf name;
+	const MML_func_object *fo; // NULL for a builtin
+	const MML_builtin *builtin;
+} hof_callee;
+
+// the elements of a vector argument; boxed ones are evaluated up front,
+// while whatever they refer to is still bound
+typedef struct {
+	MML_expr_type type; // Vector_type, NumArray_type or Range_type
+	const MML_value *vals;
+	MML_num_array a;
+	const MML_range *r;
+	size_t n;
+} hof_elems;
+
+// a callee with its arguments bound to nodes that are overwritten before
+// each call
+typedef struct {
+	hof_callee f;
+	MML_expr args[2];
+	MML_expr *arg_ptrs[2];
+	size_t n_args;
+	// where a user function's parameters are bound, and the value of
+	// `locals_replaced` when they were
+	hashmap *locals;
+	uint64_t bound_at;
+} hof_call;
+
+static bool is_pure(MML_state *restrict state, const MML_expr *e, strslice params, uint32_t depth);
+
+static bool builtin_is_pure(const MML_builtin *b)
+{
+	return b->pure || b->d_d != nullptr || b->cd_cd != nullptr
+		|| b->cd_d != nullptr || b->d_cd != nullptr;
+}
+
+static bool get_global(MML_state *restrict state, strbuf name, MML_expr **out)
+{
+	return state->variables != nullptr
+		&& hashmap_get(state->variables, name.s, name.len, (uintptr_t *)out);
+}
+
+static bool ident_is_pure(MML_state *restrict state, strbuf name, strslice params, uint32_t depth)
+{
+	for (size_t i = 0; i < params.len; ++i)
+		if (params.ptr[i].len == name.len && memcmp(params.ptr[i].s, name.s, name.len) == 0)
+			return true;
+	// `ans` is whatever the state evaluated last
+	if (name.len == 3 && memcmp(name.s, "ans", 3) == 0)
+		return false;
+
+	const MML_builtin *builtin = find_builtin(name);
+	if (builtin != nullptr && builtin->constant != nullptr)
+		return true;
+
+	// a definition is evaluated with the same parameters bound
+	MML_expr *def;
+	if (get_global(state, name, &def))
+		return depth < MAX_PURITY_DEPTH && is_pure(state, def, params, depth + 1);
+	// a builtin function passed by name, to another `map` for one
+	return builtin != nullptr && builtin_is_pure(builtin);
+}
+
+// Whether evaluating E with PARAMS bound only works out a value: it doesn't
+// define anything, print, read `ans`, or call anything that might, so it can
+// be evaluated on another thread. Whatever it can't tell within
+// MAX_PURITY_DEPTH definitions (like a recursive function) isn't.
+static bool is_pure(MML_state *restrict state, const MML_expr *e, strslice params, uint32_t depth)
+{
+	if (e == NULL)
+		return true;
+
+	switch (e->type) {
+	case Identifier_type:
+		return ident_is_pure(state, e->s, params, depth);
+	case Vector_type:
+		for (size_t i = 0; i < e->v.n; ++i)
+			if (!is_pure(state, e->v.ptr[i], params, depth))
+				return false;
+		return true;
+	case FuncObject_type:
+		// calling it evaluates its body, with only its own parameters bound
+		return depth < MAX_PURITY_DEPTH
+			&& is_pure(state, e->fo->body, e->fo->params, depth + 1);
+	case Operation_type:
+		break;
+	default:
+		return true;
+	}
+
+	if (e->op == MML_OP_ASSERT_EQUAL)
+		return false;
+	if (e->op == MML_OP_FUNC_CALL_TOK)
+	{
+		if (e->o.left == NULL || e->o.left->type != Identifier_type)
+			return false;
+
+		// like in `apply_func`, a user function shadows a builtin
+		const strbuf name = e->o.left->s;
+		MML_expr *def;
+		bool callee_pure;
+		if (get_global(state, name, &def))
+			callee_pure = def->type == FuncObject_type && depth < MAX_PURITY_DEPTH
+				&& is_pure(state, def, params, depth + 1);
+		else
+		{
+			const MML_builtin *builtin = find_builtin(name);
+			callee_pure = builtin != nullptr && builtin_is_pure(builtin);
+		}
+		return callee_pure && is_pure(state, e->o.right, params, depth);
+	}
+	return is_pure(state, e->o.left, params, depth)
+		&& is_pure(state, e->o.right, params, depth);
+}
+
+// Evaluates the elements of a vector VAL (and theirs), since they could
+// refer to parameters that are about to be bound to something else.
+static MML_value hof_force(MML_state *restrict state, MML_value val)
+{
+	if (val.type != Vector_type)
+		return val;
+
+	MML_expr **ptrs = arena_alloc_T(MML_global_arena, val.v.n, MML_expr *);
+	MML_expr *nodes = arena_alloc_T(MML_global_arena, val.v.n, MML_expr);
+	for (size_t i = 0; i < val.v.n; ++i)
+	{
+		const MML_value elem = hof_force(state, MML_eval_expr_recurse(state, val.v.ptr[i]));
+		if (elem.type == Invalid_type)
+			return VAL_INVAL;
+		nodes[i] = (MML_expr) { elem.type, .w = elem.w };
+		ptrs[i] = &nodes[i];
+	}
+	return (MML_value) { Vector_type, .v = { ptrs, val.v.n } };
+}
+
+// Works out what FN, the first argument of WHO, calls; it has to take
+// N_PARAMS arguments. Builtins aren't values, so they're found by name.
+static bool hof_callee_of(MML_state *restrict state, const char *who, const MML_expr *fn,
+		size_t n_params, hof_callee *out)
+{
+	if (fn->type == Identifier_type && MML_eval_get_variable(state, fn->s) == NULL)
+	{
+		const MML_builtin *builtin = find_builtin(fn->s);
+		if (builtin != nullptr && builtin->constant == nullptr)
+		{
+			// only `vec_args` builtins take more than one argument
+			if (n_params != 1 && builtin->vec_args == nullptr)
+			{
+				MML_log_err("`%s`: '%.*s' takes 1 argument, but would be called with %zu\n",
+						who, (int)fn->s.len, fn->s.s, n_params);
+				return false;
+			}
+			*out = (hof_callee) { .name = builtin->name, .builtin = builtin };
+			return true;
+		}
+	}
+
+	const MML_value val = MML_eval_expr_recurse(state, fn);
+	if (val.type != FuncObject_type)
+	{
+		if (val.type != Invalid_type)
+			MML_log_err("`%s`: the first argument must be a function; found a %s\n",
+					who, EXPR_TYPE_STRINGS[val.type]);
+		return false;
+	}
+
+	const strbuf name = (fn->type == Identifier_type) ? fn->s : str_lit("function");
+	if (val.fo->params.len != n_params)
+	{
+		MML_log_err("`%s`: '%.*s' takes %zu argument(s), but would be called with %zu\n",
+				who, (int)name.len, name.s, val.fo->params.len, n_params);
+		return false;
+	}
+	*out = (hof_callee) { .name = name, .fo = val.fo };
+	return true;
+}
+
+static bool hof_elems_of(MML_state *restrict state, const char *who, const MML_expr *e, hof_elems *out)
+{
+	const MML_value val = MML_eval_expr_recurse(state, e);
+	switch (val.type) {
+	case NumArray_type:
+		*out = (hof_elems) { NumArray_type, .a = val.a, .n = val.a.n };
+		return true;
+	case Range_type:
+		*out = (hof_elems) { Range_type, .r = val.r, .n = val.r->n };
+		return true;
+	case Vector_type:
+		break;
+	default:
+		if (val.type != Invalid_type)
+			MML_log_err("`%s`: takes a vector; found a %s\n", who, EXPR_TYPE_STRINGS[val.type]);
+		return false;
+	}
+
+	MML_value *vals = arena_alloc_T(MML_global_arena, val.v.n, MML_value);
+	for (size_t i = 0; i < val.v.n; ++i)
+	{
+		vals[i] = hof_force(state, MML_eval_expr_recurse(state, val.v.ptr[i]));
+		if (vals[i].type == Invalid_type)
+			return false;
+	}
+	*out = (hof_elems) { Vector_type, .vals = vals, .n = val.v.n };
+	return true;
+}
+
+static inline MML_value hof_elem(const hof_elems *e, size_t i)
+{
+	switch (e->type) {
+	case Range_type:
+		return VAL_NUM(MML_range_at(e->r, i));
+	case NumArray_type:
+		return e->a.is_complex
+			? VAL_CNUM(CMPLX(e->a.ptr[2*i], e->a.ptr[2*i+1]))
+			: VAL_NUM(e->a.ptr[i]);
+	default:
+		return e->vals[i];
+	}
+}
+
+// The calls bind locals of their own, so the caller's are put aside, and
+// put back afterwards since the rest of its body may still refer to them.
+static hashmap *hof_enter(MML_state *restrict state)
+{
+	hashmap *const outer = state->locals;
+	state->locals = nullptr;
+	return outer;
+}
+
+static void hof_leave(MML_state *restrict state, hashmap *outer)
+{
+	if (state->locals != nullptr)
+		hashmap_free(state->locals);
+	state->locals = outer;
+}
+
+// CALL must stay where it is afterwards, since the locals point into it
+static void hof_call_init(hof_call *call, const hof_callee *f, size_t n_args)
+{
+	*call = (hof_call) { .f = *f, .n_args = n_args };
+	for (size_t i = 0; i < n_args; ++i)
+		call->arg_ptrs[i] = &call->args[i];
+}
+
+static inline void hof_set_arg(hof_call *call, size_t i, MML_value val)
+{
+	call->args[i] = (MML_expr) { val.type, .w = val.w };
+}
+
+static void hof_bind(MML_state *restrict state, hof_call *call)
+{
+	if (state->locals != nullptr)
+		hashmap_free(state->locals);
+	state->locals = call->locals = hashmap_create();
+	call->bound_at = locals_replaced;
+	for (size_t i = 0; i < call->n_args; ++i)
+	{
+		const strbuf param = call->f.fo->params.ptr[i];
+		hashmap_set(call->locals, param.s, param.len, (uintptr_t)&call->args[i]);
+	}
+}
+
+static MML_value hof_apply(MML_state *restrict state, hof_call *call)
+{
+	if (call->f.fo == nullptr)
+		return apply_builtin(state, call->f.name, call->f.builtin,
+				(MML_value) { Vector_type, .v = { call->arg_ptrs, call->n_args } });
+
+	// a call to a user function in the body replaced the locals (and a new
+	// set could have the old one's address), so they're bound again
+	if (call->locals == nullptr || call->bound_at != locals_replaced)
+		hof_bind(state, call);
+	return hof_force(state, MML_eval_expr_recurse(state, call->f.fo->body));
+}
+
+// 1 or 0 for what `filter`'s function returned, or -1 if it wasn't a
+// boolean or a number
+static int hof_truth(const MML_value *val)
+{
+	switch (val->type) {
+	case Boolean_type: return val->b;
+	case Integer_type: return val->i != 0;
+	case RealNumber_type: return val->n != 0.0;
+	case ComplexNumber_type: return val->cn != 0.0;
+	case Invalid_type: return -1;
+	default:
+		MML_log_err("`filter`: the function must return a boolean or a number; it returned a %s\n",
+				EXPR_TYPE_STRINGS[val->type]);
+		return -1;
+	}
+}
+
+// a share of a `map` or `filter`
+typedef struct {
+	MML_state *parent;
+	const hof_callee *f;
+	const hof_elems *elems;
+	size_t first, end;
+	// where a map's results go (if they're real numbers), or a filter's
+	// verdicts
+	double *results;
+	bool *keep;
+	FILE *log_stream;
+
+	// `end`, unless an element failed or (for a map) didn't give a real
+	// number, in which case it's that one
+	size_t stopped_at;
+	bool failed;
+} hof_task;
+
+static void run_hof_task(MML_state *restrict state, hof_task *t)
+{
+	hof_call call;
+	hof_call_init(&call, t->f, 1);
+	for (size_t i = t->first; i < t->end; ++i)
+	{
+		hof_set_arg(&call, 0, hof_elem(t->elems, i));
+		const MML_value val = hof_apply(state, &call);
+		if (t->keep != NULL)
+		{
+			const int truth = hof_truth(&val);
+			if (truth < 0)
+			{
+				t->stopped_at = i;
+				t->failed = true;
+				return;
+			}
+			t->keep[i] = truth;
+		} else if (val.type == RealNumber_type || val.type == Integer_type)
+			t->results[i] = (val.type == Integer_type) ? (double)val.i : val.n;
+		else
+		{
+			t->stopped_at = i;
+			t->failed = (val.type == Invalid_type);
+			return;
+		}
+	}
+	t->stopped_at = t->end;
+}
+
+static void *hof_worker(void *arg)
+{
+	hof_task *t = arg;
+	in_hof_worker = true;
+	MML_log_stream = t->log_stream;
+
+	// with an output buffer of its own, since cleaning up the state flushes it
+	MML_outbuf *out = calloc(1, sizeof(MML_outbuf));
+	struct MML_config config = *t->parent->config;
+	config.out = out;
+
+	MML_state *state = MML_init_state();
+	state->config = &config;
+	// nothing a pure function does can define anything, so the variables
+	// are only read while the calls run
+	state->variables = t->parent->variables;
+	run_hof_task(state, t);
+	state->variables = nullptr;
+	MML_cleanup_state(state);
+
+	free(out);
+	return NULL;
+}
+
+static uint32_t hof_threads(MML_state *restrict state, const hof_callee *f, size_t n)
+{
+	// a profile is only kept on the calling thread
+	if (n < HOF_PARALLEL_MIN_LEN || in_hof_worker || state->profile != nullptr)
+		return 1;
+	const bool pure = (f->fo != nullptr)
+		? is_pure(state, f->fo->body, f->fo->params, 0)
+		: builtin_is_pure(f->builtin);
+	if (!pure)
+		return 1;
+
+	const long n_cpus = sysconf(_SC_NPROCESSORS_ONLN);
+	size_t n_threads = (n_cpus > 1) ? (size_t)n_cpus : 1;
+	if (n_threads > n / HOF_THREAD_MIN_LEN)
+		n_threads = n / HOF_THREAD_MIN_LEN;
+	return (n_threads < MAX_HOF_THREADS) ? (uint32_t)n_threads : MAX_HOF_THREADS;
+}
+
+// Calls F on ELEMS in N_THREADS shares (see `hof_task`), the first of them
+// on the calling thread. Returns how many elements from the start were done,
+// or SIZE_MAX if one of them failed.
+static size_t run_hof_tasks(MML_state *restrict state, const hof_callee *f, const hof_elems *elems,
+		uint32_t n_threads, double *results, bool *keep)
+{
+	hof_task tasks[MAX_HOF_THREADS];
+	pthread_t threads[MAX_HOF_THREADS];
+	bool started[MAX_HOF_THREADS];
+	for (uint32_t i = 0; i < n_threads; ++i)
+	{
+		tasks[i] = (hof_task) {
+			.parent = state, .f = f, .elems = elems,
+			.first = elems->n * i / n_threads,
+			.end = elems->n * (i+1) / n_threads,
+			.results = results, .keep = keep,
+			.log_stream = MML_log_stream,
+		};
+		started[i] = i > 0 && pthread_create(&threads[i], NULL, hof_worker, &tasks[i]) == 0;
+	}
+	run_hof_task(state, &tasks[0]);
+	for (uint32_t i = 1; i < n_threads; ++i)
+	{
+		if (started[i])
+			pthread_join(threads[i], NULL);
+		else
+			run_hof_task(state, &tasks[i]);
+	}
+
+	for (uint32_t i = 0; i < n_threads; ++i)
+		if (tasks[i].failed)
+			return SIZE_MAX;
+	for (uint32_t i = 0; i < n_threads; ++i)
+		if (tasks[i].stopped_at < tasks[i].end)
+			return tasks[i].stopped_at;
+	return elems->n;
+}
+
+// where `map` puts its results: unboxed while they're all real (or complex)
+// numbers, boxed from the first one that isn't
+typedef struct {
+	MML_expr_type type; // RealNumber_type, ComplexNumber_type or Vector_type
+	double *d;
+	MML_expr **boxed;
+	MML_expr *nodes;
+	size_t n;
+} map_results;
+
+// moves the first DONE results to a representation that can hold TYPE
+static void map_results_widen(map_results *res, size_t done, MML_expr_type type)
+{
+	if (type == ComplexNumber_type)
+	{
+		double *d = arena_alloc_T(MML_global_arena, 2*res->n, double);
+		for (size_t i = 0; i < done; ++i)
+		{
+			d[2*i] = res->d[i];
+			d[2*i+1] = 0.0;
+		}
+		res->d = d;
+		res->type = ComplexNumber_type;
+		return;
+	}
+
+	res->boxed = arena_alloc_T(MML_global_arena, res->n, MML_expr *);
+	res->nodes = arena_alloc_T(MML_global_arena, res->n, MML_expr);
+	for (size_t i = 0; i < done; ++i)
+	{
+		res->nodes[i] = (res->type == RealNumber_type)
+			? EXPR_NUM(res->d[i])
+			: (MML_expr) { ComplexNumber_type, .cn = CMPLX(res->d[2*i], res->d[2*i+1]) };
+		res->boxed[i] = &res->nodes[i];
+	}
+	res->type = Vector_type;
+}
+
+static void map_results_put(map_results *res, size_t i, MML_value val)
+{
+	if (val.type == Integer_type && res->type != Vector_type)
+		val = VAL_NUM((double)val.i);
+
+	if (res->type != Vector_type && val.type != RealNumber_type)
+	{
+		if (val.type != ComplexNumber_type)
+			map_results_widen(res, i, Vector_type);
+		else if (res->type == RealNumber_type)
+			map_results_widen(res, i, ComplexNumber_type);
+	}
+
+	if (res->type == RealNumber_type)
+		res->d[i] = val.n;
+	else if (res->type == ComplexNumber_type)
+	{
+		const _Complex double z = (val.type == RealNumber_type) ? val.n : val.cn;
+		res->d[2*i] = creal(z);
+		res->d[2*i+1] = cimag(z);
+	} else
+	{
+		res->nodes[i] = (MML_expr) { val.type, .w = val.w };
+		res->boxed[i] = &res->nodes[i];
+	}
+}
+
+static MML_value custom_map(MML_state *restrict state, MML_expr_vec *args)
+{
+	if (args->n != 2)
+	{
+		MML_log_err("`map`: takes 2 arguments: a function of 1 argument and a vector\n");
+		return VAL_INVAL;
+	}
+	hof_callee f;
+	hof_elems elems;
+	if (!hof_callee_of(state, "map", args->ptr[0], 1, &f)
+			|| !hof_elems_of(state, "map", args->ptr[1], &elems))
+		return VAL_INVAL;
+
+	map_results res = {
+		RealNumber_type,
+		.d = arena_alloc_T(MML_global_arena, elems.n, double),
+		.n = elems.n,
+	};
+	hashmap *const outer = hof_enter(state);
+
+	const uint32_t n_threads = hof_threads(state, &f, elems.n);
+	size_t done = (n_threads > 1)
+		? run_hof_tasks(state, &f, &elems, n_threads, res.d, nullptr)
+		: 0;
+	// from the first element that didn't give a real number on another
+	// thread, if there was one
+	hof_call call;
+	hof_call_init(&call, &f, 1);
+	for (size_t i = done; i < elems.n; ++i)
+	{
+		hof_set_arg(&call, 0, hof_elem(&elems, i));
+		const MML_value val = hof_apply(state, &call);
+		if (val.type == Invalid_type)
+		{
+			done = SIZE_MAX;
+			break;
+		}
+		map_results_put(&res, i, val);
+	}
+
+	hof_leave(state, outer);
+	if (done == SIZE_MAX)
+		return VAL_INVAL;
+	if (res.type == Vector_type)
+		return (MML_value) { Vector_type, .v = { res.boxed, res.n } };
+	return (MML_value) { NumArray_type, .a = {
+		.ptr = res.d, .n = res.n, .is_complex = (res.type == ComplexNumber_type) } };
+}
+
+static MML_value custom_filter(MML_state *restrict state, MML_expr_vec *args)
+{
+	if (args->n != 2)
+	{
+		MML_log_err("`filter`: takes 2 arguments: a function of 1 argument and a vector\n");
+		return VAL_INVAL;
+	}
+	hof_callee f;
+	hof_elems elems;
+	if (!hof_callee_of(state, "filter", args->ptr[0], 1, &f)
+			|| !hof_elems_of(state, "filter", args->ptr[1], &elems))
+		return VAL_INVAL;
+
+	bool *keep = arena_alloc_T(MML_global_arena, elems.n, bool);
+	hashmap *const outer = hof_enter(state);
+	const uint32_t n_threads = hof_threads(state, &f, elems.n);
+	const size_t done = run_hof_tasks(state, &f, &elems, n_threads, nullptr, keep);
+	hof_leave(state, outer);
+	if (done != elems.n)
+		return VAL_INVAL;
+
+	size_t n_kept = 0;
+	for (size_t i = 0; i < elems.n; ++i)
+		n_kept += keep[i];
+
+	if (elems.type == Vector_type)
+	{
+		MML_expr **ptrs = arena_alloc_T(MML_global_arena, n_kept, MML_expr *);
+		MML_expr *nodes = arena_alloc_T(MML_global_arena, n_kept, MML_expr);
+		for (size_t i = 0, j = 0; i < elems.n; ++i)
+		{
+			if (!keep[i])
+				continue;
+			nodes[j] = (MML_expr) { elems.vals[i].type, .w = elems.vals[i].w };
+			ptrs[j] = &nodes[j];
+			++j;
+		}
+		return (MML_value) { Vector_type, .v = { ptrs, n_kept } };
+	}
+
+	const bool is_complex = (elems.type == NumArray_type && elems.a.is_complex);
+	double *d = arena_alloc_T(MML_global_arena, is_complex ? 2*n_kept : n_kept, double);
+	for (size_t i = 0, j = 0; i < elems.n; ++i)
+	{
+		if (!keep[i])
+			continue;
+		if (is_complex)
+		{
+			d[2*j] = elems.a.ptr[2*i];
+			d[2*j+1] = elems.a.ptr[2*i+1];
+		} else
+			d[j] = hof_elem(&elems, i).n;
+		++j;
+	}
+	return (MML_value) { NumArray_type, .a = { .ptr = d, .n = n_kept, .is_complex = is_complex } };
+}
+
+static MML_value custom_fold(MML_state *restrict state, MML_expr_vec *args)
+{
+	if (args->n != 3)
+	{
+		MML_log_err("`fold`: takes 3 arguments: a function of 2 arguments, a starting value and a vector\n");
+		return VAL_INVAL;
+	}
+	hof_callee f;
+	hof_elems elems;
+	if (!hof_callee_of(state, "fold", args->ptr[0], 2, &f))
+		return VAL_INVAL;
+	MML_value acc = hof_force(state, MML_eval_expr_recurse(state, args->ptr[1]));
+	if (acc.type == Invalid_type || !hof_elems_of(state, "fold", args->ptr[2], &elems))
+		return VAL_INVAL;
+
+	// each call depends on the last, so they're made in order
+	hashmap *const outer = hof_enter(state);
+	hof_call call;
+	hof_call_init(&call, &f, 2);
+	for (size_t i = 0; i < elems.n && acc.type != Invalid_type; ++i)
+	{
+		hof_set_arg(&call, 0, acc);
+		hof_set_arg(&call, 1, hof_elem(&elems, i));
+		acc = hof_apply(state, &call);
+	}
+	hof_leave(state, outer);
+	return acc;
+}
+
+static MML_value num_array_magnitude(const MML_num_array *a)
+{
+	// same as for regular vectors: the square root of the sum of the
+	// (real parts of the) squares of the elements
+	double sum = 0.0;
+	if (a->is_complex)
+		for (size_t i = 0; i < a->n; ++i)
+			sum += a->ptr[2*i]*a->ptr[2*i] - a->ptr[2*i+1]*a->ptr[2*i+1];
+	else
+		for (size_t i = 0; i < a->n; ++i)
+			sum += a->ptr[i]*a->ptr[i];
+
+	return (sum >= 0.0) ? VAL_NUM(sqrt(sum)) : VAL_CNUM(csqrt(sum + 0.0*I));
+}
+
+#define NUM_ARRAY_ELEMWISE(_n, _out, _x, _s, _op, _arr_is_left) \
+	switch (_op) { \
+	case MML_OP_ADD_TOK: for (size_t i = 0; i < (_n); ++i) (_out)[i] = (_x) + (_s); break; \
+	case MML_OP_MUL_TOK: for (size_t i = 0; i < (_n); ++i) (_out)[i] = (_x) * (_s); break; \
+	case MML_OP_SUB_TOK: \
+		if (_arr_is_left) for (size_t i = 0; i < (_n); ++i) (_out)[i] = (_x) - (_s); \
+		else for (size_t i = 0; i < (_n); ++i) (_out)[i] = (_s) - (_x); \
+		break; \
+	case MML_OP_DIV_TOK: \
+		if (_arr_is_left) for (size_t i = 0; i < (_n); ++i) (_out)[i] = (_x) / (_s); \
+		else for (size_t i = 0; i < (_n); ++i) (_out)[i] = (_s) / (_x); \
+		break; \
+	default: break; \
+	}
+
+static MML_value num_array_scalar_op(const MML_num_array *arr, const MML_value *scalar,
+		bool arr_is_left, MML_token_type op)
+{
+	MML_num_array ret = { nullptr, arr->n, arr->is_complex || scalar->type == ComplexNumber_type };
+	double *out = arena_alloc_T(MML_global_arena, (ret.is_complex) ? 2*arr->n : arr->n, double);
+	ret.ptr = out;
+
+	if (!ret.is_complex)
+	{
+		const double s = MML_get_number(scalar);
+		NUM_ARRAY_ELEMWISE(arr->n, out, arr->ptr[i], s, op, arr_is_left);
+	} else
+	{
+		// (real, imag) pairs have the same layout as _Complex double
+		const _Complex double s = MML_get_complex(scalar);
+		_Complex double *const cout = (_Complex double *)out;
+		if (arr->is_complex)
+		{
+			const _Complex double *const src = (const _Complex double *)arr->ptr;
+			NUM_ARRAY_ELEMWISE(arr->n, cout, src[i], s, op, arr_is_left);
+		} else
+		{
+			NUM_ARRAY_ELEMWISE(arr->n, cout, arr->ptr[i], s, op, arr_is_left);
+		}
+	}
+
+	return (MML_value) { NumArray_type, .a = ret };
+}
+
+static MML_value apply_num_array_op(MML_state *restrict state, MML_value a, MML_value b, MML_token_type op)
+{
+	// anything mixing packed and boxed vectors works on boxed ones
+	if (a.type == NumArray_type && b.type == Vector_type)
+		return MML_apply_binary_op(state,
+				(MML_value) { Vector_type, .v = MML_num_array_to_vec(&a.a) }, b, op);
+	if (a.type == Vector_type && b.type == NumArray_type)
+		return MML_apply_binary_op(state,
+				a, (MML_value) { Vector_type, .v = MML_num_array_to_vec(&b.a) }, op);
+
+	if (a.type == NumArray_type && op == MML_OP_DOT_TOK
+	 && VAL_IS_NUM(b) && b.type != ComplexNumber_type)
+	{
+		const double idx = MML_get_number(&b);
+		size_t i = (size_t)idx;
+		if (fabs(i - idx) > EPSILON || idx < 0)
+		{
+			MML_log_err("vectors may only be indexed by a positive integer\n");
+			return VAL_INVAL;
+		}
+		if (i >= a.a.n)
+		{
+			MML_log_err("index %zu out of range for vector of length %zu\n", i, (size_t)a.a.n);
+			return VAL_INVAL;
+		}
+		return MML_num_array_get(&a.a, i);
+	}
+
+	if (a.type == NumArray_type && b.type == NumArray_type && a.a.n == b.a.n)
+	{
+		switch (op) {
+		case MML_OP_MUL_TOK:
+			if (!a.a.is_complex && !b.a.is_complex)
+			{
+				double sum = 0.0;
+				for (size_t i = 0; i < a.a.n; ++i)
+					sum += a.a.ptr[i] * b.a.ptr[i];
+				return VAL_NUM(sum);
+			}
+			_Complex double csum = 0.0;
+			for (size_t i = 0; i < a.a.n; ++i)
+			{
+				const MML_value x = MML_num_array_get(&a.a, i);
+				const MML_value y = MML_num_array_get(&b.a, i);
+				csum += MML_get_complex(&x) * MML_get_complex(&y);
+			}
+			return (cimag(csum) == 0.0) ? VAL_NUM(creal(csum)) : VAL_CNUM(csum);
+		case MML_OP_EQ_TOK:
+			for (size_t i = 0; i < a.a.n; ++i)
+				if (!MML_apply_binary_op(state,
+						MML_num_array_get(&a.a, i),
+						MML_num_array_get(&b.a, i),
+						MML_OP_EQ_TOK).b)
+					return VAL_BOOL(false);
+			return VAL_BOOL(true);
+		default:
+			MML_log_err("invalid binary operator on two equal-length vector operands: %s\n",
+					TOK_STRINGS[op]);
+			return VAL_INVAL;
+		}
+	}
+
+	if ((a.type == NumArray_type && VAL_IS_NUM(b)) || (VAL_IS_NUM(a) && b.type == NumArray_type))
+	{
+		switch (op) {
+		case MML_OP_ADD_TOK:
+		case MML_OP_SUB_TOK:
+		case MML_OP_MUL_TOK:
+		case MML_OP_DIV_TOK:
+			return (a.type == NumArray_type)
+				? num_array_scalar_op(&a.a, &b, true, op)
+				: num_array_scalar_op(&b.a, &a, false, op);
+		default:
+			break;
+		}
+	}
+
+	MML_log_warn("invalid binary operator on %s and %s operands: %s\n",
+			EXPR_TYPE_STRINGS[a.type], EXPR_TYPE_STRINGS[b.type],
+			TOK_STRINGS[op]);
+	return VAL_INVAL;
+}
+
+static size_t vector_len(const MML_value *v)
+{
+	switch (v->type) {
+	case Vector_type: return v->v.n;
+	case NumArray_type: return v->a.n;
+	case Range_type: return v->r->n;
+	default: return 0;
+	}
+}
+
+/*
+ * Ranges. Whatever can be worked out one element at a time as they're
+ * generated is; anything else gets the range packed into an array first.
+ */
+
+static MML_value range_magnitude(const MML_range *r)
+{
+	double sum = 0.0;
+	for (size_t i = 0; i < r->n; ++i)
+	{
+		const double x = MML_range_at(r, i);
+		sum += x*x;
+	}
+	return VAL_NUM(sqrt(sum));
+}
+
+// ranges and real packed arrays, whose elements are plain doubles
+static inline bool has_real_elems(const MML_value *v)
+{
+	return v->type == Range_type || (v->type == NumArray_type && !v->a.is_complex);
+}
+
+static inline double real_elem(const MML_value *v, size_t i)
+{
+	return (v->type == Range_type) ? MML_range_at(v->r, i) : v->a.ptr[i];
+}
+
+static inline bool is_real_scalar(const MML_value *v)
+{
+	return VAL_IS_NUM(*v) && v->type != ComplexNumber_type;
+}
+
+// the range from START to LAST in steps of STEP, if all three are finite;
+// otherwise its elements aren't affine in i any more (0*inf, inf-inf), and
+// the operation has to be done on them one at a time
+static inline bool make_finite_range(MML_value *out, double start, double step, double last, size_t n)
+{
+	if (!isfinite(start) || !isfinite(step) || !isfinite(last))
+		return false;
+	*out = MML_make_range(start, step, last, n);
+	return true;
+}
+
+// A packed into an array if it's a range, or invalid if it's too long for that
+static inline MML_value pack_range(MML_value a)
+{
+	if (a.type != Range_type)
+		return a;
+	const MML_num_array packed = MML_range_to_num_array(a.r);
+	return (packed.ptr != nullptr) ? (MML_value) { NumArray_type, .a = packed } : VAL_INVAL;
+}
+
+static MML_value apply_range_op(MML_state *restrict state, MML_value a, MML_value b, MML_token_type op)
+{
+	if (a.type == Range_type && op == MML_OP_DOT_TOK && is_real_scalar(&b))
+	{
+		const double idx = MML_get_number(&b);
+		size_t i = (size_t)idx;
+		if (fabs(i - idx) > EPSILON || idx < 0)
+		{
+			MML_log_err("vectors may only be indexed by a positive integer\n");
+			return VAL_INVAL;
+		}
+		if (i >= a.r->n)
+		{
+			MML_log_err("index %zu out of range for vector of length %zu\n", i, a.r->n);
+			return VAL_INVAL;
+		}
+		return VAL_NUM(MML_range_at(a.r, i));
+	}
+
+	// adding to, subtracting from or scaling a range by a finite amount gives
+	// another one
+	MML_value ret;
+	if (a.type == Range_type && is_real_scalar(&b))
+	{
+		const MML_range *r = a.r;
+		const double s = MML_get_number(&b);
+		switch (op) {
+		case MML_OP_ADD_TOK:
+			if (make_finite_range(&ret, r->start + s, r->step, r->last + s, r->n))
+				return ret;
+			break;
+		case MML_OP_SUB_TOK:
+			if (make_finite_range(&ret, r->start - s, r->step, r->last - s, r->n))
+				return ret;
+			break;
+		case MML_OP_MUL_TOK:
+			if (make_finite_range(&ret, r->start * s, r->step * s, r->last * s, r->n))
+				return ret;
+			break;
+		case MML_OP_DIV_TOK:
+			if (make_finite_range(&ret, r->start / s, r->step / s, r->last / s, r->n))
+				return ret;
+			break;
+		default: break;
+		}
+	} else if (is_real_scalar(&a) && b.type == Range_type)
+	{
+		const MML_range *r = b.r;
+		const double s = MML_get_number(&a);
+		switch (op) {
+		case MML_OP_ADD_TOK:
+			if (make_finite_range(&ret, s + r->start, r->step, s + r->last, r->n))
+				return ret;
+			break;
+		case MML_OP_SUB_TOK:
+			if (make_finite_range(&ret, s - r->start, -r->step, s - r->last, r->n))
+				return ret;
+			break;
+		case MML_OP_MUL_TOK:
+			if (make_finite_range(&ret, s * r->start, s * r->step, s * r->last, r->n))
+				return ret;
+			break;
+		default: break;
+		}
+	}
+
+	if (has_real_elems(&a) && has_real_elems(&b) && vector_len(&a) == vector_len(&b))
+	{
+		const size_t n = vector_len(&a);
+		switch (op) {
+		case MML_OP_MUL_TOK:
+		{
+			double sum = 0.0;
+			for (size_t i = 0; i < n; ++i)
+				sum += real_elem(&a, i) * real_elem(&b, i);
+			return VAL_NUM(sum);
+		}
+		case MML_OP_EQ_TOK:
+			for (size_t i = 0; i < n; ++i)
+				if (fabs(real_elem(&a, i) - real_elem(&b, i)) >= EPSILON)
+					return VAL_BOOL(false);
+			return VAL_BOOL(true);
+		default:
+			break;
+		}
+	}
+
+	// nothing works on two vectors of different lengths, so there's no
+	// point packing either of them
+	const bool a_is_vec = a.type == Range_type || a.type == NumArray_type || a.type == Vector_type;
+	const bool b_is_vec = b.type == Range_type || b.type == NumArray_type || b.type == Vector_type;
+	if (a_is_vec && b_is_vec && vector_len(&a) != vector_len(&b))
+	{
+		MML_log_err("invalid binary operator on vectors of lengths %zu and %zu: %s\n",
+				vector_len(&a), vector_len(&b), TOK_STRINGS[op]);
+		return VAL_INVAL;
+	}
+
+	a = pack_range(a);
+	b = pack_range(b);
+	if (a.type == Invalid_type || b.type == Invalid_type)
+		return VAL_INVAL;
+	return MML_apply_binary_op(state, a, b, op);
+}
+
+static MML_value apply_vector_op(MML_state *restrict state, MML_value a, MML_value b, MML_token_type op);
+
+// kept out of line so the untraced path stays as it was
+__attribute__((cold, noinline))
+static MML_value apply_traced_vector_op(MML_state *restrict state, MML_value a, MML_value b, MML_token_type op)
+{
+	// indexing is as cheap on a big vector as on a small one
+	const size_t n = (vector_len(&a) > vector_len(&b)) ? vector_len(&a) : vector_len(&b);
+	if (n < MML_TRACE_VECTOR_MIN || op == MML_OP_DOT_TOK)
+		return apply_vector_op(state, a, b, op);
+
+	MML_trace_begin(MML_TRACE_VECTOR, (strbuf) { (char *)TOK_STRINGS[op], strlen(TOK_STRINGS[op]) }, n);
+	const MML_value ret = apply_vector_op(state, a, b, op);
+	MML_trace_end(MML_TRACE_VECTOR);
+	return ret;
+}
+
+// the real part of a number, as the vector products sum them up
+static inline double real_part(const MML_value *v)
+{
+	return (v->type == Integer_type) ? (double)v->i : v->n;
+}
+
 MML_value MML_apply_binary_op(MML_state *restrict state, MML_value a, MML_value b, MML_token_type op)
 {
+	if (a.type == Integer_type && b.type == Integer_type)
+	{
+		// integers stay integers as long as the result is exact; anything
+		// that overflows (or divides) is done in doubles below, and so is
+		// a zero that doubles would give a negative sign (1/(0*-1) is -inf)
+		int64_t r;
+		switch (op) {
+		case MML_OP_ADD_TOK:
+			if (!__builtin_add_overflow(a.i, b.i, &r))
+				return VAL_INT(r);
+			break;
+		case MML_OP_SUB_TOK:
+			if (!__builtin_sub_overflow(a.i, b.i, &r))
+				return VAL_INT(r);
+			break;
+		case MML_OP_MUL_TOK:
+			if (!__builtin_mul_overflow(a.i, b.i, &r) && (r != 0 || (a.i >= 0 && b.i >= 0)))
+				return VAL_INT(r);
+			break;
+		case MML_OP_MOD_TOK:
+			// truncates like fmod; x % 0 is NaN, and INT64_MIN % -1 traps
+			if (b.i != 0 && b.i != -1 && (a.i >= 0 || a.i % b.i != 0))
+				return VAL_INT(a.i % b.i);
+			break;
+		case MML_OP_LESS_TOK: return VAL_BOOL(a.i < b.i);
+		case MML_OP_GREATER_TOK: return VAL_BOOL(a.i > b.i);
+		case MML_OP_LESSEQ_TOK: return VAL_BOOL(a.i <= b.i);
+		case MML_OP_GREATEREQ_TOK: return VAL_BOOL(a.i >= b.i);
+		case MML_OP_EQ_TOK:
+		case MML_OP_EXACT_EQ:
+			return VAL_BOOL(a.i == b.i);
+		case MML_OP_NOTEQ_TOK:
+		case MML_OP_EXACT_NOTEQ:
+			return VAL_BOOL(a.i != b.i);
+		default:
+			break;
+		}
+	}
+
 	if (a.type == Invalid_type)
 		return VAL_INVAL;
 
@@ -227,10 +1278,15 @@ MML_value MML_apply_binary_op(MML_state *restrict state, MML_value a, MML_value
 			switch (a.type) {
 			case ComplexNumber_type:
 				return VAL_CNUM(-MML_get_complex(&a));
+			case Integer_type:
+				// -0 is the double -0.0, so 1/-0 stays -inf
+				return (a.i != INT64_MIN && a.i != 0) ? VAL_INT(-a.i) : VAL_NUM(-(double)a.i);
 			case Boolean_type:
 			case RealNumber_type:
 				return VAL_NUM(-MML_get_number(&a));
 			case Vector_type:
+			case NumArray_type:
+			case Range_type:
 				return MML_apply_binary_op(state, a, VAL_NUM(-1), MML_OP_MUL_TOK);
 			default:
 				MML_log_warn("failed to apply %s operator on %s operand\n", TOK_STRINGS[op], EXPR_TYPE_STRINGS[a.type]);
@@ -240,6 +1296,8 @@ MML_value MML_apply_binary_op(MML_state *restrict state, MML_value a, MML_value
 			switch (a.type) {
 			case ComplexNumber_type:
 				return VAL_CNUM(cabs(MML_get_complex(&a)));
+			case Integer_type:
+				return (a.i != INT64_MIN) ? VAL_INT((a.i < 0) ? -a.i : a.i) : VAL_NUM(-(double)a.i);
 			case Boolean_type:
 			case RealNumber_type:
 				return VAL_NUM(fabs(MML_get_number(&a)));
@@ -250,10 +1308,15 @@ MML_value MML_apply_binary_op(MML_state *restrict state, MML_value a, MML_value
 				for (size_t i = 0; i < a.v.n; ++i)
 				{
 					cur_elem = MML_eval_expr(state, a.v.ptr[i]);
-					sum += MML_apply_binary_op(state, cur_elem, cur_elem, MML_OP_MUL_TOK).n;
+					const MML_value sq = MML_apply_binary_op(state, cur_elem, cur_elem, MML_OP_MUL_TOK);
+					sum += real_part(&sq);
 				}
 				_Complex double ret = csqrt(sum);
 				return (cimag(ret) == 0.0) ? VAL_NUM(creal(ret)) : VAL_CNUM(ret);
+			case NumArray_type:
+				return num_array_magnitude(&a.a);
+			case Range_type:
+				return range_magnitude(a.r);
 			default:
 				MML_log_warn("failed to apply %s operator on %s operand\n", TOK_STRINGS[op], EXPR_TYPE_STRINGS[a.type]);
 				return VAL_INVAL;
@@ -283,6 +1346,7 @@ MML_value MML_apply_binary_op(MML_state *restrict state, MML_value a, MML_value
 			switch (a.type) {
 			case ComplexNumber_type:
 				return VAL_CNUM(csqrt(MML_get_complex(&a)));
+			case Integer_type:
 			case Boolean_type:
 			case RealNumber_type:
 				return VAL_NUM(sqrt(MML_get_number(&a)));
@@ -338,12 +1402,30 @@ MML_value MML_apply_binary_op(MML_state *restrict state, MML_value a, MML_value
 				MML_log_warn("invalid binary operator on complex operands: %s\n", TOK_STRINGS[op]);
 				return VAL_INVAL;
 		}
-	} else if (a.type == Vector_type && b.type == RealNumber_type
+	}
+
+	if (MML_trace_on)
+		return apply_traced_vector_op(state, a, b, op);
+	return apply_vector_op(state, a, b, op);
+}
+
+// operations with a vector on at least one side (or with anything else the
+// numeric cases don't cover, which are errors)
+static MML_value apply_vector_op(MML_state *restrict state, MML_value a, MML_value b, MML_token_type op)
+{
+	if (a.type == Range_type || b.type == Range_type)
+	{
+		return apply_range_op(state, a, b, op);
+	} else if (a.type == NumArray_type || b.type == NumArray_type)
+	{
+		return apply_num_array_op(state, a, b, op);
+	} else if (a.type == Vector_type && (b.type == Integer_type || b.type == RealNumber_type)
 			&& op == MML_OP_DOT_TOK)
 	{
 		// vector index
 		size_t i = (size_t)MML_get_number(&b);
-		if (fabs(i - MML_get_number(&b)) > EPSILON || MML_get_number(&b) < 0)
+		if ((b.type == Integer_type) ? b.i < 0
+				: (fabs(i - MML_get_number(&b)) > EPSILON || MML_get_number(&b) < 0))
 		{
 			MML_log_err("vectors may only be indexed by a positive integer\n");
 			return VAL_INVAL;
@@ -369,10 +1451,11 @@ MML_value MML_apply_binary_op(MML_state *restrict state, MML_value a, MML_value
 				double sum = 0.0;
 				for (size_t i = 0; i < a.v.n; ++i)
 				{
-					sum += MML_apply_binary_op(state,
+					const MML_value prod = MML_apply_binary_op(state,
 							MML_eval_expr(state, a.v.ptr[i]), 
 							MML_eval_expr(state, b.v.ptr[i]), 
-							MML_OP_MUL_TOK).n;
+							MML_OP_MUL_TOK);
+					sum += real_part(&prod);
 				}
 				return VAL_NUM(sum);
 			}
@@ -442,6 +1525,168 @@ MML_value MML_apply_binary_op(MML_state *restrict state, MML_value a, MML_value
 	return VAL_INVAL;
 }
 
+/*
+ * Specialized evaluation of operations inferred to be real or complex (see
+ * mml/infer.h). Each of these returns true with the number in *OUT, or false
+ * with whatever the operation (or operand) evaluated to in *VAL, once the
+ * prediction turns out to be wrong.
+ */
+static bool eval_real(MML_state *restrict state, const MML_expr *e, double *out, MML_value *val);
+static bool eval_complex(MML_state *restrict state, const MML_expr *e, _Complex double *out, MML_value *val);
+
+static inline bool is_specialized(const MML_expr *e, MML_value_kind kind)
+{
+	return e->type == Operation_type && e->kind == kind
+		&& e->op != MML_OP_FUNC_CALL_TOK && e->op != MML_OP_ASSERT_EQUAL;
+}
+
+// non-complex numbers other than reals, which real arithmetic converts
+static inline bool is_int_or_bool(const MML_value *v)
+{
+	return v->type == Integer_type || v->type == Boolean_type;
+}
+
+static bool eval_real_operand(MML_state *restrict state, const MML_expr *e, double *out, MML_value *val)
+{
+	if (e->type == RealNumber_type)
+	{
+		*out = e->n;
+		return true;
+	}
+	if (is_specialized(e, MML_KIND_REAL))
+		return eval_real(state, e, out, val);
+
+	*val = MML_eval_expr_recurse(state, e);
+	if (val->type != RealNumber_type)
+		return false;
+	*out = val->n;
+	return true;
+}
+
+static bool eval_real(MML_state *restrict state, const MML_expr *e, double *out, MML_value *val)
+{
+	const MML_token_type op = e->op;
+	double a, b;
+	MML_value va, vb;
+	const bool a_real = eval_real_operand(state, e->o.left, &a, &va);
+
+	if (e->o.right == NULL)
+	{
+		if (a_real)
+		{
+			switch (op) {
+			case MML_OP_NEGATE: *out = -a; return true;
+			case MML_PIPE_TOK: *out = fabs(a); return true;
+			case MML_OP_ROOT: *out = sqrt(a); return true;
+			case MML_OP_UNARY_NOTHING: *out = a; return true;
+			default: va = VAL_NUM(a); break;
+			}
+		}
+		*val = MML_apply_binary_op(state, va, VAL_INVAL, op);
+	} else
+	{
+		const bool b_real = eval_real_operand(state, e->o.right, &b, &vb);
+		// a real with an integer or a boolean is real arithmetic as well,
+		// but two integers aren't
+		if ((a_real || is_int_or_bool(&va)) && (b_real || is_int_or_bool(&vb)) && (a_real || b_real))
+		{
+			const double x = (a_real) ? a : MML_get_number(&va);
+			const double y = (b_real) ? b : MML_get_number(&vb);
+			switch (op) {
+			case MML_OP_POW_TOK: *out = pow(x, y); return true;
+			case MML_OP_MUL_TOK: *out = x * y; return true;
+			case MML_OP_DIV_TOK: *out = x / y; return true;
+			case MML_OP_MOD_TOK: *out = fmod(x, y); return true;
+			case MML_OP_ADD_TOK: *out = x + y; return true;
+			case MML_OP_SUB_TOK: *out = x - y; return true;
+			case MML_OP_ROOT: *out = pow(x, 1.0/y); return true;
+			default: break;
+			}
+		}
+		*val = MML_apply_binary_op(state,
+				(a_real) ? VAL_NUM(a) : va,
+				(b_real) ? VAL_NUM(b) : vb,
+				op);
+	}
+
+	if (val->type != RealNumber_type)
+		return false;
+	*out = val->n;
+	return true;
+}
+
+static bool eval_complex_operand(MML_state *restrict state, const MML_expr *e, _Complex double *out, MML_value *val)
+{
+	if (e->type == ComplexNumber_type)
+	{
+		*out = e->cn;
+		return true;
+	}
+	if (is_specialized(e, MML_KIND_COMPLEX))
+		return eval_complex(state, e, out, val);
+	if (is_specialized(e, MML_KIND_REAL))
+	{
+		double d;
+		if (eval_real(state, e, &d, val))
+			*val = VAL_NUM(d);
+		return false;
+	}
+
+	*val = MML_eval_expr_recurse(state, e);
+	if (val->type != ComplexNumber_type)
+		return false;
+	*out = val->cn;
+	return true;
+}
+
+static bool eval_complex(MML_state *restrict state, const MML_expr *e, _Complex double *out, MML_value *val)
+{
+	const MML_token_type op = e->op;
+	_Complex double a, b;
+	MML_value va, vb;
+	const bool a_complex = eval_complex_operand(state, e->o.left, &a, &va);
+
+	if (e->o.right == NULL)
+	{
+		if (a_complex)
+		{
+			switch (op) {
+			case MML_OP_NEGATE: *out = -a; return true;
+			case MML_PIPE_TOK: *out = cabs(a); return true;
+			case MML_OP_ROOT: *out = csqrt(a); return true;
+			case MML_OP_UNARY_NOTHING: *out = a; return true;
+			default: va = VAL_CNUM(a); break;
+			}
+		}
+		*val = MML_apply_binary_op(state, va, VAL_INVAL, op);
+	} else
+	{
+		const bool b_complex = eval_complex_operand(state, e->o.right, &b, &vb);
+		if ((a_complex || VAL_IS_NUM(va)) && (b_complex || VAL_IS_NUM(vb)) && (a_complex || b_complex))
+		{
+			const _Complex double x = (a_complex) ? a : MML_get_complex(&va);
+			const _Complex double y = (b_complex) ? b : MML_get_complex(&vb);
+			switch (op) {
+			case MML_OP_POW_TOK: *out = cpow(x, y); return true;
+			case MML_OP_MUL_TOK: *out = x * y; return true;
+			case MML_OP_DIV_TOK: *out = x / y; return true;
+			case MML_OP_ADD_TOK: *out = x + y; return true;
+			case MML_OP_SUB_TOK: *out = x - y; return true;
+			default: break;
+			}
+		}
+		*val = MML_apply_binary_op(state,
+				(a_complex) ? VAL_CNUM(a) : va,
+				(b_complex) ? VAL_CNUM(b) : vb,
+				op);
+	}
+
+	if (val->type != ComplexNumber_type)
+		return false;
+	*out = val->cn;
+	return true;
+}
+
 static bool expr_contains_ident(const MML_expr *e, strbuf ident)
 {
 	return e->type == Identifier_type
@@ -500,6 +1745,8 @@ MML_value MML_eval_expr_recurse(MML_state *restrict state, const MML_expr *expr)
 	case Nothing_type: return NOTHING_VAL;
 	case Vector_type:
 		return (MML_value) { Vector_type, .v = expr->v };
+	case Integer_type:
+		return VAL_INT(expr->i);
 	case RealNumber_type:
 		return VAL_NUM(expr->n);
 	case ComplexNumber_type:
@@ -507,21 +1754,31 @@ MML_value MML_eval_expr_recurse(MML_state *restrict state, const MML_expr *expr)
 	case Boolean_type:
 		return VAL_BOOL(expr->b);
 	case Identifier_type: {
-		MML_value *val;
 		if (expr->s.len == 3 && strncmp(expr->s.s, "ans", 3) == 0)
 			return state->last_val;
-		if (hashmap_get(eval_builtin_maps[0], expr->s.s, expr->s.len, (uintptr_t *)&val))
-			return *val;
+		const MML_builtin *builtin = find_builtin(expr->s);
+		if (builtin != nullptr && builtin->constant != nullptr)
+			return *builtin->constant;
 
 		MML_expr *e = MML_eval_get_variable(state, expr->s);
-		if (e != NULL)
+		if (e != NULL && state->profile == nullptr)
 			return MML_eval_expr_recurse(state, e);
+		if (e != NULL)
+		{
+			MML_profile_enter(state->profile, MML_PROFILE_VARIABLE, expr->s);
+			const MML_value val = MML_eval_expr_recurse(state, e);
+			MML_profile_exit(state->profile);
+			return val;
+		}
 
 		MML_log_warn("undefined identifier: '%.*s'\n",
 				(int)expr->s.len, expr->s.s);
 		return VAL_INVAL;
 	}
 	case FuncObject_type: return (MML_value) { FuncObject_type, .w = expr->w };
+	case String_type: return (MML_value) { String_type, .s = expr->s };
+	case NumArray_type: return (MML_value) { NumArray_type, .a = expr->a };
+	case Range_type: return (MML_value) { Range_type, .r = expr->r };
 	default:
 		break;
 	}
@@ -529,7 +1786,7 @@ MML_value MML_eval_expr_recurse(MML_state *restrict state, const MML_expr *expr)
 	MML_expr *left = expr->o.left;
 	MML_expr *right = expr->o.right;
 
-	if (expr->o.op == MML_OP_ASSERT_EQUAL && left != NULL) {
+	if (expr->op == MML_OP_ASSERT_EQUAL && left != NULL) {
 		if (left->type == Identifier_type) {
 			if (MML_expr_depends_on(state, right, left->s)) {
 				MML_log_err("circular dependency found in definition of '%.*s'\n",
@@ -539,7 +1796,7 @@ MML_value MML_eval_expr_recurse(MML_state *restrict state, const MML_expr *expr)
 			}
 			MML_eval_set_variable(state, left->s, right);
 			return MML_eval_expr_recurse(state, right);
-		} else if (left->type == Operation_type && left->o.op == MML_OP_FUNC_CALL_TOK
+		} else if (left->type == Operation_type && left->op == MML_OP_FUNC_CALL_TOK
 				&& left->o.left->type == Identifier_type && left->o.right->type == Vector_type) {
 			MML_func_object fo;
 			fo.params.ptr = arena_alloc_T(MML_global_arena, left->o.right->v.n, strbuf);
@@ -558,16 +1815,18 @@ MML_value MML_eval_expr_recurse(MML_state *restrict state, const MML_expr *expr)
 			fo.body = right;
 
 			if (is_legal) {
+				MML_func_object *const new_fo = arena_alloc_T(MML_global_arena, 1, MML_func_object);
+				*new_fo = fo;
 				MML_expr *const new_expr = arena_alloc_T(MML_global_arena, 1, MML_expr);
 				new_expr->type = FuncObject_type;
-				new_expr->fo = fo;
+				new_expr->fo = new_fo;
 
 				if (is_legal) MML_eval_set_variable(state, left->o.left->s, new_expr);
 			}
 
 			return NOTHING_VAL; // should return 'nothing' when that's added
 		}
-	} else if (expr->o.op == MML_OP_FUNC_CALL_TOK) {
+	} else if (expr->op == MML_OP_FUNC_CALL_TOK) {
 		if (left == NULL
 		 || right == NULL
 		 || left->type != Identifier_type)
@@ -580,10 +1839,22 @@ MML_value MML_eval_expr_recurse(MML_state *restrict state, const MML_expr *expr)
 		return apply_func(state, left->s, right_val_vec);
 	}
 
+	if (expr->kind == MML_KIND_REAL)
+	{
+		double d;
+		MML_value val;
+		return eval_real(state, expr, &d, &val) ? VAL_NUM(d) : val;
+	} else if (expr->kind == MML_KIND_COMPLEX)
+	{
+		_Complex double z;
+		MML_value val;
+		return eval_complex(state, expr, &z, &val) ? VAL_CNUM(z) : val;
+	}
+
 	return MML_apply_binary_op(state,
 			MML_eval_expr_recurse(state, left),
 			(right != NULL) ? MML_eval_expr_recurse(state, right) : VAL_INVAL,
-			expr->o.op);
+			expr->op);
 }
 
 inline MML_value MML_eval_expr(MML_state *restrict state, const MML_expr *expr)
@@ -591,14 +1862,79 @@ inline MML_value MML_eval_expr(MML_state *restrict state, const MML_expr *expr)
 	return state->last_val = MML_eval_expr_recurse(state, expr);
 }
 
+MML_value MML_eval_stmt(MML_state *restrict state, const MML_expr *expr)
+{
+	// kinds are annotations, not part of what the statement means
+	if (expr != NULL && expr->type == Operation_type && expr->kind == MML_KIND_UNINFERRED)
+		MML_infer_kinds(state, (MML_expr *)expr);
+
+	if (expr == NULL || (state->profile == nullptr && !MML_timing_on && !MML_trace_on))
+		return MML_eval_expr(state, expr);
+
+	MML_phase_begin(MML_PHASE_EVAL);
+	MML_trace_begin(MML_TRACE_STATEMENT, str_lit("statement"), 0);
+	if (state->profile != nullptr)
+		MML_profile_enter_statement(state->profile, expr);
+
+	const MML_value val = MML_eval_expr(state, expr);
+
+	if (state->profile != nullptr)
+		MML_profile_exit(state->profile);
+	MML_trace_end(MML_TRACE_STATEMENT);
+	MML_phase_end(MML_PHASE_EVAL);
+	return val;
+}
+
+
+MML_expr_vec MML_parse_stmts_cached(MML_state *restrict state, const char *s)
+{
+	if (state->parse_cache == nullptr && state->config->parse_cache_size > 0)
+		state->parse_cache = MML_parse_cache_create(state->config->parse_cache_size);
+	if (state->parse_cache != nullptr)
+		return MML_parse_cache_get(state->parse_cache, s);
+
+	MML_expr_dvec parsed = MML_parse_stmts(s);
+	MML_expr_vec ret = { arena_alloc_T(MML_global_arena, dv_n(parsed), MML_expr *), dv_n(parsed) };
+	memcpy(ret.ptr, _dv_ptr(parsed), ret.n * sizeof(MML_expr *));
+	dv_destroy(parsed);
+
+	return ret;
+}
 
 MML_value MML_eval_parse(MML_state *restrict state, const char *s)
 {
-	MML_expr_dvec exprs = MML_parse_stmts(s);
-	MML_value cur;
+	const uint64_t start = (state->recorder != nullptr) ? MML_record_now() : 0;
+
+	const MML_expr_vec exprs = MML_parse_stmts_cached(state, s);
+	MML_value cur = VAL_INVAL;
+	for (size_t i = 0; i < exprs.n; ++i)
+		cur = MML_eval_stmt(state, exprs.ptr[i]);
+
+	if (state->recorder != nullptr)
+		MML_record(state->recorder, s, strlen(s), start);
+	return cur;
+}
+
+MML_value MML_eval_file(MML_state *restrict state, const char *path)
+{
+	const strbuf file = MML_map_file(path);
+	if (file.s == NULL)
+	{
+		MML_log_err("failed to map script file '%s'\n", path);
+		return VAL_INVAL;
+	}
+	dv_push(state->mapped_files, file);
+
+	MML_expr_dvec exprs;
+	if (!MML_is_compiled(file))
+		exprs = MML_parse_stmts_borrowed(file.s);
+	else if (!MML_load_compiled(file, &exprs))
+		return VAL_INVAL;
+
+	MML_value cur = VAL_INVAL;
 	MML_expr **cur_i;
 	dv_foreach(exprs, cur_i)
-		cur = MML_eval_expr(state, *cur_i);
+		cur = MML_eval_stmt(state, *cur_i);
 
 	dv_destroy(exprs);
 
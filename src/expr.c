@@ -4,86 +4,126 @@
 #include <stdio.h>
 #include <math.h>
 #include <stdlib.h>
+#include <string.h>
 
 #include "arena/arena.h"
 #include "mml/parser.h"
 #include "mml/eval.h"
 #include "mml/expr.h"
 #include "mml/config.h"
+#include "mml/output.h"
+#include "mml/timing.h"
 
-#define PRINT_INDENT(_i) printf("%*s", (_i), "")
+#define PRINT_INDENT(_out, _i) MML_out_printf((_out), "%*s", (_i), "")
 
-MML_value MML_print_typedval(MML_state *state, const MML_value *val)
+static inline MML_float_format float_format(const struct MML_config *config)
+{
+	if (config->full_prec_floats)
+		return MML_FLOAT_FIXED;
+	return (config->round_trip_floats) ? MML_FLOAT_SHORTEST : MML_FLOAT_GENERAL;
+}
+
+static void print_complex(const struct MML_config *config, _Complex double z)
+{
+	const MML_float_format fmt = float_format(config);
+	MML_out_double(config->out, creal(z), config->precision, fmt);
+	// matches "%+g": the sign is always written
+	if (!signbit(cimag(z)))
+		MML_out_putc(config->out, '+');
+	MML_out_double(config->out, cimag(z), config->precision, fmt);
+	MML_out_putc(config->out, 'i');
+}
+
+static void print_value(MML_state *state, const MML_value *val)
 {
+	MML_outbuf *out = state->config->out;
 	if (val == nullptr)
 	{
-		printf("(null)");
-		return NOTHING_VAL;
+		MML_out_puts(out, "(null)");
+		return;
 	}
 	switch (val->type) {
 	case Nothing_type: break;
 	case Integer_type:
-		printf("%" PRIi64, val->i);
+		MML_out_int(out, val->i);
 		break;
 	case RealNumber_type:
-		if (state->config->full_prec_floats)
-			printf("%.*f", state->config->precision, val->n);
-		else
-			printf("%.*g", state->config->precision, val->n);
+		MML_out_double(out, val->n, state->config->precision, float_format(state->config));
 		break;
 	case ComplexNumber_type:
-		if (state->config->full_prec_floats)
-			printf("%.*f%+.*fi",
-					state->config->precision, creal(val->cn),
-					state->config->precision, cimag(val->cn));
-		else
-			printf("%.*g%+.*gi",
-					state->config->precision, creal(val->cn),
-					state->config->precision, cimag(val->cn));
+		print_complex(state->config, val->cn);
 		break;
 	case Boolean_type:
 		if (FLAG_IS_SET(BOOLS_PRINT_NUM))
-		{
-			if (state->config->full_prec_floats)
-				printf("%.*f",
-						state->config->precision, (val->b) ? 1.0 : 0.0);
-			else
-				printf("%.*g",
-						state->config->precision, (val->b) ? 1.0 : 0.0);
-		} else
-			printf("%s", (val->b) ? "true" : "false");
+			MML_out_double(out, (val->b) ? 1.0 : 0.0,
+					state->config->precision, float_format(state->config));
+		else
+			MML_out_puts(out, (val->b) ? "true" : "false");
 		break;
 	case Identifier_type:
-		printf("%.*s", (int)val->s.len, val->s.s);
+		MML_out_write(out, val->s.s, val->s.len);
 		break;
 	case Vector_type:
-		fputc('[', stdout);
+		MML_out_putc(out, '[');
 		MML_value cur_val;
 		for (size_t i = 0; i < val->v.n; ++i)
 		{
 			cur_val = MML_eval_expr(state, val->v.ptr[i]);
-			MML_print_typedval(state, &cur_val);
+			print_value(state, &cur_val);
 			if (i < val->v.n-1)
-				fputs(", ", stdout);
+				MML_out_write(out, ", ", 2);
+		}
+		MML_out_putc(out, ']');
+		break;
+	case NumArray_type:
+		MML_out_putc(out, '[');
+		for (size_t i = 0; i < val->a.n; ++i)
+		{
+			cur_val = MML_num_array_get(&val->a, i);
+			print_value(state, &cur_val);
+			if (i < val->a.n-1)
+				MML_out_write(out, ", ", 2);
 		}
-		fputc(']', stdout);
+		MML_out_putc(out, ']');
+		break;
+	case Range_type:
+		// one element at a time, so even a huge range prints in constant space
+		MML_out_putc(out, '[');
+		for (size_t i = 0; i < val->r->n; ++i)
+		{
+			cur_val = VAL_NUM(MML_range_at(val->r, i));
+			print_value(state, &cur_val);
+			if (i < val->r->n-1)
+				MML_out_write(out, ", ", 2);
+		}
+		MML_out_putc(out, ']');
 		break;
 	case FuncObject_type:
-		fputs("FuncObject", stdout);
+		MML_out_puts(out, "FuncObject");
+		break;
+	case String_type:
+		MML_out_write(out, val->s.s, val->s.len);
 		break;
 	default:
-		fputs("(null)", stdout);
+		MML_out_puts(out, "(null)");
 		break;
 	}
 
 	state->config->last_print_was_newline = false;
+}
+
+MML_value MML_print_typedval(MML_state *state, const MML_value *val)
+{
+	MML_phase_begin(MML_PHASE_PRINT);
+	print_value(state, val);
+	MML_phase_end(MML_PHASE_PRINT);
 	return NOTHING_VAL;
 }
 
 inline MML_value MML_println_typedval(MML_state *state, const MML_value *val)
 {
 	MML_value ret = MML_print_typedval(state, val);
-	fputc('\n', stdout);
+	MML_out_newline(state->config->out);
 	state->config->last_print_was_newline = true;
 	return ret;
 }
@@ -93,7 +133,7 @@ MML_value MML_print_typedval_multiargs(MML_state *state, MML_expr_vec *args)
 	{
 		MML_value cur_val = MML_eval_expr(state, args->ptr[i]);
 		MML_print_typedval(state, &cur_val);
-		if (i < args->n-1) fputc(' ', stdout);
+		if (i < args->n-1) MML_out_putc(state->config->out, ' ');
 	}
 
 	return NOTHING_VAL;
@@ -106,97 +146,100 @@ MML_value MML_println_typedval_multiargs(MML_state *state, MML_expr_vec *args)
 		MML_println_typedval(state, &cur_val);
 	}
 	if (args->n == 0)
-		fputc('\n', stdout);
+		MML_out_newline(state->config->out);
 
 	return NOTHING_VAL;
 }
 
 void MML_print_expr(struct MML_config *config, const MML_expr *expr, uint32_t indent)
 {
-	PRINT_INDENT(indent);
+	MML_outbuf *out = config->out;
+	PRINT_INDENT(out, indent);
 	if (expr == nullptr)
 	{
-		printf("(null)\n");
+		MML_out_puts(out, "(null)\n");
 		return;
 	}
 	switch (expr->type) {
 	case Operation_type:
-		printf("Operation(%s,\n", TOK_STRINGS[expr->o.op]);
+		MML_out_printf(out, "Operation(%s,\n", TOK_STRINGS[expr->op]);
 
 		MML_print_expr(config, expr->o.left, indent+4);
-		putchar(',');
+		MML_out_putc(out, ',');
 		if (expr->o.right)
 		{
-			putchar('\n');
+			MML_out_putc(out, '\n');
 			MML_print_expr(config, expr->o.right, indent+4);
-			putchar(',');
+			MML_out_putc(out, ',');
 		}
-		putchar('\n');
-		PRINT_INDENT(indent);
-		putchar(')');
+		MML_out_putc(out, '\n');
+		PRINT_INDENT(out, indent);
+		MML_out_putc(out, ')');
 		break;
-	case Nothing_type: fputs("Nothing", stdout); break;
+	case Nothing_type: MML_out_puts(out, "Nothing"); break;
 	case Integer_type:
-		printf("Integer(%" PRIi64 ")", expr->i);
+		MML_out_puts(out, "Integer(");
+		MML_out_int(out, expr->i);
+		MML_out_putc(out, ')');
 		break;
 	case RealNumber_type:
-		if (config->full_prec_floats)
-			printf("Real(%.*f)", config->precision, expr->n);
-		else
-			printf("Real(%.*g)", config->precision, expr->n);
+		MML_out_puts(out, "Real(");
+		MML_out_double(out, expr->n, config->precision, float_format(config));
+		MML_out_putc(out, ')');
 		break;
 	case ComplexNumber_type:
-		if (config->full_prec_floats)
-			printf("Complex(%.*g%+.*gi)",
-					config->precision, creal(expr->cn),
-					config->precision, cimag(expr->cn));
-		else
-			printf("Complex(%.*g%+.*gi)",
-					config->precision, creal(expr->cn),
-					config->precision, cimag(expr->cn));
+		MML_out_puts(out, "Complex(");
+		print_complex(config, expr->cn);
+		MML_out_putc(out, ')');
 		break;
 	case Boolean_type:
+		MML_out_puts(out, "Boolean(");
 		if (FLAG_IS_SET(BOOLS_PRINT_NUM))
-		{
-			if (config->full_prec_floats)
-				printf("Boolean(%.*f)",
-						config->precision, (expr->b) ? 1.0 : 0.0);
-			else
-				printf("Boolean(%.*g)",
-						config->precision, (expr->b) ? 1.0 : 0.0);
-		} else
-			printf("Boolean(%s)", (expr->b) ? "true" : "false");
+			MML_out_double(out, (expr->b) ? 1.0 : 0.0, config->precision, float_format(config));
+		else
+			MML_out_puts(out, (expr->b) ? "true" : "false");
+		MML_out_putc(out, ')');
 		break;
 	case Identifier_type:
-		printf("Identifier('%.*s')", (int)expr->s.len, expr->s.s);
+		MML_out_printf(out, "Identifier('%.*s')", (int)expr->s.len, expr->s.s);
 		break;
 	case Vector_type:
-		printf("Vector(n=%zu,\n", expr->v.n);
+		MML_out_printf(out, "Vector(n=%zu,\n", expr->v.n);
 		for (size_t i = 0; i < expr->v.n; ++i)
 		{
 			MML_print_expr(config, expr->v.ptr[i], indent+4);
-			fputs(",\n", stdout);
+			MML_out_write(out, ",\n", 2);
 		}
-		PRINT_INDENT(indent);
-		putchar(')');
+		PRINT_INDENT(out, indent);
+		MML_out_putc(out, ')');
 		break;
 	case FuncObject_type:
-		fputs("FuncObject(params=[", stdout);
-		for (size_t i = 0; i < expr->fo.params.len; ++i)
+		MML_out_puts(out, "FuncObject(params=[");
+		for (size_t i = 0; i < expr->fo->params.len; ++i)
 		{
-			const strbuf cur_param_name = expr->fo.params.ptr[i];
-			printf("'%.*s'%s",
+			const strbuf cur_param_name = expr->fo->params.ptr[i];
+			MML_out_printf(out, "'%.*s'%s",
 					(int)cur_param_name.len,
 					cur_param_name.s,
-					(i < expr->fo.params.len-1) ? ", " : "");
+					(i < expr->fo->params.len-1) ? ", " : "");
 		}
-		fputs("], body=", stdout);
-		MML_print_expr(config, expr->fo.body, indent);
-		PRINT_INDENT(indent);
-		putchar(')');
+		MML_out_puts(out, "], body=");
+		MML_print_expr(config, expr->fo->body, indent);
+		PRINT_INDENT(out, indent);
+		MML_out_putc(out, ')');
+		break;
+	case String_type:
+		MML_out_printf(out, "String(\"%.*s\")", (int)expr->s.len, expr->s.s);
+		break;
+	case NumArray_type:
+		MML_out_printf(out, "NumArray(n=%zu, %s)", (size_t)expr->a.n, (expr->a.is_complex) ? "complex" : "real");
+		break;
+	case Range_type:
+		MML_out_printf(out, "Range(start=%g, step=%g, last=%g, n=%zu)",
+				expr->r->start, expr->r->step, expr->r->last, expr->r->n);
 		break;
 	default:
-		printf("Invalid()");
+		MML_out_puts(out, "Invalid()");
 		break;
 	}
 
@@ -206,13 +249,13 @@ void MML_print_expr(struct MML_config *config, const MML_expr *expr, uint32_t in
 inline void MML_print_exprh(const MML_expr *expr)
 {
 	MML_print_expr(&MML_global_config, expr, 0);
-	fputc('\n', stdout);
+	MML_out_newline(MML_global_config.out);
 	MML_global_config.last_print_was_newline = true;
 }
 MML_value MML_print_exprh_tv_func(MML_state *state, MML_expr_vec *args)
 {
 	MML_print_expr(state->config, args->ptr[0], 0);
-	fputc('\n', stdout);
+	MML_out_newline(state->config->out);
 	state->config->last_print_was_newline = true;
 
 	return NOTHING_VAL;
@@ -227,9 +270,11 @@ inline double MML_get_number(const MML_value *v)
 {
 	if (!VAL_IS_NUM(*v) || v->type == ComplexNumber_type)
 		return NAN;
-	return (v->type == RealNumber_type)
-		? v->n
-		: ((v->b) ? 1.0 : 0.0);
+	if (v->type == RealNumber_type)
+		return v->n;
+	if (v->type == Integer_type)
+		return (double)v->i;
+	return (v->b) ? 1.0 : 0.0;
 }
 inline _Complex double MML_get_complex(const MML_value *v)
 {
@@ -239,3 +284,55 @@ inline _Complex double MML_get_complex(const MML_value *v)
 		? v->cn
 		: MML_get_number(v) + 0.0*I;
 }
+
+MML_value MML_num_array_get(const MML_num_array *a, size_t i)
+{
+	if (a->is_complex)
+		return VAL_CNUM(a->ptr[2*i] + a->ptr[2*i+1]*I);
+	return VAL_NUM(a->ptr[i]);
+}
+
+MML_expr_vec MML_num_array_to_vec(const MML_num_array *a)
+{
+	MML_expr_vec ret;
+	ret.ptr = arena_alloc_T(MML_global_arena, a->n, MML_expr *);
+	ret.n = a->n;
+
+	MML_expr *data = arena_alloc_T(MML_global_arena, a->n, MML_expr);
+	for (size_t i = 0; i < a->n; ++i)
+	{
+		const MML_value cur = MML_num_array_get(a, i);
+		data[i].type = cur.type;
+		memcpy(&data[i].w, &cur.w, sizeof(cur.w));
+		ret.ptr[i] = data + i;
+	}
+
+	return ret;
+}
+
+MML_value MML_make_range(double start, double step, double last, size_t n)
+{
+	MML_range *r = arena_alloc_T(MML_global_arena, 1, MML_range);
+	*r = (MML_range) { start, step, last, n };
+	return (MML_value) { Range_type, .r = r };
+}
+
+MML_num_array MML_range_to_num_array(const MML_range *r)
+{
+	if (r->n > MML_RANGE_PACK_MAX)
+	{
+		MML_log_err("a range of %zu elements is too long to be stored (at most %zu)\n",
+				r->n, MML_RANGE_PACK_MAX);
+		return (MML_num_array) { nullptr, 0, false };
+	}
+	double *data = arena_alloc_T(MML_global_arena, r->n, double);
+	if (data == nullptr)
+	{
+		MML_log_err("out of memory storing a range of %zu elements\n", r->n);
+		return (MML_num_array) { nullptr, 0, false };
+	}
+	for (size_t i = 0; i < r->n; ++i)
+		data[i] = MML_range_at(r, i);
+
+	return (MML_num_array) { data, r->n, false };
+}
@@ -0,0 +1,256 @@
+#include "mml/infer.h"
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "mml/builtins.h"
+#include "mml/eval.h"
+#include "mml/expr.h"
+#include "mml/token.h"
+
+// how many definitions deep a variable's kind is looked for, which also
+// stops the search on definitions that refer to each other through calls
+#define MAX_DEFINITION_DEPTH 8
+
+typedef struct {
+	MML_state *state;
+	// the parameters of the function whose body is being inferred, if any
+	const MML_expr_vec *params;
+} infer_ctx;
+
+static MML_value_kind infer(infer_ctx *ctx, MML_expr *e, uint32_t depth, bool annotate);
+
+static MML_value_kind kind_of_type(MML_expr_type type)
+{
+	switch (type) {
+	case Integer_type: return MML_KIND_INTEGER;
+	case RealNumber_type: return MML_KIND_REAL;
+	case ComplexNumber_type: return MML_KIND_COMPLEX;
+	case Boolean_type: return MML_KIND_BOOLEAN;
+	case Vector_type:
+	case NumArray_type:
+	case Range_type:
+		return MML_KIND_VECTOR;
+	default:
+		return MML_KIND_UNKNOWN;
+	}
+}
+
+// integers, reals and booleans all take part in real arithmetic
+static bool is_real_kind(MML_value_kind k)
+{
+	return k == MML_KIND_INTEGER || k == MML_KIND_REAL || k == MML_KIND_BOOLEAN;
+}
+
+static bool is_param(const infer_ctx *ctx, strbuf name)
+{
+	if (ctx->params == NULL)
+		return false;
+	for (size_t i = 0; i < ctx->params->n; ++i)
+	{
+		const strbuf p = ctx->params->ptr[i]->s;
+		if (p.len == name.len && memcmp(p.s, name.s, name.len) == 0)
+			return true;
+	}
+	return false;
+}
+
+static MML_value_kind identifier_kind(infer_ctx *ctx, strbuf name, uint32_t depth)
+{
+	// `ans` changes with every evaluation
+	if ((name.len == 3 && memcmp(name.s, "ans", 3) == 0) || is_param(ctx, name))
+		return MML_KIND_UNKNOWN;
+
+	const MML_builtin *builtin = MML_find_builtin(name);
+	if (builtin != nullptr && builtin->constant != nullptr)
+		return kind_of_type(builtin->constant->type);
+
+	MML_expr *def = MML_eval_get_variable(ctx->state, name);
+	if (def == NULL || depth >= MAX_DEFINITION_DEPTH)
+		return MML_KIND_UNKNOWN;
+
+	// the definition belongs to another statement, so it's only looked at
+	infer_ctx outer = { ctx->state, NULL };
+	return infer(&outer, def, depth + 1, false);
+}
+
+static MML_value_kind call_kind(infer_ctx *ctx, const MML_expr *call, MML_value_kind first_arg)
+{
+	const strbuf name = call->o.left->s;
+	// a user function shadows a builtin of the same name
+	if (MML_eval_get_variable(ctx->state, name) != NULL)
+		return MML_KIND_UNKNOWN;
+
+	const MML_builtin *builtin = MML_find_builtin(name);
+	if (builtin == nullptr || builtin->vec_args != nullptr)
+		return MML_KIND_UNKNOWN;
+
+	if (is_real_kind(first_arg))
+	{
+		if (builtin->cd_d != nullptr)
+			return MML_KIND_COMPLEX;
+		if (builtin->d_d != nullptr)
+			return MML_KIND_REAL;
+	} else if (first_arg == MML_KIND_COMPLEX)
+	{
+		if (builtin->d_cd != nullptr)
+			return MML_KIND_REAL;
+		if (builtin->cd_cd != nullptr)
+			return MML_KIND_COMPLEX;
+	}
+	return MML_KIND_UNKNOWN;
+}
+
+// mirrors the cases of `MML_apply_binary_op`
+static MML_value_kind op_kind(MML_token_type op, MML_value_kind l, MML_value_kind r, bool unary)
+{
+	if (unary)
+	{
+		switch (op) {
+		case MML_OP_UNARY_NOTHING:
+			return l;
+		case MML_OP_NOT_TOK:
+			return is_real_kind(l) ? MML_KIND_BOOLEAN : MML_KIND_UNKNOWN;
+		case MML_OP_NEGATE:
+		case MML_PIPE_TOK:
+			if (l == MML_KIND_INTEGER || l == MML_KIND_COMPLEX)
+				return l;
+			if (is_real_kind(l))
+				return MML_KIND_REAL;
+			return (op == MML_OP_NEGATE && l == MML_KIND_VECTOR) ? l : MML_KIND_UNKNOWN;
+		case MML_OP_ROOT:
+			if (is_real_kind(l))
+				return MML_KIND_REAL;
+			return (l == MML_KIND_COMPLEX) ? l : MML_KIND_UNKNOWN;
+		case MML_TILDE_TOK:
+			return MML_KIND_VECTOR;
+		default:
+			return MML_KIND_UNKNOWN;
+		}
+	}
+
+	const bool l_num = is_real_kind(l) || l == MML_KIND_COMPLEX;
+	const bool r_num = is_real_kind(r) || r == MML_KIND_COMPLEX;
+	if (is_real_kind(l) && is_real_kind(r))
+	{
+		switch (op) {
+		case MML_OP_ADD_TOK: case MML_OP_SUB_TOK:
+		case MML_OP_MUL_TOK: case MML_OP_MOD_TOK:
+			// integers stay integers (unless they overflow)
+			return (l == MML_KIND_INTEGER && r == MML_KIND_INTEGER)
+				? MML_KIND_INTEGER
+				: MML_KIND_REAL;
+		case MML_OP_DIV_TOK: case MML_OP_POW_TOK: case MML_OP_ROOT:
+			return MML_KIND_REAL;
+		case MML_OP_LESS_TOK: case MML_OP_GREATER_TOK:
+		case MML_OP_LESSEQ_TOK: case MML_OP_GREATEREQ_TOK:
+		case MML_OP_EQ_TOK: case MML_OP_NOTEQ_TOK:
+		case MML_OP_EXACT_EQ: case MML_OP_EXACT_NOTEQ:
+			return MML_KIND_BOOLEAN;
+		default:
+			return MML_KIND_UNKNOWN;
+		}
+	} else if (l_num && r_num)
+	{
+		switch (op) {
+		case MML_OP_ADD_TOK: case MML_OP_SUB_TOK:
+		case MML_OP_MUL_TOK: case MML_OP_DIV_TOK:
+		case MML_OP_POW_TOK:
+			return MML_KIND_COMPLEX;
+		case MML_OP_EQ_TOK: case MML_OP_NOTEQ_TOK:
+		case MML_OP_EXACT_EQ: case MML_OP_EXACT_NOTEQ:
+			return MML_KIND_BOOLEAN;
+		default:
+			return MML_KIND_UNKNOWN;
+		}
+	} else if ((l == MML_KIND_VECTOR && r_num) || (l_num && r == MML_KIND_VECTOR))
+	{
+		switch (op) {
+		case MML_OP_ADD_TOK: case MML_OP_SUB_TOK:
+		case MML_OP_MUL_TOK: case MML_OP_DIV_TOK:
+			return MML_KIND_VECTOR;
+		default:
+			return MML_KIND_UNKNOWN;
+		}
+	} else if (l == MML_KIND_VECTOR && r == MML_KIND_VECTOR && op == MML_OP_EQ_TOK)
+		return MML_KIND_BOOLEAN;
+
+	return MML_KIND_UNKNOWN;
+}
+
+// Only writes the kinds it works out into E if ANNOTATE is set; otherwise, it
+// reuses the ones already there.
+static MML_value_kind infer(infer_ctx *ctx, MML_expr *e, uint32_t depth, bool annotate)
+{
+	if (e == NULL)
+		return MML_KIND_UNKNOWN;
+
+	switch (e->type) {
+	case Identifier_type:
+		return identifier_kind(ctx, e->s, depth);
+	case Vector_type:
+		if (annotate)
+			for (size_t i = 0; i < e->v.n; ++i)
+				infer(ctx, e->v.ptr[i], depth, true);
+		return MML_KIND_VECTOR;
+	case Operation_type:
+		break;
+	default:
+		return kind_of_type(e->type);
+	}
+
+	if (!annotate && e->kind != MML_KIND_UNINFERRED)
+		return e->kind;
+
+	MML_expr *left = e->o.left, *right = e->o.right;
+	MML_value_kind kind = MML_KIND_UNKNOWN;
+	if (e->op == MML_OP_ASSERT_EQUAL && left != NULL && left->type == Identifier_type)
+		kind = infer(ctx, right, depth, annotate);
+	else if (e->op == MML_OP_ASSERT_EQUAL && left != NULL && left->type == Operation_type
+			&& left->op == MML_OP_FUNC_CALL_TOK && left->o.right != NULL
+			&& left->o.right->type == Vector_type)
+	{
+		// a function definition: its parameters could be anything
+		if (annotate)
+		{
+			left->kind = MML_KIND_UNKNOWN;
+			infer_ctx body_ctx = { ctx->state, &left->o.right->v };
+			infer(&body_ctx, right, depth, true);
+		}
+	} else if (e->op == MML_OP_FUNC_CALL_TOK)
+	{
+		if (left == NULL || left->type != Identifier_type || right == NULL)
+			kind = MML_KIND_UNKNOWN;
+		else if (right->type == Vector_type && right->v.n > 0)
+		{
+			MML_value_kind first_arg = MML_KIND_UNKNOWN;
+			for (size_t i = 0; i < right->v.n; ++i)
+			{
+				const MML_value_kind k = infer(ctx, right->v.ptr[i], depth, annotate);
+				if (i == 0)
+					first_arg = k;
+				if (!annotate)
+					break;
+			}
+			kind = call_kind(ctx, e, first_arg);
+		}
+	} else
+	{
+		const MML_value_kind l = infer(ctx, left, depth, annotate);
+		const MML_value_kind r = (right != NULL)
+			? infer(ctx, right, depth, annotate)
+			: MML_KIND_UNKNOWN;
+		kind = op_kind(e->op, l, r, right == NULL);
+	}
+
+	if (annotate)
+		e->kind = (uint8_t)kind;
+	return kind;
+}
+
+void MML_infer_kinds(MML_state *state, MML_expr *stmt)
+{
+	infer_ctx ctx = { state, NULL };
+	infer(&ctx, stmt, 0, true);
+}
@@ -0,0 +1,291 @@
+#include "mml/lexer.h"
+
+#include <stdint.h>
+#include <string.h>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#elif defined(__ARM_NEON)
+#include <arm_neon.h>
+#endif
+
+#include "mml/parser.h"
+#include "mml/config.h"
+#include "mml/numparse.h"
+
+/*
+ * Character classes. The lexer spends most of its time skipping whitespace
+ * and walking over identifiers, so both are done 16 bytes at a time: each
+ * block is classified with a few compares, and the first byte outside the
+ * class is found with a count-trailing-zeros of the resulting mask.
+ */
+
+static inline bool is_space(unsigned char c)
+{
+	return c == ' ' || (unsigned char)(c - '\t') <= '\r' - '\t';
+}
+
+static inline bool is_ident_char(unsigned char c)
+{
+	return (unsigned char)((c | 0x20) - 'a') <= 'z' - 'a'
+		|| (unsigned char)(c - '0') <= 9
+		|| c == '_';
+}
+
+#if defined(__SSE2__)
+#define LEXER_BLOCK 16
+typedef __m128i block;
+
+static inline block load_block(const char *p)
+{
+	return _mm_loadu_si128((const block *)p);
+}
+
+// X <= N for every byte, unsigned
+static inline block le_u8(block x, uint8_t n)
+{
+	return _mm_cmpeq_epi8(_mm_min_epu8(x, _mm_set1_epi8((char)n)), x);
+}
+
+static inline block in_range(block x, uint8_t lo, uint8_t hi)
+{
+	return le_u8(_mm_sub_epi8(x, _mm_set1_epi8((char)lo)), (uint8_t)(hi - lo));
+}
+
+static inline block classify_space(block b)
+{
+	return _mm_or_si128(_mm_cmpeq_epi8(b, _mm_set1_epi8(' ')), in_range(b, '\t', '\r'));
+}
+
+static inline block classify_ident(block b)
+{
+	const block letter = in_range(_mm_or_si128(b, _mm_set1_epi8(0x20)), 'a', 'z');
+	const block digit = in_range(b, '0', '9');
+	const block under = _mm_cmpeq_epi8(b, _mm_set1_epi8('_'));
+	return _mm_or_si128(_mm_or_si128(letter, digit), under);
+}
+
+// the index of the first byte not set in the mask M, or 16
+static inline size_t first_unset(block m)
+{
+	const uint32_t miss = ~(uint32_t)_mm_movemask_epi8(m) & 0xFFFF;
+	return (miss != 0) ? (size_t)__builtin_ctz(miss) : 16;
+}
+#elif defined(__ARM_NEON)
+#define LEXER_BLOCK 16
+typedef uint8x16_t block;
+
+static inline block load_block(const char *p)
+{
+	return vld1q_u8((const uint8_t *)p);
+}
+
+static inline block in_range(block x, uint8_t lo, uint8_t hi)
+{
+	return vcleq_u8(vsubq_u8(x, vdupq_n_u8(lo)), vdupq_n_u8((uint8_t)(hi - lo)));
+}
+
+static inline block classify_space(block b)
+{
+	return vorrq_u8(vceqq_u8(b, vdupq_n_u8(' ')), in_range(b, '\t', '\r'));
+}
+
+static inline block classify_ident(block b)
+{
+	const block letter = in_range(vorrq_u8(b, vdupq_n_u8(0x20)), 'a', 'z');
+	const block digit = in_range(b, '0', '9');
+	const block under = vceqq_u8(b, vdupq_n_u8('_'));
+	return vorrq_u8(vorrq_u8(letter, digit), under);
+}
+
+// NEON has no movemask, so the inverted mask is narrowed to 4 bits per byte
+static inline size_t first_unset(block m)
+{
+	const uint64_t miss = vget_lane_u64(vreinterpret_u64_u8(
+			vshrn_n_u16(vreinterpretq_u16_u8(vmvnq_u8(m)), 4)), 0);
+	return (miss != 0) ? (size_t)(__builtin_ctzll(miss) >> 2) : 16;
+}
+#endif
+
+static const char *skip_space(const char *p, const char *end)
+{
+#ifdef LEXER_BLOCK
+	while (end - p >= LEXER_BLOCK)
+	{
+		const size_t n = first_unset(classify_space(load_block(p)));
+		p += n;
+		if (n < LEXER_BLOCK)
+			return p;
+	}
+#endif
+	while (p < end && is_space((unsigned char)*p))
+		++p;
+	return p;
+}
+
+static const char *skip_ident(const char *p, const char *end)
+{
+#ifdef LEXER_BLOCK
+	while (end - p >= LEXER_BLOCK)
+	{
+		const size_t n = first_unset(classify_ident(load_block(p)));
+		p += n;
+		if (n < LEXER_BLOCK)
+			return p;
+	}
+#endif
+	while (p < end && is_ident_char((unsigned char)*p))
+		++p;
+	return p;
+}
+
+typedef struct {
+	MML_token *ptr;
+	size_t n;
+	size_t cap;
+	Arena *arena;
+} token_buf;
+
+// the old array stays behind in the arena until it's reset
+static void grow(token_buf *toks)
+{
+	MML_token *tmp = arena_alloc_T(toks->arena, 2*toks->cap, MML_token);
+	memcpy(tmp, toks->ptr, toks->n * sizeof(MML_token));
+	toks->ptr = tmp;
+	toks->cap *= 2;
+}
+
+static inline void push(token_buf *toks, MML_token tok)
+{
+	if (toks->n == toks->cap)
+		grow(toks);
+	toks->ptr[toks->n++] = tok;
+}
+
+MML_token_vec MML_tokenize(const char *s, Arena *arena)
+{
+	size_t len = strlen(s);
+	if (len > UINT32_MAX)
+	{
+		MML_log_warn("source is longer than %" PRIu32 " bytes; the rest is ignored\n", UINT32_MAX);
+		len = UINT32_MAX;
+	}
+
+	// typical scripts average a bit over 4 bytes per token
+	token_buf toks = { NULL, 0, len/4 + 16, arena };
+	toks.ptr = arena_alloc_T(arena, toks.cap, MML_token);
+
+	const char *const end = s + len;
+	const char *p = s;
+
+	for (;;)
+	{
+		p = skip_space(p, end);
+		const size_t offset = (size_t)(p - s);
+		if (p == end)
+		{
+			push(&toks, nToken(MML_EOF_TOK, offset, 0));
+			break;
+		}
+
+		MML_token tok;
+		const MML_token_type type = TOK_BY_CHAR[(unsigned char)*p];
+		switch (type) {
+		case MML_EOF_TOK:
+			push(&toks, nToken(MML_EOF_TOK, offset, 0));
+			return (MML_token_vec) { toks.ptr, toks.n };
+		case MML_OP_DOT_TOK:
+		case MML_OP_AT_TOK:
+		case MML_OP_POW_TOK:
+		case MML_OP_MUL_TOK:
+		case MML_OP_DIV_TOK:
+		case MML_OP_MOD_TOK:
+		case MML_OP_ADD_TOK:
+		case MML_OP_SUB_TOK:
+		case MML_OPEN_PAREN_TOK:
+		case MML_CLOSE_PAREN_TOK:
+		case MML_OPEN_BRAC_TOK:
+		case MML_CLOSE_BRAC_TOK:
+		case MML_OPEN_BRACKET_TOK:
+		case MML_CLOSE_BRACKET_TOK:
+		case MML_COMMA_TOK:
+		case MML_PIPE_TOK:
+		case MML_SEMICOLON_TOK:
+		case MML_TILDE_TOK:
+			tok = nToken(type, offset, 1);
+			break;
+		case MML_OP_LESS_TOK:
+			tok = (p[1] == '=')
+				? nToken(MML_OP_LESSEQ_TOK, offset, 2)
+				: nToken(MML_OP_LESS_TOK, offset, 1);
+			break;
+		case MML_OP_GREATER_TOK:
+			tok = (p[1] == '=')
+				? nToken(MML_OP_GREATEREQ_TOK, offset, 2)
+				: nToken(MML_OP_GREATER_TOK, offset, 1);
+			break;
+		case MML_OP_EQ_TOK:
+			if (p[1] != '=')
+				tok = nToken(MML_OP_ASSERT_EQUAL, offset, 1);
+			else if (p[2] != '=')
+				tok = nToken(MML_OP_EQ_TOK, offset, 2);
+			else
+				tok = nToken(MML_OP_EXACT_EQ, offset, 3);
+			break;
+		case MML_OP_NOT_TOK:
+			if (p[1] != '=')
+				tok = nToken(MML_OP_NOT_TOK, offset, 1);
+			else if (p[2] != '=')
+				tok = nToken(MML_OP_NOTEQ_TOK, offset, 2);
+			else
+				tok = nToken(MML_OP_EXACT_NOTEQ, offset, 3);
+			break;
+		case MML_DIGIT_TOK: {
+			// indices after a '.' never have a fraction
+			const bool int_only = toks.n > 0 && toks.ptr[toks.n-1].type == MML_OP_DOT_TOK;
+			int64_t int_value;
+			const char *num_end = MML_scan_int(p, int_only, &int_value);
+			if (num_end != p)
+			{
+				tok = nToken(MML_INTEGER_TOK, offset, 0);
+				tok.inum = int_value;
+			} else
+			{
+				double value;
+				num_end = MML_scan_number(p, int_only, &value);
+				tok = nToken(MML_NUMBER_TOK, offset, 0);
+				tok.num = value;
+			}
+			push(&toks, tok);
+			p = num_end;
+			continue;
+		}
+		case MML_DQUOTE_TOK: {
+			const char *close = memchr(p + 1, '"', (size_t)(end - p - 1));
+			if (close == NULL)
+			{
+				MML_log_warn("unterminated string literal starts at '%.5s'\n", p);
+				close = end;
+			}
+			// the token only covers what's between the quotes
+			tok = nToken(MML_STRING_TOK, offset + 1, close - p - 1);
+			p = (close < end) ? close + 1 : end;
+			push(&toks, tok);
+			continue;
+		}
+		case MML_LETTER_TOK:
+		case MML_UNDERSCORE_TOK:
+			tok = nToken(MML_IDENT_TOK, offset, skip_ident(p + 1, end) - p);
+			break;
+		default:
+			MML_log_warn("invalid token starts at '%.5s'\n", p);
+			tok = nToken(MML_INVALID_TOK, offset, 1);
+			break;
+		}
+
+		push(&toks, tok);
+		p += tok.len;
+	}
+
+	return (MML_token_vec) { toks.ptr, toks.n };
+}
@@ -1,6 +1,9 @@
+#define _DEFAULT_SOURCE
+
 #include <signal.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <stddef.h>
 #include <inttypes.h>
 
@@ -9,9 +12,26 @@
 #include "mml/parser.h"
 #include "mml/config.h"
 #include "mml/prompt.h"
+#include "mml/csv.h"
+#include "mml/compile.h"
+#include "mml/server.h"
+#include "mml/batch.h"
+#include "mml/timing.h"
+#include "mml/trace.h"
+#include "arena/arena.h"
 #include "dvec/dvec.h"
+#include "map.h"
 
 extern strbuf expression;
+extern char *script_path;
+extern char *data_path;
+extern char *compile_out_path;
+extern char *serve_path;
+extern char *client_path;
+extern char *session_name;
+extern char *trace_path;
+extern char *record_path;
+extern uint32_t worker_count;
 
 void sig_handler(int32_t signum)
 {
@@ -27,6 +47,109 @@ for (size_t i = 0; i < (n); ++i) \
 	printf(fmt "%s", (p)[i], (i<(n)-1) ? ", " : ""); \
 fputc(']', stdout); }
 
+// Reads the next statement from STREAM into *STMT: everything up to and
+// including a ';' that isn't inside a "string". Returns its length, or -1
+// if STREAM has nothing left.
+static ssize_t read_stmt(FILE *stream, char **stmt, size_t *cap)
+{
+	size_t len = 0;
+	bool in_string = false;
+	int c;
+	while ((c = getc_unlocked(stream)) != EOF)
+	{
+		if (len + 2 > *cap)
+		{
+			*cap = (*cap > 0) ? *cap * 2 : 256;
+			*stmt = realloc(*stmt, *cap);
+		}
+		(*stmt)[len++] = (char)c;
+		if (c == '"')
+			in_string = !in_string;
+		else if (c == ';' && !in_string)
+			break;
+	}
+	if (len == 0)
+		return -1;
+	(*stmt)[len] = '\0';
+	return (ssize_t)len;
+}
+
+// Parses and evaluates one ';'-terminated statement at a time, so only the
+// longest statement has to fit in memory. Statements that don't define
+// anything are dropped from the arena once they've been evaluated.
+static void run_stream(MML_state *state, FILE *stream)
+{
+	char *stmt = NULL;
+	size_t stmt_cap = 0;
+
+	ssize_t stmt_len;
+	while ((stmt_len = read_stmt(stream, &stmt, &stmt_cap)) > 0)
+	{
+		const ArenaMark mark = arena_mark(MML_global_arena);
+		const uint64_t start = (state->recorder != nullptr) ? MML_record_now() : 0;
+
+		MML_expr *expr = MML_parse(stmt);
+		if (expr == NULL)
+			continue;
+
+		// whether anything was defined is only known once it has run, since
+		// a function it calls can define variables too
+		const uint64_t n_definitions = state->n_definitions;
+		bool keep = false;
+		if (!FLAG_IS_SET(NO_EVAL))
+		{
+			MML_value val = MML_eval_stmt(state, expr);
+			if (FLAG_IS_SET(PRINT) && val.type != Nothing_type)
+			{
+				MML_println_typedval(state, &val);
+				state->last_val = val;
+			}
+
+			// `ans` may still point into this statement's allocations
+			keep = state->n_definitions != n_definitions || !VAL_IS_SELF_CONTAINED(val);
+		}
+		MML_out_flush(state->config->out);
+		if (state->recorder != nullptr)
+			MML_record(state->recorder, stmt, (size_t)stmt_len, start);
+
+		if (!keep)
+		{
+			// the arguments of the last call are about to be freed, and so
+			// may be what `ans` refers to
+			if (state->locals != nullptr)
+				hashmap_free(state->locals);
+			state->locals = nullptr;
+			if (!VAL_IS_SELF_CONTAINED(state->last_val))
+				state->last_val = NOTHING_VAL;
+			arena_reset(MML_global_arena, mark);
+		}
+	}
+
+	free(stmt);
+}
+
+// --dbg-time's report, once whatever's left of the output has been flushed
+static void report_timing(void)
+{
+	MML_timing timing;
+	MML_timing_stop(&timing);
+	MML_timing_report(&timing, stderr);
+}
+
+// where `--compile` writes to without -o: SCRIPT with its .mml extension
+// (if it has one) replaced by .mmlc
+static char *default_compile_path(const char *script)
+{
+	size_t len = strlen(script);
+	if (len > 4 && strcmp(script + len - 4, ".mml") == 0)
+		len -= 4;
+
+	char *path = arena_alloc_T(MML_global_arena, len + sizeof(".mmlc"), char);
+	memcpy(path, script, len);
+	memcpy(path + len, ".mmlc", sizeof(".mmlc"));
+	return path;
+}
+
 int32_t main(int32_t argc, char **argv)
 {
 	signal(SIGINT, sig_handler);
@@ -36,6 +159,79 @@ int32_t main(int32_t argc, char **argv)
 	MML_global_config.eval_state = MML_init_state();
 	MML_arg_parse(argc, argv);
 
+	if (serve_path != NULL)
+	{
+		const int32_t ret = MML_serve(serve_path, worker_count);
+		MML_cleanup_state(MML_global_config.eval_state);
+		return ret;
+	}
+
+	if (client_path != NULL)
+	{
+		// same sources as a local run, but read here and evaluated by the daemon
+		strbuf source = expression;
+		if (script_path != NULL)
+			source = MML_map_file(script_path);
+		else if (source.s == NULL)
+			source = MML_read_string_from_stream(stdin);
+
+		int32_t status = -1;
+		if (source.s == NULL)
+			fprintf(stderr, "failed to read the expression to send\n");
+		else
+		{
+			source.len = strlen(source.s);
+			status = MML_client_eval(client_path, session_name, source,
+					FLAG_IS_SET(PRINT) ? MML_REQ_PRINT : 0, stdout, stderr);
+		}
+
+		if (script_path != NULL)
+			MML_unmap_file(source);
+		MML_cleanup_state(MML_global_config.eval_state);
+		return (status < 0) ? 2 : status;
+	}
+
+	// written at exit, once the --batch workers are done
+	if (trace_path != NULL)
+	{
+		if (!MML_trace_start(trace_path))
+		{
+			MML_cleanup_state(MML_global_config.eval_state);
+			return 1;
+		}
+		atexit(MML_trace_stop);
+	}
+
+	// the prompt reports after each line instead; everything else once, at
+	// exit, with whatever the --batch workers timed merged in
+	if (FLAG_IS_SET(DBG_TIME) && !FLAG_IS_SET(RUN_PROMPT))
+	{
+		MML_timing_start();
+		atexit(report_timing);
+	}
+
+	if (FLAG_IS_SET(BATCH))
+	{
+		// the --file script, if any, is the prelude every line can use
+		const int32_t ret = MML_eval_batch(stdin, stdout, stderr, script_path, worker_count);
+		MML_cleanup_state(MML_global_config.eval_state);
+		return ret;
+	}
+
+	// the report is written when the state is cleaned up, whichever way we exit
+	if (FLAG_IS_SET(PROFILE))
+		MML_global_config.eval_state->profile = MML_profile_create();
+	// and so is the recording
+	if (record_path != NULL)
+	{
+		MML_global_config.eval_state->recorder = MML_record_open(record_path);
+		if (MML_global_config.eval_state->recorder == NULL)
+		{
+			MML_cleanup_state(MML_global_config.eval_state);
+			return 1;
+		}
+	}
+
 	if (FLAG_IS_SET(RUN_PROMPT))
 	{
 		MML_run_prompt(MML_global_config.eval_state);
@@ -43,31 +239,98 @@ int32_t main(int32_t argc, char **argv)
 		return 0;
 	}
 
-	if (FLAG_IS_SET(READ_STDIN))
-		expression = MML_read_string_from_stream(stdin);
+	if (FLAG_IS_SET(STREAM_STDIN))
+	{
+		run_stream(MML_global_config.eval_state, stdin);
+		MML_cleanup_state(MML_global_config.eval_state);
+		return 0;
+	}
+
+	const uint64_t start = (MML_global_config.eval_state->recorder != nullptr) ? MML_record_now() : 0;
+
+	MML_expr_dvec exprs;
+	if (script_path != NULL)
+	{
+		expression = MML_map_file(script_path);
+		if (expression.s == NULL)
+		{
+			fprintf(stderr, "failed to map script file '%s'\n", script_path);
+			MML_cleanup_state(MML_global_config.eval_state);
+			return 1;
+		}
+
+		if (!MML_is_compiled(expression))
+			exprs = MML_parse_stmts_borrowed(expression.s);
+		else if (!MML_load_compiled(expression, &exprs))
+		{
+			MML_cleanup_state(MML_global_config.eval_state);
+			MML_unmap_file(expression);
+			return 1;
+		}
+	} else
+	{
+		if (FLAG_IS_SET(READ_STDIN))
+			expression = MML_read_string_from_stream(stdin);
+
+		//Expr *expr = parse(expression.s);
+		//eval_push_expr(&eval_state, expr);
+		exprs = MML_parse_stmts(expression.s);
+	}
 
-	//Expr *expr = parse(expression.s);
-	//eval_push_expr(&eval_state, expr);
-	MML_expr_dvec exprs = MML_parse_stmts(expression.s);
+	const MML_expr_vec stmts = { _dv_ptr(exprs), dv_n(exprs) };
+	if (FLAG_IS_SET(OPTIMIZE))
+		MML_fold_constants(MML_global_config.eval_state, stmts);
 
-	if (!FLAG_IS_SET(NO_EVAL))
+	int32_t ret = 0;
+	if (FLAG_IS_SET(COMPILE))
+	{
+		if (compile_out_path == NULL && script_path != NULL)
+			compile_out_path = default_compile_path(script_path);
+
+		if (compile_out_path == NULL)
+		{
+			fprintf(stderr, "argument error: -o PATH is required to compile an expression that isn't in a script file\n");
+			ret = 1;
+		} else if (MML_write_compiled(stmts, FLAG_IS_SET(OPTIMIZE), compile_out_path) != 0)
+		{
+			ret = 1;
+		}
+	} else if (data_path != NULL && !FLAG_IS_SET(NO_EVAL))
+	{
+		FILE *data = (strcmp(data_path, "-") == 0) ? stdin : fopen(data_path, "r");
+		if (data == NULL)
+		{
+			fprintf(stderr, "failed to open CSV data file '%s'\n", data_path);
+		} else
+		{
+			MML_eval_csv(MML_global_config.eval_state, exprs, data);
+			if (data != stdin)
+				fclose(data);
+		}
+	} else if (!FLAG_IS_SET(NO_EVAL))
 	{
 		MML_expr **cur;
 		dv_foreach(exprs, cur)
 		{
-			MML_value val = MML_eval_expr(
+			MML_value val = MML_eval_stmt(
 					MML_global_config.eval_state,
 					*cur);
 
 			if ((size_t)(cur - _dv_ptr(exprs)) == dv_n(exprs)-1 && FLAG_IS_SET(PRINT))
 				MML_print_typedval(MML_global_config.eval_state, &val);
 		}
+
+		// a compiled script has no source to replay
+		if (MML_global_config.eval_state->recorder != nullptr && !MML_is_compiled(expression))
+			MML_record(MML_global_config.eval_state->recorder, expression.s, strlen(expression.s), start);
 	}
 	dv_destroy(exprs);
 
 	//if (expression.allocd)
 	//	free(expression.s);
 	MML_cleanup_state(MML_global_config.eval_state);
+	if (script_path != NULL)
+		MML_unmap_file(expression);
 
-	return 0;
+	return ret;
 }
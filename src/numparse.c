@@ -0,0 +1,266 @@
+#include "mml/numparse.h"
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "numparse_pow5_incl.c"
+
+#define MAX_MANTISSA_DIGITS 19
+
+// what the scan produced: the value is mantissa * 10^exp10, where MANTISSA
+// holds at most 19 significant digits; TRUNCATED is set if nonzero digits
+// past those were dropped
+typedef struct {
+	uint64_t mantissa;
+	int64_t exp10;
+	int32_t n_digits;
+	bool truncated;
+} decimal;
+
+static inline bool is_digit(char c)
+{
+	return (unsigned char)(c - '0') < 10;
+}
+
+static inline void push_digit(decimal *d, uint32_t digit, bool fraction)
+{
+	if (d->n_digits < MAX_MANTISSA_DIGITS)
+	{
+		d->mantissa = d->mantissa*10 + digit;
+		d->n_digits += (d->mantissa != 0); // leading zeros don't count
+		d->exp10 -= fraction;
+	} else
+	{
+		d->truncated |= (digit != 0);
+		d->exp10 += !fraction;
+	}
+}
+
+static const double exact_pow10[] = {
+	1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11,
+	1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22,
+};
+
+typedef struct {
+	uint64_t lo;
+	uint64_t hi;
+} u128;
+
+static inline u128 full_mul(uint64_t a, uint64_t b)
+{
+#ifdef __SIZEOF_INT128__
+	__extension__ typedef unsigned __int128 uint128;
+	const uint128 p = (uint128)a * b;
+	return (u128) { (uint64_t)p, (uint64_t)(p >> 64) };
+#else
+	const uint64_t M32 = 0xFFFFFFFFu;
+	const uint64_t a_lo = a & M32, a_hi = a >> 32;
+	const uint64_t b_lo = b & M32, b_hi = b >> 32;
+	const uint64_t ll = a_lo * b_lo, lh = a_lo * b_hi;
+	const uint64_t hl = a_hi * b_lo, hh = a_hi * b_hi;
+	const uint64_t mid = (ll >> 32) + (lh & M32) + (hl & M32);
+	return (u128) {
+		(mid << 32) | (ll & M32),
+		hh + (lh >> 32) + (hl >> 32) + (mid >> 32),
+	};
+#endif
+}
+
+/*
+ * Eisel-Lemire (Lemire, "Number Parsing at a Gigabyte per Second", 2021):
+ * multiplies the normalized mantissa by a 128-bit approximation of 5^q and
+ * reads the rounded binary significand straight off the top bits. Returns
+ * false when that isn't enough to decide the rounding, or when the result is
+ * subnormal; the caller then falls back to strtod.
+ */
+static bool eisel_lemire(uint64_t w, int64_t q, double *out)
+{
+	if (q < POW5_SMALLEST_Q || q > POW5_LARGEST_Q)
+		return false;
+
+	const int32_t lz = __builtin_clzll(w);
+	w <<= lz;
+
+	const size_t index = 2 * (size_t)(q - POW5_SMALLEST_Q);
+	u128 product = full_mul(w, pow5_128[index]);
+	// the low 9 bits are all ones: the product might carry into the part
+	// that's kept, so take the next 64 bits of 5^q into account
+	if ((product.hi & 0x1FF) == 0x1FF)
+	{
+		const u128 second = full_mul(w, pow5_128[index + 1]);
+		product.lo += second.hi;
+		if (second.hi > product.lo)
+			++product.hi;
+		if (product.lo == UINT64_MAX && (q < -27 || q > 55))
+			return false;
+	}
+
+	const int32_t upperbit = (int32_t)(product.hi >> 63);
+	const int32_t shift = upperbit + 64 - 52 - 3;
+	uint64_t mantissa = product.hi >> shift;
+	// floor(log2(10^q)) + 63, plus the bias
+	int32_t power2 = (int32_t)(((152170 + 65536) * q) >> 16) + 63 + upperbit - lz + 1023;
+	if (power2 <= 0)
+		return false;
+
+	// exactly halfway between two doubles: round to even
+	if (product.lo <= 1 && q >= -4 && q <= 23 && (mantissa & 3) == 1
+	 && (mantissa << shift) == product.hi)
+		mantissa &= ~(uint64_t)1;
+
+	mantissa += mantissa & 1;
+	mantissa >>= 1;
+	if (mantissa >= ((uint64_t)2 << 52))
+	{
+		mantissa = (uint64_t)1 << 52;
+		++power2;
+	}
+	mantissa &= ~((uint64_t)1 << 52);
+
+	uint64_t bits;
+	if (power2 >= 0x7FF)
+		bits = (uint64_t)0x7FF << 52;
+	else
+		bits = mantissa | ((uint64_t)power2 << 52);
+	memcpy(out, &bits, sizeof(*out));
+	return true;
+}
+
+// the slow path: strtod on a copy of the literal without underscores
+static double strtod_literal(const char *start, const char *end)
+{
+	char small[128];
+	const size_t len = (size_t)(end - start);
+	char *buf = (len < sizeof(small)) ? small : malloc(len + 1);
+	if (buf == NULL)
+		return 0.0;
+
+	char *dst = buf;
+	for (const char *src = start; src < end; ++src)
+		if (*src != '_')
+			*dst++ = *src;
+	*dst = '\0';
+
+	const double ret = strtod(buf, NULL);
+	if (buf != small)
+		free(buf);
+	return ret;
+}
+
+const char *MML_scan_int(const char *s, bool int_only, int64_t *value)
+{
+	const char *p = s;
+	if (!is_digit(*p))
+		return s;
+
+	int64_t v = 0;
+	for (;;)
+	{
+		if (is_digit(*p))
+		{
+			if (__builtin_mul_overflow(v, 10, &v) || __builtin_add_overflow(v, *p++ - '0', &v))
+				return s;
+		} else if (*p == '_' && is_digit(p[1]))
+			++p;
+		else
+			break;
+	}
+
+	// what `MML_scan_number` would take as a fraction or an exponent
+	if (!int_only && (*p == '.'
+			|| ((*p == 'e' || *p == 'E') && (is_digit(p[1])
+				|| ((p[1] == '+' || p[1] == '-') && is_digit(p[2]))))))
+		return s;
+
+	*value = v;
+	return p;
+}
+
+const char *MML_scan_number(const char *s, bool int_only, double *value)
+{
+	const char *p = s;
+	decimal d = { 0, 0, 0, false };
+
+	if (!is_digit(*p))
+		return s;
+
+	for (;;)
+	{
+		if (is_digit(*p))
+			push_digit(&d, (uint32_t)(*p++ - '0'), false);
+		else if (*p == '_' && is_digit(p[1]))
+			++p;
+		else
+			break;
+	}
+
+	if (!int_only && *p == '.')
+	{
+		++p;
+		for (;;)
+		{
+			if (is_digit(*p))
+				push_digit(&d, (uint32_t)(*p++ - '0'), true);
+			else if (*p == '_' && is_digit(p[1]))
+				++p;
+			else
+				break;
+		}
+	}
+
+	if (!int_only && (*p == 'e' || *p == 'E'))
+	{
+		const char *e = p + 1;
+		const bool negative = (*e == '-');
+		if (*e == '+' || *e == '-')
+			++e;
+
+		// a bare 'e' isn't part of the number (`2e` is 2*e)
+		if (is_digit(*e))
+		{
+			int64_t exp = 0;
+			for (; is_digit(*e); ++e)
+				if (exp < 100000)
+					exp = exp*10 + (*e - '0');
+			d.exp10 += (negative) ? -exp : exp;
+			p = e;
+		}
+	}
+
+	if (d.mantissa == 0)
+	{
+		*value = 0.0;
+		return p;
+	}
+
+	if (!d.truncated)
+	{
+		// Clinger's fast path: both operands are exact, so one rounding
+		if (d.mantissa <= ((uint64_t)1 << 53) && d.exp10 >= -22 && d.exp10 <= 22)
+		{
+			*value = (d.exp10 < 0)
+				? (double)d.mantissa / exact_pow10[-d.exp10]
+				: (double)d.mantissa * exact_pow10[d.exp10];
+			return p;
+		}
+		if (eisel_lemire(d.mantissa, d.exp10, value))
+			return p;
+	} else
+	{
+		// the exact value is somewhere in [mantissa, mantissa+1) * 10^exp10
+		double lo, hi;
+		if (d.mantissa < UINT64_MAX
+		 && eisel_lemire(d.mantissa, d.exp10, &lo)
+		 && eisel_lemire(d.mantissa + 1, d.exp10, &hi)
+		 && lo == hi)
+		{
+			*value = lo;
+			return p;
+		}
+	}
+
+	*value = strtod_literal(s, p);
+	return p;
+}
@@ -0,0 +1,526 @@
+#define _DEFAULT_SOURCE
+
+#include "mml/output.h"
+
+#include <float.h>
+#include <math.h>
+#include <stdarg.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "mml/timing.h"
+
+MML_outbuf MML_stdout_buf = { .stream = NULL, .len = 0, .is_tty = -1 };
+
+static inline FILE *out_stream(const MML_outbuf *out)
+{
+	return (out->stream != NULL) ? out->stream : stdout;
+}
+
+void MML_out_flush(MML_outbuf *out)
+{
+	MML_phase_begin(MML_PHASE_PRINT);
+	FILE *stream = out_stream(out);
+	if (out->len > 0)
+		fwrite(out->buf, 1, out->len, stream);
+	out->len = 0;
+	fflush(stream);
+	MML_phase_end(MML_PHASE_PRINT);
+}
+
+void MML_out_write(MML_outbuf *out, const char *s, size_t len)
+{
+	if (len > sizeof(out->buf) - out->len)
+	{
+		MML_out_flush(out);
+		if (len >= sizeof(out->buf))
+		{
+			fwrite(s, 1, len, out_stream(out));
+			return;
+		}
+	}
+	memcpy(out->buf + out->len, s, len);
+	out->len += len;
+}
+
+void MML_out_printf(MML_outbuf *out, const char *fmt, ...)
+{
+	va_list args;
+	va_start(args, fmt);
+	const size_t avail = sizeof(out->buf) - out->len;
+	const int n = vsnprintf(out->buf + out->len, avail, fmt, args);
+	va_end(args);
+
+	if (n < 0)
+		return;
+	if ((size_t)n < avail)
+	{
+		out->len += (size_t)n;
+		return;
+	}
+
+	MML_out_flush(out);
+	va_start(args, fmt);
+	if ((size_t)n < sizeof(out->buf))
+		out->len = (size_t)vsnprintf(out->buf, sizeof(out->buf), fmt, args);
+	else
+		vfprintf(out_stream(out), fmt, args);
+	va_end(args);
+}
+
+void MML_out_newline(MML_outbuf *out)
+{
+	MML_out_putc(out, '\n');
+	if (out->is_tty < 0)
+		out->is_tty = isatty(fileno(out_stream(out))) ? 1 : 0;
+	if (out->is_tty)
+		MML_out_flush(out);
+}
+
+void MML_out_int(MML_outbuf *out, int64_t i)
+{
+	char tmp[24];
+	char *p = tmp + sizeof(tmp);
+	uint64_t u = (i < 0) ? -(uint64_t)i : (uint64_t)i;
+	do {
+		*--p = (char)('0' + u % 10);
+		u /= 10;
+	} while (u != 0);
+	if (i < 0)
+		*--p = '-';
+	MML_out_write(out, p, (size_t)(tmp + sizeof(tmp) - p));
+}
+
+void MML_out_double(MML_outbuf *out, double x, uint32_t precision, MML_float_format fmt)
+{
+	// the fast path never needs more than this
+	if (sizeof(out->buf) - out->len < 64)
+		MML_out_flush(out);
+
+	const size_t avail = sizeof(out->buf) - out->len;
+	const size_t n = MML_format_double(out->buf + out->len, avail, x, precision, fmt);
+	if (n < avail)
+	{
+		out->len += n;
+		return;
+	}
+
+	// only reachable with a huge precision or "%f" of a huge number
+	char *tmp = malloc(n + 1);
+	if (tmp == NULL)
+		return;
+	MML_format_double(tmp, n + 1, x, precision, fmt);
+	MML_out_write(out, tmp, n);
+	free(tmp);
+}
+
+/*
+ * Shortest digits: Grisu2 (Loitsch, "Printing Floating-Point Numbers Quickly
+ * and Accurately with Integers", 2010). It produces a digit string that reads
+ * back as X, almost always the shortest such string, using one 64x64-bit
+ * multiplication per boundary.
+ */
+
+typedef struct {
+	uint64_t f;
+	int32_t e;
+} diy_fp;
+
+#define DP_SIGNIFICAND_SIZE 52
+#define DP_EXPONENT_BIAS (0x3FF + DP_SIGNIFICAND_SIZE)
+#define DP_MIN_EXPONENT (-DP_EXPONENT_BIAS)
+#define DP_HIDDEN_BIT ((uint64_t)1 << DP_SIGNIFICAND_SIZE)
+#define DP_SIGNIFICAND_MASK (DP_HIDDEN_BIT - 1)
+
+// normalized 10^k for k = -348, -340, ..., 340; f is rounded to nearest
+static const diy_fp cached_powers[] = {
+	{ 0xfa8fd5a0081c0288ULL, -1220 }, { 0xbaaee17fa23ebf76ULL, -1193 }, { 0x8b16fb203055ac76ULL, -1166 }, { 0xcf42894a5dce35eaULL, -1140 },
+	{ 0x9a6bb0aa55653b2dULL, -1113 }, { 0xe61acf033d1a45dfULL, -1087 }, { 0xab70fe17c79ac6caULL, -1060 }, { 0xff77b1fcbebcdc4fULL, -1034 },
+	{ 0xbe5691ef416bd60cULL, -1007 }, { 0x8dd01fad907ffc3cULL, -980 }, { 0xd3515c2831559a83ULL, -954 }, { 0x9d71ac8fada6c9b5ULL, -927 },
+	{ 0xea9c227723ee8bcbULL, -901 }, { 0xaecc49914078536dULL, -874 }, { 0x823c12795db6ce57ULL, -847 }, { 0xc21094364dfb5637ULL, -821 },
+	{ 0x9096ea6f3848984fULL, -794 }, { 0xd77485cb25823ac7ULL, -768 }, { 0xa086cfcd97bf97f4ULL, -741 }, { 0xef340a98172aace5ULL, -715 },
+	{ 0xb23867fb2a35b28eULL, -688 }, { 0x84c8d4dfd2c63f3bULL, -661 }, { 0xc5dd44271ad3cdbaULL, -635 }, { 0x936b9fcebb25c996ULL, -608 },
+	{ 0xdbac6c247d62a584ULL, -582 }, { 0xa3ab66580d5fdaf6ULL, -555 }, { 0xf3e2f893dec3f126ULL, -529 }, { 0xb5b5ada8aaff80b8ULL, -502 },
+	{ 0x87625f056c7c4a8bULL, -475 }, { 0xc9bcff6034c13053ULL, -449 }, { 0x964e858c91ba2655ULL, -422 }, { 0xdff9772470297ebdULL, -396 },
+	{ 0xa6dfbd9fb8e5b88fULL, -369 }, { 0xf8a95fcf88747d94ULL, -343 }, { 0xb94470938fa89bcfULL, -316 }, { 0x8a08f0f8bf0f156bULL, -289 },
+	{ 0xcdb02555653131b6ULL, -263 }, { 0x993fe2c6d07b7facULL, -236 }, { 0xe45c10c42a2b3b06ULL, -210 }, { 0xaa242499697392d3ULL, -183 },
+	{ 0xfd87b5f28300ca0eULL, -157 }, { 0xbce5086492111aebULL, -130 }, { 0x8cbccc096f5088ccULL, -103 }, { 0xd1b71758e219652cULL, -77 },
+	{ 0x9c40000000000000ULL, -50 }, { 0xe8d4a51000000000ULL, -24 }, { 0xad78ebc5ac620000ULL, 3 }, { 0x813f3978f8940984ULL, 30 },
+	{ 0xc097ce7bc90715b3ULL, 56 }, { 0x8f7e32ce7bea5c70ULL, 83 }, { 0xd5d238a4abe98068ULL, 109 }, { 0x9f4f2726179a2245ULL, 136 },
+	{ 0xed63a231d4c4fb27ULL, 162 }, { 0xb0de65388cc8ada8ULL, 189 }, { 0x83c7088e1aab65dbULL, 216 }, { 0xc45d1df942711d9aULL, 242 },
+	{ 0x924d692ca61be758ULL, 269 }, { 0xda01ee641a708deaULL, 295 }, { 0xa26da3999aef774aULL, 322 }, { 0xf209787bb47d6b85ULL, 348 },
+	{ 0xb454e4a179dd1877ULL, 375 }, { 0x865b86925b9bc5c2ULL, 402 }, { 0xc83553c5c8965d3dULL, 428 }, { 0x952ab45cfa97a0b3ULL, 455 },
+	{ 0xde469fbd99a05fe3ULL, 481 }, { 0xa59bc234db398c25ULL, 508 }, { 0xf6c69a72a3989f5cULL, 534 }, { 0xb7dcbf5354e9beceULL, 561 },
+	{ 0x88fcf317f22241e2ULL, 588 }, { 0xcc20ce9bd35c78a5ULL, 614 }, { 0x98165af37b2153dfULL, 641 }, { 0xe2a0b5dc971f303aULL, 667 },
+	{ 0xa8d9d1535ce3b396ULL, 694 }, { 0xfb9b7cd9a4a7443cULL, 720 }, { 0xbb764c4ca7a44410ULL, 747 }, { 0x8bab8eefb6409c1aULL, 774 },
+	{ 0xd01fef10a657842cULL, 800 }, { 0x9b10a4e5e9913129ULL, 827 }, { 0xe7109bfba19c0c9dULL, 853 }, { 0xac2820d9623bf429ULL, 880 },
+	{ 0x80444b5e7aa7cf85ULL, 907 }, { 0xbf21e44003acdd2dULL, 933 }, { 0x8e679c2f5e44ff8fULL, 960 }, { 0xd433179d9c8cb841ULL, 986 },
+	{ 0x9e19db92b4e31ba9ULL, 1013 }, { 0xeb96bf6ebadf77d9ULL, 1039 }, { 0xaf87023b9bf0ee6bULL, 1066 },
+};
+
+static const uint32_t pow10_u32[] = {
+	1, 10, 100, 1000, 10000, 100000, 1000000, 10000000, 100000000, 1000000000,
+};
+
+static diy_fp diy_fp_from_double(double d)
+{
+	uint64_t bits;
+	memcpy(&bits, &d, sizeof(bits));
+	const int32_t biased_e = (int32_t)((bits >> DP_SIGNIFICAND_SIZE) & 0x7FF);
+	const uint64_t significand = bits & DP_SIGNIFICAND_MASK;
+	if (biased_e != 0)
+		return (diy_fp) { significand + DP_HIDDEN_BIT, biased_e - DP_EXPONENT_BIAS };
+	return (diy_fp) { significand, DP_MIN_EXPONENT + 1 };
+}
+
+#ifdef __SIZEOF_INT128__
+__extension__ typedef unsigned __int128 uint128;
+#endif
+
+static diy_fp diy_fp_mul(diy_fp a, diy_fp b)
+{
+#ifdef __SIZEOF_INT128__
+	const uint128 p = (uint128)a.f * b.f;
+	uint64_t h = (uint64_t)(p >> 64);
+	if ((uint64_t)p & ((uint64_t)1 << 63))
+		++h; // round
+	return (diy_fp) { h, a.e + b.e + 64 };
+#else
+	const uint64_t M32 = 0xFFFFFFFFu;
+	const uint64_t a_hi = a.f >> 32, a_lo = a.f & M32;
+	const uint64_t b_hi = b.f >> 32, b_lo = b.f & M32;
+	const uint64_t hh = a_hi * b_hi, hl = a_hi * b_lo;
+	const uint64_t lh = a_lo * b_hi, ll = a_lo * b_lo;
+	uint64_t tmp = (ll >> 32) + (hl & M32) + (lh & M32);
+	tmp += (uint64_t)1 << 31; // round
+	return (diy_fp) { hh + (hl >> 32) + (lh >> 32) + (tmp >> 32), a.e + b.e + 64 };
+#endif
+}
+
+static diy_fp diy_fp_normalize(diy_fp x)
+{
+	const int s = __builtin_clzll(x.f);
+	return (diy_fp) { x.f << s, x.e - s };
+}
+
+static void normalized_boundaries(diy_fp v, diy_fp *minus, diy_fp *plus)
+{
+	diy_fp pl = { (v.f << 1) + 1, v.e - 1 };
+	while (!(pl.f & (DP_HIDDEN_BIT << 1)))
+	{
+		pl.f <<= 1;
+		pl.e--;
+	}
+	pl.f <<= 64 - DP_SIGNIFICAND_SIZE - 2;
+	pl.e -= 64 - DP_SIGNIFICAND_SIZE - 2;
+
+	// the gap below a power of two is half the size of the gap above it
+	diy_fp mi = (v.f == DP_HIDDEN_BIT)
+		? (diy_fp) { (v.f << 2) - 1, v.e - 2 }
+		: (diy_fp) { (v.f << 1) - 1, v.e - 1 };
+	mi.f <<= mi.e - pl.e;
+	mi.e = pl.e;
+
+	*plus = pl;
+	*minus = mi;
+}
+
+// returns c_{-k} such that E + c.e + 64 lands in [-60, -32]; sets *K = k
+static diy_fp get_cached_power(int32_t e, int32_t *K)
+{
+	const double dk = (-61 - e) * 0.30102999566398114 + 347;
+	int32_t k = (int32_t)dk;
+	if (dk - k > 0.0)
+		++k;
+
+	const uint32_t index = (uint32_t)((k >> 3) + 1);
+	*K = -(-348 + (int32_t)(index << 3));
+	return cached_powers[index];
+}
+
+static void grisu_round(char *buf, int32_t len, uint64_t delta, uint64_t rest, uint64_t ten_kappa, uint64_t wp_w)
+{
+	while (rest < wp_w && delta - rest >= ten_kappa
+	    && (rest + ten_kappa < wp_w || wp_w - rest > rest + ten_kappa - wp_w))
+	{
+		buf[len - 1]--;
+		rest += ten_kappa;
+	}
+}
+
+static int32_t count_digits_u32(uint32_t n)
+{
+	int32_t d = 1;
+	while (d < 10 && n >= pow10_u32[d])
+		++d;
+	return d;
+}
+
+static void digit_gen(diy_fp W, diy_fp Mp, uint64_t delta, char *buf, int32_t *len, int32_t *K)
+{
+	const diy_fp one = { (uint64_t)1 << -Mp.e, Mp.e };
+	const uint64_t wp_w = Mp.f - W.f;
+	uint32_t p1 = (uint32_t)(Mp.f >> -one.e);
+	uint64_t p2 = Mp.f & (one.f - 1);
+	int32_t kappa = count_digits_u32(p1);
+	*len = 0;
+
+	while (kappa > 0)
+	{
+		const uint32_t div = pow10_u32[kappa - 1];
+		const uint32_t d = p1 / div;
+		p1 %= div;
+		if (d != 0 || *len != 0)
+			buf[(*len)++] = (char)('0' + d);
+		--kappa;
+
+		const uint64_t rest = ((uint64_t)p1 << -one.e) + p2;
+		if (rest <= delta)
+		{
+			*K += kappa;
+			grisu_round(buf, *len, delta, rest, (uint64_t)pow10_u32[kappa] << -one.e, wp_w);
+			return;
+		}
+	}
+
+	for (;;)
+	{
+		p2 *= 10;
+		delta *= 10;
+		const char d = (char)(p2 >> -one.e);
+		if (d != 0 || *len != 0)
+			buf[(*len)++] = (char)('0' + d);
+		p2 &= one.f - 1;
+		--kappa;
+		if (p2 < delta)
+		{
+			*K += kappa;
+			const int32_t index = -kappa;
+			grisu_round(buf, *len, delta, p2, one.f, wp_w * ((index < 10) ? pow10_u32[index] : 0));
+			return;
+		}
+	}
+}
+
+// writes the digits of V (finite, > 0) to BUF; V == BUF[0..len) * 10^*K
+static int32_t grisu2(double v, char *buf, int32_t *K)
+{
+	const diy_fp x = diy_fp_from_double(v);
+	diy_fp w_m, w_p;
+	normalized_boundaries(x, &w_m, &w_p);
+
+	const diy_fp c_mk = get_cached_power(w_p.e, K);
+	const diy_fp W = diy_fp_mul(diy_fp_normalize(x), c_mk);
+	diy_fp Wp = diy_fp_mul(w_p, c_mk);
+	diy_fp Wm = diy_fp_mul(w_m, c_mk);
+	Wm.f++;
+	Wp.f--;
+
+	int32_t len;
+	digit_gen(W, Wp, Wp.f - Wm.f, buf, &len, K);
+	return len;
+}
+
+/*
+ * printf emulation. The shortest digits D of x differ from x by less than
+ * half an ulp, i.e. by less than 2^-53 relative. Rounding D to p <= 15
+ * significant digits therefore gives the same result as rounding x, unless
+ * the discarded digits of D sit within that error of a tie; those cases (and
+ * anything needing more digits than D carries) go to snprintf.
+ */
+
+#define FAST_MAX_DIGITS 15
+
+static const uint64_t pow10_u64[] = {
+	1ULL, 10ULL, 100ULL, 1000ULL, 10000ULL, 100000ULL, 1000000ULL, 10000000ULL,
+	100000000ULL, 1000000000ULL, 10000000000ULL, 100000000000ULL,
+	1000000000000ULL, 10000000000000ULL, 100000000000000ULL,
+	1000000000000000ULL, 10000000000000000ULL, 100000000000000000ULL,
+};
+
+// rounds the N digits in D to P < N digits, to nearest like the exact value
+// would be; returns false if that can't be decided from D
+static bool round_digits(char *d, int32_t *n, int32_t p, int32_t *e10)
+{
+	uint64_t tail = 0;
+	for (int32_t i = p; i < *n; ++i)
+		tail = tail*10 + (uint64_t)(d[i] - '0');
+
+	// distance from the tie, in units of half the last digit of D
+	const uint64_t half = pow10_u64[*n - p];
+	const uint64_t dist = (2*tail > half) ? 2*tail - half : half - 2*tail;
+	const uint64_t margin = (*n >= 17) ? 45 : (*n == 16) ? 5 : 0;
+	if (dist <= margin)
+		return false;
+
+	*n = p;
+	if (2*tail < half)
+		return true;
+
+	int32_t i = p - 1;
+	while (i >= 0 && d[i] == '9')
+		d[i--] = '0';
+	if (i >= 0)
+	{
+		d[i]++;
+	} else
+	{
+		d[0] = '1';
+		++*e10;
+	}
+	return true;
+}
+
+static char *write_exponent(char *p, int32_t e10)
+{
+	*p++ = 'e';
+	*p++ = (e10 < 0) ? '-' : '+';
+	if (e10 < 0)
+		e10 = -e10;
+	if (e10 >= 100)
+	{
+		*p++ = (char)('0' + e10 / 100);
+		e10 %= 100;
+	}
+	*p++ = (char)('0' + e10 / 10);
+	*p++ = (char)('0' + e10 % 10);
+	return p;
+}
+
+// d.ddde+XX
+static char *write_scientific(char *p, const char *d, int32_t n, int32_t e10)
+{
+	*p++ = d[0];
+	if (n > 1)
+	{
+		*p++ = '.';
+		memcpy(p, d + 1, (size_t)(n - 1));
+		p += n - 1;
+	}
+	return write_exponent(p, e10);
+}
+
+// positional notation with exactly DECIMALS digits after the point
+static char *write_positional(char *p, const char *d, int32_t n, int32_t e10, int32_t decimals)
+{
+	if (e10 < 0)
+	{
+		*p++ = '0';
+	} else
+	{
+		for (int32_t i = 0; i <= e10; ++i)
+			*p++ = (i < n) ? d[i] : '0';
+	}
+
+	if (decimals > 0)
+	{
+		*p++ = '.';
+		for (int32_t i = e10 + 1; i <= e10 + decimals; ++i)
+			*p++ = (i >= 0 && i < n) ? d[i] : '0';
+	}
+	return p;
+}
+
+static int32_t strip_zeros(const char *d, int32_t n)
+{
+	while (n > 1 && d[n - 1] == '0')
+		--n;
+	return n;
+}
+
+// formats finite X into P (at least 64 bytes); returns the end, or NULL if
+// the result has to come from snprintf
+static char *format_fast(char *p, double x, int32_t precision, MML_float_format fmt)
+{
+	if (signbit(x))
+	{
+		*p++ = '-';
+		x = -x;
+	}
+
+	if (x == 0.0)
+	{
+		*p++ = '0';
+		if (fmt == MML_FLOAT_FIXED && precision > 0)
+		{
+			if (precision > 48)
+				return NULL;
+			*p++ = '.';
+			memset(p, '0', (size_t)precision);
+			p += precision;
+		}
+		return p;
+	}
+
+	char d[24];
+	int32_t K;
+	int32_t n = grisu2(x, d, &K);
+	int32_t e10 = n + K - 1;
+
+	switch (fmt) {
+	case MML_FLOAT_SHORTEST:
+		if (e10 < -4 || e10 >= 17)
+			return write_scientific(p, d, n, e10);
+		return write_positional(p, d, n, e10, (n - 1 - e10 > 0) ? n - 1 - e10 : 0);
+	case MML_FLOAT_GENERAL:
+		if (precision == 0)
+			precision = 1;
+		if (precision > FAST_MAX_DIGITS)
+			return NULL;
+		if (n > precision && !round_digits(d, &n, precision, &e10))
+			return NULL;
+		n = strip_zeros(d, n);
+		if (e10 < -4 || e10 >= precision)
+			return write_scientific(p, d, n, e10);
+		return write_positional(p, d, n, e10, (n - 1 - e10 > 0) ? n - 1 - e10 : 0);
+	case MML_FLOAT_FIXED: {
+		const int32_t sig = e10 + 1 + precision;
+		if (sig < 1 || sig > FAST_MAX_DIGITS || precision > 32)
+			return NULL;
+		if (n > sig && !round_digits(d, &n, sig, &e10))
+			return NULL;
+		return write_positional(p, d, n, e10, precision);
+	}
+	}
+
+	return NULL;
+}
+
+size_t MML_format_double(char *dst, size_t size, double x, uint32_t precision, MML_float_format fmt)
+{
+	// the error bound above doesn't hold for subnormals
+	if (isfinite(x) && (x == 0.0 || fabs(x) >= DBL_MIN) && precision <= INT32_MAX)
+	{
+		char tmp[64];
+		const char *end = format_fast(tmp, x, (int32_t)precision, fmt);
+		if (end != NULL)
+		{
+			const size_t len = (size_t)(end - tmp);
+			if (size > 0)
+			{
+				const size_t n = (len < size) ? len : size - 1;
+				memcpy(dst, tmp, n);
+				dst[n] = '\0';
+			}
+			return len;
+		}
+	}
+
+	int n;
+	switch (fmt) {
+	case MML_FLOAT_FIXED:
+		n = snprintf(dst, size, "%.*f", (int)precision, x);
+		break;
+	case MML_FLOAT_SHORTEST:
+		n = snprintf(dst, size, "%.17g", x);
+		break;
+	default:
+		n = snprintf(dst, size, "%.*g", (int)precision, x);
+		break;
+	}
+	return (n < 0) ? 0 : (size_t)n;
+}
@@ -0,0 +1,116 @@
+#include "mml/parse_cache.h"
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "mml/parser.h"
+#include "mml/eval.h"
+#include "mml/config.h"
+#include "arena/arena.h"
+#include "dvec/dvec.h"
+
+#define PARSE_CACHE_WAYS 4
+
+typedef struct {
+	uint64_t hash;
+	char *src; // malloc'd copy of the key; NULL if the entry is empty
+	size_t len;
+	MML_expr_vec stmts;
+	uint64_t last_used;
+} cache_entry;
+
+struct MML_parse_cache {
+	cache_entry *entries;
+	size_t set_mask;
+	uint64_t tick;
+};
+
+// 64-bit FNV-1a
+static uint64_t hash_text(const char *s, size_t len)
+{
+	uint64_t h = 0xcbf29ce484222325;
+	for (size_t i = 0; i < len; ++i)
+	{
+		h ^= (uint8_t)s[i];
+		h *= 0x100000001b3;
+	}
+	return h;
+}
+
+MML_parse_cache *MML_parse_cache_create(size_t n_entries)
+{
+	size_t n_sets = 1;
+	while (n_sets * PARSE_CACHE_WAYS < n_entries)
+		n_sets *= 2;
+
+	MML_parse_cache *cache = calloc(1, sizeof(MML_parse_cache));
+	cache->entries = calloc(n_sets * PARSE_CACHE_WAYS, sizeof(cache_entry));
+	if (cache->entries == NULL)
+	{
+		MML_log_err("failed to allocate a parse cache of %zu entries\n", n_sets * PARSE_CACHE_WAYS);
+		free(cache);
+		return NULL;
+	}
+	cache->set_mask = n_sets - 1;
+
+	return cache;
+}
+
+void MML_parse_cache_destroy(MML_parse_cache *cache)
+{
+	if (cache == NULL)
+		return;
+
+	for (size_t i = 0; i < (cache->set_mask+1) * PARSE_CACHE_WAYS; ++i)
+		free(cache->entries[i].src);
+	free(cache->entries);
+	free(cache);
+}
+
+MML_expr_vec MML_parse_cache_get(MML_parse_cache *cache, const char *s)
+{
+	const size_t len = strlen(s);
+	const uint64_t hash = hash_text(s, len);
+	cache_entry *set = &cache->entries[(hash & cache->set_mask) * PARSE_CACHE_WAYS];
+
+	// an empty entry if there is one, otherwise the least recently used
+	cache_entry *victim = &set[0];
+	for (size_t i = 0; i < PARSE_CACHE_WAYS; ++i)
+	{
+		cache_entry *cur = &set[i];
+		if (cur->src != NULL && cur->hash == hash && cur->len == len
+		 && memcmp(cur->src, s, len) == 0)
+		{
+			cur->last_used = ++cache->tick;
+			return cur->stmts;
+		}
+		if (victim->src != NULL && (cur->src == NULL || cur->last_used < victim->last_used))
+			victim = cur;
+	}
+
+	uint32_t n_errors;
+	MML_expr_dvec parsed = MML_parse_stmts_checked(s, &n_errors);
+	MML_expr_vec stmts = { arena_alloc_T(MML_global_arena, dv_n(parsed), MML_expr *), dv_n(parsed) };
+	memcpy(stmts.ptr, _dv_ptr(parsed), stmts.n * sizeof(MML_expr *));
+	dv_destroy(parsed);
+
+	if (n_errors > 0)
+		return stmts;
+
+	char *key = malloc(len + 1);
+	if (key == NULL)
+		return stmts;
+	memcpy(key, s, len + 1);
+
+	free(victim->src);
+	*victim = (cache_entry) {
+		.hash = hash,
+		.src = key,
+		.len = len,
+		.stmts = stmts,
+		.last_used = ++cache->tick,
+	};
+
+	return stmts;
+}
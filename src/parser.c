@@ -1,12 +1,15 @@
 #include <stdint.h>
 #include <stdlib.h>
-#include <ctype.h>
+#include <string.h>
 
 #include "mml/parser.h"
 #include "mml/eval.h"
 #include "mml/expr.h"
 #include "mml/token.h"
 #include "mml/config.h"
+#include "mml/lexer.h"
+#include "mml/timing.h"
+#include "mml/trace.h"
 #include "arena/arena.h"
 #include "dvec/dvec.h"
 
@@ -37,6 +40,8 @@ const char *const TOK_STRINGS[] = {
 
 	"IDENT_TOK",
 	"NUMBER_TOK",
+	"INTEGER_TOK",
+	"STRING_TOK",
 
 	"DIGIT_TOK",
 	"LETTER_TOK",
@@ -83,193 +88,135 @@ const char *const EXPR_TYPE_STRINGS[] = {
 	"identifier",
 	"vector",
 	"function object",
+	"string",
+	"numeric array",
+	"range",
 };
 
 
-// Gets the next token and advances the string pointer.
-static MML_token get_next_token(const char **s, struct parser_state *state)
+// Gets the next token and advances past it. The token array always ends with
+// an EOF token, which is returned for every call after reaching it.
+static inline MML_token get_next_token(struct parser_state *state)
 {
-	MML_token ret = nToken(MML_INVALID_TOK, NULL, 0);
-
-	if (state->has_peeked) {
-		state->has_peeked = false;
-		*s = state->saved_s;
-		return state->peeked_tok;
-	}
+	const MML_token tok = state->toks[state->pos];
+	if (state->pos < state->n_toks-1)
+		++state->pos;
+	return state->current_tok = tok;
+}
 
-	const char *cached_s = *s;
-	while (isspace(*cached_s)) ++cached_s;
-
-	MML_token_type type = TOK_BY_CHAR[(unsigned char)*cached_s];
-	switch (type) {
-	case MML_EOF_TOK:
-		*s = cached_s;
-		return state->current_tok = nToken(MML_EOF_TOK, NULL, 0);
-	case MML_OP_DOT_TOK:
-	case MML_OP_AT_TOK:
-	case MML_OP_POW_TOK:
-	case MML_OP_MUL_TOK:
-	case MML_OP_DIV_TOK:
-	case MML_OP_MOD_TOK:
-	case MML_OP_ADD_TOK:
-	case MML_OP_SUB_TOK:
-	case MML_OPEN_PAREN_TOK:
-	case MML_CLOSE_PAREN_TOK:
-	case MML_OPEN_BRAC_TOK:
-	case MML_CLOSE_BRAC_TOK:
-	case MML_OPEN_BRACKET_TOK:
-	case MML_CLOSE_BRACKET_TOK:
-	case MML_COMMA_TOK:
-	case MML_PIPE_TOK:
-	case MML_SEMICOLON_TOK:
-	case MML_TILDE_TOK:
-		ret = nToken(type, cached_s, 1);
-		++cached_s;
-		break;
-	case MML_OP_LESS_TOK:
-		if ((cached_s)[1] == '=')
-		{
-			ret = nToken(MML_OP_LESSEQ_TOK, cached_s, 2);
-			cached_s += 2;
-			break;
-		}
-		ret = nToken(MML_OP_LESS_TOK, cached_s, 1);
-		++cached_s;
-		break;
-	case MML_OP_GREATER_TOK:
-		if ((cached_s)[1] == '=')
-		{
-			ret = nToken(MML_OP_GREATEREQ_TOK, cached_s, 2);
-			cached_s += 2;
-			break;
-		}
-		ret = nToken(MML_OP_GREATER_TOK, cached_s, 1);
-		++cached_s;
-		break;
-	case MML_OP_EQ_TOK:
-		if (cached_s[1] != '=')
-		{
-			ret = nToken(MML_OP_ASSERT_EQUAL, cached_s, 1);
-			++cached_s;
-		} else if (cached_s[2] != '=')
-		{
-			ret = nToken(MML_OP_EQ_TOK, cached_s, 2);
-			cached_s += 2;
-		} else
-		{
-			ret = nToken(MML_OP_EXACT_EQ, cached_s, 3);
-			cached_s += 3;
-		}
-		break;
-	case MML_OP_NOT_TOK:
-		if ((cached_s)[1] != '=')
-		{
-			ret = nToken(MML_OP_NOT_TOK, cached_s, 1);
-			++cached_s;
-		} else if ((cached_s)[2] != '=')
-		{
-			ret = nToken(MML_OP_NOTEQ_TOK, cached_s, 2);
-			cached_s += 2;
-		} else
-		{
-			ret = nToken(MML_OP_EXACT_NOTEQ, cached_s, 3);
-			cached_s += 3;
-		}
-		break;
-	case MML_DIGIT_TOK: {
-		const char *const start = cached_s;
-		bool has_dot = false;
-		bool has_exp = false;
-		size_t n_underscores = 0;
+static inline MML_token peek_token(const struct parser_state *state)
+{
+	return state->toks[state->pos];
+}
 
-		while (true)
-		{
-			if (isdigit(*cached_s)) {
-				++cached_s;
-			} else if (*cached_s == '_' && isdigit(cached_s[1])) {
-				cached_s += 2;
-				++n_underscores;
-			} else if (!state->looking_for_int && *cached_s == '.' && !has_dot) {
-				has_dot = true;
-				++cached_s;
-			} else if (!state->looking_for_int && !has_exp && (*cached_s == 'e' || *cached_s == 'E')) {
-				has_exp = true;
-				++cached_s;
-				if (*cached_s == '+' || *cached_s == '-') ++cached_s;
-				if (!isdigit(*cached_s)) break;
-				while (isdigit(*cached_s)) ++cached_s;
-			} else break;
-		}
+// the text of TOK, copied into the arena unless the source is borrowed
+static inline strbuf tok_str(const struct parser_state *state, MML_token tok)
+{
+	const strbuf buf = { (char *)state->src + tok.offset, tok.len };
+	return state->borrow_source ? buf : strbuf_dup(buf);
+}
 
-		size_t raw_len = cached_s - start;
+#define PARSER_MAX_PRECED 15
 
-		if (n_underscores == 0) {
-			ret = nToken(MML_NUMBER_TOK, start, raw_len);
-			break;
-		}
-		
-		char *buf = arena_alloc_T(MML_global_arena, raw_len-n_underscores, char);
-		char *dst = buf;
+static bool op_is_unary(MML_token_type op)
+{
+	return (op == MML_TILDE_TOK || (op >= MML_OP_NOT_TOK && op <= MML_OP_UNARY_NOTHING));
+}
 
-		for (const char *src = start; src < cached_s && (size_t)(dst - buf) < raw_len - 1; ++src)
-			if (*src != '_') *dst++ = *src;
+static bool op_is_right_associative(MML_token_type op)
+{
+	return op == MML_OP_POW_TOK || op_is_unary(op);
+}
 
-		ret = nToken(MML_NUMBER_TOK, buf, dst - buf);
-		break;
-	}
-	case MML_LETTER_TOK:
-	case MML_UNDERSCORE_TOK: {
-		const char *const start = (char *)cached_s;
-		do {
-			++cached_s;
-		} while (isalnum(*cached_s) || *cached_s == '_');
-		ret = nToken(MML_IDENT_TOK, start, cached_s - start);
-		break;
-	}
-	default:
-		MML_log_warn("invalid token starts at '%.5s'\n", cached_s++);
-		break;
-	}
+/*
+ * The parser is a Pratt parser that keeps its stack in `state->frames`
+ * instead of on the C stack, so the nesting depth is only limited by memory.
+ * It alternates between reading an operand and the operators after it; an
+ * operand that needs a subexpression parsed first pushes a frame saying what
+ * to do with the result, and each finished subexpression is handed to the
+ * topmost frame.
+ */
+
+typedef enum {
+	FRAME_UNARY,	// the operand of the prefix operator `op`
+	FRAME_BINARY,	// the right operand of `node op`
+	FRAME_PAREN,	// the contents of (...)
+	FRAME_PIPE,	// the contents of |...|
+	FRAME_CALL,	// an argument of the function call `node`
+	FRAME_VECTOR,	// an element of the vector literal `node`
+} frame_kind;
+
+struct parser_frame {
+	frame_kind kind;
+	MML_token_type op;
+	uint32_t max_preced; // that of the expression the frame is part of
+	MML_expr *node;
+	size_t first_elem; // where the elements of `node` start in `state->elems`
+};
 
+typedef enum {
+	OPERAND_DONE,	// the operand is complete; operators after it come next
+	OPERAND_PUSHED,	// a frame was pushed; its subexpression comes next
+	OPERAND_FAILED,	// nothing was parsed; the operators after it are skipped
+} operand_result;
 
-	state->current_tok = ret;
-	*s = cached_s;
+// doubles the capacity of a scratch array; the old one stays in the arena
+static void *grow_scratch(Arena *arena, void *ptr, size_t n, size_t *cap, size_t elem_size, size_t align)
+{
+	*cap = (*cap != 0) ? 2 * *cap : 64;
+	void *ret = arena_alloc(arena, *cap * elem_size, align);
+	if (n > 0)
+		memcpy(ret, ptr, n * elem_size);
 	return ret;
 }
 
-// Peeks at the next token without advancing the string pointer.
-static MML_token peek_token(const char **s, struct parser_state *state)
+static void push_frame(struct parser_state *state, struct parser_frame frame)
 {
-	if (!state->has_peeked)
-	{
-		const char *s_copy = *s;
-		state->peeked_tok = get_next_token(&s_copy, state);
-		state->saved_s = s_copy;
-		state->has_peeked = true;
-	}
-	return state->peeked_tok;
+	if (state->n_frames == state->frames_cap)
+		state->frames = grow_scratch(state->scratch, state->frames, state->n_frames,
+				&state->frames_cap, sizeof(struct parser_frame), _Alignof(struct parser_frame));
+	state->frames[state->n_frames++] = frame;
 }
 
-#define PARSER_MAX_PRECED 15
-
-static bool op_is_unary(MML_token_type op)
+static void push_elem(struct parser_state *state, MML_expr *e)
 {
-	return (op == MML_TILDE_TOK || (op >= MML_OP_NOT_TOK && op <= MML_OP_UNARY_NOTHING));
+	if (state->n_elems == state->elems_cap)
+		state->elems = grow_scratch(state->scratch, state->elems, state->n_elems,
+				&state->elems_cap, sizeof(MML_expr *), _Alignof(MML_expr *));
+	state->elems[state->n_elems++] = e;
 }
 
-static bool op_is_right_associative(MML_token_type op)
+// moves the elements from FIRST on off the scratch stack and into the arena
+static MML_expr_vec pop_elems(struct parser_state *state, size_t first)
 {
-	return op == MML_OP_POW_TOK || op_is_unary(op);
+	const size_t n = state->n_elems - first;
+	MML_expr_vec ret = { arena_alloc_T(MML_global_arena, n, MML_expr *), n };
+	memcpy(ret.ptr, state->elems + first, n * sizeof(MML_expr *));
+	state->n_elems = first;
+	return ret;
 }
 
-static bool in_pipe_block = false;
+static MML_expr *new_op(MML_token_type op, MML_expr *left, MML_expr *right)
+{
+	MML_expr *ret = arena_alloc_T(MML_global_arena, 1, MML_expr);
+	ret->type = Operation_type;
+	ret->op = op;
+	ret->kind = MML_KIND_UNINFERRED;
+	ret->o.left = left;
+	ret->o.right = right;
+	return ret;
+}
 
-static MML_expr *parse_expr(const char **s, uint32_t max_preced, struct parser_state *state)
+static void finish_call(struct parser_state *state, MML_expr *call, size_t first_elem)
 {
-	MML_token tok = get_next_token(s, state);
+	if (state->current_tok.type != MML_CLOSE_BRAC_TOK)
+		get_next_token(state);
+	call->o.right->v = pop_elems(state, first_elem);
+}
 
-	MML_expr *left = arena_alloc_T(MML_global_arena, 1, MML_expr);
-	left->type = Invalid_type;
+static operand_result parse_operand(struct parser_state *state, uint32_t *max_preced, MML_expr **out)
+{
+	MML_token tok = get_next_token(state);
 
 	if (tok.type == MML_OP_SUB_TOK || tok.type == MML_OP_ADD_TOK
 			|| op_is_unary(tok.type))
@@ -279,209 +226,312 @@ static MML_expr *parse_expr(const char **s, uint32_t max_preced, struct parser_s
 			new_token_type = MML_OP_UNARY_NOTHING;
 		else if (new_token_type == MML_OP_SUB_TOK)
 			new_token_type = MML_OP_NEGATE;
-		
-		MML_expr *operand = parse_expr(s, PRECEDENCE[new_token_type], state);
 
-		left->type = Operation_type;
-		left->o.op = new_token_type;
-		left->o.left = operand;
-		left->o.right = NULL;
+		push_frame(state, (struct parser_frame) {
+			.kind = FRAME_UNARY, .op = new_token_type, .max_preced = *max_preced });
+		*max_preced = PRECEDENCE[new_token_type];
+		return OPERAND_PUSHED;
 	} else if (tok.type == MML_IDENT_TOK)
 	{
-		MML_token ident = tok;
-		MML_token next_tok = peek_token(s, state);
+		MML_expr *name = arena_alloc_T(MML_global_arena, 1, MML_expr);
+		name->type = Identifier_type;
+		name->s = tok_str(state, tok);
 
-		if (tok.type == MML_IDENT_TOK && next_tok.type == MML_OPEN_BRAC_TOK)
+		if (peek_token(state).type != MML_OPEN_BRAC_TOK)
 		{
-			MML_expr *name = arena_alloc_T(MML_global_arena, 1, MML_expr);
-			name->type = Identifier_type;
-			name->s = strbuf_dup(ident.buf);
+			*out = name;
+			return OPERAND_DONE;
+		}
 
-			left->type = Operation_type;
-			left->o.left = name;
-			left->o.op = MML_OP_FUNC_CALL_TOK;
+		get_next_token(state);
 
-			get_next_token(s, state);
+		MML_expr *call = new_op(MML_OP_FUNC_CALL_TOK, name, arena_alloc_T(MML_global_arena, 1, MML_expr));
+		call->o.right->type = Vector_type;
 
-			left->o.right = arena_alloc_T(MML_global_arena, 1, MML_expr);
-			left->o.right->type = Vector_type;
-			// temporary dvec because we don't know how many elements it'll have
-			MML_expr_dvec temp = DVEC_INIT;
-			do
-			{
-				if (**s == '\0' || peek_token(s, state).type == MML_CLOSE_BRAC_TOK)
-					break;
-				MML_expr *next_expr = parse_expr(s, PARSER_MAX_PRECED, state);
-				dv_push(temp, next_expr);
-				//if (next_expr != nullptr)
-				//	--next_expr->num_refs;
-			} while (get_next_token(s, state).type == MML_COMMA_TOK);
-			left->o.right->v.ptr = arena_alloc_T(MML_global_arena, dv_n(temp), MML_expr *);
-			left->o.right->v.n = dv_n(temp);
-			// copy `temp` into the actual vector
-			memcpy(
-				left->o.right->v.ptr,
-				_dv_ptr(temp),
-				dv_n(temp) * sizeof(MML_expr *));
-			dv_destroy(temp);
-
-			if (state->current_tok.type != MML_CLOSE_BRAC_TOK)
-			{
-				get_next_token(s, state);
-			/*	fprintf(stderr, "expected closing brace for function call, got %s\n",
-						TOK_STRINGS[current_tok.type]);
-				MML_free_expr(left);
-				return nullptr;*/
-			}
-		} else
+		const MML_token_type next = peek_token(state).type;
+		if (next == MML_EOF_TOK || next == MML_CLOSE_BRAC_TOK)
 		{
-			left->type = Identifier_type;
-			left->s = strbuf_dup(ident.buf);
+			finish_call(state, call, state->n_elems);
+			*out = call;
+			return OPERAND_DONE;
 		}
+
+		push_frame(state, (struct parser_frame) {
+			.kind = FRAME_CALL, .max_preced = *max_preced, .node = call, .first_elem = state->n_elems });
+		*max_preced = PARSER_MAX_PRECED;
+		return OPERAND_PUSHED;
 	} else if (tok.type == MML_OPEN_PAREN_TOK)
 	{
-		left = parse_expr(s, PARSER_MAX_PRECED, state);
-		MML_log_dbg("left type = %s\n", EXPR_TYPE_STRINGS[left->type]);
-		MML_token close_paren_tok = get_next_token(s, state);
-		if (close_paren_tok.type != MML_CLOSE_PAREN_TOK)
-			get_next_token(s, state);
+		push_frame(state, (struct parser_frame) {
+			.kind = FRAME_PAREN, .max_preced = *max_preced });
+		*max_preced = PARSER_MAX_PRECED;
+		return OPERAND_PUSHED;
 	} else if (tok.type == MML_OPEN_BRACKET_TOK)
 	{
-		MML_expr_dvec temp = DVEC_INIT;
-		while (tok.type != MML_CLOSE_BRACKET_TOK)
-		{
-			tok = peek_token(s, state);
-			if (tok.type == MML_CLOSE_BRACKET_TOK)
-				break;
-
-			MML_expr *e = parse_expr(s, PARSER_MAX_PRECED, state);
-			dv_push(temp, e);
-
-			tok = get_next_token(s, state);
-			if (tok.type != MML_CLOSE_BRACKET_TOK
-			 && tok.type != MML_COMMA_TOK)
-			{
-				MML_log_err("unexpected token %s found after element"
-						" in vector literal (expected CLOSE_BRACKET_TOK or COMMA_TOK)\n",
-					 TOK_STRINGS[tok.type]);
-				dv_destroy(temp);
+		MML_expr *vec = arena_alloc_T(MML_global_arena, 1, MML_expr);
+		vec->type = Vector_type;
 
-				return NULL;
-			}
+		if (peek_token(state).type == MML_CLOSE_BRACKET_TOK)
+		{
+			get_next_token(state);
+			vec->v = (MML_expr_vec) { arena_alloc_T(MML_global_arena, 0, MML_expr *), 0 };
+			*out = vec;
+			return OPERAND_DONE;
 		}
-		
-		left->type = Vector_type;
-		left->v.ptr = arena_alloc_T(MML_global_arena, dv_n(temp), MML_expr *);
-		left->v.n = dv_n(temp);
-		memcpy(
-			left->v.ptr,
-			_dv_ptr(temp),
-			dv_n(temp) * sizeof(MML_expr *)
-		);
-
-		dv_destroy(temp);
+
+		push_frame(state, (struct parser_frame) {
+			.kind = FRAME_VECTOR, .max_preced = *max_preced, .node = vec, .first_elem = state->n_elems });
+		*max_preced = PARSER_MAX_PRECED;
+		return OPERAND_PUSHED;
 	} else if (tok.type == MML_PIPE_TOK)
 	{
-		tok = peek_token(s, state);
-		if (tok.type == MML_PIPE_TOK)
+		if (peek_token(state).type == MML_PIPE_TOK)
 		{
 			MML_log_err("expected expression in pipe block\n");
-			return NULL;
+			++state->n_errors;
+			return OPERAND_FAILED;
 		}
 
-		in_pipe_block = true;
+		++state->pipe_depth;
+		push_frame(state, (struct parser_frame) {
+			.kind = FRAME_PIPE, .max_preced = *max_preced });
+		*max_preced = PARSER_MAX_PRECED;
+		return OPERAND_PUSHED;
+	} else if (tok.type == MML_STRING_TOK)
+	{
+		MML_expr *str = arena_alloc_T(MML_global_arena, 1, MML_expr);
+		str->type = String_type;
+		str->s = tok_str(state, tok);
+		*out = str;
+		return OPERAND_DONE;
+	} else if (tok.type == MML_NUMBER_TOK)
+	{
+		MML_expr *num = arena_alloc_T(MML_global_arena, 1, MML_expr);
+		*num = EXPR_NUM(tok.num);
+		*out = num;
+		return OPERAND_DONE;
+	} else if (tok.type == MML_INTEGER_TOK)
+	{
+		MML_expr *num = arena_alloc_T(MML_global_arena, 1, MML_expr);
+		*num = EXPR_INT(tok.inum);
+		*out = num;
+		return OPERAND_DONE;
+	}
 
-		left = parse_expr(s, PARSER_MAX_PRECED, state);
-		MML_token close_pipe_tok = get_next_token(s, state);
+	// an empty statement is fine, anything else that isn't an operand isn't
+	if (tok.type != MML_EOF_TOK && tok.type != MML_SEMICOLON_TOK)
+		++state->n_errors;
+	return OPERAND_FAILED;
+}
 
-		if (close_pipe_tok.type != MML_PIPE_TOK)
-			get_next_token(s, state);
+// if an operator that binds at most as tightly as MAX_PRECED follows LEFT,
+// pushes a frame for its right operand and sets MAX_PRECED for that
+static bool parse_operator(struct parser_state *state, uint32_t *max_preced, MML_expr *left)
+{
+	MML_token op_tok = peek_token(state);
+	if (op_tok.type == MML_INVALID_TOK)
+		return false;
+
+	bool do_advance = true;
+	if (op_tok.type == MML_IDENT_TOK
+	 || op_tok.type == MML_NUMBER_TOK
+	 || op_tok.type == MML_INTEGER_TOK
+	 || op_tok.type == MML_OPEN_PAREN_TOK
+	 || op_tok.type == MML_OPEN_BRACKET_TOK
+	 || (op_tok.type == MML_PIPE_TOK && state->pipe_depth == 0))
+	{
+		op_tok.type = MML_OP_MUL_TOK;
+		do_advance = false;
+	}
+	if (op_tok.type > MML_NOT_OP_TOK)
+		return false;
 
-		in_pipe_block = false;
-		//MML_expr *opnode = Pipe(left);
+	const uint32_t preced = PRECEDENCE[op_tok.type];
+	if (preced > *max_preced)
+		return false;
 
-		MML_expr *opnode = arena_alloc_T(MML_global_arena, 1, MML_expr);
-		opnode->type = Operation_type;
-		opnode->o.op = MML_PIPE_TOK;
-		opnode->o.left = left;
-		opnode->o.right = NULL;
+	if (do_advance) get_next_token(state);
 
-		left = opnode;
-	} else if (tok.type == MML_NUMBER_TOK)
-	{
-		if (state->looking_for_int)
-			*left = EXPR_NUM((double)strtoll(tok.buf.s, NULL, 10));
-		else
-			*left = EXPR_NUM(strtod(tok.buf.s, NULL)); 
-		state->looking_for_int = false;
-	} else {
-		return NULL;
-	}
+	push_frame(state, (struct parser_frame) {
+		.kind = FRAME_BINARY, .op = op_tok.type, .max_preced = *max_preced, .node = left });
+	*max_preced = op_is_right_associative(op_tok.type) ? preced : preced-1;
+	return true;
+}
 
-	for (;;)
-	{
-		MML_token op_tok = peek_token(s, state);
-		if (op_tok.type == MML_INVALID_TOK)
-			break;
-
-		bool do_advance = true;
-		if (op_tok.type == MML_IDENT_TOK
-		 || op_tok.type == MML_NUMBER_TOK
-		 || op_tok.type == MML_OPEN_PAREN_TOK
-		 || op_tok.type == MML_OPEN_BRACKET_TOK
-		 || (op_tok.type == MML_PIPE_TOK && !in_pipe_block))
+// hands the finished subexpression *E (NULL if it failed) to the topmost frame
+static operand_result finish_frame(struct parser_state *state, uint32_t *max_preced, MML_expr **e)
+{
+	struct parser_frame *frame = &state->frames[state->n_frames-1];
+	*max_preced = frame->max_preced;
+
+	switch (frame->kind) {
+	case FRAME_UNARY:
+		*e = new_op(frame->op, *e, NULL);
+		break;
+	case FRAME_BINARY:
+		if (*e == NULL)
 		{
-			op_tok.type = MML_OP_MUL_TOK;
-			do_advance = false;
+			MML_log_err("expected expression after operator %s\n",
+					TOK_STRINGS[frame->op]);
+			++state->n_errors;
+			--state->n_frames;
+			return OPERAND_FAILED;
 		}
-		if (op_tok.type > MML_NOT_OP_TOK)
-			break;
-
-		uint32_t preced = PRECEDENCE[op_tok.type];
-		if (preced > max_preced)
-			break;
+		*e = new_op(frame->op, frame->node, *e);
+		break;
+	case FRAME_PAREN:
+		if (get_next_token(state).type != MML_CLOSE_PAREN_TOK)
+			get_next_token(state);
+		break;
+	case FRAME_PIPE:
+		if (get_next_token(state).type != MML_PIPE_TOK)
+			get_next_token(state);
+		--state->pipe_depth;
+		*e = new_op(MML_PIPE_TOK, *e, NULL);
+		break;
+	case FRAME_CALL:
+		push_elem(state, *e);
+		if (get_next_token(state).type == MML_COMMA_TOK)
+		{
+			const MML_token_type next = peek_token(state).type;
+			if (next != MML_EOF_TOK && next != MML_CLOSE_BRAC_TOK)
+			{
+				*max_preced = PARSER_MAX_PRECED;
+				return OPERAND_PUSHED;
+			}
+		}
+		finish_call(state, frame->node, frame->first_elem);
+		*e = frame->node;
+		break;
+	case FRAME_VECTOR: {
+		push_elem(state, *e);
+		const MML_token tok = get_next_token(state);
+		if (tok.type == MML_COMMA_TOK && peek_token(state).type != MML_CLOSE_BRACKET_TOK)
+		{
+			*max_preced = PARSER_MAX_PRECED;
+			return OPERAND_PUSHED;
+		}
+		if (tok.type == MML_COMMA_TOK)
+			get_next_token(state);
+		else if (tok.type != MML_CLOSE_BRACKET_TOK)
+		{
+			MML_log_err("unexpected token %s found after element"
+					" in vector literal (expected CLOSE_BRACKET_TOK or COMMA_TOK)\n",
+				 TOK_STRINGS[tok.type]);
+			++state->n_errors;
+			state->n_elems = frame->first_elem;
+			--state->n_frames;
+			*e = NULL;
+			return OPERAND_FAILED;
+		}
+		frame->node->v = pop_elems(state, frame->first_elem);
+		*e = frame->node;
+		break;
+	}
+	}
 
-		if (do_advance) get_next_token(s, state);
+	--state->n_frames;
+	return OPERAND_DONE;
+}
 
-		if (op_tok.type == MML_OP_DOT_TOK)
-			state->looking_for_int = true;
+static MML_expr *parse_expr(uint32_t max_preced, struct parser_state *state)
+{
+	const size_t base = state->n_frames;
 
-		MML_expr *right = parse_expr(s,
-				op_is_right_associative(op_tok.type)
-					? preced
-					: preced-1, state);
+	for (;;)
+	{
+		MML_expr *e = NULL;
+		operand_result res;
+		while ((res = parse_operand(state, &max_preced, &e)) == OPERAND_PUSHED)
+			;
 
-		if (right == NULL) {
-			MML_log_err("expected expression after operator %s\n",
-					TOK_STRINGS[op_tok.type]);
-			return NULL;
+		for (;;)
+		{
+			if (res == OPERAND_DONE && parse_operator(state, &max_preced, e))
+				break;
+			if (state->n_frames == base)
+				return e;
+			res = finish_frame(state, &max_preced, &e);
+			if (res == OPERAND_PUSHED)
+				break;
 		}
+	}
+}
 
-		MML_expr *opnode = arena_alloc_T(MML_global_arena, 1, MML_expr);
-		opnode->type = Operation_type;
-		opnode->o.left = left;
-		opnode->o.right = right;
-		opnode->o.op = op_tok.type;
+static thread_local Arena *scratch_arena = NULL;
+static thread_local ArenaMark scratch_start;
 
-		left = opnode;
+void MML_free_parser_scratch(void)
+{
+	if (scratch_arena != NULL)
+		arena_destroy(scratch_arena);
+	scratch_arena = NULL;
+}
+
+static struct parser_state init_parser(const char *s, bool borrow_source)
+{
+	if (scratch_arena == NULL)
+	{
+		scratch_arena = arena_create(64 * 1024);
+		scratch_start = arena_mark(scratch_arena);
 	}
 
-	return left;
+	MML_phase_begin(MML_PHASE_LEX);
+	MML_trace_begin(MML_TRACE_PARSE, str_lit("lex"), 0);
+	const MML_token_vec toks = MML_tokenize(s, scratch_arena);
+	MML_trace_end(MML_TRACE_PARSE);
+	MML_phase_end(MML_PHASE_LEX);
+	return (struct parser_state) {
+		.src = s,
+		.toks = toks.ptr,
+		.n_toks = toks.n,
+		.pos = 0,
+		.borrow_source = borrow_source,
+		.scratch = scratch_arena,
+	};
 }
 
 MML_expr *MML_parse(const char *s)
 {
-	struct parser_state state = {0};
-	return parse_expr(&s, PARSER_MAX_PRECED, &state);
+	MML_phase_begin(MML_PHASE_PARSE);
+	struct parser_state state = init_parser(s, false);
+	MML_trace_begin(MML_TRACE_PARSE, str_lit("parse"), 0);
+	MML_expr *ret = parse_expr(PARSER_MAX_PRECED, &state);
+	MML_trace_end(MML_TRACE_PARSE);
+	arena_reset(scratch_arena, scratch_start);
+	MML_phase_end(MML_PHASE_PARSE);
+	return ret;
 }
-MML_expr_dvec MML_parse_stmts(const char *s)
+
+static MML_expr_dvec parse_stmts(const char *s, bool borrow_source, uint32_t *n_errors)
 {
+	MML_phase_begin(MML_PHASE_PARSE);
+	struct parser_state state = init_parser(s, borrow_source);
+
 	MML_expr_dvec temp = DVEC_INIT;
-	struct parser_state state = {0};
 	do
 	{
-		dv_push(temp, parse_expr(&s, PARSER_MAX_PRECED, &state));
-	} while (get_next_token(&s, &state).type == MML_SEMICOLON_TOK);
-
+		MML_trace_begin(MML_TRACE_PARSE, str_lit("parse"), 0);
+		dv_push(temp, parse_expr(PARSER_MAX_PRECED, &state));
+		MML_trace_end(MML_TRACE_PARSE);
+	} while (get_next_token(&state).type == MML_SEMICOLON_TOK);
+
+	arena_reset(scratch_arena, scratch_start);
+	if (n_errors != NULL)
+		*n_errors = state.n_errors;
+	MML_phase_end(MML_PHASE_PARSE);
 	return temp;
 }
+
+MML_expr_dvec MML_parse_stmts(const char *s)
+{
+	return parse_stmts(s, false, NULL);
+}
+MML_expr_dvec MML_parse_stmts_borrowed(const char *s)
+{
+	return parse_stmts(s, true, NULL);
+}
+MML_expr_dvec MML_parse_stmts_checked(const char *s, uint32_t *n_errors)
+{
+	return parse_stmts(s, false, n_errors);
+}
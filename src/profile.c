@@ -0,0 +1,319 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include "mml/profile.h"
+
+#include <complex.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "mml/config.h"
+#include "mml/expr.h"
+#include "mml/parser.h"
+#include "map.h"
+
+// how much of a statement's source its name shows
+#define STATEMENT_NAME_MAX 56
+// elements of a vector literal shown in a statement's name
+#define VECTOR_ELEMS_MAX 4
+// rows in the report; the rest are summed up in one line
+#define REPORT_ROWS_MAX 40
+
+typedef struct {
+	MML_profile_kind kind;
+	char *name; // malloc'd; also the key in `by_name[kind]`
+	size_t name_len;
+	uint64_t count;
+	uint64_t incl_ns;
+	uint64_t excl_ns;
+	uint32_t depth; // how many times it's open right now
+} profile_entry;
+
+typedef struct {
+	size_t entry;
+	uint64_t start_ns;
+	uint64_t child_ns;
+} profile_frame;
+
+struct MML_profile {
+	profile_entry *entries;
+	size_t n_entries, entries_cap;
+	hashmap *by_name[MML_PROFILE_N_KINDS];
+
+	profile_frame *frames;
+	size_t n_frames, frames_cap;
+};
+
+static const char *const KIND_NAMES[MML_PROFILE_N_KINDS] = {
+	[MML_PROFILE_STATEMENT] = "statement",
+	[MML_PROFILE_FUNCTION] = "function",
+	[MML_PROFILE_BUILTIN] = "builtin",
+	[MML_PROFILE_VARIABLE] = "variable",
+};
+
+static uint64_t now_ns(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000ull + (uint64_t)ts.tv_nsec;
+}
+
+MML_profile *MML_profile_create(void)
+{
+	MML_profile *profile = calloc(1, sizeof(MML_profile));
+	for (size_t k = 0; k < MML_PROFILE_N_KINDS; ++k)
+		profile->by_name[k] = hashmap_create();
+	return profile;
+}
+
+void MML_profile_destroy(MML_profile *profile)
+{
+	if (profile == NULL)
+		return;
+
+	for (size_t k = 0; k < MML_PROFILE_N_KINDS; ++k)
+		hashmap_free(profile->by_name[k]);
+	for (size_t i = 0; i < profile->n_entries; ++i)
+		free(profile->entries[i].name);
+	free(profile->entries);
+	free(profile->frames);
+	free(profile);
+}
+
+static size_t find_entry(MML_profile *profile, MML_profile_kind kind, const char *name, size_t len)
+{
+	uintptr_t index;
+	if (hashmap_get(profile->by_name[kind], name, len, &index))
+		return (size_t)index;
+
+	if (profile->n_entries == profile->entries_cap)
+	{
+		profile->entries_cap = (profile->entries_cap > 0) ? profile->entries_cap * 2 : 64;
+		profile->entries = realloc(profile->entries, profile->entries_cap * sizeof(profile_entry));
+	}
+	profile_entry *entry = &profile->entries[profile->n_entries];
+	*entry = (profile_entry) {
+		.kind = kind,
+		.name = strndup(name, len),
+		.name_len = len,
+	};
+	hashmap_set(profile->by_name[kind], entry->name, len, (uintptr_t)profile->n_entries);
+	return profile->n_entries++;
+}
+
+static void enter(MML_profile *profile, size_t entry)
+{
+	if (profile->n_frames == profile->frames_cap)
+	{
+		profile->frames_cap = (profile->frames_cap > 0) ? profile->frames_cap * 2 : 64;
+		profile->frames = realloc(profile->frames, profile->frames_cap * sizeof(profile_frame));
+	}
+	++profile->entries[entry].depth;
+	profile->frames[profile->n_frames++] = (profile_frame) {
+		.entry = entry,
+		.start_ns = now_ns(),
+	};
+}
+
+void MML_profile_enter(MML_profile *profile, MML_profile_kind kind, strbuf name)
+{
+	enter(profile, find_entry(profile, kind, name.s, name.len));
+}
+
+void MML_profile_exit(MML_profile *profile)
+{
+	const profile_frame frame = profile->frames[--profile->n_frames];
+	const uint64_t incl = now_ns() - frame.start_ns;
+
+	profile_entry *entry = &profile->entries[frame.entry];
+	++entry->count;
+	entry->excl_ns += incl - frame.child_ns;
+	if (--entry->depth == 0)
+		entry->incl_ns += incl;
+
+	if (profile->n_frames > 0)
+		profile->frames[profile->n_frames-1].child_ns += incl;
+}
+
+
+/*
+ * Statement names
+ */
+static const char *const OP_SYMBOLS[] = {
+	[MML_OP_DOT_TOK] = ".",
+	[MML_OP_AT_TOK] = " @ ",
+	[MML_OP_POW_TOK] = "^",
+	[MML_OP_ROOT] = " root ",
+	[MML_OP_MUL_TOK] = "*",
+	[MML_OP_DIV_TOK] = "/",
+	[MML_OP_MOD_TOK] = " % ",
+	[MML_OP_ADD_TOK] = " + ",
+	[MML_OP_SUB_TOK] = " - ",
+	[MML_OP_LESS_TOK] = " < ",
+	[MML_OP_GREATER_TOK] = " > ",
+	[MML_OP_LESSEQ_TOK] = " <= ",
+	[MML_OP_GREATEREQ_TOK] = " >= ",
+	[MML_OP_EQ_TOK] = " == ",
+	[MML_OP_NOTEQ_TOK] = " != ",
+	[MML_OP_EXACT_EQ] = " === ",
+	[MML_OP_EXACT_NOTEQ] = " !== ",
+	[MML_OP_ASSERT_EQUAL] = " = ",
+	[MML_OP_NOT_TOK] = "!",
+	[MML_OP_NEGATE] = "-",
+	[MML_OP_UNARY_NOTHING] = "+",
+	[MML_TILDE_TOK] = "~",
+};
+
+static const char *op_symbol(MML_token_type op)
+{
+	const size_t n = sizeof(OP_SYMBOLS) / sizeof(OP_SYMBOLS[0]);
+	return ((size_t)op < n && OP_SYMBOLS[op] != NULL) ? OP_SYMBOLS[op] : " ? ";
+}
+
+static void write_expr(FILE *f, const MML_expr *e);
+
+// E is an operand of PARENT_OP; it needs parentheses if it binds less
+// tightly, or just as tightly on the side that doesn't associate
+static void write_operand(FILE *f, const MML_expr *e, MML_token_type parent_op, bool is_right)
+{
+	bool parens = false;
+	if (e != NULL && e->type == Operation_type && e->o.right != NULL)
+	{
+		const uint8_t p = PRECEDENCE[e->op], parent_p = PRECEDENCE[parent_op];
+		const bool right_assoc = parent_op == MML_OP_POW_TOK || parent_op == MML_OP_ASSERT_EQUAL;
+		parens = p > parent_p || (p == parent_p && is_right != right_assoc);
+	}
+	if (parens)
+		fputc('(', f);
+	write_expr(f, e);
+	if (parens)
+		fputc(')', f);
+}
+
+static void write_elems(FILE *f, const MML_expr_vec *v)
+{
+	for (size_t i = 0; i < v->n && i < VECTOR_ELEMS_MAX; ++i)
+	{
+		if (i > 0)
+			fputs(", ", f);
+		write_expr(f, v->ptr[i]);
+	}
+	if (v->n > VECTOR_ELEMS_MAX)
+		fputs(", ...", f);
+}
+
+// writes E back out as (roughly) the source it was parsed from
+static void write_expr(FILE *f, const MML_expr *e)
+{
+	if (e == NULL)
+	{
+		fputs("?", f);
+		return;
+	}
+
+	switch (e->type) {
+	case Operation_type:
+		if (e->op == MML_OP_FUNC_CALL_TOK)
+		{
+			write_expr(f, e->o.left);
+			fputc('{', f);
+			if (e->o.right != NULL && e->o.right->type == Vector_type)
+				write_elems(f, &e->o.right->v);
+			fputc('}', f);
+		} else if (e->o.right == NULL)
+		{
+			fputs(op_symbol(e->op), f);
+			write_operand(f, e->o.left, e->op, true);
+		} else
+		{
+			write_operand(f, e->o.left, e->op, false);
+			fputs(op_symbol(e->op), f);
+			write_operand(f, e->o.right, e->op, true);
+		}
+		break;
+	case Integer_type: fprintf(f, "%" PRId64, e->i); break;
+	case RealNumber_type: fprintf(f, "%g", e->n); break;
+	case ComplexNumber_type: fprintf(f, "(%g%+gi)", creal(e->cn), cimag(e->cn)); break;
+	case Boolean_type: fputs(e->b ? "true" : "false", f); break;
+	case Identifier_type: fprintf(f, "%.*s", (int)e->s.len, e->s.s); break;
+	case String_type: fprintf(f, "\"%.*s\"", (int)e->s.len, e->s.s); break;
+	case Vector_type:
+		fputc('[', f);
+		write_elems(f, &e->v);
+		fputc(']', f);
+		break;
+	case NumArray_type: fprintf(f, "<%zu numbers>", (size_t)e->a.n); break;
+	case Range_type: fprintf(f, "<%zu numbers>", e->r->n); break;
+	case FuncObject_type: fputs("<function>", f); break;
+	case Nothing_type: fputs("nothing", f); break;
+	default: fputs("?", f); break;
+	}
+}
+
+void MML_profile_enter_statement(MML_profile *profile, const MML_expr *stmt)
+{
+	char *name = NULL;
+	size_t len = 0;
+	FILE *f = open_memstream(&name, &len);
+	write_expr(f, stmt);
+	fclose(f);
+
+	if (len > STATEMENT_NAME_MAX)
+	{
+		memcpy(name + STATEMENT_NAME_MAX - 3, "...", 3);
+		len = STATEMENT_NAME_MAX;
+	}
+	enter(profile, find_entry(profile, MML_PROFILE_STATEMENT, name, len));
+	free(name);
+}
+
+
+/*
+ * Report
+ */
+static int cmp_excl(const void *a, const void *b)
+{
+	const profile_entry *x = *(const profile_entry *const *)a, *y = *(const profile_entry *const *)b;
+	return (x->excl_ns < y->excl_ns) - (x->excl_ns > y->excl_ns);
+}
+
+void MML_profile_report(const MML_profile *profile, FILE *stream)
+{
+	uint64_t total_ns = 0;
+	const profile_entry **sorted = malloc(profile->n_entries * sizeof(profile_entry *));
+	for (size_t i = 0; i < profile->n_entries; ++i)
+	{
+		sorted[i] = &profile->entries[i];
+		total_ns += sorted[i]->excl_ns;
+	}
+	qsort(sorted, profile->n_entries, sizeof(profile_entry *), cmp_excl);
+	const double total = (total_ns > 0) ? (double)total_ns : 1.0;
+
+	fprintf(stream, "\nprofile: %.3f ms evaluating (inclusive time counts what's inside a region; exclusive doesn't)\n",
+			(double)total_ns / 1e6);
+	fprintf(stream, "%-9s %12s %12s %12s %7s  %s\n",
+			"kind", "count", "incl ms", "excl ms", "excl %", "name");
+
+	for (size_t i = 0; i < profile->n_entries && i < REPORT_ROWS_MAX; ++i)
+	{
+		const profile_entry *e = sorted[i];
+		fprintf(stream, "%-9s %12" PRIu64 " %12.3f %12.3f %6.1f%%  %.*s\n",
+				KIND_NAMES[e->kind], e->count,
+				(double)e->incl_ns / 1e6, (double)e->excl_ns / 1e6,
+				100.0 * (double)e->excl_ns / total,
+				(int)e->name_len, e->name);
+	}
+	if (profile->n_entries > REPORT_ROWS_MAX)
+	{
+		uint64_t rest_ns = 0;
+		for (size_t i = REPORT_ROWS_MAX; i < profile->n_entries; ++i)
+			rest_ns += sorted[i]->excl_ns;
+		fprintf(stream, "%-9s %12s %12s %12.3f %6.1f%%  (%zu more)\n",
+				"", "", "", (double)rest_ns / 1e6, 100.0 * (double)rest_ns / total,
+				profile->n_entries - REPORT_ROWS_MAX);
+	}
+
+	free(sorted);
+}
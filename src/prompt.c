@@ -6,7 +6,6 @@
 #include <string.h>
 #include <termios.h>
 #include <unistd.h>
-#include <time.h>
 #include <stdint.h>
 #include <stdbool.h>
 
@@ -16,19 +15,12 @@
 #include "mml/expr.h"
 #include "mml/eval.h"
 #include "mml/parser.h"
-#include "dvec/dvec.h"
+#include "mml/timing.h"
 
-#define NSEC_IN_SEC 1000000000ULL
 #define PROMPT_STR "\033[1;33m>>\033[0m "
 #define PROMPT_STR_LEN 3
 #define LINE_MAX_LEN 4096
 
-#define time_blck(elapsed_p, ...) { \
-	const clock_t start = clock(); \
-	{ __VA_ARGS__; }; \
-	*(elapsed_p) = (uint64_t)((double)(clock() - start) / CLOCKS_PER_SEC * NSEC_IN_SEC); \
-}
-
 static struct termios orig_termios;
 
 void term_restore(void) {
@@ -178,6 +170,10 @@ void MML_run_prompt(MML_state *state) {
 
 	ssize_t n_read = 0;
 
+	// with --dbg-time, each line's phases are reported after it
+	if (FLAG_IS_SET(DBG_TIME))
+		MML_timing_start();
+
 	while (!(cur_val.type == Invalid_type && cur_val.i == MML_QUIT_INVAL)) {
 		memset(line_in, 0, sizeof(n_read));
 		n_read = get_prompt_line(line_in, LINE_MAX_LEN);
@@ -185,30 +181,16 @@ void MML_run_prompt(MML_state *state) {
 		if (n_read == -1) break;
 		if (n_read == 0) continue;
 
-		uint64_t nsecs = 0;
-		MML_expr_dvec exprs;
-
-		if (!FLAG_IS_SET(DBG_TIME))
-			exprs = MML_parse_stmts(line_in);
-		else {
-			time_blck(&nsecs, exprs = MML_parse_stmts(line_in));
-			MML_log_dbg("parsed in %.6fs\n", (double)nsecs / NSEC_IN_SEC);
-		}
-
-		MML_expr **cur;
+		const uint64_t start = (state->recorder != nullptr) ? MML_record_now() : 0;
+		const MML_expr_vec exprs = MML_parse_stmts_cached(state, line_in);
+		for (size_t i = 0; i < exprs.n; ++i)
+			if (exprs.ptr[i] != NULL)
+				cur_val = MML_eval_stmt(state, exprs.ptr[i]);
+		if (state->recorder != nullptr)
+			MML_record(state->recorder, line_in, (size_t)n_read, start);
 
-		if (!FLAG_IS_SET(DBG_TIME)) {
-			dv_foreach(exprs, cur)
-				if (*cur != NULL)
-					cur_val = MML_eval_expr(state, *cur);
-		} else {
-			time_blck(&nsecs,
-				dv_foreach(exprs, cur)
-					if (*cur != NULL)
-						cur_val = MML_eval_expr(state, *cur));
-			
-			MML_log_dbg("evaluted in %.6fs\n", (double)nsecs / NSEC_IN_SEC);
-		}
+		// whatever was printed has to show up before the prompt's own output
+		MML_out_flush(state->config->out);
 
 		if (!state->config->last_print_was_newline)
 			puts("\033[7m%\033[0m");
@@ -218,6 +200,7 @@ void MML_run_prompt(MML_state *state) {
 		if (cur_val.type != OutputCode_type) {
 			printf("\033[2m────────────\033[0m\n");
 			MML_println_typedval(state, &cur_val);
+			MML_out_flush(state->config->out);
 			printf("\033[2m────────────\033[0m\n");
 			state->last_val = cur_val;
 		} else {
@@ -225,9 +208,15 @@ void MML_run_prompt(MML_state *state) {
 				printf("\033[2J\033[H");
 		}
 
-		dv_destroy(exprs);
 		fflush(stdout);
+
+		if (MML_timing_on) {
+			MML_timing line_timing;
+			MML_timing_take(&line_timing);
+			MML_timing_report(&line_timing, stderr);
+		}
 	}
 
+	MML_timing_stop(NULL);
 	term_restore();
 }
@@ -0,0 +1,160 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include "mml/record.h"
+
+#include <inttypes.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "mml/config.h"
+
+#define RECORDING_HEADER "MML session recording 1\n"
+
+struct MML_recorder {
+	FILE *file;
+	char *path;
+};
+
+MML_recorder *MML_record_open(const char *path)
+{
+	FILE *file = fopen(path, "w");
+	if (file == NULL)
+	{
+		MML_log_err("failed to create session recording '%s'\n", path);
+		return NULL;
+	}
+	fputs(RECORDING_HEADER, file);
+
+	MML_recorder *recorder = malloc(sizeof(MML_recorder));
+	*recorder = (MML_recorder) { .file = file, .path = strdup(path) };
+	return recorder;
+}
+
+void MML_record_close(MML_recorder *recorder)
+{
+	if (recorder == NULL)
+		return;
+
+	if (fclose(recorder->file) != 0)
+		MML_log_err("failed to write session recording '%s'\n", recorder->path);
+	free(recorder->path);
+	free(recorder);
+}
+
+uint64_t MML_record_now(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000ull + (uint64_t)ts.tv_nsec;
+}
+
+void MML_record(MML_recorder *recorder, const char *source, size_t len, uint64_t start_ns)
+{
+	const uint64_t ns = MML_record_now() - start_ns;
+	fprintf(recorder->file, "%" PRIu64 " %zu\n", ns, len);
+	fwrite(source, 1, len, recorder->file);
+	fputc('\n', recorder->file);
+}
+
+
+/*
+ * Loading
+ */
+static char *read_file(const char *path, size_t *len)
+{
+	FILE *file = fopen(path, "rb");
+	if (file == NULL)
+		return NULL;
+
+	char *data = NULL;
+	size_t cap = 0;
+	*len = 0;
+	for (;;)
+	{
+		if (*len == cap)
+		{
+			cap = (cap > 0) ? cap * 2 : 1 << 16;
+			data = realloc(data, cap + 1);
+		}
+		const size_t n = fread(data + *len, 1, cap - *len, file);
+		*len += n;
+		if (n == 0)
+			break;
+	}
+	const bool failed = ferror(file);
+	fclose(file);
+	if (failed)
+	{
+		free(data);
+		return NULL;
+	}
+	data[*len] = '\0';
+	return data;
+}
+
+bool MML_recording_load(const char *path, MML_recording *recording)
+{
+	*recording = (MML_recording) { 0 };
+
+	size_t len;
+	char *data = read_file(path, &len);
+	if (data == NULL)
+	{
+		MML_log_err("failed to read session recording '%s'\n", path);
+		return false;
+	}
+	if (strncmp(data, RECORDING_HEADER, sizeof(RECORDING_HEADER)-1) != 0)
+	{
+		MML_log_err("'%s' isn't a session recording\n", path);
+		free(data);
+		return false;
+	}
+
+	size_t cap = 0;
+	char *cur = data + sizeof(RECORDING_HEADER)-1;
+	const char *const end = data + len;
+	while (cur < end)
+	{
+		// "NS LEN\n", then LEN bytes of source and a newline
+		char *p = cur;
+		const uint64_t ns = strtoull(p, &p, 10);
+		const bool has_len = (*p == ' ');
+		const size_t src_len = has_len ? strtoull(p + 1, &p, 10) : 0;
+		if (!has_len || *p != '\n' || src_len >= (size_t)(end - p - 1))
+		{
+			MML_log_err("session recording '%s' is cut short or corrupt after %zu evaluation(s)\n",
+					path, recording->n_evals);
+			MML_recording_free(recording);
+			free(data);
+			return false;
+		}
+		cur = p + 1;
+
+		if (recording->n_evals == cap)
+		{
+			cap = (cap > 0) ? cap * 2 : 256;
+			recording->evals = realloc(recording->evals, cap * sizeof(MML_recorded_eval));
+		}
+		// the newline after the source becomes its terminator
+		cur[src_len] = '\0';
+		recording->evals[recording->n_evals++] = (MML_recorded_eval) {
+			.source = cur,
+			.len = src_len,
+			.ns = ns,
+		};
+		cur += src_len + 1;
+	}
+
+	recording->data = data;
+	return true;
+}
+
+void MML_recording_free(MML_recording *recording)
+{
+	free(recording->evals);
+	free(recording->data);
+	*recording = (MML_recording) { 0 };
+}
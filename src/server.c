@@ -0,0 +1,715 @@
+#define _GNU_SOURCE
+
+#include "mml/server.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <sys/uio.h>
+#include <sys/un.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "arena/arena.h"
+#include "mml/config.h"
+#include "mml/eval.h"
+#include "mml/expr.h"
+#include "mml/output.h"
+#include "mml/parser.h"
+#include "dvec/dvec.h"
+#include "map.h"
+
+// larger requests are refused rather than buffered
+#define MAX_FRAME_LEN (64u << 20)
+// output is sent in frames of at most this many bytes
+#define OUT_CHUNK_LEN (1u << 20)
+// how long a frame that has started arriving has to finish, which is also
+// how long a new connection has to name its session
+#define FRAME_TIMEOUT_S 5
+// connections with no request for this long are closed
+#define IDLE_TIMEOUT_S 60
+// named sessions kept by each worker; past that, the least recently used one
+// is dropped to make room
+#define MAX_SESSIONS_PER_WORKER 64
+
+/*
+ * Framing
+ */
+
+static bool write_all(int fd, struct iovec *iov, int n_iov)
+{
+	struct msghdr msg = { .msg_iov = iov, .msg_iovlen = (size_t)n_iov };
+	while (msg.msg_iovlen > 0)
+	{
+		ssize_t n = sendmsg(fd, &msg, MSG_NOSIGNAL);
+		if (n < 0)
+		{
+			if (errno == EINTR)
+				continue;
+			return false;
+		}
+
+		while (msg.msg_iovlen > 0 && (size_t)n >= msg.msg_iov->iov_len)
+		{
+			n -= (ssize_t)msg.msg_iov->iov_len;
+			++msg.msg_iov;
+			--msg.msg_iovlen;
+		}
+		if (msg.msg_iovlen > 0)
+		{
+			msg.msg_iov->iov_base = (char *)msg.msg_iov->iov_base + n;
+			msg.msg_iov->iov_len -= (size_t)n;
+		}
+	}
+	return true;
+}
+
+static bool read_all(int fd, void *buf, size_t n)
+{
+	char *p = buf;
+	while (n > 0)
+	{
+		const ssize_t got = read(fd, p, n);
+		if (got < 0 && errno == EINTR)
+			continue;
+		if (got <= 0)
+			return false;
+		p += got;
+		n -= (size_t)got;
+	}
+	return true;
+}
+
+static void put_u32le(uint8_t dst[4], uint32_t x)
+{
+	dst[0] = (uint8_t)x;
+	dst[1] = (uint8_t)(x >> 8);
+	dst[2] = (uint8_t)(x >> 16);
+	dst[3] = (uint8_t)(x >> 24);
+}
+
+// sends a frame made of TYPE (unless it's negative) followed by DATA
+static bool send_frame(int fd, int32_t type, const void *data, size_t n)
+{
+	const size_t len = n + (type >= 0);
+	if (len > MAX_FRAME_LEN)
+		return false;
+
+	uint8_t head[5];
+	put_u32le(head, (uint32_t)len);
+	head[4] = (uint8_t)type;
+
+	struct iovec iov[2] = {
+		{ head, (type >= 0) ? 5 : 4 },
+		{ (void *)data, n },
+	};
+	return write_all(fd, iov, (n > 0) ? 2 : 1);
+}
+
+// Receives a frame into a zero-terminated buffer that's freed by the caller,
+// and stores its length in *LEN. Returns NULL at EOF or on error.
+static char *recv_frame(int fd, uint32_t *len)
+{
+	uint8_t head[4];
+	if (!read_all(fd, head, sizeof(head)))
+		return NULL;
+
+	*len = (uint32_t)head[0] | (uint32_t)head[1] << 8
+		| (uint32_t)head[2] << 16 | (uint32_t)head[3] << 24;
+	if (*len > MAX_FRAME_LEN)
+		return NULL;
+
+	char *buf = malloc((size_t)*len + 1);
+	if (buf == NULL || !read_all(fd, buf, *len))
+	{
+		free(buf);
+		return NULL;
+	}
+	buf[*len] = '\0';
+	return buf;
+}
+
+// A FILE that sends whatever's written to it as frames of one type, which is
+// how output and log messages reach the client as they're produced.
+typedef struct {
+	int fd;
+	uint8_t type;
+} frame_stream;
+
+static ssize_t frame_stream_write(void *cookie, const char *buf, size_t n)
+{
+	const frame_stream *fs = cookie;
+	if (n > OUT_CHUNK_LEN)
+		n = OUT_CHUNK_LEN;
+	return send_frame(fs->fd, fs->type, buf, n) ? (ssize_t)n : -1;
+}
+
+static FILE *open_frame_stream(frame_stream *fs)
+{
+	const cookie_io_functions_t io = { .write = frame_stream_write };
+	return fopencookie(fs, "w", io);
+}
+
+/*
+ * Connections
+ */
+
+// A client's connection. It belongs to the listener while it waits for the
+// client's next frame, and to a worker while that frame is read and answered.
+typedef struct conn {
+	int fd;
+	// NULL until the client has sent it; empty for a fresh state per request
+	char *session_name;
+	// when the listener got it back, for the idle timeout
+	double idle_since;
+	struct conn *next;
+} conn;
+
+typedef struct {
+	conn *head;
+	conn *tail;
+} conn_queue;
+
+static void conn_push(conn_queue *q, conn *c)
+{
+	c->next = NULL;
+	if (q->tail != NULL)
+		q->tail->next = c;
+	else
+		q->head = c;
+	q->tail = c;
+}
+
+static conn *conn_pop(conn_queue *q)
+{
+	conn *c = q->head;
+	if (c != NULL)
+	{
+		q->head = c->next;
+		if (q->head == NULL)
+			q->tail = NULL;
+	}
+	return c;
+}
+
+static void conn_close(conn *c)
+{
+	close(c->fd);
+	free(c->session_name);
+	free(c);
+}
+
+static double now_s(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (double)ts.tv_sec + (double)ts.tv_nsec * 1e-9;
+}
+
+/*
+ * Workers
+ */
+
+typedef struct session {
+	char *name;
+	MML_state *state;
+	struct MML_config config;
+	// the worker's request count when it was last used
+	uint64_t last_used;
+} session;
+
+typedef struct server server;
+
+typedef struct {
+	pthread_t thread;
+	server *srv;
+
+	// connections to the sessions on this worker, with a request waiting
+	conn_queue queue;
+
+	// the named sessions that live on this worker, by name
+	hashmap *sessions;
+	uint32_t n_sessions;
+	uint64_t n_requests;
+	// what new sessions start out with
+	struct MML_config base_config;
+	MML_outbuf out;
+} worker;
+
+struct server {
+	pthread_mutex_t lock;
+	pthread_cond_t ready;
+	// connections any worker can take: the ones that haven't named their
+	// session yet, and the ones that get a fresh state per request
+	conn_queue shared;
+	// connections that have been served, for the listener to wait on again
+	conn_queue returned;
+	// written to when there's something in `returned`, to wake the listener
+	int wake_fds[2];
+
+	worker *workers;
+	uint32_t n_workers;
+};
+
+static uint8_t eval_request(MML_state *state, const char *src, uint8_t flags)
+{
+	uint32_t n_errors = 0;
+	MML_expr_dvec stmts = MML_parse_stmts_checked(src, &n_errors);
+	const size_t n_stmts = dv_n(stmts);
+
+	MML_value val = NOTHING_VAL;
+	MML_expr **cur;
+	dv_foreach(stmts, cur)
+		val = MML_eval_stmt(state, *cur);
+	dv_destroy(stmts);
+
+	if ((flags & MML_REQ_PRINT) && n_stmts > 0)
+		MML_print_typedval(state, &val);
+	MML_out_flush(state->config->out);
+
+	return (n_errors > 0 || val.type == Invalid_type) ? 1 : 0;
+}
+
+// evaluates SRC in a state of its own, which leaves nothing behind
+static uint8_t eval_isolated(worker *w, const char *src, uint8_t flags)
+{
+	const ArenaMark mark = arena_mark(MML_global_arena);
+	struct MML_config config = w->base_config;
+	MML_state *state = MML_init_state();
+	state->config = &config;
+
+	const uint8_t status = eval_request(state, src, flags);
+
+	MML_cleanup_state(state);
+	arena_reset(MML_global_arena, mark);
+	return status;
+}
+
+static void free_session(session *s)
+{
+	MML_cleanup_state(s->state);
+	free(s->name);
+	free(s);
+}
+
+static int find_lru_session(const void *key, size_t ksize, uintptr_t value, void *usr)
+{
+	(void)key, (void)ksize;
+	session **lru = usr;
+	session *s = (session *)value;
+	if (*lru == NULL || s->last_used < (*lru)->last_used)
+		*lru = s;
+	return 0;
+}
+
+static session *get_session(worker *w, const char *name)
+{
+	const size_t len = strlen(name);
+	session *s;
+	if (hashmap_get(w->sessions, name, len, (uintptr_t *)&s))
+	{
+		s->last_used = w->n_requests;
+		return s;
+	}
+
+	if (w->n_sessions == MAX_SESSIONS_PER_WORKER)
+	{
+		session *lru = NULL;
+		hashmap_iterate(w->sessions, find_lru_session, &lru);
+		MML_log_dbg("dropping session '%s' to make room for '%s'\n", lru->name, name);
+		hashmap_remove(w->sessions, lru->name, strlen(lru->name));
+		free_session(lru);
+		--w->n_sessions;
+	}
+
+	s = malloc(sizeof(session));
+	s->name = strdup(name);
+	s->config = w->base_config;
+	s->state = MML_init_state();
+	s->state->config = &s->config;
+	s->last_used = w->n_requests;
+	hashmap_set(w->sessions, s->name, len, (uintptr_t)s);
+	++w->n_sessions;
+	return s;
+}
+
+// Reads C's next frame and answers it. The first one names the session,
+// and is only stored; the listener then hands the connection to the
+// session's worker. Returns false once the connection should be closed.
+static bool serve_frame(worker *w, conn *c)
+{
+	uint32_t len;
+	if (c->session_name == NULL)
+		return (c->session_name = recv_frame(c->fd, &len)) != NULL;
+
+	char *req = recv_frame(c->fd, &len);
+	if (req == NULL || len == 0)
+	{
+		free(req);
+		return false;
+	}
+
+	frame_stream out_fs = { c->fd, MML_FRAME_OUT };
+	frame_stream err_fs = { c->fd, MML_FRAME_ERR };
+	FILE *out = open_frame_stream(&out_fs);
+	FILE *err = open_frame_stream(&err_fs);
+	bool ok = out != NULL && err != NULL;
+	if (ok)
+	{
+		// MML_outbuf already buffers the output
+		setvbuf(out, NULL, _IONBF, 0);
+		w->out.stream = out;
+		w->out.len = 0;
+		MML_log_stream = err;
+
+		++w->n_requests;
+		const uint8_t status = (c->session_name[0] != '\0')
+			? eval_request(get_session(w, c->session_name)->state, req + 1, (uint8_t)req[0])
+			: eval_isolated(w, req + 1, (uint8_t)req[0]);
+
+		fflush(err);
+		MML_log_stream = NULL;
+		w->out.stream = NULL;
+		ok = send_frame(c->fd, MML_FRAME_END, &status, 1);
+	}
+	if (out != NULL) fclose(out);
+	if (err != NULL) fclose(err);
+	free(req);
+	return ok;
+}
+
+static void *worker_main(void *arg)
+{
+	worker *w = arg;
+	server *srv = w->srv;
+
+	// keeps this thread's arena alive between requests
+	MML_state *anchor = MML_init_state();
+	anchor->config = &w->base_config;
+
+	for (;;)
+	{
+		pthread_mutex_lock(&srv->lock);
+		conn *c;
+		while ((c = conn_pop(&w->queue)) == NULL && (c = conn_pop(&srv->shared)) == NULL)
+			pthread_cond_wait(&srv->ready, &srv->lock);
+		pthread_mutex_unlock(&srv->lock);
+
+		if (!serve_frame(w, c))
+		{
+			conn_close(c);
+			continue;
+		}
+
+		pthread_mutex_lock(&srv->lock);
+		conn_push(&srv->returned, c);
+		pthread_mutex_unlock(&srv->lock);
+		const char wake = 0;
+		(void)!write(srv->wake_fds[1], &wake, 1);
+	}
+
+	return NULL;
+}
+
+static uint32_t hash_name(const char *s)
+{
+	uint32_t h = 0x811c9dc5u;
+	while (*s)
+		h = (h ^ (unsigned char)*s++) * 0x01000193u;
+	return h;
+}
+
+// gives C, whose next frame has started arriving, to a worker
+static void dispatch(server *srv, conn *c)
+{
+	pthread_mutex_lock(&srv->lock);
+	// a named session always lands on the worker that holds its state
+	if (c->session_name != NULL && c->session_name[0] != '\0')
+		conn_push(&srv->workers[hash_name(c->session_name) % srv->n_workers].queue, c);
+	else
+		conn_push(&srv->shared, c);
+	// the worker it's meant for may not be the one a signal would wake
+	pthread_cond_broadcast(&srv->ready);
+	pthread_mutex_unlock(&srv->lock);
+}
+
+/*
+ * Listening
+ */
+
+static volatile sig_atomic_t stop_requested = 0;
+static int listen_fd = -1;
+
+// wakes up the poll() in MML_serve
+static void stop_serving(int signum)
+{
+	(void)signum;
+	stop_requested = 1;
+	shutdown(listen_fd, SHUT_RDWR);
+}
+
+static bool make_addr(const char *path, struct sockaddr_un *addr)
+{
+	*addr = (struct sockaddr_un) { .sun_family = AF_UNIX };
+	if (strlen(path) >= sizeof(addr->sun_path))
+	{
+		MML_log_err("socket path '%s' is too long\n", path);
+		return false;
+	}
+	strcpy(addr->sun_path, path);
+	return true;
+}
+
+static int listen_at(const char *path)
+{
+	struct sockaddr_un addr;
+	if (!make_addr(path, &addr))
+		return -1;
+
+	// non-blocking, so a client that's gone by the time it's accepted
+	// can't stall the listener
+	const int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC | SOCK_NONBLOCK, 0);
+	if (fd < 0)
+	{
+		MML_log_err("failed to create a socket: %s\n", strerror(errno));
+		return -1;
+	}
+
+	int rc = bind(fd, (struct sockaddr *)&addr, sizeof(addr));
+	if (rc != 0 && errno == EADDRINUSE)
+	{
+		// a socket left behind by a daemon that's gone can be replaced;
+		// one that's still being served can't
+		const int probe = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+		const bool is_live = probe >= 0
+			&& connect(probe, (struct sockaddr *)&addr, sizeof(addr)) == 0;
+		if (probe >= 0)
+			close(probe);
+		if (is_live)
+		{
+			MML_log_err("'%s' is already being served\n", path);
+			close(fd);
+			return -1;
+		}
+		unlink(path);
+		rc = bind(fd, (struct sockaddr *)&addr, sizeof(addr));
+	}
+
+	if (rc != 0 || listen(fd, SOMAXCONN) != 0)
+	{
+		MML_log_err("failed to listen at '%s': %s\n", path, strerror(errno));
+		close(fd);
+		return -1;
+	}
+	return fd;
+}
+
+// adds the new connections to IDLE and returns how many there were
+static size_t accept_conns(conn_queue *idle, double now)
+{
+	size_t n = 0;
+	int fd;
+	while ((fd = accept4(listen_fd, NULL, NULL, SOCK_CLOEXEC)) >= 0)
+	{
+		// the listener only hands a connection over once a frame has started
+		// arriving; one that then stalls only holds up the worker reading it
+		struct timeval timeout = { .tv_sec = FRAME_TIMEOUT_S };
+		setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+
+		conn *c = malloc(sizeof(conn));
+		*c = (conn) { .fd = fd, .session_name = NULL, .idle_since = now };
+		conn_push(idle, c);
+		++n;
+	}
+	if (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR && !stop_requested)
+		MML_log_warn("accept failed: %s\n", strerror(errno));
+	return n;
+}
+
+int32_t MML_serve(const char *path, uint32_t n_workers)
+{
+	if (n_workers == 0)
+	{
+		const long n_cpus = sysconf(_SC_NPROCESSORS_ONLN);
+		n_workers = (n_cpus > 0) ? (uint32_t)n_cpus : 1;
+	}
+
+	listen_fd = listen_at(path);
+	if (listen_fd < 0)
+		return 1;
+
+	server *srv = calloc(1, sizeof(server));
+	if (pipe2(srv->wake_fds, O_CLOEXEC | O_NONBLOCK) != 0)
+	{
+		MML_log_err("failed to create a pipe: %s\n", strerror(errno));
+		close(listen_fd);
+		unlink(path);
+		free(srv);
+		return 1;
+	}
+	pthread_mutex_init(&srv->lock, NULL);
+	pthread_cond_init(&srv->ready, NULL);
+
+	signal(SIGPIPE, SIG_IGN);
+	struct sigaction sa = { .sa_handler = stop_serving };
+	sigemptyset(&sa.sa_mask);
+	sigaction(SIGINT, &sa, NULL);
+	sigaction(SIGTERM, &sa, NULL);
+
+	// only this thread handles the signals
+	sigset_t stop_signals, old_mask;
+	sigemptyset(&stop_signals);
+	sigaddset(&stop_signals, SIGINT);
+	sigaddset(&stop_signals, SIGTERM);
+	pthread_sigmask(SIG_BLOCK, &stop_signals, &old_mask);
+
+	srv->n_workers = n_workers;
+	srv->workers = calloc(n_workers, sizeof(worker));
+	for (uint32_t i = 0; i < n_workers; ++i)
+	{
+		worker *w = &srv->workers[i];
+		w->srv = srv;
+		w->sessions = hashmap_create();
+		w->base_config = MML_global_config;
+		w->base_config.eval_state = nullptr;
+		w->base_config.out = &w->out;
+		w->out.is_tty = 0;
+		pthread_create(&w->thread, NULL, worker_main, w);
+	}
+	pthread_sigmask(SIG_SETMASK, &old_mask, NULL);
+
+	MML_log_dbg("serving at '%s' with %" PRIu32 " workers\n", path, n_workers);
+
+	// the connections waiting for their client's next frame
+	conn_queue idle = { NULL, NULL };
+	size_t n_idle = 0;
+	struct pollfd *fds = NULL;
+	size_t fds_cap = 0;
+	while (!stop_requested)
+	{
+		if (n_idle + 2 > fds_cap)
+		{
+			fds_cap = 2 * (n_idle + 2);
+			fds = realloc(fds, fds_cap * sizeof(struct pollfd));
+		}
+		fds[0] = (struct pollfd) { .fd = listen_fd, .events = POLLIN };
+		fds[1] = (struct pollfd) { .fd = srv->wake_fds[0], .events = POLLIN };
+		size_t i = 2;
+		for (const conn *c = idle.head; c != NULL; c = c->next)
+			fds[i++] = (struct pollfd) { .fd = c->fd, .events = POLLIN };
+
+		// wakes up once a second to close the connections that timed out
+		if (poll(fds, n_idle + 2, 1000) < 0)
+		{
+			if (errno != EINTR)
+				MML_log_warn("poll failed: %s\n", strerror(errno));
+			continue;
+		}
+		const double now = now_s();
+
+		// the order is the same as when the fds were filled in
+		conn_queue still_idle = { NULL, NULL };
+		n_idle = 0;
+		i = 2;
+		for (conn *c = idle.head, *next; c != NULL; c = next)
+		{
+			next = c->next;
+			const double timeout = (c->session_name == NULL) ? FRAME_TIMEOUT_S : IDLE_TIMEOUT_S;
+			if (fds[i++].revents != 0)
+				dispatch(srv, c);
+			else if (now - c->idle_since > timeout)
+				conn_close(c);
+			else
+			{
+				conn_push(&still_idle, c);
+				++n_idle;
+			}
+		}
+		idle = still_idle;
+
+		if (fds[1].revents & POLLIN)
+		{
+			char drain[64];
+			while (read(srv->wake_fds[0], drain, sizeof(drain)) > 0)
+				;
+			pthread_mutex_lock(&srv->lock);
+			conn *c;
+			while ((c = conn_pop(&srv->returned)) != NULL)
+			{
+				c->idle_since = now;
+				conn_push(&idle, c);
+				++n_idle;
+			}
+			pthread_mutex_unlock(&srv->lock);
+		}
+
+		if (fds[0].revents != 0)
+			n_idle += accept_conns(&idle, now);
+	}
+
+	free(fds);
+	close(listen_fd);
+	unlink(path);
+	// the workers, their sessions and the open connections go away with
+	// the process
+	return 0;
+}
+
+/*
+ * Client
+ */
+
+int32_t MML_client_eval(const char *path, const char *session, strbuf source,
+		uint8_t flags, FILE *out, FILE *err)
+{
+	struct sockaddr_un addr;
+	if (!make_addr(path, &addr))
+		return -1;
+
+	const int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+	if (fd < 0 || connect(fd, (struct sockaddr *)&addr, sizeof(addr)) != 0)
+	{
+		MML_log_err("failed to connect to '%s': %s\n", path, strerror(errno));
+		if (fd >= 0)
+			close(fd);
+		return -1;
+	}
+
+	if (session == NULL)
+		session = "";
+	int32_t status = -1;
+	if (!send_frame(fd, -1, session, strlen(session))
+	 || !send_frame(fd, flags, source.s, source.len))
+		goto done;
+
+	uint32_t len;
+	char *frame;
+	while ((frame = recv_frame(fd, &len)) != NULL)
+	{
+		if (len > 0 && frame[0] == MML_FRAME_OUT)
+			fwrite(frame + 1, 1, len - 1, out);
+		else if (len > 0 && frame[0] == MML_FRAME_ERR)
+			fwrite(frame + 1, 1, len - 1, err);
+		else if (len > 1 && frame[0] == MML_FRAME_END)
+			status = (uint8_t)frame[1];
+		free(frame);
+
+		if (status >= 0)
+			break;
+	}
+
+	if (status < 0)
+		MML_log_err("the connection to '%s' was closed mid-request\n", path);
+done:
+	close(fd);
+	fflush(out);
+	return status;
+}
@@ -0,0 +1,266 @@
+#define _GNU_SOURCE
+
+#include "mml/timing.h"
+
+#include <errno.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#ifdef __linux__
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#endif
+
+#include "mml/config.h"
+
+// deep enough for every way the phases nest; anything deeper is charged to
+// the phase it's in
+#define PHASE_STACK_MAX 16
+
+enum { COUNTER_CYCLES, COUNTER_INSTRUCTIONS, COUNTER_CACHE_MISSES, N_COUNTERS };
+
+typedef struct {
+	uint64_t ns;
+	uint64_t counters[N_COUNTERS];
+} sample;
+
+typedef struct {
+	MML_phase phase;
+	uint32_t depth; // times it was entered while already innermost
+	sample start;
+} phase_frame;
+
+typedef struct {
+	MML_timing totals;
+	int counter_fds[N_COUNTERS]; // -1 if not open; the first leads the group
+	phase_frame stack[PHASE_STACK_MAX];
+	uint32_t n_frames;
+	uint32_t overflow; // pushes past the end of `stack`, to pop the same number
+} thread_timing;
+
+thread_local bool MML_timing_on = false;
+static thread_local thread_timing timing;
+
+static const char *const PHASE_NAMES[MML_N_PHASES] = {
+	[MML_PHASE_LEX] = "lex",
+	[MML_PHASE_PARSE] = "parse",
+	[MML_PHASE_OPTIMIZE] = "optimize",
+	[MML_PHASE_EVAL] = "eval",
+	[MML_PHASE_PRINT] = "print",
+};
+
+
+/*
+ * Counters
+ */
+#ifdef __linux__
+static int open_counter(uint64_t config, int group_fd)
+{
+	struct perf_event_attr attr = {
+		.type = PERF_TYPE_HARDWARE,
+		.size = sizeof(attr),
+		.config = config,
+		.disabled = (group_fd == -1),
+		.exclude_kernel = 1,
+		.exclude_hv = 1,
+		.read_format = PERF_FORMAT_GROUP,
+	};
+	return (int)syscall(SYS_perf_event_open, &attr, 0, -1, group_fd, 0);
+}
+
+// counts this thread's user-space cycles, instructions and cache misses as
+// one group, so they're read together with a single read(2)
+static void open_counters(void)
+{
+	static const uint64_t CONFIGS[N_COUNTERS] = {
+		[COUNTER_CYCLES] = PERF_COUNT_HW_CPU_CYCLES,
+		[COUNTER_INSTRUCTIONS] = PERF_COUNT_HW_INSTRUCTIONS,
+		[COUNTER_CACHE_MISSES] = PERF_COUNT_HW_CACHE_MISSES,
+	};
+
+	for (size_t i = 0; i < N_COUNTERS; ++i)
+	{
+		timing.counter_fds[i] = open_counter(CONFIGS[i], (i > 0) ? timing.counter_fds[0] : -1);
+		if (timing.counter_fds[i] < 0)
+		{
+			MML_log_dbg("hardware counters are unavailable (%s); only timing phases\n", strerror(errno));
+			for (size_t j = 0; j < i; ++j)
+				close(timing.counter_fds[j]);
+			for (size_t j = 0; j < N_COUNTERS; ++j)
+				timing.counter_fds[j] = -1;
+			return;
+		}
+	}
+	ioctl(timing.counter_fds[0], PERF_EVENT_IOC_RESET, PERF_IOC_FLAG_GROUP);
+	ioctl(timing.counter_fds[0], PERF_EVENT_IOC_ENABLE, PERF_IOC_FLAG_GROUP);
+	timing.totals.has_counters = true;
+}
+
+static void close_counters(void)
+{
+	for (size_t i = 0; i < N_COUNTERS; ++i)
+	{
+		if (timing.counter_fds[i] >= 0)
+			close(timing.counter_fds[i]);
+		timing.counter_fds[i] = -1;
+	}
+}
+
+static void read_counters(uint64_t *counters)
+{
+	// PERF_FORMAT_GROUP: the number of counters, then their values
+	uint64_t buf[1 + N_COUNTERS];
+	if (timing.counter_fds[0] < 0 || read(timing.counter_fds[0], buf, sizeof(buf)) != sizeof(buf))
+		return;
+	memcpy(counters, buf + 1, sizeof(uint64_t) * N_COUNTERS);
+}
+#else
+static void open_counters(void)
+{
+	for (size_t i = 0; i < N_COUNTERS; ++i)
+		timing.counter_fds[i] = -1;
+}
+static void close_counters(void) {}
+static void read_counters(uint64_t *) {}
+#endif
+
+static sample take_sample(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	sample s = { .ns = (uint64_t)ts.tv_sec * 1000000000ull + (uint64_t)ts.tv_nsec };
+	read_counters(s.counters);
+	return s;
+}
+
+// adds what happened between START and END to PHASE
+static void charge(MML_phase phase, const sample *start, const sample *end)
+{
+	MML_phase_totals *t = &timing.totals.phases[phase];
+	t->ns += end->ns - start->ns;
+	t->cycles += end->counters[COUNTER_CYCLES] - start->counters[COUNTER_CYCLES];
+	t->instructions += end->counters[COUNTER_INSTRUCTIONS] - start->counters[COUNTER_INSTRUCTIONS];
+	t->cache_misses += end->counters[COUNTER_CACHE_MISSES] - start->counters[COUNTER_CACHE_MISSES];
+}
+
+
+/*
+ * Phases
+ */
+void MML_timing_push(MML_phase phase)
+{
+	if (timing.overflow > 0 || timing.n_frames == PHASE_STACK_MAX)
+	{
+		++timing.overflow;
+		return;
+	}
+
+	phase_frame *top = (timing.n_frames > 0) ? &timing.stack[timing.n_frames-1] : NULL;
+	if (top != NULL && top->phase == phase)
+	{
+		++top->depth;
+		return;
+	}
+
+	const sample now = take_sample();
+	if (top != NULL)
+		charge(top->phase, &top->start, &now);
+	timing.stack[timing.n_frames++] = (phase_frame) { .phase = phase, .depth = 1, .start = now };
+}
+
+void MML_timing_pop(MML_phase)
+{
+	if (timing.overflow > 0)
+	{
+		--timing.overflow;
+		return;
+	}
+	if (timing.n_frames == 0)
+		return;
+
+	phase_frame *top = &timing.stack[timing.n_frames-1];
+	if (--top->depth > 0)
+		return;
+
+	const sample now = take_sample();
+	charge(top->phase, &top->start, &now);
+	++timing.totals.phases[top->phase].count;
+	if (--timing.n_frames > 0)
+		timing.stack[timing.n_frames-1].start = now;
+}
+
+void MML_timing_start(void)
+{
+	if (MML_timing_on)
+		return;
+
+	timing = (thread_timing) { .n_frames = 0 };
+	open_counters();
+	MML_timing_on = true;
+}
+
+void MML_timing_stop(MML_timing *totals)
+{
+	if (!MML_timing_on)
+		return;
+
+	MML_timing_on = false;
+	close_counters();
+	MML_timing_take(totals);
+}
+
+void MML_timing_take(MML_timing *totals)
+{
+	const bool has_counters = timing.totals.has_counters;
+	if (totals != NULL)
+		*totals = timing.totals;
+	timing.totals = (MML_timing) { .has_counters = has_counters };
+}
+
+void MML_timing_merge(const MML_timing *totals)
+{
+	for (size_t p = 0; p < MML_N_PHASES; ++p)
+	{
+		MML_phase_totals *dst = &timing.totals.phases[p];
+		const MML_phase_totals *src = &totals->phases[p];
+		dst->count += src->count;
+		dst->ns += src->ns;
+		dst->cycles += src->cycles;
+		dst->instructions += src->instructions;
+		dst->cache_misses += src->cache_misses;
+	}
+	timing.totals.has_counters = timing.totals.has_counters || totals->has_counters;
+}
+
+void MML_timing_report(const MML_timing *totals, FILE *stream)
+{
+	uint64_t total_ns = 0;
+	for (size_t p = 0; p < MML_N_PHASES; ++p)
+		total_ns += totals->phases[p].ns;
+	const double total = (total_ns > 0) ? (double)total_ns : 1.0;
+
+	fprintf(stream, "%-9s %10s %12s %7s", "phase", "count", "seconds", "%");
+	if (totals->has_counters)
+		fprintf(stream, " %14s %14s %6s %12s", "cycles", "instructions", "IPC", "cache misses");
+	fputc('\n', stream);
+
+	for (size_t p = 0; p < MML_N_PHASES; ++p)
+	{
+		const MML_phase_totals *t = &totals->phases[p];
+		if (t->count == 0)
+			continue;
+
+		fprintf(stream, "%-9s %10" PRIu64 " %12.6f %6.1f%%", PHASE_NAMES[p], t->count,
+				(double)t->ns / 1e9, 100.0 * (double)t->ns / total);
+		if (totals->has_counters)
+			fprintf(stream, " %14" PRIu64 " %14" PRIu64 " %6.2f %12" PRIu64,
+					t->cycles, t->instructions,
+					(t->cycles > 0) ? (double)t->instructions / (double)t->cycles : 0.0,
+					t->cache_misses);
+		fputc('\n', stream);
+	}
+}
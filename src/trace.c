@@ -0,0 +1,207 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include "mml/trace.h"
+
+#include <inttypes.h>
+#include <stdatomic.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "mml/config.h"
+
+// events kept per thread (48 bytes each)
+#define RING_EVENTS (1u << 16)
+// longer names are cut short
+#define EVENT_NAME_MAX 30
+
+typedef struct {
+	uint64_t ts_ns;
+	uint64_t arg;
+	uint8_t cat;
+	char ph; // 'B' or 'E'
+	uint8_t name_len;
+	char name[EVENT_NAME_MAX-1];
+} trace_event;
+
+typedef struct trace_ring {
+	struct trace_ring *next;
+	uint32_t tid;
+	uint64_t n_recorded; // the next event goes at `n_recorded % RING_EVENTS`
+	trace_event events[RING_EVENTS];
+} trace_ring;
+
+bool MML_trace_on = false;
+
+static FILE *trace_file = NULL;
+static uint64_t start_ns = 0;
+
+// every thread's ring, newest first; only ever pushed to until the trace stops
+static _Atomic(trace_ring *) rings = NULL;
+static atomic_uint_least32_t next_tid = 1;
+static thread_local trace_ring *ring = NULL;
+
+static const char *const CATEGORY_NAMES[MML_TRACE_N_CATEGORIES] = {
+	[MML_TRACE_PARSE] = "parse",
+	[MML_TRACE_STATEMENT] = "statement",
+	[MML_TRACE_FUNCTION] = "function",
+	[MML_TRACE_BUILTIN] = "builtin",
+	[MML_TRACE_VECTOR] = "vector",
+};
+
+static uint64_t now_ns(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000ull + (uint64_t)ts.tv_nsec;
+}
+
+// the calling thread's ring, made and registered the first time it records
+static trace_ring *thread_ring(void)
+{
+	if (ring != NULL)
+		return ring;
+
+	ring = malloc(sizeof(trace_ring));
+	ring->tid = atomic_fetch_add(&next_tid, 1);
+	ring->n_recorded = 0;
+	ring->next = atomic_load(&rings);
+	while (!atomic_compare_exchange_weak(&rings, &ring->next, ring))
+		;
+	return ring;
+}
+
+static trace_event *next_event(void)
+{
+	trace_ring *r = thread_ring();
+	return &r->events[r->n_recorded++ % RING_EVENTS];
+}
+
+void MML_trace_record_begin(MML_trace_category cat, strbuf name, uint64_t arg)
+{
+	trace_event *e = next_event();
+	const size_t len = (name.len < sizeof(e->name)) ? name.len : sizeof(e->name);
+	e->cat = (uint8_t)cat;
+	e->ph = 'B';
+	e->arg = arg;
+	e->name_len = (uint8_t)len;
+	memcpy(e->name, name.s, len);
+	e->ts_ns = now_ns();
+}
+
+void MML_trace_record_end(MML_trace_category cat)
+{
+	const uint64_t ts = now_ns();
+	trace_event *e = next_event();
+	e->cat = (uint8_t)cat;
+	e->ph = 'E';
+	e->ts_ns = ts;
+}
+
+bool MML_trace_start(const char *path)
+{
+	trace_file = fopen(path, "w");
+	if (trace_file == NULL)
+	{
+		MML_log_err("failed to create trace file '%s'\n", path);
+		return false;
+	}
+
+	start_ns = now_ns();
+	// so the thread that starts the trace is thread 1
+	thread_ring();
+	MML_trace_on = true;
+	return true;
+}
+
+
+/*
+ * Writing
+ */
+static void write_json_string(FILE *f, const char *s, size_t len)
+{
+	fputc('"', f);
+	for (size_t i = 0; i < len; ++i)
+	{
+		const unsigned char c = (unsigned char)s[i];
+		if (c == '"' || c == '\\')
+			fprintf(f, "\\%c", c);
+		else if (c < 0x20)
+			fprintf(f, "\\u%04x", c);
+		else
+			fputc(c, f);
+	}
+	fputc('"', f);
+}
+
+// returns the number of events that were overwritten
+static uint64_t write_ring(FILE *f, const trace_ring *r, int32_t pid, bool *first)
+{
+	const uint64_t n = (r->n_recorded < RING_EVENTS) ? r->n_recorded : RING_EVENTS;
+	const uint64_t oldest = r->n_recorded - n;
+
+	fprintf(f, "%s\n{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":%d,\"tid\":%u,\"args\":{\"name\":",
+			*first ? "" : ",", pid, r->tid);
+	*first = false;
+	if (r->tid == 1)
+		fputs("\"main\"}}", f);
+	else
+		fprintf(f, "\"thread %u\"}}", r->tid);
+
+	// events whose beginning was overwritten can't be matched up, so they're
+	// left out
+	uint64_t depth = 0;
+	for (uint64_t i = oldest; i < r->n_recorded; ++i)
+	{
+		const trace_event *e = &r->events[i % RING_EVENTS];
+		if (e->ph == 'B')
+			++depth;
+		else if (depth > 0)
+			--depth;
+		else
+			continue;
+
+		const uint64_t ts = (e->ts_ns > start_ns) ? e->ts_ns - start_ns : 0;
+		fprintf(f, ",\n{\"ph\":\"%c\",\"cat\":\"%s\",\"pid\":%d,\"tid\":%u,\"ts\":%" PRIu64 ".%03u",
+				e->ph, CATEGORY_NAMES[e->cat], pid, r->tid,
+				ts / 1000, (uint32_t)(ts % 1000));
+		if (e->ph == 'B')
+		{
+			fputs(",\"name\":", f);
+			write_json_string(f, e->name, e->name_len);
+			if (e->arg != 0)
+				fprintf(f, ",\"args\":{\"n\":%" PRIu64 "}", e->arg);
+		}
+		fputc('}', f);
+	}
+	return oldest;
+}
+
+void MML_trace_stop(void)
+{
+	if (!MML_trace_on)
+		return;
+	MML_trace_on = false;
+
+	const int32_t pid = (int32_t)getpid();
+	uint64_t dropped = 0;
+	bool first = true;
+
+	fputs("{\"displayTimeUnit\":\"ns\",\"traceEvents\":[", trace_file);
+	for (trace_ring *r = atomic_exchange(&rings, NULL), *next; r != NULL; r = next)
+	{
+		dropped += write_ring(trace_file, r, pid, &first);
+		next = r->next;
+		free(r);
+	}
+	fprintf(trace_file, "\n],\"otherData\":{\"dropped_events\":%" PRIu64 "}}\n", dropped);
+
+	if (dropped > 0)
+		MML_log_warn("the trace's oldest %" PRIu64 " events were overwritten\n", dropped);
+	fclose(trace_file);
+	trace_file = NULL;
+	ring = NULL;
+}
@@ -8,45 +8,49 @@
 #include "mml/expr.h"
 #include "mml/eval.h"
 
+/* Builders for hand-written ASTs. Nodes go in the global arena like the
+ * parser's do, so they're freed along with it. */
+
 #define _write_leaf(__e__, t, f, val) ({ \
-	mml_e(__e__)->type = (t); \
-	mml_e(__e__)->f = (val); \
+	(__e__)->type = (t); \
+	(__e__)->f = (val); \
 })
 #define _create_leaf(t, f, val) ({ \
-	arena_index e__ = arena_alloc(MML_global_arena, sizeof(MML_expr)); \
+	MML_expr *e__ = arena_alloc_T(MML_global_arena, 1, MML_expr); \
 	_write_leaf(e__, t, f, (val)); \
 	e__; \
 })
 
-static inline arena_index _create_vec_leaf(size_t n, ...) { 
-	arena_index e = arena_alloc(MML_global_arena, sizeof(MML_expr));
-	mml_e(e)->type = Vector_type;
-	mml_e(e)->v.i = arena_alloc(MML_global_arena, n * sizeof(MML_expr));
-	mml_e(e)->v.n = n;
+static inline MML_expr *_create_vec_leaf(size_t n, ...) {
+	MML_expr *e = arena_alloc_T(MML_global_arena, 1, MML_expr);
+	e->type = Vector_type;
+	e->v.ptr = arena_alloc_T(MML_global_arena, n, MML_expr *);
+	e->v.n = n;
 
 	va_list ap;
 	va_start(ap, n);
 	for (size_t i = 0; i < n; ++i)
-		*mml_ei(*mml_e(e), i) = va_arg(ap, arena_index);
+		e->v.ptr[i] = va_arg(ap, MML_expr *);
 	va_end(ap);
 
 	return e;
 }
 
 #define _write_oper(__e__, oper, a, b) ({ \
-	mml_e(__e__)->type = Operation_type; \
-	mml_e(__e__)->o.op = (oper); \
-	mml_e(__e__)->o.left = (a); \
-	mml_e(__e__)->o.right = (b); \
+	(__e__)->type = Operation_type; \
+	(__e__)->op = (oper); \
+	(__e__)->kind = MML_KIND_UNINFERRED; \
+	(__e__)->o.left = (a); \
+	(__e__)->o.right = (b); \
 })
 /* whichever is named `_create_oper` is the one used */
 #define _create_oper(oper, a, b) ({ \
-	arena_index __e = arena_alloc(MML_global_arena, sizeof(MML_expr)); \
+	MML_expr *__e = arena_alloc_T(MML_global_arena, 1, MML_expr); \
 	_write_oper(__e, (oper), (a), (b)); \
 	__e; \
 })
-static inline arena_index __create_oper(MML_token_type op, arena_index a, arena_index b) {
-	arena_index e = arena_alloc(MML_global_arena, sizeof(MML_expr));
+static inline MML_expr *__create_oper(MML_token_type op, MML_expr *a, MML_expr *b) {
+	MML_expr *e = arena_alloc_T(MML_global_arena, 1, MML_expr);
 	_write_oper(e, op, a, b);
 	return e;
 }
@@ -83,9 +87,9 @@ static inline arena_index __create_oper(MML_token_type op, arena_index a, arena_
 #define NotEqual(a, b) \
 	(_create_oper(MML_OP_NOTEQ_TOK, (a), (b)))
 #define ExactlyEqual(a, b) \
-	(_create_oper(MML_OP_EXACT_EQ_TOK, (a), (b)))
+	(_create_oper(MML_OP_EXACT_EQ, (a), (b)))
 #define ExactlyNotEqual(a, b) \
-	(_create_oper(MML_OP_EXACT_NOTEQ_TOK, (a), (b)))
+	(_create_oper(MML_OP_EXACT_NOTEQ, (a), (b)))
 
 #define AssertEqual(a, b) \
 	(_create_oper(MML_OP_ASSERT_EQUAL, (a), (b)))
@@ -98,6 +102,8 @@ static inline arena_index __create_oper(MML_token_type op, arena_index a, arena_
 	(_create_oper(MML_PIPE_TOK, (a), NULL))
 
 
+#define Integer(x) \
+	(_create_leaf(Integer_type, i, (x)))
 #define Real(r) \
 	(_create_leaf(RealNumber_type, n, (r)))
 #define Complex(c) \
@@ -108,25 +114,25 @@ static inline arena_index __create_oper(MML_token_type op, arena_index a, arena_
 	(_create_vec_leaf(n, ##__VA_ARGS__))
 
 #define Identifier(sl) \
-	(_create_leaf(Identifier_type, s, ((strbuf) { (sl), sizeof(sl)-1, false })))
+	(_create_leaf(Identifier_type, s, ((strbuf) { (char *)(sl), sizeof(sl)-1 })))
 #define IdentifierS(sll) \
-	(_create_leaf(Identifier_type, s, ((strbuf) { ( #sll ), sizeof(#sll)-1, false })))
+	(_create_leaf(Identifier_type, s, ((strbuf) { (char *)( #sll ), sizeof(#sll)-1 })))
 #define IdentifierL(s_, l) \
-	(_create_leaf(Identifier_type, s, ((strbuf) { (s_), (l), false })))
+	(_create_leaf(Identifier_type, s, ((strbuf) { (char *)(s_), (l) })))
 
 #define Function(sl) \
-	(_create_leaf(Identifier_type, s, ((strbuf) { (sl), sizeof(sl)-1, false })))
+	(_create_leaf(Identifier_type, s, ((strbuf) { (char *)(sl), sizeof(sl)-1 })))
 #define FunctionS(sll) \
-	(_create_leaf(Identifier_type, s, ((strbuf) { ( #sll ), sizeof(#sll)-1, false })))
+	(_create_leaf(Identifier_type, s, ((strbuf) { (char *)( #sll ), sizeof(#sll)-1 })))
 #define FunctionL(s_, l) \
-	(_create_leaf(Identifier_type, s, ((strbuf) { (s_), (l), false })))
+	(_create_leaf(Identifier_type, s, ((strbuf) { (char *)(s_), (l) })))
 
 #define Variable(sl) \
-	(_create_leaf(Identifier_type, s, ((strbuf) { (sl), sizeof(sl)-1, false })))
+	(_create_leaf(Identifier_type, s, ((strbuf) { (char *)(sl), sizeof(sl)-1 })))
 #define VariableS(sll) \
-	(_create_leaf(Identifier_type, s, ((strbuf) { ( #sll ), sizeof(#sll)-1, false })))
+	(_create_leaf(Identifier_type, s, ((strbuf) { (char *)( #sll ), sizeof(#sll)-1 })))
 #define VariableL(s_, l) \
-	(_create_leaf(Identifier_type, s, ((strbuf) { (s_), (l), false })))
+	(_create_leaf(Identifier_type, s, ((strbuf) { (char *)(s_), (l) })))
 
 
 
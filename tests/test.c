@@ -1,4 +1,6 @@
 #include <stdint.h>
+#include <stdio.h>
+#include <string.h>
 
 #include "mml/eval.h"
 #include "mml/expr.h"
@@ -97,23 +99,21 @@ int32_t main(int32_t argc, char **argv)
 		case LEFT_LEFT:
 			MML_expr *ll_new_left = e->o.left->o.left; // set variable
 			MML_expr *ll_new_right = _create_oper(
-				OPPOSITE_OPERATION[e->o.left->o.op],
+				OPPOSITE_OPERATION[e->o.left->op],
 				e->o.right,
 				e->o.left->o.right
 			);
-			free(e->o.left);
 			e->o.left = ll_new_left;
 			e->o.right = ll_new_right;
 			break;
 		case RIGHT_LEFT:
 			MML_expr *rl_new_left = _create_oper(
-				OPPOSITE_OPERATION[e->o.right->o.op],
+				OPPOSITE_OPERATION[e->o.right->op],
 				e->o.left,
 				e->o.right->o.right
 			);
 			MML_expr *rl_new_right = e->o.right->o.left;
 			e->o.left = rl_new_left;
-			free(e->o.right);
 			e->o.right = rl_new_right;
 			break;
 		case LEFT_RIGHT:
@@ -138,8 +138,6 @@ int32_t main(int32_t argc, char **argv)
 		printf(" = %.*s\n", (int)var.len, var.s);
 	}
 
-	MML_free_expr(&e);
-
 	MML_cleanup_state(state);
 	return 0;
 }
@@ -0,0 +1,125 @@
+/* Writes the perfect-hash table of builtins (see mml/builtins.h) to stdout.
+ * The names come from the same X-macro lists the builtins are defined with,
+ * so the table can't get out of sync with them. It looks for the smallest
+ * power-of-two table and a seed for `MML_builtin_hash` that put every name in
+ * a slot of its own; the output only depends on the lists, so it's the same
+ * on every build. */
+
+#include <inttypes.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "mml/builtins.h"
+
+typedef struct {
+	const char *table;
+	const char *name;
+} builtin_name;
+
+static const builtin_name NAMES[] = {
+#define MML_BUILTIN(ident, ...) { TABLE, #ident },
+#define TABLE "eval__builtins"
+#include "../src/builtins.def"
+#undef TABLE
+#define TABLE "math__builtins"
+#include "../lib/math.def"
+#undef TABLE
+#define TABLE "stdmml__builtins"
+#include "../lib/stdmml.def"
+#undef TABLE
+#define TABLE "io__builtins"
+#include "../lib/io.def"
+#undef TABLE
+#undef MML_BUILTIN
+};
+
+#define N_NAMES (sizeof(NAMES) / sizeof(NAMES[0]))
+#define MAX_SIZE_BITS 16
+#define SEEDS_PER_SIZE (1u << 20)
+
+static uint32_t slot_of(size_t i, uint32_t seed, uint32_t size)
+{
+	return MML_builtin_hash(NAMES[i].name, strlen(NAMES[i].name), seed) & (size - 1);
+}
+
+static bool is_perfect(uint32_t seed, uint32_t size, int32_t *slots)
+{
+	for (uint32_t s = 0; s < size; ++s)
+		slots[s] = -1;
+
+	for (size_t i = 0; i < N_NAMES; ++i)
+	{
+		const uint32_t s = slot_of(i, seed, size);
+		if (slots[s] >= 0)
+			return false;
+		slots[s] = (int32_t)i;
+	}
+	return true;
+}
+
+int main(void)
+{
+	for (size_t i = 0; i < N_NAMES; ++i)
+		for (size_t j = 0; j < i; ++j)
+			if (strcmp(NAMES[i].name, NAMES[j].name) == 0)
+			{
+				fprintf(stderr, "gen_builtin_phash: '%s' is defined in both %s and %s\n",
+						NAMES[i].name, NAMES[j].table, NAMES[i].table);
+				return 1;
+			}
+
+	static int32_t slots[1u << MAX_SIZE_BITS];
+	uint32_t size = 1;
+	while (size < N_NAMES)
+		size <<= 1;
+
+	uint32_t seed = 0;
+	for (;; size <<= 1)
+	{
+		if (size > (1u << MAX_SIZE_BITS))
+		{
+			fprintf(stderr, "gen_builtin_phash: no perfect hash for %zu names\n", N_NAMES);
+			return 1;
+		}
+		for (seed = 0; seed < SEEDS_PER_SIZE; ++seed)
+			if (is_perfect(seed, size, slots))
+				break;
+		if (seed < SEEDS_PER_SIZE)
+			break;
+	}
+
+	printf("/* Generated by tools/gen_builtin_phash.c from src/builtins.def and\n"
+		" * lib/<name>.def; don't edit. Included by eval.c: every builtin's name hashes\n"
+		" * to a slot of its own, so a name is a builtin iff it's the name in its\n"
+		" * slot. */\n\n");
+
+	const char *last_table = NULL;
+	for (size_t i = 0; i < N_NAMES; ++i)
+	{
+		if (last_table != NULL && strcmp(last_table, NAMES[i].table) == 0)
+			continue;
+		printf("extern const MML_builtin %s[];\n", NAMES[i].table);
+		last_table = NAMES[i].table;
+	}
+
+	printf("\n#define BUILTIN_PHASH_SEED 0x%08" PRIx32 "u\n", seed);
+	printf("#define BUILTIN_PHASH_SIZE %" PRIu32 "\n\n", size);
+	printf("static const MML_builtin *const builtin_phash[BUILTIN_PHASH_SIZE] = {\n");
+	for (uint32_t s = 0; s < size; ++s)
+	{
+		if (slots[s] < 0)
+			continue;
+
+		// the index of the name within its own table
+		const size_t i = (size_t)slots[s];
+		size_t index = 0;
+		for (size_t j = i; j > 0 && strcmp(NAMES[j-1].table, NAMES[i].table) == 0; --j)
+			++index;
+		printf("\t[%3" PRIu32 "] = &%s[%zu],\t// %s\n", s, NAMES[i].table, index, NAMES[i].name);
+	}
+	printf("};\n");
+
+	return 0;
+}